@@ -0,0 +1,180 @@
+#include "../include/common.h"
+#include "../include/scan.h"
+
+/*
+ * Microbenchmarks of the scan kernels: each workload is timed with the
+ * scalar, SSE2 and AVX2 kernels (those the CPU supports), and the speedup
+ * over scalar is printed. Run with: make bench
+ */
+
+/* Long command line: 1 MB of words without quotes or pipes */
+#define LINE_SIZE (1 << 20)
+
+/* Huge directory: names tested against a long completion prefix */
+#define DIR_ENTRIES 500000
+#define DIR_PREFIX "Photo_Archive_Summer_2024_"
+
+/* Masks scanned by the history trigram search */
+#define MASK_COUNT (1 << 20)
+
+/* Each workload runs for at least this long per kernel set */
+#define MIN_RUN_NS 200000000LL
+
+static const char *level_names[] = {"scalar", "sse2", "avx2"};
+
+static char *line;
+static char *blanks;
+static char **entries;
+static size_t *entry_lengths;
+static uint64_t *masks;
+static uint32_t *mask_hits;
+
+/* Keeps results alive so the calls are not optimized away */
+static volatile size_t sink;
+
+static int64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void run_find_any(void) {
+    sink += scan_find_any(line, LINE_SIZE, "\"'|");
+}
+
+static void run_skip_space(void) {
+    sink += scan_skip_space(blanks + 1, LINE_SIZE - 1);
+}
+
+static void run_trim_end(void) {
+    sink += scan_trim_end(blanks, LINE_SIZE - 1);
+}
+
+static void run_prefix(void) {
+    size_t prefix_len = strlen(DIR_PREFIX);
+    size_t matches = 0;
+    for (size_t i = 0; i < DIR_ENTRIES; i++) {
+        matches += scan_has_prefix_nocase(entries[i], entry_lengths[i], DIR_PREFIX, prefix_len);
+    }
+    sink += matches;
+}
+
+static void run_mask_superset(void) {
+    sink += scan_mask_superset(masks, MASK_COUNT, 0x8000000000000101ULL, mask_hits);
+}
+
+typedef struct {
+    const char *name;
+    void (*run)(void);
+} Workload;
+
+static const Workload workloads[] = {
+    {"find_any   1 MB line, no match", run_find_any},
+    {"skip_space 1 MB of blanks", run_skip_space},
+    {"trim_end   1 MB of blanks", run_trim_end},
+    {"prefix     500k directory entries", run_prefix},
+    {"superset   1M trigram masks", run_mask_superset},
+};
+
+/**
+ * Average time of one run of workload, in nanoseconds
+ */
+static double time_workload(const Workload *workload) {
+    workload->run();  // warm up caches
+    int64_t start = now_ns();
+    int64_t elapsed;
+    long runs = 0;
+    do {
+        workload->run();
+        runs++;
+        elapsed = now_ns() - start;
+    } while (elapsed < MIN_RUN_NS);
+    return (double)elapsed / (double)runs;
+}
+
+/**
+ * Build the inputs; the random parts come from a fixed seed
+ */
+static int make_inputs(void) {
+    line = malloc(LINE_SIZE);
+    blanks = malloc(LINE_SIZE);
+    entries = malloc(DIR_ENTRIES * sizeof(char *));
+    entry_lengths = malloc(DIR_ENTRIES * sizeof(size_t));
+    masks = malloc(MASK_COUNT * sizeof(uint64_t));
+    mask_hits = malloc(MASK_COUNT * sizeof(uint32_t));
+    if (line == NULL || blanks == NULL || entries == NULL || entry_lengths == NULL ||
+        masks == NULL || mask_hits == NULL) {
+        perror("malloc");
+        return -1;
+    }
+
+    srand(42);
+    for (size_t i = 0; i < LINE_SIZE; i++) {
+        line[i] = (i % 8 == 7) ? ' ' : (char)('a' + rand() % 26);
+        blanks[i] = " \t"[i % 2];
+    }
+    // Blanks between two words, scanned from either end
+    blanks[0] = 'x';
+    blanks[LINE_SIZE - 1] = 'x';
+
+    // Half the names share the prefix (in another case), half differ near its end
+    for (size_t i = 0; i < DIR_ENTRIES; i++) {
+        char name[64];
+        int len = snprintf(name, sizeof(name), "%s_%06zu.jpg",
+                           i % 2 ? "photo_archive_summer_2024" : "Photo_Archive_Summer_2023", i);
+        entries[i] = strdup(name);
+        entry_lengths[i] = (size_t)len;
+        if (entries[i] == NULL) {
+            perror("strdup");
+            return -1;
+        }
+    }
+
+    for (size_t i = 0; i < MASK_COUNT; i++) {
+        masks[i] = ((uint64_t)rand() << 33) ^ ((uint64_t)rand() << 2) ^ (uint64_t)rand();
+    }
+    return 0;
+}
+
+int main(void) {
+    if (make_inputs() != 0) {
+        return EXIT_FAILURE;
+    }
+
+    printf("%-36s", "workload");
+    for (int level = SCAN_LEVEL_SCALAR; level <= SCAN_LEVEL_AVX2; level++) {
+        printf("%17s", level_names[level]);
+    }
+    printf("\n");
+
+    for (size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); w++) {
+        printf("%-36s", workloads[w].name);
+        double scalar_ns = 0;
+        for (int level = SCAN_LEVEL_SCALAR; level <= SCAN_LEVEL_AVX2; level++) {
+            if (scan_set_level(level) != 0) {
+                printf("%17s", "n/a");
+                continue;
+            }
+            double ns = time_workload(&workloads[w]);
+            if (level == SCAN_LEVEL_SCALAR) {
+                scalar_ns = ns;
+                printf("%14.0f us", ns / 1000);
+            } else {
+                printf("%9.0f us %4.1fx", ns / 1000, scalar_ns / ns);
+            }
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+
+    for (size_t i = 0; i < DIR_ENTRIES; i++) {
+        free(entries[i]);
+    }
+    free(entries);
+    free(entry_lengths);
+    free(masks);
+    free(mask_hits);
+    free(line);
+    free(blanks);
+    return EXIT_SUCCESS;
+}
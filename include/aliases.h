@@ -1,9 +1,11 @@
 #ifndef ALIASES_H
 #define ALIASES_H
 
+#include <stddef.h>
+
 /**
  * Initialize alias system
- * Loads aliases from ~/.kordrc file
+ * Aliases from ~/.kordrc are defined when the rc file is sourced
  */
 void init_aliases(void);
 
@@ -14,7 +16,7 @@ void init_aliases(void);
 void cleanup_aliases(void);
 
 /**
- * Set an alias
+ * Set an alias (values may be of any length)
  * Returns 0 on success, -1 on failure
  */
 int set_alias(const char *name, const char *value);
@@ -31,6 +33,12 @@ const char *get_alias(const char *name);
  */
 int unset_alias(const char *name);
 
+/**
+ * Iterate over alias names (in no particular order)
+ * Start with *pos = 0; returns NULL after the last one
+ */
+const char *next_alias_name(size_t *pos);
+
 /**
  * Print all aliases
  */
@@ -38,6 +46,9 @@ void print_aliases(void);
 
 /**
  * Expand aliases in command if needed
+ * The first word of every pipeline segment is checked, recursively (an alias
+ * is not expanded again inside its own expansion), and an alias whose value
+ * ends in a blank makes the next word eligible too
  * Returns newly allocated string with expanded command (must be freed by caller)
  * Returns NULL if no expansion needed (use original command)
  */
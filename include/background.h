@@ -0,0 +1,74 @@
+#ifndef BACKGROUND_H
+#define BACKGROUND_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+/* How often a waiting worker checks whether it was abandoned (ms) */
+#define CANCEL_CHECK_MS 50
+
+/**
+ * Work handed to a worker thread (completion search, prompt segments)
+ * Embedded in the job it runs; shared by the shell and the worker and
+ * freed by whichever lets go last
+ */
+typedef struct {
+    pthread_mutex_t lock;    // guards refs, done and the job's results
+    int refs;                // guarded by lock
+    int done;                // guarded by lock
+    atomic_int cancelled;    // set by the shell when it no longer wants the results
+    int notify[2];           // the worker writes a byte to notify[1] when done
+} BackgroundTask;
+
+/**
+ * Milliseconds on the CLOCK_MONOTONIC clock
+ */
+long long monotonic_ms(void);
+
+/**
+ * Set up a task held by the shell alone
+ * Returns 0 on success, -1 if no notification pipe can be made
+ */
+int background_task_init(BackgroundTask *task);
+
+/**
+ * Run worker(arg) on a detached thread, which holds a reference to the
+ * task until it calls background_task_release()
+ * Returns 0 on success, -1 if no thread could be started
+ */
+int background_task_start(BackgroundTask *task, void *(*worker)(void *), void *arg);
+
+/**
+ * Mark the task done (after storing its results) and wake the shell
+ * through the notification pipe
+ */
+void background_task_finish(BackgroundTask *task);
+
+/**
+ * Whether the worker has finished
+ */
+int background_task_done(BackgroundTask *task);
+
+/**
+ * Drop one reference to the task; the last one closes its pipe
+ * Returns 1 if that was the last reference (the caller then frees the
+ * job), 0 otherwise
+ */
+int background_task_release(BackgroundTask *task);
+
+/**
+ * Run argv[0] (a full path) with environment envp, stdin and stderr on
+ * /dev/null and in a process group of its own, and read up to max_output
+ * bytes of its standard output. It is killed, with anything it started,
+ * once it has written more, when the CLOCK_MONOTONIC deadline (ms) passes
+ * or as soon as *cancelled is set
+ * *complete is set to 1 if it exited with status 0 and all of its output
+ * was read, 0 if it failed or was killed
+ * Returns the output (output_len set, not NUL-terminated), or NULL if it
+ * could not be run
+ */
+char *background_spawn_read(char *const argv[], char *const envp[], size_t max_output, long long deadline,
+                            atomic_int *cancelled, size_t *output_len, int *complete);
+
+#endif // BACKGROUND_H
@@ -1,6 +1,57 @@
 #ifndef BUILTINS_H
 #define BUILTINS_H
 
+#include <stddef.h>
+
+/* Builtin flags */
+#define BUILTIN_RUN_IN_PARENT 0x01   // changes shell state, so it is never forked
+#define BUILTIN_FORKLESS      0x02   // runs in the shell unless piped or redirected
+
+/* Type of the builtins loaded from plugins (see plugin.h) */
+#define BUILTIN_TYPE_PLUGIN (-1)
+
+/**
+ * Descriptor of a built-in command, resolved once per command
+ */
+typedef struct {
+    const char *name;
+    int type;                        // BuiltinType, for help
+    int (*func)(char **args);        // returns -1 for exit
+    unsigned flags;                  // BUILTIN_* flags
+} Builtin;
+
+/**
+ * Look up a built-in command with a single probe of a perfect hash table,
+ * then among the builtins registered at run time
+ * Returns its descriptor, or NULL if command is not a builtin
+ */
+const Builtin *find_builtin(const char *command);
+
+/**
+ * Run a builtin resolved with find_builtin()
+ * Returns its exit status (-1 for exit)
+ */
+int run_builtin(const Builtin *builtin, char **args);
+
+/**
+ * Add a builtin at run time; the descriptor must stay valid until it is
+ * unregistered
+ * Returns 0 on success, -1 if the name is taken or on allocation failure
+ */
+int register_builtin(const Builtin *builtin);
+
+/**
+ * Remove a builtin added with register_builtin()
+ * Returns its descriptor (for the caller to free), or NULL if not registered
+ */
+const Builtin *unregister_builtin(const char *name);
+
+/**
+ * Iterate over the builtins registered at run time
+ * Start with *pos = 0; returns NULL once all have been visited
+ */
+const Builtin *next_registered_builtin(size_t *pos);
+
 /**
  * Check if a command is a built-in command
  * Returns 1 if built-in, 0 otherwise
@@ -8,20 +59,22 @@
 int is_builtin(const char *command);
 
 /**
- * Check if a built-in command must run in parent process
- * Returns 1 if must run in parent, 0 if can run in child
+ * Name of the index-th built-in command (in table order)
+ * Returns NULL once index is past the last one
  */
-int must_run_in_parent(const char *command);
+const char *get_builtin_name(int index);
 
 /**
- * Execute a built-in command
- * Returns 0 on success, non-zero on failure
- * Returns -1 for exit command (special case)
+ * The current directory as cd keeps it in $PWD (the logical path)
+ * getcwd() is only called when $PWD is unset or, at first use, does not
+ * name the current directory
+ * Returns the path (valid until $PWD next changes), or NULL if unknown
  */
-int execute_builtin(char **args);
+const char *get_current_directory(void);
 
 /**
  * Built-in command: cd - change directory
+ * Follows the logical path from $PWD and updates $PWD and $OLDPWD
  */
 int builtin_cd(char **args);
 
@@ -40,6 +93,17 @@ int builtin_echo(char **args);
  */
 int builtin_exit(char **args);
 
+/**
+ * Record the status of the last command run, the default of exit
+ */
+void set_last_status(int status);
+
+/**
+ * Status the shell should exit with: the argument of the exit that ended
+ * it, or the status of the last command run
+ */
+int get_exit_status(void);
+
 /**
  * Built-in command: set - set shell variable
  * Usage: set VAR=value or set VAR value
@@ -53,8 +117,8 @@ int builtin_set(char **args);
 int builtin_export(char **args);
 
 /**
- * Built-in command: unset - unset variable
- * Usage: unset VAR
+ * Built-in command: unset - unset variable or array element
+ * Usage: unset VAR | unset VAR[subscript]
  */
 int builtin_unset(char **args);
 
@@ -78,8 +142,62 @@ int builtin_unalias(char **args);
 
 /**
  * Built-in command: history - display command history
- * Usage: history
+ * Usage: history [-n] [--since AGE] [--cwd DIR] [--failed] [--sort duration] [--stats] ...
  */
 int builtin_history(char **args);
 
+/**
+ * Built-in command: declare - declare variables and arrays
+ * Usage: declare [-aA] [name[=value] ...]
+ */
+int builtin_declare(char **args);
+
+/**
+ * Built-in command: source (also ".") - run a script in the current shell
+ * Usage: source filename
+ */
+int builtin_source(char **args);
+
+/**
+ * Built-in command: complete - define argument completion for commands
+ * Usage: complete [-W words] [-C command] name ... | complete -p|-r [name ...]
+ */
+int builtin_complete(char **args);
+
+/**
+ * Built-in commands: true and : - do nothing, successfully
+ */
+int builtin_true(char **args);
+
+/**
+ * Built-in command: false - do nothing, unsuccessfully
+ */
+int builtin_false(char **args);
+
+/**
+ * Built-in command: test (also "[ ... ]") - evaluate a conditional expression
+ * Paths are looked up once per expression
+ * Returns 0 if true, 1 if false, 2 on a syntax error
+ */
+int builtin_test(char **args);
+
+/**
+ * Built-in command: printf - format and print arguments
+ * Usage: printf format [arguments]
+ * Output is collected and written in large chunks
+ */
+int builtin_printf(char **args);
+
+/**
+ * Built-in command: sleep - wait for a number of seconds (fractions and
+ * s/m/h/d suffixes allowed); Ctrl+C interrupts it
+ */
+int builtin_sleep(char **args);
+
+/**
+ * Built-in command: enable - load builtins from shared objects
+ * Usage: enable [-p] | enable -f file name ... | enable -d name ...
+ */
+int builtin_enable(char **args);
+
 #endif // BUILTINS_H
@@ -0,0 +1,50 @@
+#ifndef COMMAND_INDEX_H
+#define COMMAND_INDEX_H
+
+#include <stddef.h>
+#include "completion.h"
+
+/**
+ * Add the builtins and aliases starting with prefix[0..len) to a list
+ * being collected
+ * Reads shell state: main thread only
+ * Returns 0 on success, -1 on allocation failure
+ */
+int complete_shell_command(const char *prefix, size_t len, CompletionList *list);
+
+/**
+ * Add the executables in the absolute directories of path (the default
+ * $PATH if NULL) starting with prefix[0..len) to a list being collected
+ * The catalogue is refreshed lazily: a directory is only rescanned when
+ * path or the directory's mtime changed. It is persisted in cache_path
+ * (if not NULL), so a new shell only has to stat the directories
+ * Safe to call from a completion worker thread; calls are serialized
+ * Returns 0 on success, -1 on allocation failure
+ */
+int complete_path_command(const char *prefix, size_t len, const char *path, const char *cache_path,
+                          CompletionList *list);
+
+/**
+ * Whether name[0..len) is an executable in the absolute $PATH directories,
+ * answered from the catalogue; the directories' mtimes are rechecked at
+ * most once a second
+ * Never blocks on a completion worker: returns -1 (unknown) while one is
+ * refreshing the catalogue
+ * Main thread only
+ * Returns 1 if found, 0 if not, -1 if unknown
+ */
+int command_exists(const char *name, size_t len);
+
+/**
+ * Location of the catalogue cache file: $XDG_CACHE_HOME/kord-sh/commands
+ * (or ~/.cache/kord-sh/commands)
+ * Returns 0 on success, -1 if no cache location is available
+ */
+int command_index_cache_path(char *buffer, size_t size);
+
+/**
+ * Free the PATH catalogue
+ */
+void cleanup_command_index(void);
+
+#endif // COMMAND_INDEX_H
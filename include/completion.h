@@ -0,0 +1,105 @@
+#ifndef COMPLETION_H
+#define COMPLETION_H
+
+#include <stddef.h>
+
+/**
+ * Sorted list of completion candidates
+ * The names live in one arena owned by the list
+ */
+typedef struct {
+    char **items;        // sorted (strcmp order)
+    size_t count;
+    char *arena;         // NUL-terminated names, back to back
+    size_t arena_used;
+    size_t arena_capacity;
+    size_t *offsets;     // where each name starts in the arena, while collecting
+    size_t capacity;
+} CompletionList;
+
+/**
+ * Add name[0..len) (followed by suffix, unless it is '\0') to a list
+ * being collected; the list starts zeroed
+ * Returns 0 on success, -1 on allocation failure
+ */
+int completion_list_add(CompletionList *list, const char *name, size_t len, char suffix);
+
+/**
+ * Finish collecting: sort the items and drop duplicates
+ * Returns 0 on success, -1 on allocation failure
+ */
+int completion_list_sort(CompletionList *list);
+
+/**
+ * Call visit for every entry of an open directory except . and ..,
+ * in a single pass (getdents64() on Linux); type is the entry's d_type
+ * Stops at the first non-zero return of visit
+ * Returns 0 on success, -1 on error, or visit's non-zero return
+ */
+int completion_scan_dir(int dir_fd, int (*visit)(void *ctx, int dir_fd, const char *name, unsigned char type),
+                        void *ctx);
+
+/**
+ * What Tab is completing
+ */
+typedef struct {
+    const char *word;        // the word, up to the cursor
+    int command_word;        // word is the command name of its pipeline segment
+    const char *command;     // command name of the segment, or NULL if word is it
+    const char *previous;    // the word before word ("" if none)
+    const char *line;        // the whole line, and the cursor's byte offset in it
+    size_t point;
+} CompletionRequest;
+
+/* Candidate search running on a worker thread */
+typedef struct CompletionJob CompletionJob;
+
+/**
+ * Start searching for completions of request's word on a worker thread
+ * A command word matches builtins, aliases and executables on $PATH.
+ * Arguments of a command with a spec (see the complete builtin) match the
+ * spec's words and generator output. Otherwise the word matches the entries of word's directory whose names start
+ * with the part of word after its last '/' (case-insensitive), with '/'
+ * appended to directories. The directory is read in a single pass; file
+ * types come from d_type, with fstatat() only for symlinks and
+ * filesystems that do not report it
+ * Returns the job, or NULL on failure
+ */
+CompletionJob *completion_job_start(const CompletionRequest *request);
+
+/**
+ * Descriptor that becomes readable once the job is done (for poll())
+ */
+int completion_job_fd(const CompletionJob *job);
+
+/**
+ * Whether the candidates are whole words (command names, spec words and
+ * generator output) rather than names of entries in word's directory
+ */
+int completion_job_whole_words(const CompletionJob *job);
+
+/**
+ * Copy the candidates found so far into a sorted list, and whether the
+ * search is done
+ * Returns 0 on success, -1 if the search failed (e.g. unreadable
+ * directory) or memory runs out
+ */
+int completion_job_collect(CompletionJob *job, CompletionList *list, int *done);
+
+/**
+ * Stop a job if it is still running and let go of it
+ * A worker blocked on a slow filesystem finishes in the background
+ */
+void completion_job_release(CompletionJob *job);
+
+/**
+ * Length of the longest prefix shared by every item
+ */
+size_t completion_common_prefix(const CompletionList *list);
+
+/**
+ * Free the list's items and arena
+ */
+void completion_list_free(CompletionList *list);
+
+#endif // COMPLETION_H
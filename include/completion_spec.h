@@ -0,0 +1,66 @@
+#ifndef COMPLETION_SPEC_H
+#define COMPLETION_SPEC_H
+
+#include "completion.h"
+#include <stdatomic.h>
+
+/* Generator command prepared for a completion worker */
+typedef struct CompletionGenerator CompletionGenerator;
+
+/**
+ * Register how the arguments of command name complete, replacing any
+ * previous spec: words (whitespace-separated) and/or a generator command
+ * whose output lines are candidates. Either may be NULL
+ * Returns 0 on success, -1 on failure
+ */
+int set_completion_spec(const char *name, const char *words, const char *generator);
+
+/**
+ * Remove the spec of command name
+ * Returns 0 on success, -1 if there is none
+ */
+int remove_completion_spec(const char *name);
+
+/**
+ * Whether command name has a spec
+ */
+int has_completion_spec(const char *name);
+
+/**
+ * Print the spec of name (every spec if name is NULL) as a complete command
+ * Returns 0 on success, -1 if name has no spec
+ */
+int print_completion_specs(const char *name);
+
+/**
+ * Look up the spec for request's command and add its matching words to a
+ * list being collected; the generator (if any) is prepared in *generator
+ * for completion_generator_run()
+ * Reads shell state: main thread only
+ * Returns 1 if the command has a spec, 0 if not, -1 on allocation failure
+ */
+int completion_spec_lookup(const CompletionRequest *request, CompletionList *list,
+                           CompletionGenerator **generator);
+
+/**
+ * Run a generator (through /bin/sh, with $1 the command name, $2 the word
+ * and $3 the previous word, and COMP_LINE/COMP_POINT in the environment)
+ * and add its output lines that start with the word to a list being
+ * collected. Output is reused for $COMPLETION_CACHE_TTL seconds; the
+ * generator is killed once *cancelled is set (its Tab was abandoned)
+ * Safe to call from a completion worker thread
+ * Returns 0 on success, 1 if cancelled, -1 on failure
+ */
+int completion_generator_run(CompletionGenerator *generator, atomic_int *cancelled, CompletionList *list);
+
+/**
+ * Free a prepared generator
+ */
+void completion_generator_free(CompletionGenerator *generator);
+
+/**
+ * Free every spec and the generator output cache
+ */
+void cleanup_completion_specs(void);
+
+#endif // COMPLETION_SPEC_H
@@ -5,17 +5,10 @@
 #define SHELL_VERSION "1.0.0"
 
 /* History configuration */
-#define MAX_HISTORY 50
-
-/* Alias configuration */
-#define MAX_ALIASES 100
-#define MAX_ALIAS_NAME 64
-#define MAX_ALIAS_VALUE 1024
+#define DEFAULT_HISTORY_SIZE 100000  // entries kept when $HISTSIZE is unset
 
 /* Variable configuration */
-#define MAX_VARIABLES 256
-#define MAX_VAR_NAME 128
-#define MAX_VAR_VALUE 1024
+#define MAX_ARRAY_INDEX 1048576
 
 /* Parser configuration */
 #define MAX_COMMANDS 64
@@ -2,6 +2,7 @@
 #define EXECUTOR_H
 
 #include "config.h"
+#include "builtins.h"
 
 /**
  * Execute commands (handles multiple commands for pipes)
@@ -18,10 +19,15 @@ int execute_command(char ***commands);
 int execute_single_command(char **command, int fd_read, int fd_write);
 
 /**
- * Execute an external command using fork/exec
- * Returns 0 on success, non-zero on failure
+ * Execute an external command using fork/exec, or builtin (if not NULL)
+ * in the forked child
+ * assignments holds assign_count "VAR=value" words that are exported to
+ * the child only (e.g. "VAR=x cmd"); pass NULL and 0 if there are none
+ * Returns the command's exit status (128 + signal if it was killed,
+ * 127 if it was not found)
  */
-int execute_external(char **command, int fd_read, int fd_write);
+int execute_external(char **command, const Builtin *builtin, char **assignments, int assign_count,
+                     int fd_read, int fd_write);
 
 /**
  * Apply I/O redirection based on command arguments
@@ -0,0 +1,65 @@
+#ifndef GAP_BUFFER_H
+#define GAP_BUFFER_H
+
+#include <stddef.h>
+
+/**
+ * Growable gap buffer holding the line being edited
+ * Text is data[0..gap_start) followed by data[gap_end..capacity); edits
+ * move the gap to the edit position first, so a run of inserts or deletes
+ * at the cursor costs O(1) amortized each
+ */
+typedef struct {
+    char *data;
+    size_t capacity;
+    size_t gap_start;
+    size_t gap_end;
+} GapBuffer;
+
+/**
+ * Initialize an empty buffer
+ * Returns 0 on success, -1 on allocation failure
+ */
+int gb_init(GapBuffer *gb, size_t initial_capacity);
+
+/**
+ * Free the buffer's storage
+ */
+void gb_free(GapBuffer *gb);
+
+/**
+ * Number of bytes of text
+ */
+size_t gb_length(const GapBuffer *gb);
+
+/**
+ * Insert text[0..len) before byte offset pos
+ * Returns 0 on success, -1 on allocation failure (nothing is inserted)
+ */
+int gb_insert(GapBuffer *gb, size_t pos, const char *text, size_t len);
+
+/**
+ * Remove count bytes starting at byte offset pos (clamped to the text)
+ */
+void gb_delete(GapBuffer *gb, size_t pos, size_t count);
+
+/**
+ * Replace the whole text with text[0..len)
+ * Returns 0 on success, -1 on allocation failure (the text is unchanged)
+ */
+int gb_set(GapBuffer *gb, const char *text, size_t len);
+
+/**
+ * The text as one NUL-terminated string (moves the gap to the end)
+ * Valid until the next edit
+ */
+const char *gb_text(GapBuffer *gb);
+
+/**
+ * Hand the text over as a NUL-terminated string the caller frees
+ * The buffer is left empty and must be initialized again before reuse
+ * Returns NULL on allocation failure
+ */
+char *gb_detach(GapBuffer *gb);
+
+#endif // GAP_BUFFER_H
@@ -0,0 +1,75 @@
+#ifndef HASHTABLE_H
+#define HASHTABLE_H
+
+#include <stddef.h>
+
+/**
+ * Slot of an open-addressing hash table
+ * The key is an interned copy owned by the table; value is owned by the caller
+ */
+typedef struct {
+    char *key;           // NULL if the slot is empty
+    size_t key_len;
+    unsigned int hash;
+    void *value;
+} HashEntry;
+
+/**
+ * Open-addressing (linear probing) hash table keyed by strings
+ * Capacity is always a power of two and grows on demand
+ */
+typedef struct {
+    HashEntry *entries;
+    size_t capacity;
+    size_t count;        // live entries
+    size_t used;         // live entries + tombstones
+} HashTable;
+
+/**
+ * FNV-1a hash of key[0..len)
+ */
+unsigned int hash_string(const char *key, size_t len);
+
+/**
+ * Initialize an empty table
+ * Returns 0 on success, -1 on allocation failure
+ */
+int ht_init(HashTable *ht, size_t initial_capacity);
+
+/**
+ * Free all keys and slots; free_value (if not NULL) is called on every value
+ */
+void ht_free(HashTable *ht, void (*free_value)(void *));
+
+/**
+ * Find the entry for key[0..len)
+ * Returns NULL if not present
+ */
+HashEntry *ht_lookup(const HashTable *ht, const char *key, size_t len);
+
+/**
+ * Find the entry for key[0..len), creating it (with a NULL value) if needed
+ * The returned pointer is only valid until the next insertion
+ * Returns NULL on allocation failure
+ */
+HashEntry *ht_insert(HashTable *ht, const char *key, size_t len);
+
+/**
+ * Remove key[0..len) from the table
+ * Returns the removed value (for the caller to free), or NULL if not present
+ */
+void *ht_remove(HashTable *ht, const char *key, size_t len);
+
+/**
+ * Convenience lookup by NUL-terminated key
+ * Returns the value, or NULL if not present
+ */
+void *ht_get(const HashTable *ht, const char *key);
+
+/**
+ * Iterate over live entries
+ * Start with *pos = 0; returns NULL once all entries have been visited
+ */
+HashEntry *ht_next(const HashTable *ht, size_t *pos);
+
+#endif // HASHTABLE_H
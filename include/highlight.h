@@ -0,0 +1,28 @@
+#ifndef HIGHLIGHT_H
+#define HIGHLIGHT_H
+
+#include <stddef.h>
+
+/**
+ * Style every byte of the edited line text[0..len) with a STYLE_* value
+ * (see render.h): command words by what they resolve to (builtin, alias,
+ * $PATH executable or nothing), quoted strings, redirections and pipes
+ * Only the part of the line around what changed since the previous call
+ * is lexed again; command lookups are answered from the command index
+ * Returns the styles (owned by the highlighter, valid until the next
+ * call), or NULL on allocation failure
+ */
+const unsigned char *highlight_line(const char *text, size_t len);
+
+/**
+ * Forget the previous line, so the next one is styled from scratch
+ * (commands may have appeared or gone in the meantime)
+ */
+void highlight_reset(void);
+
+/**
+ * Free the highlighter's buffers
+ */
+void cleanup_highlight(void);
+
+#endif // HIGHLIGHT_H
@@ -2,38 +2,73 @@
 #define HISTORY_H
 
 #include "config.h"
+#include <stdint.h>
 
 /**
  * Initialize history system
- * Loads history from ~/.kord_history file
+ * Loads history from ~/.kord_history file and keeps it open for appending
  */
 void init_history(void);
 
 /**
  * Cleanup history system
- * Saves history to file and frees all allocated memory
+ * Flushes unsynced entries to disk and frees all allocated memory
  */
 void cleanup_history(void);
 
 /**
- * Add command to history
- * If command count exceeds MAX_HISTORY, oldest entry is removed
+ * Add command to history in O(1)
+ * The entry is appended to ~/.kord_history right away, under an flock
+ * shared with other shells; their new entries are merged in first
+ * Keeps at most $HISTSIZE entries (DEFAULT_HISTORY_SIZE if unset, no limit
+ * if negative); the oldest entries are dropped first
+ * $HISTCONTROL may contain ignorespace, ignoreboth and erasedups
  */
 void add_history(const char *command);
 
 /**
- * Get history entry at index (0 = oldest, count-1 = newest)
- * Returns NULL if index out of bounds
+ * Check whether $HISTCONTROL keeps command out of history (ignorespace)
+ * Returns 1 if it must not be recorded, 0 otherwise
+ */
+int history_ignores(const char *command);
+
+/**
+ * Merge entries other shells appended to ~/.kord_history since the last look
+ * Returns the number of entries added
+ */
+int read_new_history(void);
+
+/**
+ * Get history entry at index (0 = oldest, count-1 = newest) in O(1)
+ * Returns NULL if index out of bounds or the entry was erased as a duplicate
  */
 const char *get_history(int index);
 
 /**
- * Get number of history entries
+ * Get number of history entries (erased entries still occupy an index)
  */
 int get_history_count(void);
 
 /**
- * Move history entry to the latest position
+ * Sequence number of entry 0; entry i has sequence number base + i
+ * Sequence numbers stay stable until get_history_generation() changes
+ */
+uint64_t get_history_base_seq(void);
+
+/**
+ * Counter bumped whenever entries are renumbered (erased entries squeezed out)
+ */
+unsigned int get_history_generation(void);
+
+/**
+ * Find the nearest entry at or after index that was not erased,
+ * stepping by direction (-1 towards older, 1 towards newer)
+ * Returns its index, or -1 if there is none
+ */
+int find_history_entry(int index, int direction);
+
+/**
+ * Move history entry to the latest position in O(1)
  * Used when user selects a history command via arrow keys
  */
 void move_history_to_latest(int index);
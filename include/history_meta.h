@@ -0,0 +1,32 @@
+#ifndef HISTORY_META_H
+#define HISTORY_META_H
+
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * Open the history metadata store (~/.kord_history.meta) and pick a
+ * session id for this shell
+ */
+void init_history_meta(void);
+
+/**
+ * Close the history metadata store
+ */
+void cleanup_history_meta(void);
+
+/**
+ * Record one executed command line: when it started, how long it ran,
+ * its exit status and the directory it was started in
+ * Lines kept out of history by $HISTCONTROL are not recorded either
+ */
+void record_history_meta(const char *command, time_t started_at, uint32_t duration_ms, int status, const char *cwd);
+
+/**
+ * Filter or aggregate recorded commands (history --since 1w --failed ...)
+ * args[0] is "history"; see builtin help for the options
+ * Returns 0 on success, 1 on a usage error
+ */
+int query_history_meta(char **args);
+
+#endif // HISTORY_META_H
@@ -0,0 +1,32 @@
+#ifndef HISTORY_SEARCH_H
+#define HISTORY_SEARCH_H
+
+/* Maximum number of ranked results returned by history_search_fuzzy() */
+#define HISTORY_FUZZY_MAX_RESULTS 64
+
+/**
+ * Find the newest history entry older than index `before` that contains
+ * query (case-sensitive); pass get_history_count() to start at the newest
+ * Queries of three or more bytes are answered from a trigram index that is
+ * brought up to date incrementally on every call
+ * Returns the history index of the match, or -1 if there is none
+ */
+int history_search_substring(const char *query, int before);
+
+/**
+ * Rank history entries that contain the letters of query in order
+ * (case-insensitive), best match first; matches at word starts and runs of
+ * consecutive letters score higher, and newer entries win ties
+ * Each distinct command is reported once, at its newest index
+ * should_stop is polled between blocks of entries (may be NULL); if it
+ * returns nonzero the search is abandoned
+ * Returns the number of indexes stored in results, or -1 if abandoned
+ */
+int history_search_fuzzy(const char *query, int *results, int max_results, int (*should_stop)(void));
+
+/**
+ * Free the search index
+ */
+void cleanup_history_search(void);
+
+#endif // HISTORY_SEARCH_H
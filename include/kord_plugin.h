@@ -0,0 +1,71 @@
+#ifndef KORD_PLUGIN_H
+#define KORD_PLUGIN_H
+
+/*
+ * Loadable builtins for kord-sh
+ *
+ * A plugin is a shared object exporting, for each builtin NAME, a
+ * KordBuiltin named NAME_kord_builtin. "enable -f ./lib.so NAME" loads
+ * it; from then on NAME runs in the shell process, without a fork.
+ * This header is the whole interface: plugins need nothing else from the
+ * shell's sources. Build with: cc -shared -fPIC -o lib.so plugin.c
+ *
+ *     static int hello(int argc, char **argv, KordOutput *out, const KordShellApi *api) {
+ *         const char *user = api->get_variable("USER");
+ *         api->printf(out, "hello, %s (%d args)\n", user ? user : "you", argc - 1);
+ *         return 0;
+ *     }
+ *     const KordBuiltin hello_kord_builtin = {
+ *         KORD_PLUGIN_ABI_VERSION, "hello", hello, 0, "hello - greet the user"
+ *     };
+ */
+
+#include <stddef.h>
+
+/* Bumped on every incompatible change; a plugin built for another version is refused */
+#define KORD_PLUGIN_ABI_VERSION 1
+
+/* KordBuiltin flags */
+#define KORD_BUILTIN_SHELL_STATE 0x01   /* changes shell variables: never run in a forked
+                                           child, even in a pipeline (redirections are
+                                           then ignored) */
+
+/* Buffered standard output of a running builtin (opaque) */
+typedef struct KordOutput KordOutput;
+
+/**
+ * Services of the shell, passed to every call of a plugin builtin
+ * Fields are only ever added at the end; check size before using one
+ * that a newer ABI version added
+ */
+typedef struct {
+    unsigned abi_version;
+    size_t size;                                          /* sizeof(KordShellApi) of the shell */
+
+    /* Output: collected and written in large chunks when the builtin returns */
+    int (*write)(KordOutput *out, const char *data, size_t len);   /* returns 0, or -1 on failure */
+    int (*printf)(KordOutput *out, const char *format, ...);       /* returns bytes added, or -1 */
+
+    /* Shell variables (strings returned by get_variable stay valid until the variable changes) */
+    const char *(*get_variable)(const char *name);                 /* NULL if unset */
+    int (*set_variable)(const char *name, const char *value);      /* returns 0, or -1 on failure */
+    int (*export_variable)(const char *name, const char *value);   /* value NULL: export as is */
+    int (*unset_variable)(const char *name);
+} KordShellApi;
+
+/**
+ * A plugin builtin: argv[0] is its name, argv[argc] is NULL
+ * Returns the exit status (0-255)
+ */
+typedef int (*KordBuiltinFunc)(int argc, char **argv, KordOutput *out, const KordShellApi *api);
+
+/* What a plugin exports as NAME_kord_builtin */
+typedef struct {
+    unsigned abi_version;        /* KORD_PLUGIN_ABI_VERSION */
+    const char *name;            /* NAME */
+    KordBuiltinFunc func;
+    unsigned flags;              /* KORD_BUILTIN_* */
+    const char *usage;           /* one line shown by help NAME, or NULL */
+} KordBuiltin;
+
+#endif /* KORD_PLUGIN_H */
@@ -0,0 +1,51 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stddef.h>
+#include <stdarg.h>
+
+/* Bytes collected before a write() */
+#define OUTPUT_BUFFER_SIZE 8192
+
+/**
+ * Buffered output channel of a builtin: what it prints is collected and
+ * written with as few write() calls as possible
+ * (plugins see it as the opaque KordOutput of kord_plugin.h)
+ */
+struct KordOutput {
+    int fd;
+    size_t len;
+    int failed;          // a write() failed; later output is dropped
+    char data[OUTPUT_BUFFER_SIZE];
+};
+typedef struct KordOutput OutputBuffer;
+
+/**
+ * Start an empty channel writing to fd
+ */
+void output_init(OutputBuffer *out, int fd);
+
+/**
+ * Add data[0..len) to the channel, writing out full buffers
+ */
+void output_append(OutputBuffer *out, const char *data, size_t len);
+
+/**
+ * Add text formatted as by vprintf() (ap is left for the caller to va_end())
+ * Returns the number of bytes added, or -1 on failure
+ */
+int output_vformat(OutputBuffer *out, const char *format, va_list ap);
+
+/**
+ * Add text formatted as by printf()
+ * Returns the number of bytes added, or -1 on failure
+ */
+int output_format(OutputBuffer *out, const char *format, ...);
+
+/**
+ * Write out everything collected
+ * Returns 0 on success, -1 if any write() failed
+ */
+int output_flush(OutputBuffer *out);
+
+#endif // OUTPUT_H
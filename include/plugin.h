@@ -0,0 +1,42 @@
+#ifndef PLUGIN_H
+#define PLUGIN_H
+
+#include "builtins.h"
+
+/**
+ * Load the builtin name from the shared object at path (its
+ * name_kord_builtin symbol) and register it
+ * Returns 0 on success, -1 on failure (reported on stderr)
+ */
+int load_plugin_builtin(const char *path, const char *name);
+
+/**
+ * Unregister a builtin loaded with load_plugin_builtin() and let go of
+ * its shared object
+ * Returns 0 on success, -1 if name is not a loaded builtin
+ */
+int unload_plugin_builtin(const char *name);
+
+/**
+ * Run a loaded builtin: the plugin gets argv, a buffered output channel
+ * and access to shell variables
+ * Returns its exit status
+ */
+int run_plugin_builtin(const Builtin *builtin, char **args);
+
+/**
+ * One-line usage a loaded builtin declared, or NULL
+ */
+const char *plugin_builtin_usage(const Builtin *builtin);
+
+/**
+ * Shared object a loaded builtin came from
+ */
+const char *plugin_builtin_path(const Builtin *builtin);
+
+/**
+ * Unload every plugin builtin
+ */
+void cleanup_plugins(void);
+
+#endif // PLUGIN_H
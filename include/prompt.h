@@ -2,20 +2,31 @@
 #define PROMPT_H
 
 /**
- * Display the shell prompt with username, hostname, and current directory
+ * Display the shell prompt for a new command line, starting the
+ * background worker for the segments it shows (git, k8s, battery)
  */
 void print_prompt(void);
 
 /**
- * Build and return a dynamically allocated prompt string
- * Caller must free the returned string
+ * Build the prompt string from $PS1 ("user@host:cwd$ " in colors if unset)
+ * PS1 is compiled once; the string is only rebuilt when PS1, the current
+ * directory (tracked in $PWD) or a segment value changes
+ * Returns the prompt (owned by the prompt module, valid until the next
+ * call), or NULL on failure
  */
-char *build_prompt(void);
+const char *build_prompt(void);
 
 /**
- * Read user input (raw mode or cooked mode)
+ * Free the cached prompt
  */
-int read_user_input(char *command);
+void cleanup_prompt(void);
+
+/**
+ * Read user input (raw mode or cooked mode), of any length
+ * *command is set to the line (caller frees)
+ * Returns its length, or -1 on EOF (Ctrl+D) with *command set to NULL
+ */
+int read_user_input(char **command);
 
 /**
  * Print welcome banner when shell starts
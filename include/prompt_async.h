@@ -0,0 +1,60 @@
+#ifndef PROMPT_ASYNC_H
+#define PROMPT_ASYNC_H
+
+#include <stddef.h>
+
+/* Prompt segments that need outside information */
+typedef enum {
+    SEGMENT_GIT,         // branch (or short commit) of the repository, '*' if it has changes
+    SEGMENT_K8S,         // current-context of the kubeconfig
+    SEGMENT_BATTERY,     // charge of the first battery, '+' while charging
+    SEGMENT_COUNT
+} AsyncSegment;
+
+/**
+ * Look up an asynchronous segment by its name in PS1 ("git", "k8s",
+ * "battery")
+ * Returns the segment, or -1 if there is no such segment
+ */
+int prompt_async_lookup(const char *name, size_t len);
+
+/**
+ * Recompute the segments in mask (bits 1 << SEGMENT_*) for a new prompt
+ * on a background worker, given at most $PROMPT_TIMEOUT milliseconds
+ * Until the worker is done, the last value computed in the same context
+ * (the same directory for git) is shown
+ * Main thread only
+ */
+void prompt_async_start(unsigned mask);
+
+/**
+ * Value of a segment for the current prompt ("" if none is known yet)
+ * Valid until the next prompt_async_* call
+ */
+const char *prompt_async_value(int segment);
+
+/**
+ * Changes whenever a value returned by prompt_async_value() may have
+ * changed, so prompts built from them can be cached
+ */
+unsigned prompt_async_generation(void);
+
+/**
+ * File descriptor that becomes readable when the worker is done, to poll
+ * along with the terminal
+ * Returns the descriptor, or -1 if no worker is running
+ */
+int prompt_async_fd(void);
+
+/**
+ * Take the results of a finished worker
+ * Returns 1 if a value shown in the prompt changed, 0 otherwise
+ */
+int prompt_async_update(void);
+
+/**
+ * Abandon the worker and free the remembered values
+ */
+void cleanup_prompt_async(void);
+
+#endif // PROMPT_ASYNC_H
@@ -16,10 +16,13 @@ void disable_raw_mode(void);
  * Read user input in raw mode with immediate character echo
  * Supports:
  * - Arrow keys (up/down for history, left/right for cursor movement)
+ * - Ctrl+R incremental history search (Ctrl+T switches to fuzzy ranking)
  * - Backspace
  * - Basic line editing
+ * The line has no length limit; *line is set to it (caller frees)
+ * Returns its length, or -1 on EOF (Ctrl+D) with *line set to NULL
  */
-int read_input_raw(char *buffer, size_t buffer_size);
+int read_input_raw(char **line);
 
 /**
  * Check if raw mode is currently enabled
@@ -0,0 +1,82 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stddef.h>
+
+/**
+ * How a byte of the edited line is drawn (see render_line)
+ */
+enum {
+    STYLE_PLAIN = 0,
+    STYLE_BUILTIN,           // command word naming a builtin
+    STYLE_ALIAS,             // command word naming an alias
+    STYLE_COMMAND,           // command word found on $PATH (or an executable path)
+    STYLE_UNKNOWN_COMMAND,   // command word that resolves to nothing
+    STYLE_STRING,            // quoted text
+    STYLE_REDIRECT,          // redirection and pipe operators
+    STYLE_COUNT
+};
+
+/**
+ * Install the SIGWINCH handler and read the terminal size
+ */
+void init_render(void);
+
+/**
+ * Terminal width in columns (TIOCGWINSZ, re-read after SIGWINCH; 80 if unknown)
+ */
+int render_width(void);
+
+/**
+ * Check whether the terminal was resized since the last call
+ * Returns 1 if it was, 0 otherwise
+ */
+int render_resized(void);
+
+/**
+ * Number of terminal columns a string takes (skips escape sequences,
+ * counts each UTF-8 character once)
+ */
+int render_text_width(const char *s, size_t len);
+
+/**
+ * Queue bytes for the next render_flush()
+ */
+void render_append(const char *data, size_t len);
+
+/**
+ * Write everything queued with a single write()
+ */
+void render_flush(void);
+
+/**
+ * Start a new frame: a prompt prompt_width columns wide has just been
+ * drawn at the start of a row, with nothing after it
+ */
+void render_begin(int prompt_width);
+
+/**
+ * Bring the screen in line with the edited line: text[0..len) after the
+ * prompt, each byte colored by its STYLE_* in styles (all plain if NULL),
+ * followed by ghost[0..ghost_len) dimmed, with the cursor at byte offset
+ * cursor of text
+ * Only cells that differ from the previous frame (in text or style) are
+ * rewritten; wrapped lines are handled with the real terminal width.
+ * Everything goes out in one write()
+ */
+void render_line(const char *text, size_t len, const unsigned char *styles, size_t cursor,
+                 const char *ghost, size_t ghost_len);
+
+/**
+ * Erase the prompt and the drawn line, leaving the cursor at the start of
+ * the prompt's row (queued, not flushed)
+ */
+void render_clear(void);
+
+/**
+ * Write tail (if not NULL) after the drawn line and move the cursor to the
+ * start of the row below (queued, not flushed); the frame is finished
+ */
+void render_end(const char *tail);
+
+#endif // RENDER_H
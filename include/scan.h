@@ -0,0 +1,59 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Maximum number of distinct bytes accepted by scan_find_any() */
+#define SCAN_MAX_SET 8
+
+/* Kernel sets, from slowest to fastest */
+#define SCAN_LEVEL_SCALAR 0
+#define SCAN_LEVEL_SSE2   1
+#define SCAN_LEVEL_AVX2   2
+
+/**
+ * Select the fastest scanning kernels supported by the running CPU
+ * (AVX2, SSE2 or portable scalar code). Called automatically on first use.
+ */
+void init_scan(void);
+
+/**
+ * Use the kernels of level (SCAN_LEVEL_*) instead, e.g. to compare them
+ * Returns 0 on success, -1 if the CPU or the build does not support level
+ */
+int scan_set_level(int level);
+
+/**
+ * Find the first byte of s[0..len) that is one of the bytes in set
+ * set is a NUL-terminated string of at most SCAN_MAX_SET bytes
+ * Returns the index of the match, or len if there is none
+ */
+size_t scan_find_any(const char *s, size_t len, const char *set);
+
+/**
+ * Skip leading whitespace (as classified by isspace() in the C locale)
+ * Returns the index of the first non-whitespace byte, or len if all are blank
+ */
+size_t scan_skip_space(const char *s, size_t len);
+
+/**
+ * Skip trailing whitespace
+ * Returns the length of s[0..len) once trailing whitespace is removed
+ */
+size_t scan_trim_end(const char *s, size_t len);
+
+/**
+ * Case-insensitive (ASCII) prefix test
+ * Returns 1 if s[0..s_len) starts with prefix[0..prefix_len), 0 otherwise
+ */
+int scan_has_prefix_nocase(const char *s, size_t s_len, const char *prefix, size_t prefix_len);
+
+/**
+ * Collect the indexes i of masks[0..count) for which (masks[i] & need) == need
+ * out must have room for count entries
+ * Returns the number of indexes written (in increasing order)
+ */
+size_t scan_mask_superset(const uint64_t *masks, size_t count, uint64_t need, uint32_t *out);
+
+#endif // SCAN_H
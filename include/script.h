@@ -0,0 +1,25 @@
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+/**
+ * Run one command line: expand aliases, parse and execute it
+ * Returns the status of the command, or -1 if the shell should exit
+ */
+int run_command_line(const char *line);
+
+/**
+ * Execute every command of a script file in the current shell (source / .)
+ * The compiled form of the script is cached on disk, keyed by the file's
+ * path, size, mtime and inode; a cache hit maps it instead of re-lexing
+ * Returns the status of the last command, 1 if the file cannot be read,
+ * or -1 if the script ran "exit"
+ */
+int source_file(const char *path);
+
+/**
+ * Source ~/.kordrc if it exists
+ * Returns -1 if the rc file ran "exit", 0 otherwise
+ */
+int load_rc_file(void);
+
+#endif // SCRIPT_H
@@ -0,0 +1,33 @@
+#ifndef SUGGEST_H
+#define SUGGEST_H
+
+#include <stddef.h>
+
+/**
+ * Note that command was run (or read from another shell's history)
+ * cwd is the directory it ran in, or NULL if unknown
+ * Only takes effect once the suggestion trie has been built
+ */
+void suggest_add(const char *command, const char *cwd);
+
+/**
+ * Index up to budget not-yet-indexed history entries, newest first
+ * Meant to be called while the user is idle; lookups only see indexed entries
+ * Returns 1 if older entries remain, 0 once history is fully indexed
+ */
+int suggest_backfill(int budget);
+
+/**
+ * Best history line starting with prefix[0..len) and longer than it
+ * Ranked by frecency (use count with exponential decay), with a bonus for
+ * lines previously run in cwd
+ * Returns the whole line (owned by the trie), or NULL if there is none
+ */
+const char *suggest_lookup(const char *prefix, size_t len, const char *cwd);
+
+/**
+ * Free the suggestion trie
+ */
+void cleanup_suggest(void);
+
+#endif // SUGGEST_H
@@ -1,8 +1,11 @@
 #ifndef VARIABLES_H
 #define VARIABLES_H
 
+#include <stddef.h>
+
 /**
  * Initialize the variable system
+ * Imports the inherited environment; from then on the shell owns it
  * Must be called before using any variable functions
  */
 void init_variables(void);
@@ -14,17 +17,31 @@ void init_variables(void);
 void cleanup_variables(void);
 
 /**
- * Set a shell variable (not exported to environment)
+ * Set a shell variable
+ * New variables are not exported; exported ones keep their envp slot updated
  * Returns 0 on success, -1 on failure
  */
 int set_variable(const char *name, const char *value);
 
 /**
- * Get a variable value (checks shell variables first, then environment)
+ * Get a variable value (shell and exported variables share one table)
  * Returns the value if found, NULL otherwise
  */
 const char *get_variable(const char *name);
 
+/**
+ * Get a variable value by a name that is not NUL-terminated (name[0..len))
+ * Lets expansion look up "$VAR" in place without copying the name
+ * Returns the value if found, NULL otherwise
+ */
+const char *get_variable_n(const char *name, size_t len);
+
+/**
+ * Get a variable holding a count or a duration (a non-negative integer)
+ * Returns its value, or default_value if it is unset, empty or invalid
+ */
+int get_variable_int(const char *name, int default_value);
+
 /**
  * Export a variable to the environment
  * If the variable exists as shell variable, it gets promoted to environment
@@ -33,27 +50,99 @@ const char *get_variable(const char *name);
  */
 int export_variable(const char *name, const char *value);
 
+/**
+ * Get the shell-owned environment as a NULL-terminated "NAME=value" array
+ * Maintained incrementally on export/unset; pass it directly to execve()
+ * The array is owned by the variable system and must not be freed
+ */
+char **get_environment(void);
+
+/**
+ * Copy the environment for use off the main thread, with the "NAME=value"
+ * strings of extra (NULL-terminated, or NULL) in place of the variables
+ * they name
+ * The copy is a single allocation: release it with free()
+ * Returns the copy, or NULL on allocation failure
+ */
+char **copy_environment(char *const *extra);
+
 /**
  * Unset a variable (removes from both shell variables and environment)
  * Returns 0 on success, -1 on failure
  */
 int unset_variable(const char *name);
 
+/**
+ * Declare name as an array (declare -a / declare -A)
+ * An existing scalar value becomes element 0
+ * Returns 0 on success, -1 on failure
+ */
+int declare_array(const char *name, int assoc);
+
+/**
+ * Assign a whole array: name=(values...) or name+=(values...) when append is set
+ * Words of the form "[subscript]=value" set explicit elements
+ * Returns 0 on success, -1 on failure
+ */
+int set_array(const char *name, char **values, int count, int append);
+
+/**
+ * Assign one element: name[subscript]=value
+ * Indexed subscripts are integers (negative counts from the end)
+ * Returns 0 on success, -1 on failure
+ */
+int set_array_element(const char *name, const char *subscript, const char *value);
+
+/**
+ * Get one element by name[0..name_len) and subscript[0..sub_len) in O(1)
+ * Returns the value if set, NULL otherwise
+ */
+const char *get_array_element_n(const char *name, size_t name_len, const char *subscript, size_t sub_len);
+
+/**
+ * Unset one element: unset name[subscript]
+ * Returns 0 on success, -1 if it was not set
+ */
+int unset_array_element(const char *name, const char *subscript);
+
+/**
+ * Call visit for every element value (or key, when want_keys is set)
+ * A scalar behaves like a one-element array; visit may be NULL to just count
+ * Returns the number of elements, -1 if the variable is not set, or -2
+ * if visit returned non-zero
+ */
+long for_each_array_item(const char *name, size_t name_len, int want_keys,
+                         int (*visit)(void *ctx, const char *item), void *ctx);
+
 /**
  * Print all shell variables
  */
 void print_variables(void);
 
 /**
- * Check if a command is a variable assignment (VAR=value)
+ * Count the leading NAME=value words of a command
+ * Example: ["A=1", "B=2", "make", NULL] -> 2
+ */
+int count_assignment_words(char **command);
+
+/**
+ * Check if a command is a variable assignment (every word is VAR=value)
  * Returns 1 if it's an assignment, 0 otherwise
  */
 int is_variable_assignment(char **command);
 
 /**
- * Execute a variable assignment (VAR=value)
+ * Execute a variable assignment (VAR=value [VAR2=value2 ...])
  * Returns 0 on success, 1 on failure
  */
 int execute_variable_assignment(char **command);
 
+/**
+ * Export per-command assignments (the "VAR=x" in "VAR=x cmd")
+ * Meant to be called in the forked child, so only the child's copy of the
+ * environment vector gets the overlay
+ * Returns 0 on success, -1 on failure
+ */
+int apply_command_assignments(char **assignments, int count);
+
 #endif // VARIABLES_H
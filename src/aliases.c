@@ -1,239 +1,371 @@
 #include "../include/common.h"
 #include "../include/aliases.h"
+#include "../include/hashtable.h"
+#include "../include/scan.h"
 
+/* Initial number of slots in the alias table */
+#define ALIAS_TABLE_INITIAL 128
+
+/**
+ * An alias definition
+ * The fully expanded form of the value (nested aliases resolved) is
+ * memoized and reused until any alias is defined or removed
+ */
 typedef struct {
-    char name[MAX_ALIAS_NAME];
-    char value[MAX_ALIAS_VALUE];
-    int active;  // 1 if slot is used, 0 if free
+    char *value;
+    char *expansion;                // memoized expansion of value, or NULL
+    size_t expansion_len;
+    int expansion_blank;            // expansion leaves the next word in command position
+    unsigned int expansion_generation;
+    int expanding;                  // set while this alias is being expanded (cycle guard)
 } Alias;
 
-static Alias aliases[MAX_ALIASES];
-static int alias_count = 0;
+static HashTable alias_table;
+static int aliases_initialized = 0;
 
-/**
- * Get home directory path
- */
-static const char *get_home_dir(void) {
-    const char *home = getenv("HOME");
-    if (home == NULL) {
-        home = ".";  // Fallback to current directory
-    }
-    return home;
-}
+/* Bumped whenever an alias changes; memoized expansions from older generations are stale */
+static unsigned int alias_generation = 1;
+
+/* State of one expand_alias() call */
+typedef struct {
+    char *data;          // expanded line
+    size_t len;
+    size_t cap;
+    Alias *root;         // alias whose expansion may be memoized, or NULL
+    int blocked;         // a cycle was cut at an alias other than root
+    int expanded;        // at least one alias was substituted
+} AliasExpansion;
 
 /**
- * Get full path to .kordrc file
+ * Release an alias (used as the hash table value destructor)
  */
-static void get_kordrc_path(char *buffer, size_t size) {
-    const char *home = get_home_dir();
-    snprintf(buffer, size, "%s/.kordrc", home);
+static void free_alias(void *ptr) {
+    Alias *alias = ptr;
+    if (alias == NULL) {
+        return;
+    }
+    free(alias->value);
+    free(alias->expansion);
+    free(alias);
 }
 
 void init_aliases(void) {
-    // Initialize alias array
-    for (int i = 0; i < MAX_ALIASES; i++) {
-        aliases[i].active = 0;
-    }
-    alias_count = 0;
-    
-    // Load aliases from .kordrc file
-    char kordrc_path[1024];
-    get_kordrc_path(kordrc_path, sizeof(kordrc_path));
-    
-    FILE *file = fopen(kordrc_path, "r");
-    if (file == NULL) {
-        // File doesn't exist, that's okay
+    if (aliases_initialized) {
         return;
     }
-    
-    char line[MAX_ALIAS_VALUE + MAX_ALIAS_NAME + 10];
-    while (fgets(line, sizeof(line), file)) {
-        // Remove trailing newline
-        line[strcspn(line, "\n")] = '\0';
-        
-        // Skip empty lines and comments
-        if (line[0] == '\0' || line[0] == '#') {
-            continue;
-        }
-        
-        // Parse alias command: alias name='value' or alias name="value"
-        char *alias_start = strstr(line, "alias ");
-        if (alias_start == line) {
-            char *equals = strchr(line, '=');
-            if (equals == NULL) {
-                continue;
-            }
-            
-            // Extract name (between "alias " and '=')
-            char name[MAX_ALIAS_NAME];
-            int name_len = equals - (line + 6);  // 6 = strlen("alias ")
-            if (name_len <= 0 || name_len >= MAX_ALIAS_NAME) {
-                continue;
-            }
-            
-            strncpy(name, line + 6, name_len);
-            name[name_len] = '\0';
-            
-            // Trim whitespace from name
-            char *name_ptr = name;
-            while (*name_ptr == ' ' || *name_ptr == '\t') name_ptr++;
-            char *name_end = name_ptr + strlen(name_ptr) - 1;
-            while (name_end > name_ptr && (*name_end == ' ' || *name_end == '\t')) {
-                *name_end = '\0';
-                name_end--;
-            }
-            
-            // Extract value (after '=')
-            char *value = equals + 1;
-            while (*value == ' ' || *value == '\t') value++;
-            
-            // Remove quotes if present
-            if ((*value == '\'' || *value == '"') && strlen(value) >= 2) {
-                char quote = *value;
-                value++;
-                char *end = strrchr(value, quote);
-                if (end) {
-                    *end = '\0';
-                }
-            }
-            
-            // Add alias to memory
-            set_alias(name_ptr, value);
-        }
+
+    if (ht_init(&alias_table, ALIAS_TABLE_INITIAL) != 0) {
+        return;
     }
-    
-    fclose(file);
+    aliases_initialized = 1;
 }
 
 void cleanup_aliases(void) {
     // No need to save to file, aliases are only stored in memory
-    // Just cleanup the memory
-    for (int i = 0; i < MAX_ALIASES; i++) {
-        aliases[i].active = 0;
-    }
-    alias_count = 0;
+    ht_free(&alias_table, free_alias);
+    aliases_initialized = 0;
 }
 
 int set_alias(const char *name, const char *value) {
-    if (name == NULL || value == NULL) {
+    if (name == NULL || value == NULL || name[0] == '\0') {
         return -1;
     }
-    
-    if (strlen(name) >= MAX_ALIAS_NAME || strlen(value) >= MAX_ALIAS_VALUE) {
+
+    if (!aliases_initialized) {
+        init_aliases();
+    }
+
+    char *value_copy = strdup(value);
+    if (value_copy == NULL) {
+        perror("strdup");
         return -1;
     }
-    
-    // Check if alias already exists
-    for (int i = 0; i < MAX_ALIASES; i++) {
-        if (aliases[i].active && strcmp(aliases[i].name, name) == 0) {
-            // Update existing alias
-            strncpy(aliases[i].value, value, MAX_ALIAS_VALUE - 1);
-            aliases[i].value[MAX_ALIAS_VALUE - 1] = '\0';
-            return 0;
-        }
+
+    HashEntry *entry = ht_insert(&alias_table, name, strlen(name));
+    if (entry == NULL) {
+        free(value_copy);
+        return -1;
     }
-    
-    // Find free slot
-    for (int i = 0; i < MAX_ALIASES; i++) {
-        if (!aliases[i].active) {
-            aliases[i].active = 1;
-            strncpy(aliases[i].name, name, MAX_ALIAS_NAME - 1);
-            aliases[i].name[MAX_ALIAS_NAME - 1] = '\0';
-            strncpy(aliases[i].value, value, MAX_ALIAS_VALUE - 1);
-            aliases[i].value[MAX_ALIAS_VALUE - 1] = '\0';
-            alias_count++;
-            return 0;
+
+    Alias *alias = entry->value;
+    if (alias == NULL) {
+        alias = calloc(1, sizeof(Alias));
+        if (alias == NULL) {
+            perror("calloc");
+            free(value_copy);
+            ht_remove(&alias_table, name, strlen(name));
+            return -1;
         }
+        entry->value = alias;
     }
-    
-    // No free slots
-    return -1;
+
+    free(alias->value);
+    alias->value = value_copy;
+    alias_generation++;
+
+    return 0;
 }
 
 const char *get_alias(const char *name) {
     if (name == NULL) {
         return NULL;
     }
-    
-    for (int i = 0; i < MAX_ALIASES; i++) {
-        if (aliases[i].active && strcmp(aliases[i].name, name) == 0) {
-            return aliases[i].value;
-        }
-    }
-    
-    return NULL;
+
+    Alias *alias = ht_get(&alias_table, name);
+    return alias ? alias->value : NULL;
 }
 
 int unset_alias(const char *name) {
     if (name == NULL) {
         return -1;
     }
-    
-    for (int i = 0; i < MAX_ALIASES; i++) {
-        if (aliases[i].active && strcmp(aliases[i].name, name) == 0) {
-            aliases[i].active = 0;
-            alias_count--;
-            return 0;
-        }
+
+    Alias *alias = ht_remove(&alias_table, name, strlen(name));
+    if (alias == NULL) {
+        return -1;
     }
-    
-    return -1;
+
+    free_alias(alias);
+    alias_generation++;
+    return 0;
+}
+
+/**
+ * qsort comparator for hash entries, by name
+ */
+static int compare_entries(const void *a, const void *b) {
+    const HashEntry *ea = *(const HashEntry * const *)a;
+    const HashEntry *eb = *(const HashEntry * const *)b;
+    return strcmp(ea->key, eb->key);
+}
+
+const char *next_alias_name(size_t *pos) {
+    HashEntry *entry = ht_next(&alias_table, pos);
+    return entry ? entry->key : NULL;
 }
 
 void print_aliases(void) {
-    if (alias_count == 0) {
+    if (alias_table.count == 0) {
         printf("No aliases defined\n\r");
         return;
     }
-    
-    for (int i = 0; i < MAX_ALIASES; i++) {
-        if (aliases[i].active) {
-            printf("alias %s='%s'\n\r", aliases[i].name, aliases[i].value);
+
+    HashEntry **sorted = malloc(alias_table.count * sizeof(HashEntry *));
+    if (sorted == NULL) {
+        perror("malloc");
+        return;
+    }
+
+    size_t n = 0;
+    size_t pos = 0;
+    HashEntry *entry;
+    while ((entry = ht_next(&alias_table, &pos)) != NULL) {
+        sorted[n++] = entry;
+    }
+    qsort(sorted, n, sizeof(HashEntry *), compare_entries);
+
+    for (size_t i = 0; i < n; i++) {
+        const Alias *alias = sorted[i]->value;
+        printf("alias %s='%s'\n\r", sorted[i]->key, alias->value);
+    }
+
+    free(sorted);
+}
+
+/**
+ * Append s[0..n) to the expanded line
+ * Returns 0 on success, -1 on allocation failure
+ */
+static int expansion_append(AliasExpansion *exp, const char *s, size_t n) {
+    if (exp->len + n + 1 > exp->cap) {
+        size_t new_cap = exp->cap ? exp->cap : 128;
+        while (new_cap < exp->len + n + 1) {
+            new_cap *= 2;
+        }
+        char *new_data = realloc(exp->data, new_cap);
+        if (new_data == NULL) {
+            perror("realloc");
+            return -1;
+        }
+        exp->data = new_data;
+        exp->cap = new_cap;
+    }
+
+    memcpy(exp->data + exp->len, s, n);
+    exp->len += n;
+    exp->data[exp->len] = '\0';
+    return 0;
+}
+
+/**
+ * Length of the word (or, with whole_segment set, the rest of the pipeline
+ * segment) starting at s. Quotes and "${...}" are skipped as a unit, so a
+ * blank or '|' inside them does not end the span.
+ */
+static size_t span_length(const char *s, size_t len, int whole_segment) {
+    const char *stop_set = whole_segment ? "\"'|$" : " \t\n\"'|$";
+    size_t i = 0;
+
+    while (i < len) {
+        i += scan_find_any(s + i, len - i, stop_set);
+        if (i >= len) {
+            break;
+        }
+
+        char c = s[i];
+        if (c == '"' || c == '\'') {
+            const char *close = memchr(s + i + 1, c, len - i - 1);
+            i = close ? (size_t)(close - s) + 1 : len;
+        } else if (c == '$') {
+            i++;
+            if (i < len && s[i] == '{') {
+                int depth = 0;
+                for (; i < len; i++) {
+                    if (s[i] == '{') {
+                        depth++;
+                    } else if (s[i] == '}' && --depth == 0) {
+                        i++;
+                        break;
+                    }
+                }
+            }
+        } else {
+            break;  // Blank or '|'
+        }
+    }
+
+    return i;
+}
+
+static int expand_text(AliasExpansion *exp, const char *text, size_t len, int command_pos, int *ends_in_command_pos);
+
+/**
+ * Append the full expansion of an alias
+ * *next_in_command_pos is set when the word following the alias must be
+ * checked for aliases too (value ends in a blank, as in bash)
+ * Returns 0 on success, -1 on allocation failure
+ */
+static int expand_one_alias(AliasExpansion *exp, Alias *alias, int *next_in_command_pos) {
+    // Only top-level expansions are memoized: nested ones depend on the chain above them
+    int top_level = (exp->root == NULL);
+
+    if (top_level && alias->expansion != NULL && alias->expansion_generation == alias_generation) {
+        *next_in_command_pos = alias->expansion_blank;
+        return expansion_append(exp, alias->expansion, alias->expansion_len);
+    }
+
+    size_t start = exp->len;
+    size_t value_len = strlen(alias->value);
+    int ends_in_command_pos = 0;
+
+    if (top_level) {
+        exp->root = alias;
+        exp->blocked = 0;
+    }
+
+    alias->expanding = 1;
+    int result = expand_text(exp, alias->value, value_len, 1, &ends_in_command_pos);
+    alias->expanding = 0;
+
+    *next_in_command_pos = ends_in_command_pos ||
+                           (value_len > 0 && isblank((unsigned char)alias->value[value_len - 1]));
+
+    if (top_level) {
+        exp->root = NULL;
+
+        if (result == 0 && !exp->blocked) {
+            char *memo = malloc(exp->len - start + 1);
+            if (memo != NULL) {
+                memcpy(memo, exp->data + start, exp->len - start);
+                memo[exp->len - start] = '\0';
+                free(alias->expansion);
+                alias->expansion = memo;
+                alias->expansion_len = exp->len - start;
+                alias->expansion_blank = *next_in_command_pos;
+                alias->expansion_generation = alias_generation;
+            }
+        }
+    }
+
+    return result;
+}
+
+/**
+ * Expand aliases in text[0..len), appending the result
+ * Aliases are recognized in command position: the first word of every
+ * pipeline segment, and the word after an alias whose value ends in a blank.
+ * Text without aliases is copied in as few pieces as possible.
+ * Returns 0 on success, -1 on allocation failure
+ */
+static int expand_text(AliasExpansion *exp, const char *text, size_t len, int command_pos, int *ends_in_command_pos) {
+    size_t flushed = 0;  // text[0..flushed) has already been appended
+    size_t i = 0;
+
+    while (i < len) {
+        i += scan_skip_space(text + i, len - i);
+        if (i >= len) {
+            break;
         }
+
+        if (text[i] == '|') {
+            i++;
+            command_pos = 1;
+            continue;
+        }
+
+        if (!command_pos) {
+            i += span_length(text + i, len - i, 1);
+            continue;
+        }
+
+        size_t word_len = span_length(text + i, len - i, 0);
+        HashEntry *entry = ht_lookup(&alias_table, text + i, word_len);
+        Alias *alias = entry ? entry->value : NULL;
+
+        if (alias != NULL && alias->expanding) {
+            // Cycle: the word stays literal (alias ls='ls -F')
+            if (alias != exp->root) {
+                exp->blocked = 1;
+            }
+            alias = NULL;
+        }
+
+        if (alias == NULL) {
+            i += word_len;
+            command_pos = 0;
+            continue;
+        }
+
+        if (expansion_append(exp, text + flushed, i - flushed) != 0 ||
+            expand_one_alias(exp, alias, &command_pos) != 0) {
+            return -1;
+        }
+        exp->expanded = 1;
+        i += word_len;
+        flushed = i;
+    }
+
+    *ends_in_command_pos = command_pos;
+
+    // At the top level nothing needs copying unless something was expanded
+    if (exp->root == NULL && !exp->expanded) {
+        return 0;
     }
+    return expansion_append(exp, text + flushed, len - flushed);
 }
 
 char *expand_alias(const char *command) {
-    if (command == NULL) {
+    if (command == NULL || alias_table.count == 0) {
         return NULL;
     }
-    
-    // Extract first word (command name)
-    char cmd_name[MAX_ALIAS_NAME];
-    const char *ptr = command;
-    int i = 0;
-    
-    // Skip leading whitespace
-    while (*ptr == ' ' || *ptr == '\t') ptr++;
-    
-    // Extract command name
-    while (*ptr && *ptr != ' ' && *ptr != '\t' && i < MAX_ALIAS_NAME - 1) {
-        cmd_name[i++] = *ptr++;
-    }
-    cmd_name[i] = '\0';
-    
-    if (i == 0) {
-        return NULL;  // Empty command
-    }
-    
-    // Check if this is an alias
-    const char *alias_value = get_alias(cmd_name);
-    if (alias_value == NULL) {
-        return NULL;  // Not an alias
-    }
-    
-    // Build expanded command
-    size_t alias_len = strlen(alias_value);
-    size_t rest_len = strlen(ptr);
-    size_t total_len = alias_len + rest_len + 1;
-    
-    char *expanded = malloc(total_len);
-    if (expanded == NULL) {
+
+    AliasExpansion exp = {0};
+    int ends_in_command_pos;
+
+    if (expand_text(&exp, command, strlen(command), 1, &ends_in_command_pos) != 0 || !exp.expanded) {
+        free(exp.data);
         return NULL;
     }
-    
-    strcpy(expanded, alias_value);
-    strcat(expanded, ptr);
-    
-    return expanded;
+
+    return exp.data;
 }
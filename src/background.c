@@ -0,0 +1,162 @@
+#include "../include/common.h"
+#include "../include/background.h"
+#include <errno.h>
+#include <poll.h>
+#include <spawn.h>
+
+/* Output buffer of a spawned command, before it has to grow */
+#define SPAWN_OUTPUT_INITIAL 4096
+
+long long monotonic_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+int background_task_init(BackgroundTask *task) {
+    if (pipe(task->notify) != 0) {
+        perror("pipe");
+        return -1;
+    }
+    fcntl(task->notify[0], F_SETFD, FD_CLOEXEC);
+    fcntl(task->notify[1], F_SETFD, FD_CLOEXEC);
+    pthread_mutex_init(&task->lock, NULL);
+    atomic_init(&task->cancelled, 0);
+    task->refs = 1;
+    task->done = 0;
+    return 0;
+}
+
+int background_task_start(BackgroundTask *task, void *(*worker)(void *), void *arg) {
+    pthread_mutex_lock(&task->lock);
+    task->refs++;
+    pthread_mutex_unlock(&task->lock);
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int status = pthread_create(&thread, &attr, worker, arg) == 0 ? 0 : -1;
+    pthread_attr_destroy(&attr);
+
+    if (status != 0) {
+        // The worker's reference goes with it
+        pthread_mutex_lock(&task->lock);
+        task->refs--;
+        pthread_mutex_unlock(&task->lock);
+    }
+    return status;
+}
+
+void background_task_finish(BackgroundTask *task) {
+    pthread_mutex_lock(&task->lock);
+    task->done = 1;
+    pthread_mutex_unlock(&task->lock);
+
+    ssize_t written;
+    do {
+        written = write(task->notify[1], "", 1);
+    } while (written == -1 && errno == EINTR);
+}
+
+int background_task_done(BackgroundTask *task) {
+    pthread_mutex_lock(&task->lock);
+    int done = task->done;
+    pthread_mutex_unlock(&task->lock);
+    return done;
+}
+
+int background_task_release(BackgroundTask *task) {
+    pthread_mutex_lock(&task->lock);
+    int last = --task->refs == 0;
+    pthread_mutex_unlock(&task->lock);
+    if (!last) {
+        return 0;
+    }
+
+    pthread_mutex_destroy(&task->lock);
+    close(task->notify[0]);
+    close(task->notify[1]);
+    return 1;
+}
+
+char *background_spawn_read(char *const argv[], char *const envp[], size_t max_output, long long deadline,
+                            atomic_int *cancelled, size_t *output_len, int *complete) {
+    size_t capacity = max_output < SPAWN_OUTPUT_INITIAL ? max_output : SPAWN_OUTPUT_INITIAL;
+    char *output = malloc(capacity);
+    int fds[2];
+    if (output == NULL || pipe(fds) != 0) {
+        free(output);
+        return NULL;
+    }
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+
+    // In a process group of its own, so that killing it reaches whatever
+    // the command started as well
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+    posix_spawnattr_setpgroup(&attr, 0);
+
+    pid_t pid;
+    int spawn_error = posix_spawn(&pid, argv[0], &actions, &attr, argv, envp);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    close(fds[1]);
+    if (spawn_error != 0) {
+        close(fds[0]);
+        free(output);
+        return NULL;
+    }
+
+    size_t len = 0;
+    int killed = 0;
+    while (1) {
+        long long left = deadline - monotonic_ms();
+        if ((len == capacity && capacity >= max_output) || left <= 0 || atomic_load(cancelled)) {
+            killed = 1;
+            break;
+        }
+
+        struct pollfd pfd = {fds[0], POLLIN, 0};
+        if (poll(&pfd, 1, left < CANCEL_CHECK_MS ? (int)left : CANCEL_CHECK_MS) <= 0) {
+            continue;
+        }
+        if (len == capacity) {
+            size_t new_capacity = capacity * 2 < max_output ? capacity * 2 : max_output;
+            char *new_output = realloc(output, new_capacity);
+            if (new_output == NULL) {
+                killed = 1;
+                break;
+            }
+            output = new_output;
+            capacity = new_capacity;
+        }
+        ssize_t n = read(fds[0], output + len, capacity - len);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        len += (size_t)n;
+    }
+    close(fds[0]);
+    if (killed) {
+        kill(-pid, SIGKILL);
+    }
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR) {
+    }
+    *complete = !killed && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    *output_len = len;
+    return output;
+}
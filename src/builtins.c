@@ -3,6 +3,20 @@
 #include "../include/variables.h"
 #include "../include/aliases.h"
 #include "../include/history.h"
+#include "../include/history_meta.h"
+#include "../include/script.h"
+#include "../include/completion_spec.h"
+#include "../include/output.h"
+#include "../include/hashtable.h"
+#include "../include/plugin.h"
+#include <errno.h>
+#include <poll.h>
+#ifdef __linux__
+#include <sys/timerfd.h>
+#endif
+
+/* Paths whose stat results one test expression keeps */
+#define TEST_STAT_CACHE 4
 
 // Built-in command types
 typedef enum {
@@ -17,64 +31,244 @@ typedef enum {
     BUILTIN_UNALIAS,
     BUILTIN_HISTORY,
     BUILTIN_HELP,
-    BUILTIN_UNKNOWN
+    BUILTIN_DECLARE,
+    BUILTIN_SOURCE,
+    BUILTIN_DOT,
+    BUILTIN_COMPLETE,
+    BUILTIN_TEST,
+    BUILTIN_BRACKET,
+    BUILTIN_PRINTF,
+    BUILTIN_TRUE,
+    BUILTIN_FALSE,
+    BUILTIN_COLON,
+    BUILTIN_SLEEP,
+    BUILTIN_ENABLE,
+    BUILTIN_COUNT
 } BuiltinType;
 
-// Built-in command table
-typedef struct {
-    const char *name;
-    BuiltinType type;
-    int (*func)(char **args);
-    int must_run_in_parent;  // 1 if must run in parent, 0 if can run in child
-} Builtin;
-
-static Builtin builtins[] = {
-    {"cd", BUILTIN_CD, builtin_cd, 1},
+// Built-in command table, in BuiltinType order
+static const Builtin builtins[BUILTIN_COUNT] = {
+    {"cd", BUILTIN_CD, builtin_cd, BUILTIN_RUN_IN_PARENT},
     {"pwd", BUILTIN_PWD, builtin_pwd, 0},
     {"echo", BUILTIN_ECHO, builtin_echo, 0},
-    {"exit", BUILTIN_EXIT, builtin_exit, 1},
-    {"set", BUILTIN_SET, builtin_set, 1},
-    {"export", BUILTIN_EXPORT, builtin_export, 1},
-    {"unset", BUILTIN_UNSET, builtin_unset, 1},
-    {"alias", BUILTIN_ALIAS, builtin_alias, 1},
-    {"unalias", BUILTIN_UNALIAS, builtin_unalias, 1},
-    {"history", BUILTIN_HISTORY, builtin_history, 1},
+    {"exit", BUILTIN_EXIT, builtin_exit, BUILTIN_RUN_IN_PARENT},
+    {"set", BUILTIN_SET, builtin_set, BUILTIN_RUN_IN_PARENT},
+    {"export", BUILTIN_EXPORT, builtin_export, BUILTIN_RUN_IN_PARENT},
+    {"unset", BUILTIN_UNSET, builtin_unset, BUILTIN_RUN_IN_PARENT},
+    {"alias", BUILTIN_ALIAS, builtin_alias, BUILTIN_RUN_IN_PARENT},
+    {"unalias", BUILTIN_UNALIAS, builtin_unalias, BUILTIN_RUN_IN_PARENT},
+    {"history", BUILTIN_HISTORY, builtin_history, BUILTIN_RUN_IN_PARENT},
     {"help", BUILTIN_HELP, builtin_help, 0},
-    {NULL, BUILTIN_UNKNOWN, NULL, 0}  // Sentinel
+    {"declare", BUILTIN_DECLARE, builtin_declare, BUILTIN_RUN_IN_PARENT},
+    {"source", BUILTIN_SOURCE, builtin_source, BUILTIN_RUN_IN_PARENT},
+    {".", BUILTIN_DOT, builtin_source, BUILTIN_RUN_IN_PARENT},
+    {"complete", BUILTIN_COMPLETE, builtin_complete, BUILTIN_RUN_IN_PARENT},
+    {"test", BUILTIN_TEST, builtin_test, BUILTIN_FORKLESS},
+    {"[", BUILTIN_BRACKET, builtin_test, BUILTIN_FORKLESS},
+    {"printf", BUILTIN_PRINTF, builtin_printf, BUILTIN_FORKLESS},
+    {"true", BUILTIN_TRUE, builtin_true, BUILTIN_FORKLESS},
+    {"false", BUILTIN_FALSE, builtin_false, BUILTIN_FORKLESS},
+    {":", BUILTIN_COLON, builtin_true, BUILTIN_FORKLESS},
+    {"sleep", BUILTIN_SLEEP, builtin_sleep, BUILTIN_FORKLESS},
+    {"enable", BUILTIN_ENABLE, builtin_enable, BUILTIN_RUN_IN_PARENT},
 };
 
-int is_builtin(const char *command) {
-    for (int i = 0; builtins[i].name != NULL; i++) {
-        if (strcmp(command, builtins[i].name) == 0) {
-            return 1;
+/*
+ * Perfect hash over the builtin names (gperf-style): a name's slot is its
+ * length plus the values of its first, second (NUL for one-character
+ * names) and last characters. The values were searched so that no two
+ * names share a slot; a name added to the table needs a free slot, and
+ * -Woverride-init reports two entries on one slot
+ */
+#define BUILTIN_HASH_SLOTS 46
+
+static const unsigned char asso_values[UCHAR_MAX + 1] = {
+    [':'] = 5, ['['] = 1, ['a'] = 7, ['c'] = 6, ['d'] = 1, ['e'] = 11,
+    ['f'] = 4, ['h'] = 5, ['l'] = 2, ['n'] = 15, ['p'] = 9, ['r'] = 4,
+    ['s'] = 2, ['t'] = 15, ['u'] = 9, ['w'] = 7, ['x'] = 10, ['y'] = 12,
+};
+
+// Slot -> BuiltinType + 1 (0: empty)
+static const unsigned char builtin_slots[BUILTIN_HASH_SLOTS] = {
+    [1] = BUILTIN_DOT + 1,
+    [3] = BUILTIN_BRACKET + 1,
+    [10] = BUILTIN_CD + 1,
+    [11] = BUILTIN_COLON + 1,
+    [16] = BUILTIN_ALIAS + 1,
+    [18] = BUILTIN_SLEEP + 1,
+    [19] = BUILTIN_SOURCE + 1,
+    [20] = BUILTIN_PWD + 1,
+    [21] = BUILTIN_ECHO + 1,
+    [23] = BUILTIN_PRINTF + 1,
+    [24] = BUILTIN_HISTORY + 1,
+    [25] = BUILTIN_COMPLETE + 1,
+    [27] = BUILTIN_FALSE + 1,
+    [29] = BUILTIN_HELP + 1,
+    [30] = BUILTIN_DECLARE + 1,
+    [31] = BUILTIN_SET + 1,
+    [33] = BUILTIN_UNALIAS + 1,
+    [34] = BUILTIN_TRUE + 1,
+    [40] = BUILTIN_EXIT + 1,
+    [42] = BUILTIN_EXPORT + 1,
+    [43] = BUILTIN_ENABLE + 1,
+    [44] = BUILTIN_UNSET + 1,
+    [45] = BUILTIN_TEST + 1,
+};
+
+/* Status of the last command, and the one the shell exits with */
+static int last_status = 0;
+static int exit_status = 0;
+
+/* Builtins registered at run time (from plugins): name -> const Builtin * */
+static HashTable registered_builtins;
+static int registered_initialized = 0;
+
+const char *get_builtin_name(int index) {
+    if (index < 0 || index >= BUILTIN_COUNT) {
+        return NULL;
+    }
+    return builtins[index].name;
+}
+
+const Builtin *find_builtin(const char *command) {
+    size_t len = strlen(command);
+    if (len == 0) {
+        return NULL;
+    }
+
+    size_t key = len + asso_values[(unsigned char)command[0]] + asso_values[(unsigned char)command[1]] +
+                 asso_values[(unsigned char)command[len - 1]];
+    if (key < BUILTIN_HASH_SLOTS && builtin_slots[key] != 0) {
+        const Builtin *builtin = &builtins[builtin_slots[key] - 1];
+        if (strcmp(command, builtin->name) == 0) {
+            return builtin;
         }
     }
-    return 0;
+    if (!registered_initialized || registered_builtins.count == 0) {
+        return NULL;
+    }
+    HashEntry *entry = ht_lookup(&registered_builtins, command, len);
+    return entry ? entry->value : NULL;
+}
+
+int run_builtin(const Builtin *builtin, char **args) {
+    if (builtin->type == BUILTIN_TYPE_PLUGIN) {
+        return run_plugin_builtin(builtin, args);
+    }
+    return builtin->func(args);
 }
 
-int must_run_in_parent(const char *command) {
-    for (int i = 0; builtins[i].name != NULL; i++) {
-        if (strcmp(command, builtins[i].name) == 0) {
-            return builtins[i].must_run_in_parent;
+int register_builtin(const Builtin *builtin) {
+    if (!registered_initialized) {
+        if (ht_init(&registered_builtins, 16) != 0) {
+            return -1;
         }
+        registered_initialized = 1;
+    }
+    if (find_builtin(builtin->name) != NULL) {
+        return -1;
     }
+    HashEntry *entry = ht_insert(&registered_builtins, builtin->name, strlen(builtin->name));
+    if (entry == NULL) {
+        return -1;
+    }
+    entry->value = (void *)builtin;
     return 0;
 }
 
-int execute_builtin(char **args) {
-    if (args[0] == NULL) {
-        return 0;  // Empty command
+const Builtin *unregister_builtin(const char *name) {
+    if (!registered_initialized) {
+        return NULL;
+    }
+    const Builtin *builtin = ht_remove(&registered_builtins, name, strlen(name));
+    if (registered_builtins.count == 0) {
+        ht_free(&registered_builtins, NULL);
+        registered_initialized = 0;
+    }
+    return builtin;
+}
+
+const Builtin *next_registered_builtin(size_t *pos) {
+    if (!registered_initialized) {
+        return NULL;
     }
+    HashEntry *entry = ht_next(&registered_builtins, pos);
+    return entry ? entry->value : NULL;
+}
 
-    // Find the builtin type
-    BuiltinType type = BUILTIN_UNKNOWN;
-    for (int i = 0; builtins[i].name != NULL; i++) {
-        if (strcmp(args[0], builtins[i].name) == 0) {
-            return builtins[i].func(args);
+int is_builtin(const char *command) {
+    return find_builtin(command) != NULL;
+}
+
+const char *get_current_directory(void) {
+    static int pwd_checked = 0;
+
+    // An inherited $PWD is trusted once it is known to name the current directory
+    const char *pwd = get_variable("PWD");
+    if (pwd != NULL && pwd[0] == '/') {
+        if (pwd_checked) {
+            return pwd;
+        }
+        struct stat pwd_st, dot_st;
+        if (stat(pwd, &pwd_st) == 0 && stat(".", &dot_st) == 0 &&
+            pwd_st.st_dev == dot_st.st_dev && pwd_st.st_ino == dot_st.st_ino) {
+            pwd_checked = 1;
+            return pwd;
         }
     }
-    
-    return 1;  // Not found (shouldn't happen if is_builtin was checked)
+
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == NULL || export_variable("PWD", cwd) != 0) {
+        return NULL;
+    }
+    pwd_checked = 1;
+    return get_variable("PWD");
+}
+
+/**
+ * Resolve path against the absolute directory base, removing "." and ".."
+ * components lexically (the logical view cd keeps in $PWD)
+ * Returns 0 on success, -1 if base is unknown or the result does not fit
+ */
+static int logical_path(const char *base, const char *path, char *out, size_t size) {
+    size_t len = 0;
+    if (path[0] != '/') {
+        if (base == NULL || base[0] != '/' || strlen(base) >= size) {
+            return -1;
+        }
+        len = strlen(base);
+        memcpy(out, base, len);
+        while (len > 0 && out[len - 1] == '/') {
+            len--;
+        }
+    }
+
+    const char *p = path;
+    while (*p) {
+        while (*p == '/') p++;
+        const char *end = p + strcspn(p, "/");
+        size_t part = (size_t)(end - p);
+        if (part == 0 || (part == 1 && p[0] == '.')) {
+            // Nothing to add
+        } else if (part == 2 && p[0] == '.' && p[1] == '.') {
+            while (len > 0 && out[len - 1] != '/') len--;
+            if (len > 0) len--;
+        } else {
+            if (len + 1 + part >= size) {
+                return -1;
+            }
+            out[len++] = '/';
+            memcpy(out + len, p, part);
+            len += part;
+        }
+        p = end;
+    }
+
+    if (len == 0) {
+        out[len++] = '/';
+    }
+    out[len] = '\0';
+    return 0;
 }
 
 int builtin_cd(char **args) {
@@ -82,7 +276,7 @@ int builtin_cd(char **args) {
     
     if (args[1] == NULL) {
         // No argument, go to home directory
-        path = getenv("HOME");
+        path = get_variable("HOME");
         if (path == NULL) {
             fprintf(stderr, "cd: HOME not set\n");
             return 1;
@@ -91,19 +285,43 @@ int builtin_cd(char **args) {
         path = args[1];
     }
     
+    // Follow the logical path from $PWD, so "cd .." leaves a symlinked
+    // directory the way it was entered and $PWD stays known without getcwd()
+    char target[PATH_MAX];
+    char old[PATH_MAX];
+    const char *cwd = get_current_directory();
+    snprintf(old, sizeof(old), "%s", cwd ? cwd : "");
+    if (logical_path(cwd, path, target, sizeof(target)) == 0 && chdir(target) == 0) {
+        if (old[0] != '\0') {
+            export_variable("OLDPWD", old);
+        }
+        export_variable("PWD", target);
+        return 0;
+    }
+
     if (chdir(path) != 0) {
         perror("cd");
         return 1;
     }
     
+    // The logical path is unusable: take the physical one
+    if (old[0] != '\0') {
+        export_variable("OLDPWD", old);
+    }
+    char physical[PATH_MAX];
+    if (getcwd(physical, sizeof(physical)) != NULL) {
+        export_variable("PWD", physical);
+    } else {
+        unset_variable("PWD");
+    }
     return 0;
 }
 
 int builtin_pwd(char **args) {
     (void)args;  // Unused parameter
     
-    char cwd[PATH_MAX];
-    if (getcwd(cwd, sizeof(cwd)) != NULL) {
+    const char *cwd = get_current_directory();
+    if (cwd != NULL) {
         printf("%s\n", cwd);
         return 0;
     }
@@ -124,10 +342,30 @@ int builtin_echo(char **args) {
 }
 
 int builtin_exit(char **args) {
-    (void)args;  // Unused parameter
+    if (args[1] != NULL) {
+        char *end;
+        errno = 0;
+        long status = strtol(args[1], &end, 10);
+        if (errno != 0 || end == args[1] || *end != '\0') {
+            fprintf(stderr, "exit: %s: numeric argument required\n\r", args[1]);
+            status = 2;
+        }
+        exit_status = (int)(status & 0xFF);
+    } else {
+        exit_status = last_status;
+    }
     return -1;  // Special return value to signal exit
 }
 
+void set_last_status(int status) {
+    last_status = status;
+    exit_status = status;
+}
+
+int get_exit_status(void) {
+    return exit_status;
+}
+
 int builtin_set(char **args) {
     // If no arguments, print all variables
     if (args[1] == NULL) {
@@ -201,9 +439,15 @@ int builtin_unset(char **args) {
         return 1;
     }
     
-    const char *name = args[1];
+    char *name = args[1];
+    char *bracket = strchr(name, '[');
     
-    if (unset_variable(name) != 0) {
+    if (bracket != NULL && name[strlen(name) - 1] == ']') {
+        // unset name[subscript] removes a single array element
+        name[strlen(name) - 1] = '\0';
+        *bracket = '\0';
+        unset_array_element(name, bracket + 1);
+    } else if (unset_variable(name) != 0) {
         // Not an error if variable doesn't exist
         // fprintf(stderr, "unset: variable '%s' not found\n\r", name);
     }
@@ -211,6 +455,85 @@ int builtin_unset(char **args) {
     return 0;
 }
 
+int builtin_source(char **args) {
+    if (args[1] == NULL) {
+        fprintf(stderr, "%s: usage: %s filename\n\r", args[0], args[0]);
+        return 1;
+    }
+    
+    return source_file(args[1]);
+}
+
+int builtin_declare(char **args) {
+    if (args[1] == NULL) {
+        print_variables();
+        return 0;
+    }
+    
+    int is_array = 0;
+    int is_assoc = 0;
+    int i = 1;
+    
+    // Options: -a (indexed array), -A (associative array)
+    for (; args[i] != NULL && args[i][0] == '-'; i++) {
+        for (const char *opt = args[i] + 1; *opt; opt++) {
+            if (*opt == 'a') {
+                is_array = 1;
+            } else if (*opt == 'A') {
+                is_assoc = 1;
+            } else {
+                fprintf(stderr, "declare: -%c: invalid option\n\r", *opt);
+                fprintf(stderr, "declare: usage: declare [-aA] [name[=value] ...]\n\r");
+                return 1;
+            }
+        }
+    }
+    
+    int status = 0;
+    while (args[i] != NULL) {
+        char *word = args[i];
+        size_t name_len = strcspn(word, "[+=");
+        char saved = word[name_len];
+        
+        if ((is_array || is_assoc) && name_len > 0) {
+            word[name_len] = '\0';
+            if (declare_array(word, is_assoc) != 0) {
+                status = 1;
+            }
+            word[name_len] = saved;
+        }
+        
+        if (strchr(word, '=') == NULL) {
+            // declare name: create the variable if it does not exist yet
+            if (!is_array && !is_assoc && get_variable(word) == NULL && set_variable(word, "") != 0) {
+                status = 1;
+            }
+            i++;
+            continue;
+        }
+        
+        // "name=(" extends up to the ")" word
+        int end = i + 1;
+        size_t len = strlen(word);
+        if (len >= 2 && strcmp(word + len - 2, "=(") == 0) {
+            while (args[end] != NULL && strcmp(args[end - 1], ")") != 0) {
+                end++;
+            }
+        }
+        
+        char *next = args[end];
+        args[end] = NULL;
+        if (execute_variable_assignment(args + i) != 0) {
+            fprintf(stderr, "declare: `%s': not a valid identifier\n\r", word);
+            status = 1;
+        }
+        args[end] = next;
+        i = end;
+    }
+    
+    return status;
+}
+
 int builtin_alias(char **args) {
     // If no arguments, print all aliases
     if (args[1] == NULL) {
@@ -227,18 +550,23 @@ int builtin_alias(char **args) {
         
         // Build full value from remaining arguments
         // This handles: alias ll='ls -la' which gets split into multiple args
-        char full_value[1024] = {0};
         const char *value_start = equals + 1;
+        size_t total = strlen(value_start) + 1;
+        for (int i = 2; args[i] != NULL; i++) {
+            total += strlen(args[i]) + 1;
+        }
         
-        // Copy first part after '='
-        strncpy(full_value, value_start, sizeof(full_value) - 1);
+        char *full_value = malloc(total);
+        if (full_value == NULL) {
+            perror("malloc");
+            return 1;
+        }
         
-        // Append remaining arguments with spaces
+        // Copy first part after '=', then the remaining arguments with spaces
+        char *end_ptr = stpcpy(full_value, value_start);
         for (int i = 2; args[i] != NULL; i++) {
-            if (strlen(full_value) + strlen(args[i]) + 2 < sizeof(full_value)) {
-                strcat(full_value, " ");
-                strcat(full_value, args[i]);
-            }
+            *end_ptr++ = ' ';
+            end_ptr = stpcpy(end_ptr, args[i]);
         }
         
         // Remove quotes if present
@@ -252,7 +580,10 @@ int builtin_alias(char **args) {
             }
         }
         
-        if (set_alias(name, value) != 0) {
+        int result = set_alias(name, value);
+        free(full_value);
+        
+        if (result != 0) {
             fprintf(stderr, "alias: failed to set alias '%s'\n\r", name);
             return 1;
         }
@@ -289,8 +620,17 @@ int builtin_unalias(char **args) {
 }
 
 int builtin_history(char **args) {
-    (void)args;  // Unused parameter
-    
+    // history -n: read entries other sessions appended since we last looked
+    if (args[1] != NULL && strcmp(args[1], "-n") == 0) {
+        read_new_history();
+        return 0;
+    }
+
+    // history --since 1w --failed ...: query the metadata store
+    if (args[1] != NULL && strncmp(args[1], "--", 2) == 0) {
+        return query_history_meta(args);
+    }
+
     int count = get_history_count();
     
     if (count == 0) {
@@ -314,70 +654,138 @@ int builtin_help(char **args) {
         // Help for specific command
         const char *cmd = args[1];
 
-        int cmd_index = -1;
-        for (int i = 0; builtins[i].name != NULL; i++) {
-            if (strcmp(cmd, builtins[i].name) == 0) {
-                cmd_index = i;
-                break;
-            }
+        const Builtin *builtin = find_builtin(cmd);
+        if (builtin && builtin->type == BUILTIN_TYPE_PLUGIN) {
+            const char *usage = plugin_builtin_usage(builtin);
+            printf("%s\n\r", usage ? usage : cmd);
+            printf("  Loaded from %s (enable -d %s unloads it).\n\r", plugin_builtin_path(builtin), cmd);
+            return 0;
         }
-        
-        switch (cmd_index) {
-            case 0: // cd
+        switch (builtin ? builtin->type : BUILTIN_COUNT) {
+            case BUILTIN_CD: // cd
                 printf("cd: cd [directory]\n\r");
                 printf("  Change the current directory.\n\r");
                 printf("  If no directory is specified, changes to HOME directory.\n\r");
                 break;
-            case 1: // pwd
+            case BUILTIN_PWD: // pwd
                 printf("pwd: pwd\n\r");
                 printf("  Print the current working directory.\n\r");
                 break;
-            case 2: // echo
+            case BUILTIN_ECHO: // echo
                 printf("echo: echo [args...]\n\r");
                 printf("  Print arguments to standard output.\n\r");
                 printf("  Variables can be expanded using $VAR syntax.\n\r");
                 break;
-            case 3: // exit
-                printf("exit: exit\n\r");
-                printf("  Exit the shell.\n\r");
+            case BUILTIN_EXIT: // exit
+                printf("exit: exit [n]\n\r");
+                printf("  Exit the shell with status n (default: that of the last command).\n\r");
                 break;
-            case 4: // set
+            case BUILTIN_SET: // set
                 printf("set: set [VAR=value | VAR value]\n\r");
                 printf("  Set a shell variable (not exported to environment).\n\r");
                 printf("  Without arguments, displays all shell variables.\n\r");
                 printf("  Alternative: VAR=value (direct assignment)\n\r");
                 break;
-            case 5: // export
+            case BUILTIN_EXPORT: // export
                 printf("export: export VAR[=value]\n\r");
                 printf("  Export a variable to the environment.\n\r");
                 printf("  - export VAR=value: Create and export variable\n\r");
                 printf("  - export VAR: Export existing shell variable\n\r");
                 break;
-            case 6: // unset
+            case BUILTIN_UNSET: // unset
                 printf("unset: unset VAR\n\r");
                 printf("  Remove a variable from both shell and environment.\n\r");
                 break;
-            case 7: // alias
+            case BUILTIN_ALIAS: // alias
                 printf("alias: alias [name[=value]]\n\r");
                 printf("  Define or display aliases.\n\r");
                 printf("  - alias: Display all aliases\n\r");
                 printf("  - alias name: Display specific alias\n\r");
                 printf("  - alias name='value': Create or update alias\n\r");
                 break;
-            case 8: // unalias
+            case BUILTIN_UNALIAS: // unalias
                 printf("unalias: unalias name\n\r");
                 printf("  Remove an alias.\n\r");
                 break;
-            case 9: // history
+            case BUILTIN_HISTORY: // history
                 printf("history: history\n\r");
                 printf("  Display command history.\n\r");
                 printf("  Use UP/DOWN arrow keys to navigate history.\n\r");
+                printf("  history -n reads entries added by other shells since the last command.\n\r");
+                printf("  Query recorded runs (time, duration, exit status, directory):\n\r");
+                printf("    --since AGE / --until AGE  started within / before AGE ago (30m, 2h, 1w)\n\r");
+                printf("    --cwd DIR                  run in DIR or below it\n\r");
+                printf("    --failed, --status N       non-zero / exact exit status\n\r");
+                printf("    --slower DURATION          ran at least DURATION (500ms, 2s)\n\r");
+                printf("    --grep TEXT, --session     command contains TEXT / this shell only\n\r");
+                printf("    --sort time|duration, --limit N, --stats (per-command totals)\n\r");
+                printf("  Example: history --since 1w --sort duration --limit 10\n\r");
                 break;
-            case 10: // help
+            case BUILTIN_HELP: // help
                 printf("help: help [command]\n\r");
                 printf("  Display help information about builtin commands.\n\r");
                 printf("  Without arguments, lists all available commands.\n\r");
                 break;
+            case BUILTIN_DECLARE: // declare
+                printf("declare: declare [-aA] [name[=value] ...]\n\r");
+                printf("  Declare variables and give them values.\n\r");
+                printf("  - declare -a name: Make name an indexed array\n\r");
+                printf("  - declare -A name: Make name an associative array\n\r");
+                printf("  Without arguments, displays all shell variables.\n\r");
+                break;
+            case BUILTIN_SOURCE: // source
+            case BUILTIN_DOT: // .
+                printf("source: source filename\n\r");
+                printf("  Execute commands from a file in the current shell.\n\r");
+                printf("  Also available as: . filename\n\r");
+                printf("  The parsed script is cached in ~/.cache/kord-sh until the file changes.\n\r");
+                break;
+            case BUILTIN_COMPLETE: // complete
+                printf("complete: complete [-W words] [-C command] name ...\n\r");
+                printf("  Specify how the arguments of commands are completed with Tab.\n\r");
+                printf("  - -W 'a b c': Complete from a word list\n\r");
+                printf("  - -C command: Complete from the output lines of command, run as\n\r");
+                printf("    command NAME WORD PREVIOUS with COMP_LINE and COMP_POINT set;\n\r");
+                printf("    output is reused for $COMPLETION_CACHE_TTL seconds (default 60)\n\r");
+                printf("  - complete -p [name ...]: Display specs\n\r");
+                printf("  - complete -r [name ...]: Remove specs (all without names)\n\r");
+                break;
+            case BUILTIN_TEST: // test
+            case BUILTIN_BRACKET: // [
+                printf("test: test expression | [ expression ]\n\r");
+                printf("  Evaluate a conditional expression: exit status 0 if true, 1 if false.\n\r");
+                printf("  - Files: -e -f -d -L -s -r -w -x -b -c -p -S, a -nt b, a -ot b, a -ef b\n\r");
+                printf("  - Strings: -z s, -n s, a = b, a != b, a < b, a > b\n\r");
+                printf("  - Integers: a -eq b (also -ne -lt -le -gt -ge)\n\r");
+                printf("  - Combined with ! ( ) -a -o\n\r");
+                break;
+            case BUILTIN_PRINTF: // printf
+                printf("printf: printf format [arguments]\n\r");
+                printf("  Print arguments under control of format (%%s %%b %%c %%d %%i %%o %%u %%x %%X\n\r");
+                printf("  %%e %%f %%g, with flags, width and precision); the format is reused\n\r");
+                printf("  while arguments remain.\n\r");
+                break;
+            case BUILTIN_TRUE: // true
+            case BUILTIN_COLON: // :
+                printf("true: true | :\n\r");
+                printf("  Do nothing, successfully.\n\r");
+                break;
+            case BUILTIN_FALSE: // false
+                printf("false: false\n\r");
+                printf("  Do nothing, unsuccessfully.\n\r");
+                break;
+            case BUILTIN_SLEEP: // sleep
+                printf("sleep: sleep number[smhd] ...\n\r");
+                printf("  Wait for the total time given (seconds by default, fractions allowed).\n\r");
+                printf("  Ctrl+C interrupts it.\n\r");
+                break;
+            case BUILTIN_ENABLE: // enable
+                printf("enable: enable [-p] | enable -f file name ... | enable -d name ...\n\r");
+                printf("  Load builtins from a shared object (see include/kord_plugin.h).\n\r");
+                printf("  - -f file name: Load name from the symbol name_kord_builtin in file\n\r");
+                printf("  - -d name: Unload a builtin loaded with -f\n\r");
+                printf("  - -p or no options: List the builtins\n\r");
+                break;
             default:
                 printf("help: no help topics match '%s'\n\r", cmd);
                 return 1;
@@ -399,10 +807,22 @@ int builtin_help(char **args) {
         printf("  unalias name      - Remove alias\n\r");
         printf("  history           - Display command history\n\r");
         printf("  help [command]    - Display this help\n\r");
+        printf("  declare [-aA] name- Declare variables and arrays\n\r");
+        printf("  source file       - Run a script in this shell (also: . file)\n\r");
+        printf("  complete [-WC] name- Define argument completion for commands\n\r");
+        printf("  test expr / [ expr ]- Evaluate a conditional expression\n\r");
+        printf("  printf fmt [args] - Formatted output\n\r");
+        printf("  true / false / :  - Succeed / fail / do nothing\n\r");
+        printf("  sleep seconds     - Wait (Ctrl+C interrupts)\n\r");
+        printf("  enable -f lib name- Load a builtin from a shared object\n\r");
         printf("\n\r");
         printf("Variable Assignment:\n\r");
         printf("  VAR=value         - Set shell variable directly\n\r");
         printf("  $VAR              - Expand variable value\n\r");
+        printf("  ${VAR:-default}   - Default value (also :=, :+, :?)\n\r");
+        printf("  ${VAR#pat} ${VAR%%pat} ${VAR/pat/rep} ${VAR:off:len} ${#VAR}\n\r");
+        printf("  arr=(a b c)       - Indexed array; ${arr[1]} ${arr[@]} ${#arr[@]}\n\r");
+        printf("  declare -A map    - Associative array; map[key]=value ${!map[@]}\n\r");
         printf("\n\r");
         printf("Features:\n\r");
         printf("  - Pipes: command1 | command2\n\r");
@@ -417,3 +837,633 @@ int builtin_help(char **args) {
     
     return 0;
 }
+
+int builtin_complete(char **args) {
+    const char *words = NULL;
+    const char *generator = NULL;
+    int print = 0;
+    int remove = 0;
+
+    int i = 1;
+    for (; args[i] != NULL && args[i][0] == '-'; i++) {
+        if (strcmp(args[i], "--") == 0) {
+            i++;
+            break;
+        } else if (strcmp(args[i], "-p") == 0) {
+            print = 1;
+        } else if (strcmp(args[i], "-r") == 0) {
+            remove = 1;
+        } else if (strcmp(args[i], "-W") == 0 && args[i + 1] != NULL) {
+            words = args[++i];
+        } else if (strcmp(args[i], "-C") == 0 && args[i + 1] != NULL) {
+            generator = args[++i];
+        } else if (strcmp(args[i], "-F") == 0) {
+            fprintf(stderr, "complete: -F: shell functions are not supported, use -C command\n\r");
+            return 1;
+        } else {
+            fprintf(stderr, "complete: usage: complete [-W words] [-C command] name ... | -p [name ...] | -r [name ...]\n\r");
+            return 1;
+        }
+    }
+
+    // Without a spec to define, list (or remove) specs
+    if (remove || print || (words == NULL && generator == NULL)) {
+        if (args[i] == NULL) {
+            if (remove) {
+                cleanup_completion_specs();
+                return 0;
+            }
+            return print_completion_specs(NULL) == 0 ? 0 : 1;
+        }
+
+        int status = 0;
+        for (; args[i] != NULL; i++) {
+            int result = remove ? remove_completion_spec(args[i]) : print_completion_specs(args[i]);
+            if (result != 0) {
+                fprintf(stderr, "complete: %s: no completion specification\n\r", args[i]);
+                status = 1;
+            }
+        }
+        return status;
+    }
+
+    if (args[i] == NULL) {
+        fprintf(stderr, "complete: usage: complete [-W words] [-C command] name ...\n\r");
+        return 1;
+    }
+    for (; args[i] != NULL; i++) {
+        if (set_completion_spec(args[i], words, generator) != 0) {
+            fprintf(stderr, "complete: failed to set completion for '%s'\n\r", args[i]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int builtin_true(char **args) {
+    (void)args;
+    return 0;
+}
+
+int builtin_false(char **args) {
+    (void)args;
+    return 1;
+}
+
+/* A test expression being evaluated */
+typedef struct {
+    char **args;
+    int count;
+    int pos;
+    int error;                       // syntax error seen: exit status 2
+    const char *name;                // "test" or "["
+    struct {
+        const char *path;
+        int follow;                  // stat() rather than lstat()
+        int result;
+        struct stat st;
+    } stats[TEST_STAT_CACHE];        // paths looked up by this expression
+    int stat_count;
+} TestExpr;
+
+static void test_error(TestExpr *e, const char *arg, const char *message) {
+    if (!e->error) {
+        if (arg) {
+            fprintf(stderr, "%s: %s: %s\n\r", e->name, arg, message);
+        } else {
+            fprintf(stderr, "%s: %s\n\r", e->name, message);
+        }
+    }
+    e->error = 1;
+}
+
+/**
+ * fstatat() a path, reusing the result if the expression already looked
+ * it up (as in "[ -e f -a ! -L f -a -s f ]")
+ * Returns the stat buffer, or NULL if the path does not exist
+ */
+static const struct stat *test_stat(TestExpr *e, const char *path, int follow) {
+    for (int i = 0; i < e->stat_count && i < TEST_STAT_CACHE; i++) {
+        if (e->stats[i].follow == follow && strcmp(e->stats[i].path, path) == 0) {
+            return e->stats[i].result == 0 ? &e->stats[i].st : NULL;
+        }
+    }
+    int slot = e->stat_count++ % TEST_STAT_CACHE;
+    e->stats[slot].path = path;
+    e->stats[slot].follow = follow;
+    e->stats[slot].result = fstatat(AT_FDCWD, path, &e->stats[slot].st, follow ? 0 : AT_SYMLINK_NOFOLLOW);
+    return e->stats[slot].result == 0 ? &e->stats[slot].st : NULL;
+}
+
+static int is_unary_op(const char *s) {
+    return s[0] == '-' && s[1] != '\0' && s[2] == '\0' && strchr("bcdefghknprstuwxzGLOS", s[1]) != NULL;
+}
+
+static int is_binary_op(const char *s) {
+    static const char *const ops[] = {"=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt",
+                                      "-ge", "-nt", "-ot", "-ef", NULL};
+    for (int i = 0; ops[i] != NULL; i++) {
+        if (strcmp(s, ops[i]) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static long long test_integer(TestExpr *e, const char *s) {
+    char *end;
+    errno = 0;
+    long long value = strtoll(s, &end, 10);
+    while (isspace((unsigned char)*end)) {
+        end++;
+    }
+    if (end == s || *end != '\0' || errno == ERANGE) {
+        test_error(e, s, "integer expression expected");
+    }
+    return value;
+}
+
+static int test_unary(TestExpr *e, char op, const char *arg) {
+    const struct stat *st;
+    switch (op) {
+        case 'z': return arg[0] == '\0';
+        case 'n': return arg[0] != '\0';
+        case 't': return isatty((int)test_integer(e, arg));
+        case 'L':
+        case 'h':
+            st = test_stat(e, arg, 0);
+            return st && S_ISLNK(st->st_mode);
+        case 'r': return faccessat(AT_FDCWD, arg, R_OK, AT_EACCESS) == 0;
+        case 'w': return faccessat(AT_FDCWD, arg, W_OK, AT_EACCESS) == 0;
+        case 'x': return faccessat(AT_FDCWD, arg, X_OK, AT_EACCESS) == 0;
+    }
+
+    st = test_stat(e, arg, 1);
+    if (st == NULL) {
+        return 0;
+    }
+    switch (op) {
+        case 'e': return 1;
+        case 'f': return S_ISREG(st->st_mode);
+        case 'd': return S_ISDIR(st->st_mode);
+        case 'b': return S_ISBLK(st->st_mode);
+        case 'c': return S_ISCHR(st->st_mode);
+        case 'p': return S_ISFIFO(st->st_mode);
+        case 'S': return S_ISSOCK(st->st_mode);
+        case 's': return st->st_size > 0;
+        case 'g': return (st->st_mode & S_ISGID) != 0;
+        case 'u': return (st->st_mode & S_ISUID) != 0;
+        case 'k': return (st->st_mode & S_ISVTX) != 0;
+        case 'O': return st->st_uid == geteuid();
+        case 'G': return st->st_gid == getegid();
+    }
+    return 0;
+}
+
+static int newer_than(const struct stat *a, const struct stat *b) {
+    if (a->st_mtim.tv_sec != b->st_mtim.tv_sec) {
+        return a->st_mtim.tv_sec > b->st_mtim.tv_sec;
+    }
+    return a->st_mtim.tv_nsec > b->st_mtim.tv_nsec;
+}
+
+static int test_binary(TestExpr *e, const char *left, const char *op, const char *right) {
+    if (op[0] != '-') {
+        int cmp = strcmp(left, right);
+        if (strcmp(op, "!=") == 0) return cmp != 0;
+        if (op[0] == '<') return cmp < 0;
+        if (op[0] == '>') return cmp > 0;
+        return cmp == 0;
+    }
+    if (op[1] == 'a') return left[0] != '\0' && right[0] != '\0';
+    if (op[1] == 'o') return left[0] != '\0' || right[0] != '\0';
+
+    if (strcmp(op, "-nt") == 0 || strcmp(op, "-ot") == 0 || strcmp(op, "-ef") == 0) {
+        const struct stat *a = test_stat(e, left, 1);
+        const struct stat *b = test_stat(e, right, 1);
+        if (op[1] == 'e') return a && b && a->st_dev == b->st_dev && a->st_ino == b->st_ino;
+        if (op[1] == 'n') return a && (!b || newer_than(a, b));
+        return b && (!a || newer_than(b, a));
+    }
+
+    long long a = test_integer(e, left);
+    long long b = test_integer(e, right);
+    if (strcmp(op, "-eq") == 0) return a == b;
+    if (strcmp(op, "-ne") == 0) return a != b;
+    if (strcmp(op, "-lt") == 0) return a < b;
+    if (strcmp(op, "-le") == 0) return a <= b;
+    if (strcmp(op, "-gt") == 0) return a > b;
+    return a >= b;
+}
+
+static int test_or(TestExpr *e);
+
+static int test_primary(TestExpr *e) {
+    if (e->pos >= e->count) {
+        test_error(e, NULL, "argument expected");
+        return 0;
+    }
+    char **args = e->args + e->pos;
+    int left = e->count - e->pos;
+
+    if (left >= 3 && is_binary_op(args[1])) {
+        e->pos += 3;
+        return test_binary(e, args[0], args[1], args[2]);
+    }
+    if (strcmp(args[0], "(") == 0) {
+        e->pos++;
+        int value = test_or(e);
+        if (e->pos >= e->count || strcmp(e->args[e->pos], ")") != 0) {
+            test_error(e, NULL, "`)' expected");
+            return 0;
+        }
+        e->pos++;
+        return value;
+    }
+    if (left >= 2 && is_unary_op(args[0])) {
+        e->pos += 2;
+        return test_unary(e, args[0][1], args[1]);
+    }
+    e->pos++;
+    return args[0][0] != '\0';
+}
+
+static int test_not(TestExpr *e) {
+    if (e->pos + 1 < e->count && strcmp(e->args[e->pos], "!") == 0) {
+        e->pos++;
+        return !test_not(e);
+    }
+    return test_primary(e);
+}
+
+static int test_and(TestExpr *e) {
+    int value = test_not(e);
+    while (e->pos < e->count && strcmp(e->args[e->pos], "-a") == 0) {
+        e->pos++;
+        int right = test_not(e);
+        value = value && right;
+    }
+    return value;
+}
+
+static int test_or(TestExpr *e) {
+    int value = test_and(e);
+    while (e->pos < e->count && strcmp(e->args[e->pos], "-o") == 0) {
+        e->pos++;
+        int right = test_and(e);
+        value = value || right;
+    }
+    return value;
+}
+
+int builtin_test(char **args) {
+    TestExpr e = {0};
+    e.name = args[0];
+    e.args = args + 1;
+    while (e.args[e.count] != NULL) {
+        e.count++;
+    }
+    if (strcmp(args[0], "[") == 0) {
+        if (e.count == 0 || strcmp(e.args[e.count - 1], "]") != 0) {
+            fprintf(stderr, "[: missing `]'\n\r");
+            return 2;
+        }
+        e.count--;
+    }
+
+    // The POSIX rules by argument count, then the full grammar
+    int value;
+    char **a = e.args;
+    if (e.count == 0) {
+        return 1;
+    } else if (e.count == 1) {
+        value = a[0][0] != '\0';
+    } else if (e.count == 2 && strcmp(a[0], "!") == 0) {
+        value = a[1][0] == '\0';
+    } else if (e.count == 2) {
+        if (!is_unary_op(a[0])) {
+            test_error(&e, a[0], "unary operator expected");
+            return 2;
+        }
+        value = test_unary(&e, a[0][1], a[1]);
+    } else if (e.count == 3 && (is_binary_op(a[1]) || strcmp(a[1], "-a") == 0 || strcmp(a[1], "-o") == 0)) {
+        value = test_binary(&e, a[0], a[1], a[2]);
+    } else {
+        value = test_or(&e);
+        if (e.pos < e.count) {
+            test_error(&e, e.args[e.pos], "too many arguments");
+        }
+    }
+    return e.error ? 2 : !value;
+}
+
+/**
+ * Decode the backslash escape at s (just past the backslash) into *c;
+ * in_argument selects %b rules (\0nnn octal, \c)
+ * Returns the number of bytes consumed, or 0 for \c (stop all output)
+ */
+static size_t decode_escape(const char *s, char *c, int in_argument) {
+    static const char letters[] = "\\\\a\ab\bf\fn\nr\rt\tv\v\"\"";
+    for (size_t i = 0; letters[i] != '\0'; i += 2) {
+        if (*s == letters[i]) {
+            *c = letters[i + 1];
+            return 1;
+        }
+    }
+    if (in_argument && *s == 'c') {
+        return 0;
+    }
+
+    size_t used = 0;
+    int value = 0;
+    if (*s >= '0' && *s <= '7') {
+        // %b takes \0nnn, the format \nnn
+        size_t start = in_argument && *s == '0' ? 1 : 0;
+        used = start;
+        while (used < start + 3 && s[used] >= '0' && s[used] <= '7') {
+            value = value * 8 + (s[used++] - '0');
+        }
+    } else if (*s == 'x' && isxdigit((unsigned char)s[1])) {
+        used = 1;
+        while (used < 3 && isxdigit((unsigned char)s[used])) {
+            char digit = (char)tolower((unsigned char)s[used++]);
+            value = value * 16 + (isdigit((unsigned char)digit) ? digit - '0' : digit - 'a' + 10);
+        }
+    } else {
+        // Unknown escape: the backslash stands for itself
+        *c = '\\';
+        return (size_t)-1;
+    }
+    *c = (char)value;
+    return used;
+}
+
+/**
+ * Append text with its backslash escapes decoded
+ * Returns 0, or -1 if \c stopped output (in_argument only)
+ */
+static int append_escaped(OutputBuffer *out, const char *text, size_t len, int in_argument) {
+    size_t i = 0;
+    while (i < len) {
+        size_t plain = i;
+        while (i < len && text[i] != '\\') {
+            i++;
+        }
+        output_append(out, text + plain, i - plain);
+        if (i + 1 >= len) {
+            output_append(out, text + i, len - i);
+            break;
+        }
+
+        char c;
+        size_t used = decode_escape(text + i + 1, &c, in_argument);
+        if (used == 0) {
+            return -1;
+        }
+        output_append(out, &c, 1);
+        i += used == (size_t)-1 ? 1 : used + 1;
+    }
+    return 0;
+}
+
+/**
+ * Numeric argument of printf: a number (decimal, 0x hex or 0 octal), or
+ * 'c / "c for the character's code
+ */
+static long long printf_integer(const char *arg, int *status) {
+    if (arg[0] == '\'' || arg[0] == '"') {
+        return (unsigned char)arg[1];
+    }
+    char *end;
+    errno = 0;
+    long long value = strtoll(arg, &end, 0);
+    if (errno == ERANGE) {
+        value = (long long)strtoull(arg, &end, 0);
+    }
+    if (*end != '\0' || (end == arg && arg[0] != '\0')) {
+        fprintf(stderr, "printf: %s: invalid number\n\r", arg);
+        *status = 1;
+    }
+    return value;
+}
+
+static double printf_double(const char *arg, int *status) {
+    if (arg[0] == '\'' || arg[0] == '"') {
+        return (unsigned char)arg[1];
+    }
+    char *end;
+    double value = strtod(arg, &end);
+    if (*end != '\0' || (end == arg && arg[0] != '\0')) {
+        fprintf(stderr, "printf: %s: invalid number\n\r", arg);
+        *status = 1;
+    }
+    return value;
+}
+
+int builtin_printf(char **args) {
+    if (args[1] == NULL) {
+        fprintf(stderr, "printf: usage: printf format [arguments]\n\r");
+        return 2;
+    }
+
+    const char *format = args[1];
+    char **next = args + 2;
+    int status = 0;
+    int stop = 0;
+    OutputBuffer *out = malloc(sizeof(OutputBuffer));
+    if (out == NULL) {
+        perror("malloc");
+        return 1;
+    }
+    output_init(out, STDOUT_FILENO);
+    fflush(stdout);
+
+    // The format is reused while arguments remain
+    do {
+        char **start = next;
+        const char *p = format;
+        while (*p && !stop) {
+            if (*p == '\\') {
+                char c;
+                size_t used = decode_escape(p + 1, &c, 0);
+                output_append(out, &c, 1);
+                p += used == (size_t)-1 ? 1 : used + 1;
+                continue;
+            }
+            if (*p != '%') {
+                size_t run = strcspn(p, "\\%");
+                output_append(out, p, run);
+                p += run;
+                continue;
+            }
+            if (p[1] == '%') {
+                output_append(out, "%", 1);
+                p += 2;
+                continue;
+            }
+
+            // %[flags][width][.precision]conversion, with * taken from the arguments
+            char spec[64];
+            size_t spec_len = 0;
+            spec[spec_len++] = *p++;
+            while (*p && strchr("-+ #0", *p) && spec_len < 8) {
+                spec[spec_len++] = *p++;
+            }
+            for (int part = 0; part < 2; part++) {
+                if (part == 1) {
+                    if (*p != '.') {
+                        break;
+                    }
+                    spec[spec_len++] = *p++;
+                }
+                if (*p == '*') {
+                    const char *arg = *next ? *next++ : "0";
+                    spec_len += (size_t)snprintf(spec + spec_len, 16, "%d", (int)printf_integer(arg, &status));
+                    p++;
+                } else {
+                    while (isdigit((unsigned char)*p) && spec_len < 40) {
+                        spec[spec_len++] = *p++;
+                    }
+                }
+            }
+
+            char conversion = *p;
+            if (conversion == '\0' || strchr("diouxXeEfFgGaAcsb", conversion) == NULL) {
+                fprintf(stderr, "printf: %%%c: invalid format character\n\r", conversion ? conversion : '%');
+                status = 1;
+                stop = 1;
+                break;
+            }
+            p++;
+            const char *arg = *next ? *next++ : "";
+
+            if (conversion == 'b') {
+                // Decoded, then padded like %s (escapes only shrink the argument)
+                size_t arg_len = strlen(arg);
+                if (spec_len == 1 || arg_len >= OUTPUT_BUFFER_SIZE) {
+                    stop = append_escaped(out, arg, arg_len, 1) != 0;
+                    continue;
+                }
+                OutputBuffer *decoded = malloc(sizeof(OutputBuffer));
+                if (decoded == NULL) {
+                    perror("malloc");
+                    status = 1;
+                    break;
+                }
+                output_init(decoded, -1);  // never fills up, so never written
+                stop = append_escaped(decoded, arg, arg_len, 1) != 0;
+                decoded->data[decoded->len] = '\0';
+                memcpy(spec + spec_len, "s", 2);
+                output_format(out, spec, decoded->data);
+                free(decoded);
+            } else if (conversion == 's' || conversion == 'c') {
+                char first[2] = {arg[0], '\0'};
+                memcpy(spec + spec_len, "s", 2);
+                output_format(out, spec, conversion == 's' ? arg : first);
+            } else if (strchr("diouxX", conversion)) {
+                memcpy(spec + spec_len, "ll", 2);
+                spec[spec_len + 2] = conversion;
+                spec[spec_len + 3] = '\0';
+                output_format(out, spec, printf_integer(arg, &status));
+            } else {
+                spec[spec_len] = conversion;
+                spec[spec_len + 1] = '\0';
+                output_format(out, spec, printf_double(arg, &status));
+            }
+        }
+        if (next == start) {
+            break;  // the format takes no arguments
+        }
+    } while (*next != NULL && !stop);
+
+    if (output_flush(out) != 0) {
+        perror("printf");
+        status = 1;
+    }
+    free(out);
+    return status;
+}
+
+static volatile sig_atomic_t sleep_interrupted = 0;
+
+static void interrupt_sleep(int sig) {
+    (void)sig;
+    sleep_interrupted = 1;
+}
+
+/**
+ * Wait for seconds, or until SIGINT (Ctrl+C)
+ * On Linux the wait is a poll() on a timerfd, so it wakes for a signal
+ * like any other wait of the shell
+ * Returns 0 when the time is up, 1 if interrupted
+ */
+static int wait_interruptibly(double seconds) {
+    struct sigaction sa, old;
+    sa.sa_handler = interrupt_sleep;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;  // no SA_RESTART: the wait must return
+    sleep_interrupted = 0;
+    sigaction(SIGINT, &sa, &old);
+
+    time_t whole = (time_t)seconds;
+    long nanos = (long)((seconds - (double)whole) * 1e9);
+    if (whole > 0 || nanos > 0) {
+        int waited = 0;
+#ifdef __linux__
+        int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+        struct itimerspec timer = {{0, 0}, {whole, nanos}};
+        if (fd != -1 && timerfd_settime(fd, 0, &timer, NULL) == 0) {
+            struct pollfd pfd = {fd, POLLIN, 0};
+            while (!sleep_interrupted && poll(&pfd, 1, -1) <= 0 && (errno == EINTR || errno == EAGAIN)) {
+            }
+            waited = 1;
+        }
+        if (fd != -1) {
+            close(fd);
+        }
+#endif
+        if (!waited) {
+            struct timespec left = {whole, nanos};
+            while (!sleep_interrupted && nanosleep(&left, &left) == -1 && errno == EINTR) {
+            }
+        }
+    }
+
+    sigaction(SIGINT, &old, NULL);
+    return sleep_interrupted;
+}
+
+int builtin_sleep(char **args) {
+    if (args[1] == NULL) {
+        fprintf(stderr, "sleep: missing operand\n\r");
+        return 1;
+    }
+
+    // The intervals add up; each may have an s, m, h or d suffix
+    double seconds = 0;
+    for (int i = 1; args[i] != NULL; i++) {
+        char *end;
+        double value = strtod(args[i], &end);
+        double unit = 1;
+        if (*end != '\0' && end[1] == '\0') {
+            switch (*end) {
+                case 's': unit = 1; end++; break;
+                case 'm': unit = 60; end++; break;
+                case 'h': unit = 3600; end++; break;
+                case 'd': unit = 86400; end++; break;
+            }
+        }
+        if (end == args[i] || *end != '\0' || !(value >= 0) || value * unit > 1e9) {
+            fprintf(stderr, "sleep: invalid time interval '%s'\n\r", args[i]);
+            return 1;
+        }
+        seconds += value * unit;
+    }
+
+    if (wait_interruptibly(seconds)) {
+        // The terminal echoed ^C without a line break
+        write(STDOUT_FILENO, "\n", 1);
+        return 128 + SIGINT;
+    }
+    return 0;
+}
@@ -0,0 +1,577 @@
+#include "../include/common.h"
+#include "../include/command_index.h"
+#include "../include/builtins.h"
+#include "../include/aliases.h"
+#include "../include/variables.h"
+#include "../include/background.h"
+#include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/* $PATH used when the variable is unset (same as the executor) */
+#define DEFAULT_PATH "/usr/local/bin:/usr/bin:/bin"
+
+/* How often command_exists() rechecks the $PATH directories (ms) */
+#define COMMAND_RECHECK_MS 1000
+
+/* Identifies a catalogue cache file of this layout */
+#define CATALOGUE_MAGIC "KORDCMD1"
+
+/**
+ * Header of the catalogue cache file
+ * Followed by dir_count records
+ */
+typedef struct {
+    char magic[8];
+    uint32_t dir_count;
+    uint32_t reserved;
+} CatalogueHeader;
+
+/**
+ * One directory in the catalogue cache file
+ * Followed by the path (path_len bytes, no NUL) and names_size bytes of
+ * NUL-terminated names
+ */
+typedef struct {
+    uint32_t path_len;
+    uint32_t names_size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+} CatalogueRecord;
+
+/* Executables found in one $PATH directory */
+typedef struct {
+    char *path;
+    int64_t mtime_sec;       // directory mtime when it was scanned
+    int64_t mtime_nsec;
+    int scanned;             // 0 until the names reflect the directory
+    char *names;             // NUL-terminated names, back to back
+    size_t names_size;
+    size_t names_capacity;
+} PathDir;
+
+/* Directories of the current $PATH, in order */
+static PathDir *dirs = NULL;
+static size_t dir_count = 0;
+static char *indexed_path = NULL;
+
+/* Directories read from the cache file, not yet claimed by $PATH */
+static PathDir *cached_dirs = NULL;
+static size_t cached_count = 0;
+static int cache_loaded = 0;
+
+/* Every executable name, sorted and without duplicates */
+static const char **catalogue = NULL;
+static size_t catalogue_count = 0;
+
+/* Serializes completion workers over the catalogue state above */
+static pthread_mutex_t catalogue_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* When command_exists() last brought the catalogue up to date (CLOCK_MONOTONIC ms) */
+static long long checked_at = 0;
+
+static void free_dir(PathDir *dir) {
+    free(dir->path);
+    free(dir->names);
+    memset(dir, 0, sizeof(*dir));
+}
+
+int command_index_cache_path(char *buffer, size_t size) {
+    const char *xdg = get_variable("XDG_CACHE_HOME");
+    const char *home = get_variable("HOME");
+
+    int n;
+    if (xdg != NULL && xdg[0] == '/') {
+        n = snprintf(buffer, size, "%s/kord-sh/commands", xdg);
+    } else if (home != NULL && home[0] == '/') {
+        n = snprintf(buffer, size, "%s/.cache/kord-sh/commands", home);
+    } else {
+        return -1;
+    }
+    return (n > 0 && (size_t)n < size) ? 0 : -1;
+}
+
+/**
+ * Create the directory holding path, and its parent if needed
+ * Returns 0 if the directory exists afterwards, -1 otherwise
+ */
+static int make_parent_dir(const char *path) {
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", path);
+    char *slash = strrchr(dir, '/');
+    if (slash == NULL || slash == dir) {
+        return 0;
+    }
+    *slash = '\0';
+    if (mkdir(dir, 0700) == 0 || errno == EEXIST) {
+        return 0;
+    }
+    if (errno != ENOENT || make_parent_dir(dir) != 0) {
+        return -1;
+    }
+    return (mkdir(dir, 0700) == 0 || errno == EEXIST) ? 0 : -1;
+}
+
+/**
+ * Read the catalogue cache file into cached_dirs
+ * A missing or malformed file just leaves the cache empty
+ */
+static void load_catalogue(const char *cache_path) {
+    cache_loaded = 1;
+
+    int fd = open(cache_path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return;
+    }
+
+    struct stat st;
+    char *data = NULL;
+    size_t size = 0;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(CatalogueHeader)) {
+        size = (size_t)st.st_size;
+        data = malloc(size);
+        if (data != NULL && pread(fd, data, size, 0) != (ssize_t)size) {
+            free(data);
+            data = NULL;
+        }
+    }
+    close(fd);
+    if (data == NULL) {
+        return;
+    }
+
+    CatalogueHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, CATALOGUE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.dir_count > size / sizeof(CatalogueRecord)) {
+        free(data);
+        return;
+    }
+
+    cached_dirs = calloc(header.dir_count ? header.dir_count : 1, sizeof(PathDir));
+    if (cached_dirs == NULL) {
+        free(data);
+        return;
+    }
+
+    size_t pos = sizeof(header);
+    for (uint32_t i = 0; i < header.dir_count; i++) {
+        CatalogueRecord record;
+        if (size - pos < sizeof(record)) {
+            break;
+        }
+        memcpy(&record, data + pos, sizeof(record));
+        pos += sizeof(record);
+        if (size - pos < (size_t)record.path_len + record.names_size ||
+            (record.names_size > 0 && data[pos + record.path_len + record.names_size - 1] != '\0')) {
+            break;
+        }
+
+        PathDir *dir = &cached_dirs[cached_count];
+        dir->path = strndup(data + pos, record.path_len);
+        dir->names = malloc(record.names_size ? record.names_size : 1);
+        if (dir->path == NULL || dir->names == NULL) {
+            free_dir(dir);
+            break;
+        }
+        memcpy(dir->names, data + pos + record.path_len, record.names_size);
+        dir->names_size = dir->names_capacity = record.names_size;
+        dir->mtime_sec = record.mtime_sec;
+        dir->mtime_nsec = record.mtime_nsec;
+        dir->scanned = 1;
+        cached_count++;
+        pos += record.path_len + record.names_size;
+    }
+
+    free(data);
+}
+
+/**
+ * Write the catalogue of the current $PATH directories to the cache file
+ * atomically (temporary file + rename)
+ * Failures are silent: the cache is only an optimization
+ */
+static void save_catalogue(const char *cache_path) {
+    char tmp_path[PATH_MAX + 32];
+    if (make_parent_dir(cache_path) != 0) {
+        return;
+    }
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%ld.tmp", cache_path, (long)getpid());
+
+    FILE *file = fopen(tmp_path, "w");
+    if (file == NULL) {
+        return;
+    }
+
+    CatalogueHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CATALOGUE_MAGIC, sizeof(header.magic));
+    for (size_t i = 0; i < dir_count; i++) {
+        header.dir_count += dirs[i].scanned;
+    }
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+    for (size_t i = 0; i < dir_count && ok; i++) {
+        if (!dirs[i].scanned) {
+            continue;
+        }
+        CatalogueRecord record;
+        memset(&record, 0, sizeof(record));
+        record.path_len = (uint32_t)strlen(dirs[i].path);
+        record.names_size = (uint32_t)dirs[i].names_size;
+        record.mtime_sec = dirs[i].mtime_sec;
+        record.mtime_nsec = dirs[i].mtime_nsec;
+        ok = fwrite(&record, sizeof(record), 1, file) == 1 &&
+             fwrite(dirs[i].path, 1, record.path_len, file) == record.path_len &&
+             fwrite(dirs[i].names, 1, dirs[i].names_size, file) == dirs[i].names_size;
+    }
+
+    if (fclose(file) != 0 || !ok || rename(tmp_path, cache_path) != 0) {
+        unlink(tmp_path);
+    }
+}
+
+/**
+ * Add a directory entry to the directory's names if it is an executable
+ * file (following symlinks)
+ * Returns 0 on success, -1 on allocation failure
+ */
+static int collect_executable(void *ctx, int dir_fd, const char *name, unsigned char type) {
+    PathDir *dir = ctx;
+
+    if (type == DT_DIR) {
+        return 0;
+    }
+    if (type != DT_REG) {
+        struct stat st;
+        if (fstatat(dir_fd, name, &st, 0) != 0 || !S_ISREG(st.st_mode)) {
+            return 0;
+        }
+    }
+    if (faccessat(dir_fd, name, X_OK, 0) != 0) {
+        return 0;
+    }
+
+    size_t len = strlen(name) + 1;
+    if (dir->names_size + len > dir->names_capacity) {
+        size_t new_capacity = dir->names_capacity ? dir->names_capacity * 2 : 4096;
+        while (new_capacity < dir->names_size + len) {
+            new_capacity *= 2;
+        }
+        char *new_names = realloc(dir->names, new_capacity);
+        if (new_names == NULL) {
+            perror("realloc");
+            return -1;
+        }
+        dir->names = new_names;
+        dir->names_capacity = new_capacity;
+    }
+    memcpy(dir->names + dir->names_size, name, len);
+    dir->names_size += len;
+    return 0;
+}
+
+/**
+ * Rescan a directory whose mtime is in st
+ */
+static void scan_dir(PathDir *dir, const struct stat *st) {
+    dir->names_size = 0;
+    dir->scanned = 0;
+
+    int dir_fd = open(dir->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd == -1) {
+        return;
+    }
+    if (completion_scan_dir(dir_fd, collect_executable, dir) == 0) {
+        dir->mtime_sec = (int64_t)st->st_mtim.tv_sec;
+        dir->mtime_nsec = (int64_t)st->st_mtim.tv_nsec;
+        dir->scanned = 1;
+    }
+    close(dir_fd);
+}
+
+/**
+ * Take the entry for path out of list (leaving an empty slot)
+ * Returns 1 if it was found and moved to *out, 0 otherwise
+ */
+static int claim_dir(PathDir *list, size_t count, const char *path, PathDir *out) {
+    for (size_t i = 0; i < count; i++) {
+        if (list[i].path != NULL && strcmp(list[i].path, path) == 0) {
+            *out = list[i];
+            memset(&list[i], 0, sizeof(list[i]));
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Rebuild the directory list for a new $PATH, keeping what is already
+ * known about directories that stay
+ * Returns 0 on success, -1 on allocation failure
+ */
+static int set_path(const char *path) {
+    size_t max_dirs = 1;
+    for (const char *p = path; *p; p++) {
+        max_dirs += (*p == ':');
+    }
+    PathDir *new_dirs = calloc(max_dirs, sizeof(PathDir));
+    char *new_path = strdup(path);
+    if (new_dirs == NULL || new_path == NULL) {
+        free(new_dirs);
+        free(new_path);
+        return -1;
+    }
+
+    size_t new_count = 0;
+    const char *element = path;
+    while (1) {
+        const char *colon = strchr(element, ':');
+        size_t len = colon ? (size_t)(colon - element) : strlen(element);
+
+        // Relative entries depend on the cwd; they are not catalogued
+        if (len > 0 && element[0] == '/') {
+            char *dir_path = strndup(element, len);
+            int duplicate = 0;
+            for (size_t i = 0; dir_path != NULL && i < new_count; i++) {
+                duplicate |= strcmp(new_dirs[i].path, dir_path) == 0;
+            }
+
+            if (dir_path != NULL && !duplicate) {
+                PathDir *dir = &new_dirs[new_count++];
+                if (claim_dir(dirs, dir_count, dir_path, dir) ||
+                    claim_dir(cached_dirs, cached_count, dir_path, dir)) {
+                    free(dir_path);
+                } else {
+                    dir->path = dir_path;
+                }
+            } else {
+                free(dir_path);
+            }
+        }
+
+        if (colon == NULL) {
+            break;
+        }
+        element = colon + 1;
+    }
+
+    for (size_t i = 0; i < dir_count; i++) {
+        free_dir(&dirs[i]);
+    }
+    free(dirs);
+    free(indexed_path);
+    dirs = new_dirs;
+    dir_count = new_count;
+    indexed_path = new_path;
+    return 0;
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+/**
+ * Rebuild the sorted catalogue from the directories' names
+ * Returns 0 on success, -1 on allocation failure
+ */
+static int build_catalogue(void) {
+    size_t total = 0;
+    for (size_t i = 0; i < dir_count; i++) {
+        for (size_t pos = 0; pos < dirs[i].names_size; pos += strlen(dirs[i].names + pos) + 1) {
+            total++;
+        }
+    }
+
+    const char **names = malloc((total ? total : 1) * sizeof(const char *));
+    if (names == NULL) {
+        perror("malloc");
+        return -1;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < dir_count; i++) {
+        for (size_t pos = 0; pos < dirs[i].names_size; pos += strlen(dirs[i].names + pos) + 1) {
+            names[n++] = dirs[i].names + pos;
+        }
+    }
+
+    qsort(names, n, sizeof(const char *), compare_names);
+    size_t kept = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (kept == 0 || strcmp(names[i], names[kept - 1]) != 0) {
+            names[kept++] = names[i];
+        }
+    }
+
+    free(catalogue);
+    catalogue = names;
+    catalogue_count = kept;
+    return 0;
+}
+
+/**
+ * Binary search for the first catalogue name that is >= prefix[0..len)
+ * in its first len bytes
+ */
+static size_t catalogue_lower_bound(const char *prefix, size_t len) {
+    size_t lo = 0, hi = catalogue_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strncmp(catalogue[mid], prefix, len) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+ * Bring the catalogue up to date with path and the directories' mtimes
+ * Called with catalogue_lock held
+ * Returns 0 on success, -1 on allocation failure
+ */
+static int refresh_catalogue(const char *path, const char *cache_path) {
+    if (!cache_loaded && cache_path != NULL) {
+        load_catalogue(cache_path);
+    }
+
+    int changed = 0;
+    int rescanned = 0;
+    if (indexed_path == NULL || strcmp(indexed_path, path) != 0) {
+        if (set_path(path) != 0) {
+            return -1;
+        }
+        changed = 1;
+    }
+
+    for (size_t i = 0; i < dir_count; i++) {
+        PathDir *dir = &dirs[i];
+        struct stat st;
+        if (stat(dir->path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+            if (dir->names_size > 0 || dir->scanned) {
+                dir->names_size = 0;
+                dir->scanned = 0;
+                changed = 1;
+            }
+            continue;
+        }
+        if (!dir->scanned || dir->mtime_sec != (int64_t)st.st_mtim.tv_sec ||
+            dir->mtime_nsec != (int64_t)st.st_mtim.tv_nsec) {
+            scan_dir(dir, &st);
+            changed = 1;
+            rescanned = 1;
+        }
+    }
+
+    if (changed && build_catalogue() != 0) {
+        return -1;
+    }
+    if (rescanned && cache_path != NULL) {
+        save_catalogue(cache_path);
+    }
+    return 0;
+}
+
+int complete_shell_command(const char *prefix, size_t len, CompletionList *list) {
+    for (int i = 0; get_builtin_name(i) != NULL; i++) {
+        const char *name = get_builtin_name(i);
+        if (strncmp(name, prefix, len) == 0 && completion_list_add(list, name, strlen(name), '\0') != 0) {
+            return -1;
+        }
+    }
+
+    size_t pos = 0;
+    const Builtin *builtin;
+    while ((builtin = next_registered_builtin(&pos)) != NULL) {
+        if (strncmp(builtin->name, prefix, len) == 0 &&
+            completion_list_add(list, builtin->name, strlen(builtin->name), '\0') != 0) {
+            return -1;
+        }
+    }
+
+    pos = 0;
+    const char *alias;
+    while ((alias = next_alias_name(&pos)) != NULL) {
+        if (strncmp(alias, prefix, len) == 0 && completion_list_add(list, alias, strlen(alias), '\0') != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int complete_path_command(const char *prefix, size_t len, const char *path, const char *cache_path,
+                          CompletionList *list) {
+    if (path == NULL) {
+        path = DEFAULT_PATH;
+    }
+
+    pthread_mutex_lock(&catalogue_lock);
+    int status = refresh_catalogue(path, cache_path);
+    if (status == 0) {
+        // Binary search for the first match, then walk the rest
+        size_t i = catalogue_lower_bound(prefix, len);
+        for (; i < catalogue_count && strncmp(catalogue[i], prefix, len) == 0; i++) {
+            if (completion_list_add(list, catalogue[i], strlen(catalogue[i]), '\0') != 0) {
+                status = -1;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&catalogue_lock);
+    return status;
+}
+
+int command_exists(const char *name, size_t len) {
+    // A completion worker may be busy refreshing on a slow filesystem: never wait for it
+    if (pthread_mutex_trylock(&catalogue_lock) != 0) {
+        return -1;
+    }
+
+    long long now_ms = monotonic_ms();
+    const char *path = get_variable("PATH");
+    if (path == NULL) {
+        path = DEFAULT_PATH;
+    }
+
+    int status = 0;
+    if (indexed_path == NULL || strcmp(indexed_path, path) != 0 || now_ms - checked_at >= COMMAND_RECHECK_MS) {
+        char cache_path[PATH_MAX];
+        int has_cache = command_index_cache_path(cache_path, sizeof(cache_path)) == 0;
+        status = refresh_catalogue(path, has_cache ? cache_path : NULL);
+        checked_at = now_ms;
+    }
+
+    int found = -1;
+    if (status == 0) {
+        size_t i = catalogue_lower_bound(name, len);
+        found = i < catalogue_count && strncmp(catalogue[i], name, len) == 0 && catalogue[i][len] == '\0';
+    }
+    pthread_mutex_unlock(&catalogue_lock);
+    return found;
+}
+
+void cleanup_command_index(void) {
+    // A completion worker may still be refreshing on a slow filesystem;
+    // the process is exiting, so leave the catalogue to it
+    if (pthread_mutex_trylock(&catalogue_lock) != 0) {
+        return;
+    }
+    for (size_t i = 0; i < dir_count; i++) {
+        free_dir(&dirs[i]);
+    }
+    for (size_t i = 0; i < cached_count; i++) {
+        free_dir(&cached_dirs[i]);
+    }
+    free(dirs);
+    free(cached_dirs);
+    free(indexed_path);
+    free(catalogue);
+    dirs = cached_dirs = NULL;
+    dir_count = cached_count = 0;
+    indexed_path = NULL;
+    catalogue = NULL;
+    catalogue_count = 0;
+    cache_loaded = 0;
+    pthread_mutex_unlock(&catalogue_lock);
+}
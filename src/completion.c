@@ -0,0 +1,435 @@
+#include "../include/common.h"
+#include "../include/completion.h"
+#include "../include/scan.h"
+#include "../include/command_index.h"
+#include "../include/completion_spec.h"
+#include "../include/variables.h"
+#include "../include/background.h"
+#include <stdint.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+/* Bytes of directory entries fetched per getdents64() call */
+#define DIRENT_BUFFER_SIZE 65536
+
+/**
+ * Candidate search running on a worker thread
+ * Shared by the editor and the worker; freed by whichever lets go last
+ */
+struct CompletionJob {
+    BackgroundTask task;
+    CompletionList list;     // candidates so far, unsorted (guarded by task.lock)
+    int status;              // result of the search, once done
+    char *word;
+    int command_word;
+    char *path;              // $PATH and catalogue cache file, for command words
+    char *cache_path;
+    int has_spec;            // the command has a completion spec
+    CompletionGenerator *generator;  // the spec's generator, or NULL
+};
+
+#ifdef __linux__
+/* Record returned by getdents64() (not exported by glibc headers) */
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+#endif
+
+int completion_list_add(CompletionList *list, const char *name, size_t len, char suffix) {
+    size_t need = len + 2;  // suffix and NUL
+    if (list->arena_used + need > list->arena_capacity) {
+        size_t new_capacity = list->arena_capacity ? list->arena_capacity * 2 : 4096;
+        while (new_capacity < list->arena_used + need) {
+            new_capacity *= 2;
+        }
+        char *new_arena = realloc(list->arena, new_capacity);
+        if (new_arena == NULL) {
+            perror("realloc");
+            return -1;
+        }
+        list->arena = new_arena;
+        list->arena_capacity = new_capacity;
+    }
+    if (list->count == list->capacity) {
+        size_t new_capacity = list->capacity ? list->capacity * 2 : 64;
+        size_t *new_offsets = realloc(list->offsets, new_capacity * sizeof(size_t));
+        if (new_offsets == NULL) {
+            perror("realloc");
+            return -1;
+        }
+        list->offsets = new_offsets;
+        list->capacity = new_capacity;
+    }
+
+    char *dest = list->arena + list->arena_used;
+    memcpy(dest, name, len);
+    if (suffix != '\0') {
+        dest[len++] = suffix;
+    }
+    dest[len] = '\0';
+
+    list->offsets[list->count++] = list->arena_used;
+    list->arena_used += len + 1;
+    return 0;
+}
+
+/**
+ * Whether a directory entry is (or links to) a directory
+ * Only symlinks and entries without a reported type cost a fstatat()
+ */
+static int entry_is_dir(int dir_fd, const char *name, unsigned char type) {
+    if (type == DT_DIR) {
+        return 1;
+    }
+    if (type != DT_LNK && type != DT_UNKNOWN) {
+        return 0;
+    }
+    struct stat st;
+    return fstatat(dir_fd, name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+}
+
+int completion_scan_dir(int dir_fd, int (*visit)(void *ctx, int dir_fd, const char *name, unsigned char type),
+                        void *ctx) {
+    int status = 0;
+#ifdef __linux__
+    char *entries = malloc(DIRENT_BUFFER_SIZE);
+    if (entries == NULL) {
+        return -1;
+    }
+    long n;
+    while (status == 0 && (n = syscall(SYS_getdents64, dir_fd, entries, DIRENT_BUFFER_SIZE)) != 0) {
+        if (n < 0) {
+            status = -1;
+            break;
+        }
+        for (long pos = 0; pos < n && status == 0; ) {
+            struct linux_dirent64 *entry = (struct linux_dirent64 *)(entries + pos);
+            const char *name = entry->d_name;
+            // Skip . and ..
+            if (!(name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))) {
+                status = visit(ctx, dir_fd, name, entry->d_type);
+            }
+            pos += entry->d_reclen;
+        }
+    }
+    free(entries);
+#else
+    int dup_fd = dup(dir_fd);
+    DIR *dir = dup_fd == -1 ? NULL : fdopendir(dup_fd);
+    if (dir == NULL) {
+        if (dup_fd != -1) close(dup_fd);
+        return -1;
+    }
+    struct dirent *entry;
+    while (status == 0 && (entry = readdir(dir)) != NULL) {
+        const char *name = entry->d_name;
+        if (!(name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))) {
+            status = visit(ctx, dir_fd, name, entry->d_type);
+        }
+    }
+    closedir(dir);
+#endif
+    return status;
+}
+
+/* What a filename search matches entries against */
+typedef struct {
+    CompletionJob *job;
+    const char *prefix;
+    size_t prefix_len;
+} FilenameQuery;
+
+/**
+ * Add a directory entry to the job's candidates if it matches the query's
+ * prefix
+ * Returns 0 on success, 1 if the job was cancelled, -1 on allocation failure
+ */
+static int consider_entry(void *ctx, int dir_fd, const char *name, unsigned char type) {
+    FilenameQuery *query = ctx;
+    if (atomic_load(&query->job->task.cancelled)) {
+        return 1;
+    }
+
+    // If prefix is empty, match all files
+    size_t len = strlen(name);
+    if (query->prefix_len > 0 && !scan_has_prefix_nocase(name, len, query->prefix, query->prefix_len)) {
+        return 0;
+    }
+    char suffix = entry_is_dir(dir_fd, name, type) ? '/' : '\0';
+
+    pthread_mutex_lock(&query->job->task.lock);
+    int status = completion_list_add(&query->job->list, name, len, suffix);
+    pthread_mutex_unlock(&query->job->task.lock);
+    return status;
+}
+
+static int compare_items(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+int completion_list_sort(CompletionList *list) {
+    // The arena no longer moves: turn offsets into pointers
+    free(list->items);
+    list->items = NULL;
+    if (list->count > 0) {
+        list->items = malloc(list->count * sizeof(char *));
+        if (list->items == NULL) {
+            perror("malloc");
+            return -1;
+        }
+        for (size_t i = 0; i < list->count; i++) {
+            list->items[i] = list->arena + list->offsets[i];
+        }
+        qsort(list->items, list->count, sizeof(char *), compare_items);
+
+        // Drop duplicates (a name found through several sources)
+        size_t kept = 1;
+        for (size_t i = 1; i < list->count; i++) {
+            if (strcmp(list->items[i], list->items[kept - 1]) != 0) {
+                list->items[kept++] = list->items[i];
+            }
+        }
+        list->count = kept;
+    }
+    free(list->offsets);
+    list->offsets = NULL;
+    list->capacity = 0;
+    return 0;
+}
+
+/**
+ * Collect the entries of word's directory whose names start with the part
+ * of word after its last '/'
+ * Returns 0 on success (or cancellation), -1 if the directory cannot be read
+ */
+static int search_filenames(CompletionJob *job) {
+    const char *word = job->word;
+    const char *last_slash = strrchr(word, '/');
+    const char *prefix = last_slash ? last_slash + 1 : word;
+
+    char *dir_path;
+    if (last_slash == NULL) {
+        dir_path = strdup(".");
+    } else if (last_slash == word) {
+        dir_path = strdup("/");
+    } else {
+        dir_path = strndup(word, (size_t)(last_slash - word));
+    }
+    if (dir_path == NULL) {
+        return -1;
+    }
+    int dir_fd = open(dir_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    free(dir_path);
+    if (dir_fd == -1) {
+        return -1;
+    }
+
+    FilenameQuery query = {job, prefix, strlen(prefix)};
+    int status = completion_scan_dir(dir_fd, consider_entry, &query);
+    close(dir_fd);
+    return status == 1 ? 0 : status;
+}
+
+/**
+ * Add the candidates collected (unsorted) in found to the job's list
+ * Returns 0 on success, -1 on allocation failure
+ */
+static int merge_found(CompletionJob *job, CompletionList *found) {
+    int status = 0;
+    pthread_mutex_lock(&job->task.lock);
+    for (size_t i = 0; status == 0 && i < found->count; i++) {
+        const char *name = found->arena + found->offsets[i];
+        status = completion_list_add(&job->list, name, strlen(name), '\0');
+    }
+    pthread_mutex_unlock(&job->task.lock);
+
+    completion_list_free(found);
+    return status;
+}
+
+/**
+ * Collect the executables on $PATH matching a command word
+ * Returns 0 on success, -1 on allocation failure
+ */
+static int search_commands(CompletionJob *job) {
+    CompletionList found;
+    memset(&found, 0, sizeof(found));
+    if (complete_path_command(job->word, strlen(job->word), job->path, job->cache_path, &found) != 0) {
+        completion_list_free(&found);
+        return -1;
+    }
+    return merge_found(job, &found);
+}
+
+/**
+ * Collect the output of a spec's generator
+ * Returns 0 on success (or cancellation), -1 if it cannot be run or memory
+ * runs out
+ */
+static int search_generator(CompletionJob *job) {
+    if (job->generator == NULL) {
+        return 0;
+    }
+    CompletionList found;
+    memset(&found, 0, sizeof(found));
+    int status = completion_generator_run(job->generator, &job->task.cancelled, &found);
+    if (status != 0) {
+        completion_list_free(&found);
+        return status == 1 ? 0 : -1;
+    }
+    return merge_found(job, &found);
+}
+
+/**
+ * Drop one reference to a job, freeing it with the last one
+ */
+static void release_job(CompletionJob *job) {
+    if (!background_task_release(&job->task)) {
+        return;
+    }
+
+    completion_list_free(&job->list);
+    free(job->word);
+    free(job->path);
+    free(job->cache_path);
+    completion_generator_free(job->generator);
+    free(job);
+}
+
+/**
+ * Search for the job's candidates and report them done
+ */
+static void run_search(CompletionJob *job) {
+    int status;
+    if (job->command_word) {
+        status = search_commands(job);
+    } else if (job->has_spec) {
+        status = search_generator(job);
+    } else {
+        status = search_filenames(job);
+    }
+
+    pthread_mutex_lock(&job->task.lock);
+    job->status = status;
+    pthread_mutex_unlock(&job->task.lock);
+    background_task_finish(&job->task);
+}
+
+static void *completion_worker(void *arg) {
+    CompletionJob *job = arg;
+    run_search(job);
+    release_job(job);
+    return NULL;
+}
+
+CompletionJob *completion_job_start(const CompletionRequest *request) {
+    const char *word = request->word;
+    CompletionJob *job = calloc(1, sizeof(CompletionJob));
+    if (job == NULL) {
+        perror("calloc");
+        return NULL;
+    }
+    if (background_task_init(&job->task) != 0) {
+        free(job);
+        return NULL;
+    }
+    job->command_word = request->command_word;
+    job->word = strdup(word);
+
+    // Everything read from shell state is captured here, on the main thread
+    int status = job->word != NULL ? 0 : -1;
+    if (status == 0 && !job->command_word) {
+        job->has_spec = completion_spec_lookup(request, &job->list, &job->generator);
+        status = job->has_spec < 0 ? -1 : 0;
+    }
+    if (status == 0 && job->command_word) {
+        const char *path = get_variable("PATH");
+        char cache_path[PATH_MAX];
+        job->path = path ? strdup(path) : NULL;
+        job->cache_path = command_index_cache_path(cache_path, sizeof(cache_path)) == 0 ? strdup(cache_path) : NULL;
+        status = complete_shell_command(word, strlen(word), &job->list);
+    }
+    if (status != 0) {
+        release_job(job);
+        return NULL;
+    }
+
+    if (background_task_start(&job->task, completion_worker, job) != 0) {
+        // No thread to spare: search in the foreground
+        run_search(job);
+    }
+    return job;
+}
+
+int completion_job_fd(const CompletionJob *job) {
+    return job->task.notify[0];
+}
+
+int completion_job_whole_words(const CompletionJob *job) {
+    return job->command_word || job->has_spec;
+}
+
+int completion_job_collect(CompletionJob *job, CompletionList *list, int *done) {
+    memset(list, 0, sizeof(*list));
+
+    pthread_mutex_lock(&job->task.lock);
+    *done = job->task.done;
+    int status = job->task.done ? job->status : 0;
+    const CompletionList *found = &job->list;
+    if (status == 0 && found->count > 0) {
+        list->arena = malloc(found->arena_used);
+        list->offsets = malloc(found->count * sizeof(size_t));
+        if (list->arena == NULL || list->offsets == NULL) {
+            perror("malloc");
+            status = -1;
+        } else {
+            memcpy(list->arena, found->arena, found->arena_used);
+            memcpy(list->offsets, found->offsets, found->count * sizeof(size_t));
+            list->arena_used = list->arena_capacity = found->arena_used;
+            list->count = list->capacity = found->count;
+        }
+    }
+    pthread_mutex_unlock(&job->task.lock);
+
+    if (status != 0 || completion_list_sort(list) != 0) {
+        completion_list_free(list);
+        return -1;
+    }
+    return 0;
+}
+
+void completion_job_release(CompletionJob *job) {
+    atomic_store(&job->task.cancelled, 1);
+    release_job(job);
+}
+
+size_t completion_common_prefix(const CompletionList *list) {
+    if (list->count == 0) {
+        return 0;
+    }
+
+    // Sorted order: the first and last items differ the most
+    const char *first = list->items[0];
+    const char *last = list->items[list->count - 1];
+    size_t len = 0;
+    while (first[len] != '\0' && first[len] == last[len]) {
+        len++;
+    }
+    // Never end in the middle of a UTF-8 character
+    while (len > 0 && ((unsigned char)first[len] & 0xC0) == 0x80) {
+        len--;
+    }
+    return len;
+}
+
+void completion_list_free(CompletionList *list) {
+    free(list->items);
+    free(list->arena);
+    free(list->offsets);
+    memset(list, 0, sizeof(*list));
+}
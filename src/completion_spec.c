@@ -0,0 +1,405 @@
+#include "../include/common.h"
+#include "../include/completion_spec.h"
+#include "../include/hashtable.h"
+#include "../include/variables.h"
+#include "../include/background.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+/* Initial number of slots in the spec table */
+#define SPEC_TABLE_INITIAL 32
+
+/* Generator outputs kept for reuse */
+#define GENERATOR_CACHE_SIZE 16
+
+/* Seconds a generator's output is reused when $COMPLETION_CACHE_TTL is unset */
+#define DEFAULT_COMPLETION_CACHE_TTL 60
+
+/* A generator still running after this long is killed (ms) */
+#define GENERATOR_TIME_LIMIT_MS 10000
+
+/* Generator output beyond this is ignored */
+#define GENERATOR_OUTPUT_MAX (1024 * 1024)
+
+/**
+ * How the arguments of one command complete
+ */
+typedef struct {
+    char *words;         // whitespace-separated word list, or NULL
+    char *generator;     // command whose output lines are candidates, or NULL
+} CompletionSpec;
+
+struct CompletionGenerator {
+    char *key;           // generator, command, word and previous word, NUL-separated
+    size_t key_len;
+    char *argv[8];       // /bin/sh -c '<generator> "$@"' sh command word previous
+    char **envp;         // environment copy plus COMP_LINE and COMP_POINT
+    const char *word;    // points into key
+    int ttl;             // seconds the output stays reusable
+};
+
+/* Output of a recent generator run */
+typedef struct {
+    char *key;
+    size_t key_len;
+    char *output;
+    size_t output_len;
+    long long finished;  // CLOCK_MONOTONIC ms
+} CachedOutput;
+
+static HashTable spec_table;
+static int specs_initialized = 0;
+
+/* Recent generator outputs, shared by completion workers */
+static CachedOutput output_cache[GENERATOR_CACHE_SIZE];
+static pthread_mutex_t output_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void free_spec(void *ptr) {
+    CompletionSpec *spec = ptr;
+    if (spec == NULL) {
+        return;
+    }
+    free(spec->words);
+    free(spec->generator);
+    free(spec);
+}
+
+static void init_completion_specs(void) {
+    if (specs_initialized) {
+        return;
+    }
+    if (ht_init(&spec_table, SPEC_TABLE_INITIAL) != 0) {
+        return;
+    }
+    specs_initialized = 1;
+}
+
+int set_completion_spec(const char *name, const char *words, const char *generator) {
+    if (name == NULL || name[0] == '\0') {
+        return -1;
+    }
+    init_completion_specs();
+    if (!specs_initialized) {
+        return -1;
+    }
+
+    CompletionSpec *spec = calloc(1, sizeof(CompletionSpec));
+    if (spec == NULL) {
+        perror("calloc");
+        return -1;
+    }
+    spec->words = words ? strdup(words) : NULL;
+    spec->generator = generator ? strdup(generator) : NULL;
+    if ((words && spec->words == NULL) || (generator && spec->generator == NULL)) {
+        free_spec(spec);
+        return -1;
+    }
+
+    HashEntry *entry = ht_insert(&spec_table, name, strlen(name));
+    if (entry == NULL) {
+        free_spec(spec);
+        return -1;
+    }
+    free_spec(entry->value);
+    entry->value = spec;
+    return 0;
+}
+
+int remove_completion_spec(const char *name) {
+    if (!specs_initialized) {
+        return -1;
+    }
+    CompletionSpec *spec = ht_remove(&spec_table, name, strlen(name));
+    if (spec == NULL) {
+        return -1;
+    }
+    free_spec(spec);
+    return 0;
+}
+
+int has_completion_spec(const char *name) {
+    return specs_initialized && ht_get(&spec_table, name) != NULL;
+}
+
+/**
+ * Print one spec as the complete command that defines it
+ */
+static void print_spec(const char *name, const CompletionSpec *spec) {
+    printf("complete");
+    if (spec->words != NULL) {
+        printf(" -W '%s'", spec->words);
+    }
+    if (spec->generator != NULL) {
+        printf(" -C '%s'", spec->generator);
+    }
+    printf(" %s\n\r", name);
+}
+
+static int compare_entries(const void *a, const void *b) {
+    const HashEntry *ea = *(const HashEntry * const *)a;
+    const HashEntry *eb = *(const HashEntry * const *)b;
+    return strcmp(ea->key, eb->key);
+}
+
+int print_completion_specs(const char *name) {
+    if (!specs_initialized) {
+        return name == NULL ? 0 : -1;
+    }
+
+    if (name != NULL) {
+        CompletionSpec *spec = ht_get(&spec_table, name);
+        if (spec == NULL) {
+            return -1;
+        }
+        print_spec(name, spec);
+        return 0;
+    }
+
+    // Sorted, so the listing is stable regardless of hash order
+    HashEntry **sorted = malloc((spec_table.count + 1) * sizeof(HashEntry *));
+    if (sorted == NULL) {
+        perror("malloc");
+        return -1;
+    }
+    size_t count = 0;
+    size_t pos = 0;
+    HashEntry *entry;
+    while ((entry = ht_next(&spec_table, &pos)) != NULL) {
+        sorted[count++] = entry;
+    }
+    qsort(sorted, count, sizeof(HashEntry *), compare_entries);
+    for (size_t i = 0; i < count; i++) {
+        print_spec(sorted[i]->key, sorted[i]->value);
+    }
+    free(sorted);
+    return 0;
+}
+
+/**
+ * Prepare a generator run with everything it reads from the shell copied,
+ * so that the worker never touches shell state
+ * Returns the generator, or NULL on allocation failure
+ */
+static CompletionGenerator *prepare_generator(const char *generator, const CompletionRequest *request) {
+    const char *parts[4] = {generator, request->command, request->word, request->previous};
+    size_t part_len[4];
+    size_t key_len = 0;
+    for (int i = 0; i < 4; i++) {
+        part_len[i] = strlen(parts[i]);
+        key_len += part_len[i] + 1;
+    }
+
+    CompletionGenerator *gen = calloc(1, sizeof(CompletionGenerator));
+    char *script = malloc(strlen(generator) + sizeof(" \"$@\""));
+    if (gen != NULL) {
+        gen->key = malloc(key_len);
+    }
+    if (gen == NULL || script == NULL || gen->key == NULL) {
+        perror("malloc");
+        free(script);
+        completion_generator_free(gen);
+        return NULL;
+    }
+
+    // The key doubles as storage for the arguments
+    char *key_parts[4];
+    char *dest = gen->key;
+    for (int i = 0; i < 4; i++) {
+        key_parts[i] = dest;
+        memcpy(dest, parts[i], part_len[i] + 1);
+        dest += part_len[i] + 1;
+    }
+    gen->key_len = key_len;
+    gen->word = key_parts[2];
+    gen->ttl = get_variable_int("COMPLETION_CACHE_TTL", DEFAULT_COMPLETION_CACHE_TTL);
+
+    sprintf(script, "%s \"$@\"", generator);
+    gen->argv[0] = "/bin/sh";
+    gen->argv[1] = "-c";
+    gen->argv[2] = script;
+    gen->argv[3] = "sh";
+    gen->argv[4] = key_parts[1];
+    gen->argv[5] = key_parts[2];
+    gen->argv[6] = key_parts[3];
+    gen->argv[7] = NULL;
+
+    // Environment: the shell's, plus COMP_LINE and COMP_POINT
+    char *comp_line = malloc(strlen(request->line) + sizeof("COMP_LINE="));
+    char comp_point[32];
+    if (comp_line == NULL) {
+        perror("malloc");
+        completion_generator_free(gen);
+        return NULL;
+    }
+    sprintf(comp_line, "COMP_LINE=%s", request->line);
+    snprintf(comp_point, sizeof(comp_point), "COMP_POINT=%zu", request->point);
+    char *extra[] = {comp_line, comp_point, NULL};
+    gen->envp = copy_environment(extra);
+    free(comp_line);
+    if (gen->envp == NULL) {
+        completion_generator_free(gen);
+        return NULL;
+    }
+    return gen;
+}
+
+int completion_spec_lookup(const CompletionRequest *request, CompletionList *list,
+                           CompletionGenerator **generator) {
+    *generator = NULL;
+    if (!specs_initialized || request->command == NULL) {
+        return 0;
+    }
+    CompletionSpec *spec = ht_get(&spec_table, request->command);
+    if (spec == NULL) {
+        return 0;
+    }
+
+    size_t word_len = strlen(request->word);
+    for (const char *p = spec->words; p != NULL && *p; ) {
+        while (*p && isspace((unsigned char)*p)) p++;
+        const char *start = p;
+        while (*p && !isspace((unsigned char)*p)) p++;
+        size_t len = (size_t)(p - start);
+        if (len > 0 && len >= word_len && strncmp(start, request->word, word_len) == 0 &&
+            completion_list_add(list, start, len, '\0') != 0) {
+            return -1;
+        }
+    }
+
+    if (spec->generator != NULL) {
+        *generator = prepare_generator(spec->generator, request);
+        if (*generator == NULL) {
+            return -1;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Copy a cached output for key if it is younger than ttl seconds
+ * Returns the copy (output_len set), or NULL if there is none
+ */
+static char *cached_output(const char *key, size_t key_len, int ttl, size_t *output_len) {
+    char *output = NULL;
+    long long now = monotonic_ms();
+
+    pthread_mutex_lock(&output_cache_lock);
+    for (int i = 0; i < GENERATOR_CACHE_SIZE; i++) {
+        CachedOutput *cached = &output_cache[i];
+        if (cached->key != NULL && cached->key_len == key_len && memcmp(cached->key, key, key_len) == 0 &&
+            now - cached->finished < ttl * 1000LL) {
+            output = malloc(cached->output_len + 1);
+            if (output != NULL) {
+                memcpy(output, cached->output, cached->output_len);
+                *output_len = cached->output_len;
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&output_cache_lock);
+    return output;
+}
+
+/**
+ * Keep a copy of a generator's output, replacing the entry for the same
+ * key or else the oldest one
+ */
+static void cache_output(const char *key, size_t key_len, const char *output, size_t output_len) {
+    char *key_copy = malloc(key_len);
+    char *output_copy = malloc(output_len + 1);
+    if (key_copy == NULL || output_copy == NULL) {
+        free(key_copy);
+        free(output_copy);
+        return;
+    }
+    memcpy(key_copy, key, key_len);
+    memcpy(output_copy, output, output_len);
+
+    pthread_mutex_lock(&output_cache_lock);
+    int slot = 0;
+    for (int i = 0; i < GENERATOR_CACHE_SIZE; i++) {
+        CachedOutput *cached = &output_cache[i];
+        if (cached->key != NULL && cached->key_len == key_len && memcmp(cached->key, key, key_len) == 0) {
+            slot = i;
+            break;
+        }
+        if (cached->key == NULL || cached->finished < output_cache[slot].finished) {
+            slot = i;
+        }
+    }
+    CachedOutput *cached = &output_cache[slot];
+    free(cached->key);
+    free(cached->output);
+    cached->key = key_copy;
+    cached->key_len = key_len;
+    cached->output = output_copy;
+    cached->output_len = output_len;
+    cached->finished = monotonic_ms();
+    pthread_mutex_unlock(&output_cache_lock);
+}
+
+int completion_generator_run(CompletionGenerator *gen, atomic_int *cancelled, CompletionList *list) {
+    size_t output_len = 0;
+    char *output = gen->ttl > 0 ? cached_output(gen->key, gen->key_len, gen->ttl, &output_len) : NULL;
+    if (output == NULL) {
+        int complete;
+        output = background_spawn_read(gen->argv, gen->envp, GENERATOR_OUTPUT_MAX,
+                                       monotonic_ms() + GENERATOR_TIME_LIMIT_MS, cancelled, &output_len, &complete);
+        if (output == NULL) {
+            return -1;
+        }
+        if (atomic_load(cancelled)) {
+            free(output);
+            return 1;
+        }
+        // Failed or cut-short output is used this once, but not cached
+        if (gen->ttl > 0 && complete) {
+            cache_output(gen->key, gen->key_len, output, output_len);
+        }
+    }
+
+    // One candidate per line; only those starting with the word
+    int status = 0;
+    size_t word_len = strlen(gen->word);
+    for (size_t pos = 0; pos < output_len && status == 0; ) {
+        const char *line = output + pos;
+        const char *newline = memchr(line, '\n', output_len - pos);
+        size_t len = newline ? (size_t)(newline - line) : output_len - pos;
+        pos += len + 1;
+
+        if (len > 0 && line[len - 1] == '\r') {
+            len--;
+        }
+        if (len > 0 && len >= word_len && strncmp(line, gen->word, word_len) == 0) {
+            status = completion_list_add(list, line, len, '\0');
+        }
+    }
+    free(output);
+    return status;
+}
+
+void completion_generator_free(CompletionGenerator *gen) {
+    if (gen == NULL) {
+        return;
+    }
+    free(gen->key);
+    free(gen->argv[2]);
+    free(gen->envp);
+    free(gen);
+}
+
+void cleanup_completion_specs(void) {
+    if (specs_initialized) {
+        ht_free(&spec_table, free_spec);
+        specs_initialized = 0;
+    }
+
+    pthread_mutex_lock(&output_cache_lock);
+    for (int i = 0; i < GENERATOR_CACHE_SIZE; i++) {
+        free(output_cache[i].key);
+        free(output_cache[i].output);
+        memset(&output_cache[i], 0, sizeof(output_cache[i]));
+    }
+    pthread_mutex_unlock(&output_cache_lock);
+}
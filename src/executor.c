@@ -3,6 +3,7 @@
 #include "../include/builtins.h"
 #include "../include/raw_input.h"
 #include "../include/variables.h"
+#include <errno.h>
 
 int execute_command(char ***commands) {
     if (commands == NULL || commands[0] == NULL) {
@@ -55,6 +56,36 @@ int execute_command(char ***commands) {
         }
     }
     
+    set_last_status(result);
+    return result;
+}
+
+/**
+ * Whether command has I/O redirections (applied only in a forked child)
+ */
+static int has_redirection(char **command) {
+    for (int i = 0; command[i] != NULL; i++) {
+        if (strcmp(command[i], "<") == 0 || strcmp(command[i], ">") == 0 || strcmp(command[i], ">>") == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Run a builtin in the shell itself, with the terminal as a child would
+ * have it (output processing and Ctrl+C on)
+ */
+static int run_forkless(const Builtin *builtin, char **command) {
+    int was_raw_mode = is_raw_mode_enabled();
+    if (was_raw_mode) {
+        disable_raw_mode();
+    }
+    int result = run_builtin(builtin, command);
+    fflush(stdout);
+    if (was_raw_mode) {
+        enable_raw_mode();
+    }
     return result;
 }
 
@@ -69,16 +100,111 @@ int execute_single_command(char **command, int fd_read, int fd_write) {
         return execute_variable_assignment(command);
     }
     
-    // Check if it's a built-in command and must run in parent process
-    if (is_builtin(command[0]) && (must_run_in_parent(command[0]))) {
-        return execute_builtin(command);
+    // Leading VAR=value words only apply to this command's environment
+    int assign_count = count_assignment_words(command);
+    char **assignments = command;
+    command += assign_count;
+    
+    // Resolve the builtin once: it either runs here or in the forked child
+    const Builtin *builtin = find_builtin(command[0]);
+    if (builtin && (builtin->flags & BUILTIN_RUN_IN_PARENT)) {
+        // Like POSIX special builtins, assignments persist in the shell
+        for (int i = 0; i < assign_count; i++) {
+            char *single[] = {assignments[i], NULL};
+            execute_variable_assignment(single);
+        }
+        return run_builtin(builtin, command);
+    }
+
+    // test, printf, sleep...: no fork unless the command is piped or redirected
+    // (assignments before them would only reach their environment, which they never read)
+    if (builtin && (builtin->flags & BUILTIN_FORKLESS) && fd_read == -1 && fd_write == -1 &&
+        !has_redirection(command)) {
+        return run_forkless(builtin, command);
     }
     
     // Otherwise, execute as external command
-    return execute_external(command, fd_read, fd_write);
+    return execute_external(command, builtin, assignments, assign_count, fd_read, fd_write);
 }
 
-int execute_external(char **command, int fd_read, int fd_write) {
+/**
+ * execve() file, running it with /bin/sh if it is not a binary and has
+ * no #! line (ENOEXEC), as execvp() does
+ * Only returns on failure (errno set)
+ */
+static void exec_file(const char *file, char **command, char **envp) {
+    execve(file, command, envp);
+    if (errno != ENOEXEC) {
+        return;
+    }
+
+    size_t argc = 0;
+    while (command[argc] != NULL) {
+        argc++;
+    }
+    char **sh_args = malloc((argc + 2) * sizeof(char *));
+    if (sh_args == NULL) {
+        errno = ENOEXEC;
+        return;
+    }
+    sh_args[0] = "/bin/sh";
+    sh_args[1] = (char *)file;
+    memcpy(sh_args + 2, command + 1, argc * sizeof(char *));   // argv[1..] and the NULL
+    execve("/bin/sh", sh_args, envp);
+    free(sh_args);
+    errno = ENOEXEC;
+}
+
+/**
+ * Replace the process image with command, searching $PATH like execvp()
+ * but passing the shell-owned environment vector directly
+ * Only returns on failure (errno set)
+ */
+static void exec_with_environment(char **command, char **envp) {
+    if (strchr(command[0], '/') != NULL) {
+        exec_file(command[0], command, envp);
+        return;
+    }
+    
+    const char *path = get_variable("PATH");
+    if (path == NULL) {
+        path = "/usr/local/bin:/usr/bin:/bin";
+    }
+    
+    size_t name_len = strlen(command[0]);
+    int first_error = 0;     // first failure other than "not there", e.g. EACCES
+    char candidate[PATH_MAX];
+    
+    while (1) {
+        const char *colon = strchr(path, ':');
+        size_t dir_len = colon ? (size_t)(colon - path) : strlen(path);
+        
+        // An empty PATH element means the current directory
+        const char *dir = dir_len ? path : ".";
+        if (dir_len == 0) dir_len = 1;
+        
+        if (dir_len + 1 + name_len < sizeof(candidate)) {
+            memcpy(candidate, dir, dir_len);
+            candidate[dir_len] = '/';
+            memcpy(candidate + dir_len + 1, command[0], name_len + 1);
+            
+            exec_file(candidate, command, envp);
+            if (first_error == 0 && errno != ENOENT && errno != ENOTDIR) {
+                first_error = errno;
+            }
+        }
+        
+        if (colon == NULL) {
+            break;
+        }
+        path = colon + 1;
+    }
+    
+    errno = first_error ? first_error : ENOENT;
+}
+
+int execute_external(char **command, const Builtin *builtin, char **assignments, int assign_count,
+                     int fd_read, int fd_write) {
     // Temporarily disable raw mode so child processes get normal terminal settings (cooked mode)
     int was_raw_mode = is_raw_mode_enabled();
     if (was_raw_mode) {
@@ -118,19 +244,27 @@ int execute_external(char **command, int fd_read, int fd_write) {
         }
 
         apply_io_redirection(command);
+        
+        // Overlay VAR=x prefixes on this child's copy of the environment
+        if (assign_count > 0) {
+            apply_command_assignments(assignments, assign_count);
+        }
 
         // Check if it's a builtin that can run in child (like pwd, echo in pipes)
-        if (is_builtin(command[0]) && !must_run_in_parent(command[0])) {
-            int result = execute_builtin(command);
-            exit(result);
+        if (builtin != NULL) {
+            int result = run_builtin(builtin, command);
+            // _exit: exit() would rewind the stdin buffer shared with the parent
+            fflush(stdout);
+            _exit(result);
         }
         
         // External command
-        if (execvp(command[0], command) == -1) {
-            perror("kord-sh");
-        }
+        exec_with_environment(command, get_environment());
+        int exec_errno = errno;
+        perror("kord-sh");
 
-        exit(EXIT_FAILURE);
+        // 127: command not found, 126: found but not executable
+        _exit(exec_errno == ENOENT ? 127 : 126);
     }
     else {
         // Parent process
@@ -152,9 +286,10 @@ int execute_external(char **command, int fd_read, int fd_write) {
         if (was_raw_mode) {
             enable_raw_mode();
         }
+        
+        // Exit status, or 128 + signal number as in other shells
+        return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
     }
-    
-    return 0;
 }
 
 void apply_io_redirection(char **command) {
@@ -170,13 +305,13 @@ void apply_io_redirection(char **command) {
         if (strcmp(command[read_idx], "<") == 0) {
             if (command[read_idx + 1] == NULL) {
                 fprintf(stderr, "kord-sh: syntax error: expected filename after '<'\n");
-                exit(EXIT_FAILURE);
+                _exit(EXIT_FAILURE);
             }
             
             int fd = open(command[read_idx + 1], O_RDONLY);
             if (fd == -1) {
                 perror(command[read_idx + 1]);
-                exit(EXIT_FAILURE);
+                _exit(EXIT_FAILURE);
             }
             
             dup2(fd, STDIN_FILENO);
@@ -188,13 +323,13 @@ void apply_io_redirection(char **command) {
         else if (strcmp(command[read_idx], ">>") == 0) {
             if (command[read_idx + 1] == NULL) {
                 fprintf(stderr, "kord-sh: syntax error: expected filename after '>>'\n");
-                exit(EXIT_FAILURE);
+                _exit(EXIT_FAILURE);
             }
             
             int fd = open(command[read_idx + 1], O_WRONLY | O_CREAT | O_APPEND, 0644);
             if (fd == -1) {
                 perror(command[read_idx + 1]);
-                exit(EXIT_FAILURE);
+                _exit(EXIT_FAILURE);
             }
             
             dup2(fd, STDOUT_FILENO);
@@ -206,13 +341,13 @@ void apply_io_redirection(char **command) {
         else if (strcmp(command[read_idx], ">") == 0) {
             if (command[read_idx + 1] == NULL) {
                 fprintf(stderr, "kord-sh: syntax error: expected filename after '>'\n");
-                exit(EXIT_FAILURE);
+                _exit(EXIT_FAILURE);
             }
             
             int fd = open(command[read_idx + 1], O_WRONLY | O_CREAT | O_TRUNC, 0644);
             if (fd == -1) {
                 perror(command[read_idx + 1]);
-                exit(EXIT_FAILURE);
+                _exit(EXIT_FAILURE);
             }
             
             dup2(fd, STDOUT_FILENO);
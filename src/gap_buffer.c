@@ -0,0 +1,143 @@
+#include "../include/common.h"
+#include "../include/gap_buffer.h"
+#include <stdint.h>
+
+int gb_init(GapBuffer *gb, size_t initial_capacity) {
+    if (initial_capacity < 16) {
+        initial_capacity = 16;
+    }
+    gb->data = malloc(initial_capacity);
+    if (gb->data == NULL) {
+        perror("malloc");
+        gb->capacity = gb->gap_start = gb->gap_end = 0;
+        return -1;
+    }
+    gb->capacity = initial_capacity;
+    gb->gap_start = 0;
+    gb->gap_end = initial_capacity;
+    return 0;
+}
+
+void gb_free(GapBuffer *gb) {
+    free(gb->data);
+    gb->data = NULL;
+    gb->capacity = gb->gap_start = gb->gap_end = 0;
+}
+
+size_t gb_length(const GapBuffer *gb) {
+    return gb->capacity - (gb->gap_end - gb->gap_start);
+}
+
+/**
+ * Move the gap so that it starts at byte offset pos of the text
+ */
+static void move_gap(GapBuffer *gb, size_t pos) {
+    if (pos < gb->gap_start) {
+        size_t n = gb->gap_start - pos;
+        memmove(gb->data + gb->gap_end - n, gb->data + pos, n);
+        gb->gap_start -= n;
+        gb->gap_end -= n;
+    } else if (pos > gb->gap_start) {
+        size_t n = pos - gb->gap_start;
+        memmove(gb->data + gb->gap_start, gb->data + gb->gap_end, n);
+        gb->gap_start += n;
+        gb->gap_end += n;
+    }
+}
+
+/**
+ * Make the gap at least need bytes long (doubling the capacity)
+ * Returns 0 on success, -1 on allocation failure
+ */
+static int reserve(GapBuffer *gb, size_t need) {
+    if (gb->gap_end - gb->gap_start >= need) {
+        return 0;
+    }
+
+    size_t length = gb_length(gb);
+    size_t new_capacity = gb->capacity ? gb->capacity : 16;
+    while (new_capacity - length < need) {
+        if (new_capacity > SIZE_MAX / 2) {
+            return -1;
+        }
+        new_capacity *= 2;
+    }
+
+    char *new_data = realloc(gb->data, new_capacity);
+    if (new_data == NULL) {
+        perror("realloc");
+        return -1;
+    }
+
+    // The text after the gap moves to the end of the larger block
+    size_t tail = gb->capacity - gb->gap_end;
+    memmove(new_data + new_capacity - tail, new_data + gb->gap_end, tail);
+    gb->data = new_data;
+    gb->gap_end = new_capacity - tail;
+    gb->capacity = new_capacity;
+    return 0;
+}
+
+int gb_insert(GapBuffer *gb, size_t pos, const char *text, size_t len) {
+    if (len == 0) {
+        return 0;
+    }
+    if (reserve(gb, len) != 0) {
+        return -1;
+    }
+
+    size_t length = gb_length(gb);
+    move_gap(gb, pos < length ? pos : length);
+    memcpy(gb->data + gb->gap_start, text, len);
+    gb->gap_start += len;
+    return 0;
+}
+
+void gb_delete(GapBuffer *gb, size_t pos, size_t count) {
+    size_t length = gb_length(gb);
+    if (pos >= length) {
+        return;
+    }
+    if (count > length - pos) {
+        count = length - pos;
+    }
+
+    move_gap(gb, pos);
+    gb->gap_end += count;
+}
+
+int gb_set(GapBuffer *gb, const char *text, size_t len) {
+    // Keep one byte spare for gb_text's terminator
+    size_t length = gb_length(gb);
+    if (len + 1 > length && reserve(gb, len + 1 - length) != 0) {
+        return -1;
+    }
+
+    gb->gap_start = 0;
+    gb->gap_end = gb->capacity;
+    memcpy(gb->data, text, len);
+    gb->gap_start = len;
+    return 0;
+}
+
+const char *gb_text(GapBuffer *gb) {
+    // The terminator goes in the gap, so the gap must not be empty
+    if (gb->gap_start == gb->gap_end && reserve(gb, 1) != 0) {
+        return NULL;
+    }
+
+    move_gap(gb, gb_length(gb));
+    gb->data[gb->gap_start] = '\0';
+    return gb->data;
+}
+
+char *gb_detach(GapBuffer *gb) {
+    if (gb_text(gb) == NULL) {
+        return NULL;
+    }
+
+    char *text = gb->data;
+    gb->data = NULL;
+    gb->capacity = gb->gap_start = gb->gap_end = 0;
+    return text;
+}
@@ -0,0 +1,197 @@
+#include "../include/common.h"
+#include "../include/hashtable.h"
+
+/* Marks a slot whose entry was removed; probing continues past it */
+static char tombstone_key;
+#define TOMBSTONE (&tombstone_key)
+
+/* Grow once live entries plus tombstones exceed 3/4 of the slots */
+#define HT_MAX_LOAD(cap) (((cap) >> 2) * 3)
+
+unsigned int hash_string(const char *key, size_t len) {
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)key[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+int ht_init(HashTable *ht, size_t initial_capacity) {
+    size_t capacity = 16;
+    while (capacity < initial_capacity) {
+        capacity <<= 1;
+    }
+
+    ht->entries = calloc(capacity, sizeof(HashEntry));
+    if (ht->entries == NULL) {
+        perror("calloc");
+        return -1;
+    }
+
+    ht->capacity = capacity;
+    ht->count = 0;
+    ht->used = 0;
+    return 0;
+}
+
+void ht_free(HashTable *ht, void (*free_value)(void *)) {
+    if (ht->entries == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < ht->capacity; i++) {
+        HashEntry *entry = &ht->entries[i];
+        if (entry->key != NULL && entry->key != TOMBSTONE) {
+            if (free_value != NULL) {
+                free_value(entry->value);
+            }
+            free(entry->key);
+        }
+    }
+
+    free(ht->entries);
+    ht->entries = NULL;
+    ht->capacity = 0;
+    ht->count = 0;
+    ht->used = 0;
+}
+
+/**
+ * Locate the slot for a key: either the live entry holding it, or the
+ * slot where it should be inserted (first tombstone seen, else the empty slot)
+ */
+static HashEntry *find_slot(const HashTable *ht, const char *key, size_t len, unsigned int hash) {
+    size_t mask = ht->capacity - 1;
+    size_t idx = hash & mask;
+    HashEntry *reuse = NULL;
+
+    while (1) {
+        HashEntry *entry = &ht->entries[idx];
+
+        if (entry->key == NULL) {
+            return reuse ? reuse : entry;
+        }
+
+        if (entry->key == TOMBSTONE) {
+            if (reuse == NULL) {
+                reuse = entry;
+            }
+        } else if (entry->hash == hash && entry->key_len == len && memcmp(entry->key, key, len) == 0) {
+            return entry;
+        }
+
+        idx = (idx + 1) & mask;
+    }
+}
+
+/**
+ * Rehash into a table of new_capacity slots, dropping tombstones
+ */
+static int ht_resize(HashTable *ht, size_t new_capacity) {
+    HashEntry *new_entries = calloc(new_capacity, sizeof(HashEntry));
+    if (new_entries == NULL) {
+        perror("calloc");
+        return -1;
+    }
+
+    size_t mask = new_capacity - 1;
+    for (size_t i = 0; i < ht->capacity; i++) {
+        HashEntry *entry = &ht->entries[i];
+        if (entry->key == NULL || entry->key == TOMBSTONE) {
+            continue;
+        }
+
+        size_t idx = entry->hash & mask;
+        while (new_entries[idx].key != NULL) {
+            idx = (idx + 1) & mask;
+        }
+        new_entries[idx] = *entry;
+    }
+
+    free(ht->entries);
+    ht->entries = new_entries;
+    ht->capacity = new_capacity;
+    ht->used = ht->count;
+    return 0;
+}
+
+HashEntry *ht_lookup(const HashTable *ht, const char *key, size_t len) {
+    if (ht->entries == NULL) {
+        return NULL;
+    }
+
+    HashEntry *entry = find_slot(ht, key, len, hash_string(key, len));
+    return (entry->key != NULL && entry->key != TOMBSTONE) ? entry : NULL;
+}
+
+HashEntry *ht_insert(HashTable *ht, const char *key, size_t len) {
+    if (ht->entries == NULL && ht_init(ht, 0) != 0) {
+        return NULL;
+    }
+
+    unsigned int hash = hash_string(key, len);
+    HashEntry *entry = find_slot(ht, key, len, hash);
+    if (entry->key != NULL && entry->key != TOMBSTONE) {
+        return entry;
+    }
+
+    if (ht->used + 1 > HT_MAX_LOAD(ht->capacity)) {
+        // Double only when live entries need it; otherwise just purge tombstones
+        size_t new_capacity = (ht->count + 1 > ht->capacity / 2) ? ht->capacity * 2 : ht->capacity;
+        if (ht_resize(ht, new_capacity) != 0) {
+            return NULL;
+        }
+        entry = find_slot(ht, key, len, hash);
+    }
+
+    char *interned = malloc(len + 1);
+    if (interned == NULL) {
+        perror("malloc");
+        return NULL;
+    }
+    memcpy(interned, key, len);
+    interned[len] = '\0';
+
+    if (entry->key == NULL) {
+        ht->used++;
+    }
+    entry->key = interned;
+    entry->key_len = len;
+    entry->hash = hash;
+    entry->value = NULL;
+    ht->count++;
+
+    return entry;
+}
+
+void *ht_remove(HashTable *ht, const char *key, size_t len) {
+    HashEntry *entry = ht_lookup(ht, key, len);
+    if (entry == NULL) {
+        return NULL;
+    }
+
+    void *value = entry->value;
+    free(entry->key);
+    entry->key = TOMBSTONE;
+    entry->key_len = 0;
+    entry->value = NULL;
+    ht->count--;
+
+    return value;
+}
+
+void *ht_get(const HashTable *ht, const char *key) {
+    HashEntry *entry = ht_lookup(ht, key, strlen(key));
+    return entry ? entry->value : NULL;
+}
+
+HashEntry *ht_next(const HashTable *ht, size_t *pos) {
+    while (*pos < ht->capacity) {
+        HashEntry *entry = &ht->entries[(*pos)++];
+        if (entry->key != NULL && entry->key != TOMBSTONE) {
+            return entry;
+        }
+    }
+    return NULL;
+}
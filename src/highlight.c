@@ -0,0 +1,275 @@
+#include "../include/common.h"
+#include "../include/highlight.h"
+#include "../include/render.h"
+#include "../include/builtins.h"
+#include "../include/aliases.h"
+#include "../include/command_index.h"
+
+/* Lexer state between tokens */
+#define LEX_COMMAND  0x01    // the next word is in command position
+#define LEX_REDIRECT 0x02    // the next word is the target of a redirection
+
+/* Command names up to this long are looked up without an allocation */
+#define COMMAND_NAME_MAX 256
+
+/* Start of a token, with the lexer state before it */
+typedef struct {
+    size_t offset;
+    unsigned char state;
+} Boundary;
+
+/* The previously styled line */
+static char *line_text = NULL;
+static unsigned char *line_styles = NULL;
+static size_t line_len = 0;
+static size_t line_capacity = 0;
+
+/* Token starts of the previous line, and room to lex the edited region into */
+static Boundary *bounds = NULL;
+static Boundary *spare_bounds = NULL;
+static size_t bound_count = 0;
+
+/**
+ * Make room for a line of len bytes (len + 1 token starts), keeping the
+ * previous line
+ * Returns 0 on success, -1 on allocation failure
+ */
+static int reserve(size_t len) {
+    if (len + 1 < line_capacity) {
+        return 0;
+    }
+
+    size_t new_capacity = line_capacity ? line_capacity : 256;
+    while (new_capacity <= len + 1) {
+        new_capacity *= 2;
+    }
+    char *new_text = realloc(line_text, new_capacity);
+    if (new_text != NULL) {
+        line_text = new_text;
+    }
+    unsigned char *new_styles = new_text ? realloc(line_styles, new_capacity) : NULL;
+    if (new_styles != NULL) {
+        line_styles = new_styles;
+    }
+    Boundary *new_bounds = new_styles ? realloc(bounds, new_capacity * sizeof(Boundary)) : NULL;
+    if (new_bounds != NULL) {
+        bounds = new_bounds;
+    }
+    Boundary *new_spare = new_bounds ? realloc(spare_bounds, new_capacity * sizeof(Boundary)) : NULL;
+    if (new_spare == NULL) {
+        perror("realloc");
+        return -1;
+    }
+    spare_bounds = new_spare;
+    line_capacity = new_capacity;
+    return 0;
+}
+
+/**
+ * Whether word[0..len) is a NAME=value assignment (which keeps the next
+ * word in command position)
+ */
+static int is_assignment(const char *word, size_t len) {
+    if (len == 0 || !(isalpha((unsigned char)word[0]) || word[0] == '_')) {
+        return 0;
+    }
+    for (size_t i = 1; i < len; i++) {
+        if (word[i] == '=') {
+            return 1;
+        }
+        if (!(isalnum((unsigned char)word[i]) || word[i] == '_')) {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Style of a command word: what the name resolves to
+ */
+static unsigned char command_style(const char *word, size_t len) {
+    char buffer[COMMAND_NAME_MAX];
+    char *name = len < sizeof(buffer) ? buffer : malloc(len + 1);
+    if (name == NULL) {
+        return STYLE_PLAIN;
+    }
+    memcpy(name, word, len);
+    name[len] = '\0';
+
+    unsigned char style;
+    if (memchr(name, '/', len) != NULL) {
+        struct stat st;
+        int runnable = stat(name, &st) == 0 && S_ISREG(st.st_mode) && access(name, X_OK) == 0;
+        style = runnable ? STYLE_COMMAND : STYLE_UNKNOWN_COMMAND;
+    } else if (is_builtin(name)) {
+        style = STYLE_BUILTIN;
+    } else if (get_alias(name) != NULL) {
+        style = STYLE_ALIAS;
+    } else {
+        int found = command_exists(name, len);
+        style = found > 0 ? STYLE_COMMAND : (found == 0 ? STYLE_UNKNOWN_COMMAND : STYLE_PLAIN);
+    }
+
+    if (name != buffer) {
+        free(name);
+    }
+    return style;
+}
+
+/**
+ * Style the token of text starting at pos, updating the lexer state
+ * Returns the offset just past the token
+ */
+static size_t lex_token(const char *text, size_t len, size_t pos, unsigned char *state) {
+    size_t start = pos;
+
+    if (isspace((unsigned char)text[pos])) {
+        while (pos < len && isspace((unsigned char)text[pos])) {
+            pos++;
+        }
+        memset(line_styles + start, STYLE_PLAIN, pos - start);
+        return pos;
+    }
+    if (text[pos] == '|') {
+        line_styles[pos] = STYLE_REDIRECT;
+        *state = LEX_COMMAND;
+        return pos + 1;
+    }
+
+    // A word: quoted parts may hold blanks and pipes, and so may "${...}"
+    int quoted = 0;
+    int expanded = 0;
+    while (pos < len && !isspace((unsigned char)text[pos]) && text[pos] != '|') {
+        char c = text[pos];
+        size_t part = pos;
+        if (c == '\'' || c == '"') {
+            quoted = 1;
+            pos++;
+            while (pos < len && text[pos] != c) {
+                pos++;
+            }
+            if (pos < len) pos++;
+            memset(line_styles + part, STYLE_STRING, pos - part);
+            continue;
+        }
+        if (c == '$') {
+            expanded = 1;
+            if (pos + 1 < len && text[pos + 1] == '{') {
+                while (pos < len && text[pos] != '}') {
+                    pos++;
+                }
+                if (pos < len) pos++;
+                memset(line_styles + part, STYLE_PLAIN, pos - part);
+                continue;
+            }
+        }
+        line_styles[pos++] = STYLE_PLAIN;
+    }
+
+    const char *word = text + start;
+    size_t word_len = pos - start;
+    if (!quoted && ((word_len == 1 && (word[0] == '<' || word[0] == '>')) ||
+                    (word_len == 2 && word[0] == '>' && word[1] == '>'))) {
+        memset(line_styles + start, STYLE_REDIRECT, word_len);
+        *state |= LEX_REDIRECT;
+    } else if (*state & LEX_REDIRECT) {
+        *state &= ~LEX_REDIRECT;
+    } else if (*state & LEX_COMMAND) {
+        // Leading assignments only apply to the command's environment
+        if (!is_assignment(word, word_len)) {
+            *state = 0;
+            if (!quoted && !expanded) {
+                memset(line_styles + start, command_style(word, word_len), word_len);
+            }
+        }
+    }
+    return pos;
+}
+
+const unsigned char *highlight_line(const char *text, size_t len) {
+    if (reserve(len > line_len ? len : line_len) != 0) {
+        return NULL;
+    }
+
+    // Bytes unchanged since the previous line, at the start and at the end
+    size_t shortest = len < line_len ? len : line_len;
+    size_t prefix = 0;
+    while (prefix < shortest && text[prefix] == line_text[prefix]) {
+        prefix++;
+    }
+    if (prefix == len && len == line_len) {
+        return line_styles;
+    }
+    size_t suffix = 0;
+    while (suffix < shortest - prefix && text[len - 1 - suffix] == line_text[line_len - 1 - suffix]) {
+        suffix++;
+    }
+
+    // Restart at the token holding the last unchanged byte before the edit
+    size_t k = 0;
+    size_t lo = 0, hi = bound_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (bounds[mid].offset < prefix) {
+            k = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    size_t pos = bound_count > 0 ? bounds[k].offset : 0;
+    unsigned char state = bound_count > 0 ? bounds[k].state : LEX_COMMAND;
+
+    // The unchanged tail keeps its styles, shifted to where it now sits
+    memmove(line_styles + len - suffix, line_styles + line_len - suffix, suffix);
+
+    // Lex until a token starts in the unchanged tail in the same state as
+    // it did before: from there on, nothing differs
+    size_t lexed = 0;
+    size_t j = k;
+    int synced = 0;
+    while (pos < len) {
+        if (pos >= len - suffix) {
+            while (j < bound_count && bounds[j].offset + len < pos + line_len) {
+                j++;
+            }
+            if (j < bound_count && bounds[j].offset + len == pos + line_len && bounds[j].state == state) {
+                synced = 1;
+                break;
+            }
+        }
+        spare_bounds[lexed].offset = pos;
+        spare_bounds[lexed].state = state;
+        lexed++;
+        pos = lex_token(text, len, pos, &state);
+    }
+
+    size_t tail = synced ? bound_count - j : 0;
+    memmove(bounds + k + lexed, bounds + j, tail * sizeof(Boundary));
+    for (size_t t = k + lexed; t < k + lexed + tail; t++) {
+        bounds[t].offset = bounds[t].offset + len - line_len;
+    }
+    memcpy(bounds + k, spare_bounds, lexed * sizeof(Boundary));
+    bound_count = k + lexed + tail;
+
+    memcpy(line_text, text, len);
+    line_len = len;
+    return line_styles;
+}
+
+void highlight_reset(void) {
+    line_len = 0;
+    bound_count = 0;
+}
+
+void cleanup_highlight(void) {
+    free(line_text);
+    free(line_styles);
+    free(bounds);
+    free(spare_bounds);
+    line_text = NULL;
+    line_styles = NULL;
+    bounds = NULL;
+    spare_bounds = NULL;
+    line_len = line_capacity = bound_count = 0;
+}
@@ -1,18 +1,81 @@
 #include "../include/common.h"
 #include "../include/history.h"
+#include "../include/builtins.h"
+#include "../include/variables.h"
+#include "../include/hashtable.h"
+#include "../include/suggest.h"
+#include <stdint.h>
+#include <errno.h>
+#include <sys/file.h>
+#include <sys/uio.h>
 
+/* Command strings are packed into arena chunks of this size */
+#define HISTORY_CHUNK_SIZE 65536
+
+/* Initial number of ring slots; the ring doubles up to the history limit */
+#define HISTORY_RING_INITIAL 256
+
+/* Erased entries are squeezed out once they are this many and half the ring */
+#define HISTORY_COMPACT_MIN 64
+
+/* The history file is fdatasync'ed every this many entries or seconds */
+#define HISTORY_SYNC_BATCH 16
+#define HISTORY_SYNC_INTERVAL 2
+
+/* The history file is compacted in the background once it has at least
+ * this many lines and twice the history limit */
+#define HISTORY_FILE_COMPACT_MIN 1000
+
+/* HISTCONTROL flags */
+#define HISTCONTROL_IGNORESPACE 0x1
+#define HISTCONTROL_ERASEDUPS   0x2
+
+/**
+ * Arena chunk holding command strings
+ * Freed once no entry points into it any more (and it is not the one being filled)
+ */
 typedef struct {
-    char *command;
+    size_t used;
+    size_t size;
+    size_t live;         // entries whose command lives in this chunk
+    char data[];
+} HistoryChunk;
+
+typedef struct {
+    char *command;       // NULL once erased as a duplicate
+    HistoryChunk *chunk;
 } HistoryEntry;
 
-static HistoryEntry history[MAX_HISTORY];
-static int history_count = 0;
+/* Ring buffer: entry i (0 = oldest) lives in slot (ring_head + i) & (ring_capacity - 1) */
+static HistoryEntry *ring = NULL;
+static size_t ring_capacity = 0;
+static size_t ring_head = 0;
+static size_t ring_count = 0;        // entries in the ring, erased ones included
+static size_t erased_count = 0;
+static uint64_t head_seq = 0;        // sequence number of entry 0; grows on eviction
+static unsigned int history_generation = 0;  // bumped when sequence numbers are reassigned
+
+static HistoryChunk *current_chunk = NULL;
+
+/* command -> sequence number + 1 of its entry; only kept while erasedups is on */
+static HashTable dedup_index;
+static int dedup_index_valid = 0;
+
+/* Append-only ~/.kord_history, shared with other sessions */
+static int history_fd = -1;
+static off_t file_offset = 0;        // bytes of the file already merged into memory
+static size_t file_lines = 0;        // lines in the file, as far as we know
+static int unsynced_entries = 0;
+static time_t last_sync = 0;
+static pid_t compactor_pid = -1;
+
+#define RING_SLOT(i) (&ring[(ring_head + (i)) & (ring_capacity - 1)])
 
 /**
  * Get home directory path
  */
 static const char *get_home_dir(void) {
-    const char *home = getenv("HOME");
+    const char *home = get_variable("HOME");
     if (home == NULL) {
         home = ".";  // Fallback to current directory
     }
@@ -27,126 +90,728 @@ static void get_history_path(char *buffer, size_t size) {
     snprintf(buffer, size, "%s/.kord_history", home);
 }
 
-void init_history(void) {
-    // Initialize history array
-    for (int i = 0; i < MAX_HISTORY; i++) {
-        history[i].command = NULL;
+/**
+ * Maximum number of live entries: $HISTSIZE, DEFAULT_HISTORY_SIZE if unset,
+ * unlimited if negative
+ */
+static size_t history_limit(void) {
+    const char *value = get_variable("HISTSIZE");
+    if (value == NULL || value[0] == '\0') {
+        return DEFAULT_HISTORY_SIZE;
     }
-    history_count = 0;
-    
-    // Load history from .kord_history file
-    char history_path[1024];
-    get_history_path(history_path, sizeof(history_path));
-    
-    FILE *file = fopen(history_path, "r");
-    if (file == NULL) {
-        // File doesn't exist, that's okay
+
+    char *end;
+    long long limit = strtoll(value, &end, 10);
+    if (*end != '\0') {
+        return DEFAULT_HISTORY_SIZE;
+    }
+    return limit < 0 ? SIZE_MAX : (size_t)limit;
+}
+
+/**
+ * Parse $HISTCONTROL (colon-separated: ignorespace, ignoredups, ignoreboth, erasedups)
+ * Consecutive duplicates are always skipped
+ */
+static int history_control(void) {
+    const char *value = get_variable("HISTCONTROL");
+    if (value == NULL) {
+        return 0;
+    }
+
+    int flags = 0;
+    while (*value) {
+        size_t len = strcspn(value, ":");
+        if ((len == 11 && strncmp(value, "ignorespace", len) == 0) ||
+            (len == 10 && strncmp(value, "ignoreboth", len) == 0)) {
+            flags |= HISTCONTROL_IGNORESPACE;
+        } else if (len == 9 && strncmp(value, "erasedups", len) == 0) {
+            flags |= HISTCONTROL_ERASEDUPS;
+        }
+        value += len;
+        if (*value == ':') value++;
+    }
+    return flags;
+}
+
+/**
+ * Copy a command into the arena
+ * Returns the stored string (and its chunk in *chunk_out), or NULL on failure
+ */
+static char *arena_store(const char *command, size_t len, HistoryChunk **chunk_out) {
+    if (current_chunk == NULL || current_chunk->size - current_chunk->used < len + 1) {
+        // Retire the full chunk; it is freed once its last entry goes away
+        if (current_chunk != NULL && current_chunk->live == 0) {
+            free(current_chunk);
+        }
+
+        size_t size = len + 1 > HISTORY_CHUNK_SIZE ? len + 1 : HISTORY_CHUNK_SIZE;
+        current_chunk = malloc(sizeof(HistoryChunk) + size);
+        if (current_chunk == NULL) {
+            perror("malloc");
+            return NULL;
+        }
+        current_chunk->used = 0;
+        current_chunk->size = size;
+        current_chunk->live = 0;
+    }
+
+    char *stored = current_chunk->data + current_chunk->used;
+    memcpy(stored, command, len);
+    stored[len] = '\0';
+    current_chunk->used += len + 1;
+    current_chunk->live++;
+
+    *chunk_out = current_chunk;
+    return stored;
+}
+
+/**
+ * Drop an entry's reference to its arena chunk
+ */
+static void entry_release(HistoryEntry *entry) {
+    if (entry->command == NULL) {
         return;
     }
-    
-    char line[1024];
-    while (fgets(line, sizeof(line), file) && history_count < MAX_HISTORY) {
-        // Remove trailing newline
-        line[strcspn(line, "\n")] = '\0';
-        
-        // Skip empty lines
-        if (line[0] == '\0') {
+
+    HistoryChunk *chunk = entry->chunk;
+    if (--chunk->live == 0 && chunk != current_chunk) {
+        free(chunk);
+    }
+    entry->command = NULL;
+    entry->chunk = NULL;
+}
+
+/**
+ * Mark entry index as erased (its slot stays until the next compaction)
+ */
+static void erase_entry(size_t index) {
+    HistoryEntry *entry = RING_SLOT(index);
+    if (entry->command != NULL) {
+        entry_release(entry);
+        erased_count++;
+    }
+}
+
+/**
+ * Double the ring, unwrapping it so that entry 0 is in slot 0
+ * Returns 0 on success, -1 on allocation failure
+ */
+static int ring_grow(void) {
+    size_t new_capacity = ring_capacity ? ring_capacity * 2 : HISTORY_RING_INITIAL;
+    HistoryEntry *new_ring = malloc(new_capacity * sizeof(HistoryEntry));
+    if (new_ring == NULL) {
+        perror("malloc");
+        return -1;
+    }
+
+    for (size_t i = 0; i < ring_count; i++) {
+        new_ring[i] = *RING_SLOT(i);
+    }
+
+    free(ring);
+    ring = new_ring;
+    ring_capacity = new_capacity;
+    ring_head = 0;
+    return 0;
+}
+
+/**
+ * Remove the oldest entry
+ */
+static void evict_oldest(void) {
+    HistoryEntry *entry = RING_SLOT(0);
+    if (entry->command == NULL) {
+        erased_count--;
+    } else {
+        if (dedup_index_valid) {
+            HashEntry *hit = ht_lookup(&dedup_index, entry->command, strlen(entry->command));
+            if (hit != NULL && (uint64_t)(uintptr_t)hit->value - 1 == head_seq) {
+                ht_remove(&dedup_index, entry->command, strlen(entry->command));
+            }
+        }
+        entry_release(entry);
+    }
+
+    ring_head = (ring_head + 1) & (ring_capacity - 1);
+    ring_count--;
+    head_seq++;
+}
+
+/**
+ * Append an entry, evicting the oldest ones beyond the history limit
+ * Returns 0 on success, -1 on failure
+ */
+static int append_entry(const char *command, size_t len) {
+    size_t limit = history_limit();
+    if (limit == 0) {
+        return 0;
+    }
+
+    while (ring_count > 0 && ring_count - erased_count >= limit) {
+        evict_oldest();
+    }
+
+    if (ring_count == ring_capacity && ring_grow() != 0) {
+        return -1;
+    }
+
+    HistoryEntry *entry = RING_SLOT(ring_count);
+    entry->command = arena_store(command, len, &entry->chunk);
+    if (entry->command == NULL) {
+        return -1;
+    }
+    ring_count++;
+
+    if (dedup_index_valid) {
+        HashEntry *hit = ht_insert(&dedup_index, command, len);
+        if (hit != NULL) {
+            hit->value = (void *)(uintptr_t)(head_seq + ring_count);
+        }
+    }
+    return 0;
+}
+
+/**
+ * Build the command -> entry index used by erasedups, erasing older duplicates
+ */
+static void build_dedup_index(void) {
+    if (ht_init(&dedup_index, ring_count * 2) != 0) {
+        return;
+    }
+    dedup_index_valid = 1;
+
+    for (size_t i = 0; i < ring_count; i++) {
+        HistoryEntry *entry = RING_SLOT(i);
+        if (entry->command == NULL) {
             continue;
         }
-        
-        // Add to history
-        history[history_count].command = strdup(line);
-        if (history[history_count].command != NULL) {
-            history_count++;
+
+        HashEntry *hit = ht_insert(&dedup_index, entry->command, strlen(entry->command));
+        if (hit == NULL) {
+            continue;
+        }
+        if (hit->value != NULL) {
+            erase_entry((size_t)((uint64_t)(uintptr_t)hit->value - 1 - head_seq));
         }
+        hit->value = (void *)(uintptr_t)(head_seq + i + 1);
     }
-    
-    fclose(file);
 }
 
-void cleanup_history(void) {
-    // Save history to file
-    char history_path[1024];
+/**
+ * Squeeze erased entries out of the ring once they make up half of it
+ * Amortized O(1) per erased entry
+ */
+static void maybe_compact(void) {
+    if (erased_count < HISTORY_COMPACT_MIN || erased_count * 2 < ring_count) {
+        return;
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < ring_count; i++) {
+        HistoryEntry *entry = RING_SLOT(i);
+        if (entry->command != NULL) {
+            *RING_SLOT(kept) = *entry;
+            kept++;
+        }
+    }
+    ring_count = kept;
+    erased_count = 0;
+    history_generation++;
+
+    // Sequence numbers changed; the index is rebuilt on next use
+    if (dedup_index_valid) {
+        ht_free(&dedup_index, NULL);
+        dedup_index_valid = 0;
+    }
+}
+
+/**
+ * Store a command in memory, applying HISTCONTROL erasedups and the
+ * consecutive-duplicate rule
+ * Returns 1 if the command was stored, 0 if it was skipped
+ */
+static int remember_command(const char *command, size_t len, int flags) {
+    // Don't add duplicate consecutive entries
+    int newest = find_history_entry((int)ring_count - 1, -1);
+    if (newest >= 0 && strcmp(RING_SLOT(newest)->command, command) == 0) {
+        return 0;
+    }
+
+    if (flags & HISTCONTROL_ERASEDUPS) {
+        if (!dedup_index_valid) {
+            build_dedup_index();
+        }
+        HashEntry *hit = dedup_index_valid ? ht_lookup(&dedup_index, command, len) : NULL;
+        if (hit != NULL) {
+            erase_entry((size_t)((uint64_t)(uintptr_t)hit->value - 1 - head_seq));
+        }
+    } else if (dedup_index_valid) {
+        // erasedups was switched off: stop paying for the index
+        ht_free(&dedup_index, NULL);
+        dedup_index_valid = 0;
+    }
+
+    int stored = append_entry(command, len) == 0;
+    maybe_compact();
+    return stored;
+}
+
+/**
+ * Open ~/.kord_history for appending
+ * Returns 0 on success, -1 on failure
+ */
+static int open_history_file(void) {
+    char history_path[PATH_MAX];
     get_history_path(history_path, sizeof(history_path));
-    
-    FILE *file = fopen(history_path, "w");
-    if (file != NULL) {
-        for (int i = 0; i < history_count; i++) {
-            if (history[i].command != NULL) {
-                fprintf(file, "%s\n", history[i].command);
+
+    history_fd = open(history_path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    file_offset = 0;
+    file_lines = 0;
+    return history_fd == -1 ? -1 : 0;
+}
+
+/**
+ * Read up to size bytes of fd at offset, retrying short reads
+ * Returns the number of bytes read
+ */
+static size_t pread_all(int fd, char *data, size_t size, off_t offset) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = pread(fd, data + done, size - done, offset + (off_t)done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        done += (size_t)n;
+    }
+    return done;
+}
+
+/**
+ * Merge complete lines appended to the file since file_offset
+ * Lock-free: a line still being written (no '\n' yet) is left for next time
+ * Returns the number of entries read
+ */
+static int import_new_lines(void) {
+    struct stat st;
+    if (history_fd == -1 || fstat(history_fd, &st) != 0 || st.st_size <= file_offset) {
+        return 0;
+    }
+
+    size_t size = (size_t)(st.st_size - file_offset);
+    char *data = malloc(size);
+    if (data == NULL) {
+        perror("malloc");
+        return 0;
+    }
+
+    size_t done = pread_all(history_fd, data, size, file_offset);
+
+    int flags = history_control();
+    int imported = 0;
+    size_t pos = 0;
+    while (pos < done) {
+        char *newline = memchr(data + pos, '\n', done - pos);
+        if (newline == NULL) {
+            break;
+        }
+
+        size_t len = (size_t)(newline - (data + pos));
+        *newline = '\0';
+        if (len > 0 && data[pos + len - 1] == '\r') {
+            data[pos + --len] = '\0';
+        }
+
+        // Skip empty lines
+        if (len > 0) {
+            imported += remember_command(data + pos, len, flags);
+            suggest_add(data + pos, NULL);
+        }
+        file_lines++;
+        pos = (size_t)(newline - data) + 1;
+    }
+
+    file_offset += (off_t)pos;
+    free(data);
+    return imported;
+}
+
+/**
+ * Length of the start of new_fd's file that the compactor copied from the
+ * end of the old file (its first old_size bytes): the longest run of whole
+ * lines that the old file ends with
+ * Lines past it were appended by other shells after the compaction
+ */
+static off_t compacted_length(int old_fd, off_t old_size, int new_fd) {
+    struct stat st;
+    if (fstat(new_fd, &st) != 0) {
+        return 0;
+    }
+    size_t size = (size_t)(st.st_size < old_size ? st.st_size : old_size);
+    char *new_data = malloc(size ? size : 1);
+    char *old_tail = malloc(size ? size : 1);
+    size_t length = 0;
+    if (new_data != NULL && old_tail != NULL &&
+        pread_all(new_fd, new_data, size, 0) == size &&
+        pread_all(old_fd, old_tail, size, old_size - (off_t)size) == size) {
+        for (length = size; length > 0; length--) {
+            if (new_data[length - 1] == '\n' && memcmp(new_data, old_tail + size - length, length) == 0) {
+                break;
             }
         }
-        fclose(file);
     }
-    
-    // Free memory
-    for (int i = 0; i < MAX_HISTORY; i++) {
-        if (history[i].command != NULL) {
-            free(history[i].command);
-            history[i].command = NULL;
+    free(new_data);
+    free(old_tail);
+    return (off_t)length;
+}
+
+/**
+ * Check whether ~/.kord_history was replaced (compacted) since we opened it
+ * If so, merge what is left of the old file, then switch to the new one,
+ * skipping the part copied from the old file but not what other shells
+ * appended to it since
+ * Returns 1 if the file was reopened, 0 otherwise
+ */
+static int reopen_if_replaced(void) {
+    char history_path[PATH_MAX];
+    get_history_path(history_path, sizeof(history_path));
+
+    struct stat path_st, fd_st;
+    if (stat(history_path, &path_st) != 0 || fstat(history_fd, &fd_st) != 0 ||
+        (path_st.st_ino == fd_st.st_ino && path_st.st_dev == fd_st.st_dev)) {
+        return 0;
+    }
+
+    // Lines other shells appended before the compaction, not merged yet
+    import_new_lines();
+
+    int old_fd = history_fd;
+    off_t old_size = file_offset;
+    if (open_history_file() != 0) {
+        close(old_fd);
+        return 1;
+    }
+    file_offset = compacted_length(old_fd, old_size, history_fd);
+    file_lines = ring_count - erased_count;
+    close(old_fd);
+    return 1;
+}
+
+/**
+ * Take the exclusive lock that serializes writers (and the compactor)
+ * Returns 0 on success, -1 on failure
+ */
+static int lock_history_file(void) {
+    while (history_fd != -1) {
+        if (flock(history_fd, LOCK_EX) != 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+
+        // The compactor may have renamed a new file into place while we waited
+        if (!reopen_if_replaced()) {
+            return 0;
         }
     }
-    history_count = 0;
+    return -1;
 }
 
-void add_history(const char *command) {
-    if (command == NULL || command[0] == '\0') {
+/**
+ * Rewrite the history file keeping only its last `limit` lines
+ * Runs in a forked child; holds the writers' lock for the whole rewrite
+ */
+static void compact_history_file(size_t limit) {
+    char history_path[PATH_MAX];
+    get_history_path(history_path, sizeof(history_path));
+
+    // A fresh open file description: the inherited one shares the parent's lock
+    int fd = open(history_path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
         return;
     }
-    
-    // Don't add duplicate consecutive entries
-    if (history_count > 0 && history[history_count - 1].command != NULL) {
-        if (strcmp(history[history_count - 1].command, command) == 0) {
+    while (flock(fd, LOCK_EX) != 0) {
+        if (errno != EINTR) {
+            close(fd);
             return;
         }
     }
-    
-    // If history is full, remove oldest entry
-    if (history_count >= MAX_HISTORY) {
-        if (history[0].command != NULL) {
-            free(history[0].command);
+
+    struct stat st;
+    FILE *file = fdopen(fd, "r");
+    if (file == NULL || fstat(fd, &st) != 0) {
+        close(fd);
+        return;
+    }
+
+    // Offsets of the line starts, kept in a ring of limit + 1 slots
+    size_t slots = limit + 1;
+    off_t *starts = malloc(slots * sizeof(off_t));
+    if (starts == NULL) {
+        fclose(file);
+        return;
+    }
+    size_t lines = 0;
+    off_t offset = 0;
+    int c, at_line_start = 1;
+    while ((c = getc_unlocked(file)) != EOF) {
+        if (at_line_start) {
+            starts[lines++ % slots] = offset;
+            at_line_start = 0;
+        }
+        if (c == '\n') {
+            at_line_start = 1;
         }
-        
-        // Shift all entries down
-        for (int i = 0; i < MAX_HISTORY - 1; i++) {
-            history[i].command = history[i + 1].command;
+        offset++;
+    }
+
+    if (lines > limit) {
+        off_t keep_from = starts[(lines - limit) % slots];
+        char tmp_path[PATH_MAX + 32];
+        snprintf(tmp_path, sizeof(tmp_path), "%s.%ld.tmp", history_path, (long)getpid());
+
+        int out = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (out != -1) {
+            char buffer[65536];
+            int ok = 1;
+            off_t pos = keep_from;
+            ssize_t n;
+            while ((n = pread(fd, buffer, sizeof(buffer), pos)) > 0) {
+                if (write(out, buffer, (size_t)n) != n) {
+                    ok = 0;
+                    break;
+                }
+                pos += n;
+            }
+
+            if (n < 0 || fsync(out) != 0) {
+                ok = 0;
+            }
+            if (close(out) != 0 || !ok || rename(tmp_path, history_path) != 0) {
+                unlink(tmp_path);
+            }
+        }
+    }
+
+    free(starts);
+    fclose(file);  // Also releases the lock
+}
+
+/**
+ * Fork a background compaction once the file holds twice the history limit
+ */
+static void maybe_start_compaction(void) {
+    if (compactor_pid > 0 && waitpid(compactor_pid, NULL, WNOHANG) != 0) {
+        compactor_pid = -1;
+    }
+
+    size_t limit = history_limit();
+    if (compactor_pid > 0 || limit == SIZE_MAX || file_lines < HISTORY_FILE_COMPACT_MIN ||
+        file_lines / 2 < limit) {
+        return;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        // Ctrl+C at the prompt must not interrupt the rewrite
+        signal(SIGINT, SIG_IGN);
+        compact_history_file(limit);
+        _exit(EXIT_SUCCESS);
+    }
+    if (pid > 0) {
+        compactor_pid = pid;
+        file_lines = limit;
+    }
+}
+
+/**
+ * Append one entry to the history file; the caller holds the lock and has
+ * merged other sessions' entries, so file_offset stays exact
+ * The write is a single O_APPEND writev()
+ */
+static void append_to_file(const char *command, size_t len) {
+    struct iovec parts[2] = {
+        {(void *)command, len},
+        {"\n", 1},
+    };
+    ssize_t written = writev(history_fd, parts, 2);
+    if (written == (ssize_t)(len + 1)) {
+        file_offset += written;
+        file_lines++;
+    }
+
+    // Batched fsync: at most one per HISTORY_SYNC_BATCH entries or HISTORY_SYNC_INTERVAL seconds
+    time_t now = time(NULL);
+    if (++unsynced_entries >= HISTORY_SYNC_BATCH || now - last_sync >= HISTORY_SYNC_INTERVAL) {
+        fdatasync(history_fd);
+        unsynced_entries = 0;
+        last_sync = now;
+    }
+}
+
+void init_history(void) {
+    // Load history from .kord_history file
+    if (open_history_file() != 0) {
+        return;
+    }
+
+    last_sync = time(NULL);
+    import_new_lines();
+}
+
+void cleanup_history(void) {
+    // Entries are already on disk; only flush what is still unsynced
+    if (history_fd != -1) {
+        if (unsynced_entries > 0) {
+            fdatasync(history_fd);
+            unsynced_entries = 0;
         }
-        history[MAX_HISTORY - 1].command = NULL;
-        history_count--;
+        close(history_fd);
+        history_fd = -1;
     }
-    
-    // Add new entry
-    history[history_count].command = strdup(command);
-    if (history[history_count].command != NULL) {
-        history_count++;
+
+    // Free memory
+    while (ring_count > 0) {
+        evict_oldest();
     }
+    free(ring);
+    ring = NULL;
+    ring_capacity = 0;
+    ring_head = 0;
+    erased_count = 0;
+    history_generation++;
+
+    free(current_chunk);
+    current_chunk = NULL;
+
+    if (dedup_index_valid) {
+        ht_free(&dedup_index, NULL);
+        dedup_index_valid = 0;
+    }
+}
+
+int history_ignores(const char *command) {
+    return (history_control() & HISTCONTROL_IGNORESPACE) && command[0] == ' ';
+}
+
+void add_history(const char *command) {
+    if (command == NULL || command[0] == '\0') {
+        return;
+    }
+
+    if (history_ignores(command)) {
+        return;
+    }
+    int flags = history_control();
+
+    // Pick up other sessions' entries first so ours lands after them
+    int locked = (lock_history_file() == 0);
+    if (locked) {
+        import_new_lines();
+    }
+
+    size_t len = strlen(command);
+    if (remember_command(command, len, flags) && locked) {
+        append_to_file(command, len);
+    }
+
+    suggest_add(command, get_current_directory());
+
+    if (locked) {
+        flock(history_fd, LOCK_UN);
+        maybe_start_compaction();
+    }
+}
+
+int read_new_history(void) {
+    if (history_fd == -1) {
+        return 0;
+    }
+    reopen_if_replaced();
+    return import_new_lines();
 }
 
 const char *get_history(int index) {
-    if (index < 0 || index >= history_count) {
+    if (index < 0 || (size_t)index >= ring_count) {
         return NULL;
     }
-    
-    return history[index].command;
+
+    return RING_SLOT(index)->command;
 }
 
 int get_history_count(void) {
-    return history_count;
+    return (int)ring_count;
+}
+
+uint64_t get_history_base_seq(void) {
+    return head_seq;
+}
+
+unsigned int get_history_generation(void) {
+    return history_generation;
+}
+
+int find_history_entry(int index, int direction) {
+    while (index >= 0 && (size_t)index < ring_count) {
+        if (RING_SLOT(index)->command != NULL) {
+            return index;
+        }
+        index += direction;
+    }
+    return -1;
 }
 
 void move_history_to_latest(int index) {
-    if (index < 0 || index >= history_count) {
+    if (index < 0 || (size_t)index >= ring_count || RING_SLOT(index)->command == NULL) {
+        return;
+    }
+
+    // Re-append a copy, then erase the original; appending may evict it,
+    // so the string is copied out of the arena first
+    char *command = strdup(RING_SLOT(index)->command);
+    if (command == NULL) {
+        perror("strdup");
         return;
     }
-    
-    // Save the command at the index
-    char *command = history[index].command;
-    
-    // Shift all entries after index down by one
-    for (int i = index; i < history_count - 1; i++) {
-        history[i].command = history[i + 1].command;
-    }
-    
-    // Place the saved command at the end
-    history[history_count - 1].command = command;
+    uint64_t seq = head_seq + (uint64_t)index;
+    size_t len = strlen(command);
+
+    int locked = (lock_history_file() == 0);
+    if (locked) {
+        // Importing may renumber the ring or erase the entry as a duplicate:
+        // find the command again if it is no longer where it was
+        unsigned int generation = history_generation;
+        import_new_lines();
+        if (generation != history_generation || seq < head_seq || seq - head_seq >= ring_count ||
+            RING_SLOT(seq - head_seq)->command == NULL ||
+            strcmp(RING_SLOT(seq - head_seq)->command, command) != 0) {
+            int found = (int)ring_count - 1;
+            while ((found = find_history_entry(found, -1)) >= 0 &&
+                   strcmp(RING_SLOT(found)->command, command) != 0) {
+                found--;
+            }
+            seq = found >= 0 ? head_seq + (uint64_t)found : UINT64_MAX;
+        }
+    }
+
+    if (append_entry(command, len) == 0) {
+        if (locked) {
+            append_to_file(command, len);
+        }
+
+        // Appending may have evicted entries from the front
+        if (seq != UINT64_MAX && seq >= head_seq) {
+            erase_entry((size_t)(seq - head_seq));
+        }
+        maybe_compact();
+    }
+    free(command);
+
+    if (locked) {
+        flock(history_fd, LOCK_UN);
+        maybe_start_compaction();
+    }
 }
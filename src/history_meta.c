@@ -0,0 +1,617 @@
+#include "../include/common.h"
+#include "../include/history_meta.h"
+#include "../include/history.h"
+#include "../include/hashtable.h"
+#include "../include/variables.h"
+#include <stddef.h>
+#include <errno.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+
+/* Segment format; bump the trailing digit when the layout changes */
+#define META_MAGIC "KORDHM1"
+
+/* Rows per segment, and bytes of command/cwd strings per segment */
+#define META_ROWS 1024
+#define META_HEAP 65536
+
+/**
+ * Segment header
+ * min_start/max_start form a zone map: time-filtered queries skip whole
+ * segments without touching their columns
+ */
+typedef struct {
+    char magic[8];
+    uint32_t row_count;
+    uint32_t heap_used;
+    int64_t min_start;
+    int64_t max_start;
+} MetaHeader;
+
+/**
+ * ~/.kord_history.meta is a sequence of fixed-size segments, each holding
+ * up to META_ROWS rows stored column by column; command and cwd columns
+ * are offsets into the segment's string heap
+ * Rows are appended in place under an flock; the header is written last,
+ * so readers never see a half-written row
+ */
+typedef struct {
+    MetaHeader header;
+    int64_t start[META_ROWS];        // start time, seconds since the epoch
+    uint32_t duration[META_ROWS];    // milliseconds
+    int32_t status[META_ROWS];       // exit status
+    uint32_t session[META_ROWS];     // id of the shell that ran it
+    uint32_t command[META_ROWS];     // heap offset
+    uint32_t cwd[META_ROWS];         // heap offset
+    char heap[META_HEAP];
+} MetaSegment;
+
+#define SEGMENT_SIZE ((off_t)sizeof(MetaSegment))
+#define COLUMN_OFFSET(segment, column, row) \
+    ((segment) + (off_t)offsetof(MetaSegment, column) + (off_t)(row) * (off_t)sizeof(((MetaSegment *)0)->column[0]))
+
+/* Parsed history query options */
+typedef struct {
+    int64_t since;                   // 0: no lower bound
+    int64_t until;                   // 0: no upper bound
+    const char *cwd;                 // directory (and its subdirectories), or NULL
+    size_t cwd_len;
+    int failed;                      // only non-zero exit statuses
+    int status;                      // exact exit status, or -1
+    int this_session;
+    uint32_t min_duration;           // milliseconds
+    const char *grep;                // substring of the command, or NULL
+    int sort_duration;               // slowest first instead of chronological
+    long limit;                      // 0: no limit
+    int stats;                       // aggregate per command
+} MetaQuery;
+
+typedef struct {
+    const MetaSegment *segment;
+    uint32_t row;
+} MetaMatch;
+
+/* Per-command aggregate for history --stats */
+typedef struct {
+    const char *command;
+    uint32_t runs;
+    uint32_t failures;
+    uint64_t total_ms;
+    uint32_t max_ms;
+} CommandStats;
+
+static int meta_fd = -1;
+static uint32_t session_id = 0;
+static int meta_initialized = 0;
+
+void init_history_meta(void) {
+    if (meta_initialized) {
+        return;
+    }
+
+    const char *home = get_variable("HOME");
+    char meta_path[PATH_MAX];
+    snprintf(meta_path, sizeof(meta_path), "%s/.kord_history.meta", home ? home : ".");
+
+    meta_fd = open(meta_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    session_id = ((uint32_t)getpid() * 2654435761u) ^ (uint32_t)now.tv_sec ^ (uint32_t)now.tv_nsec;
+    if (session_id == 0) {
+        session_id = 1;
+    }
+
+    meta_initialized = 1;
+}
+
+void cleanup_history_meta(void) {
+    if (meta_fd != -1) {
+        close(meta_fd);
+        meta_fd = -1;
+    }
+    meta_initialized = 0;
+}
+
+/**
+ * Write len bytes at offset
+ * Returns 0 on success, -1 on failure
+ */
+static int write_at(off_t offset, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t n = pwrite(meta_fd, p, len, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+        offset += n;
+    }
+    return 0;
+}
+
+/**
+ * Read len bytes at offset
+ * Returns 0 on success, -1 on failure or short read
+ */
+static int read_at(off_t offset, void *data, size_t len) {
+    ssize_t n;
+    do {
+        n = pread(meta_fd, data, len, offset);
+    } while (n < 0 && errno == EINTR);
+    return n == (ssize_t)len ? 0 : -1;
+}
+
+void record_history_meta(const char *command, time_t started_at, uint32_t duration_ms, int status, const char *cwd) {
+    if (!meta_initialized) {
+        init_history_meta();
+    }
+    if (meta_fd == -1 || command == NULL || command[0] == '\0' || history_ignores(command)) {
+        return;
+    }
+    if (cwd == NULL) {
+        cwd = "";
+    }
+
+    size_t command_len = strlen(command) + 1;
+    size_t cwd_len = strlen(cwd) + 1;
+    if (command_len + cwd_len > META_HEAP || cwd_len > PATH_MAX) {
+        return;
+    }
+
+    while (flock(meta_fd, LOCK_EX) != 0) {
+        if (errno != EINTR) {
+            return;
+        }
+    }
+
+    struct stat st;
+    if (fstat(meta_fd, &st) != 0) {
+        flock(meta_fd, LOCK_UN);
+        return;
+    }
+
+    // Append to the last segment while it has room, otherwise start a new one
+    MetaHeader header;
+    off_t segment = 0;
+    int fresh = 1;
+    if (st.st_size >= SEGMENT_SIZE) {
+        segment = (st.st_size / SEGMENT_SIZE - 1) * SEGMENT_SIZE;
+        fresh = read_at(segment, &header, sizeof(header)) != 0 ||
+                memcmp(header.magic, META_MAGIC, sizeof(header.magic)) != 0 ||
+                header.row_count >= META_ROWS || header.heap_used > META_HEAP ||
+                META_HEAP - header.heap_used < command_len + cwd_len;
+    }
+    if (fresh) {
+        segment = (st.st_size + SEGMENT_SIZE - 1) / SEGMENT_SIZE * SEGMENT_SIZE;
+        if (ftruncate(meta_fd, segment + SEGMENT_SIZE) != 0) {
+            flock(meta_fd, LOCK_UN);
+            return;
+        }
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, META_MAGIC, sizeof(header.magic));
+        header.min_start = started_at;
+        header.max_start = started_at;
+    }
+
+    uint32_t row = header.row_count;
+
+    // Consecutive commands usually share a directory: reuse the previous row's string
+    uint32_t cwd_offset = UINT32_MAX;
+    if (row > 0) {
+        uint32_t previous;
+        char previous_cwd[PATH_MAX];
+        if (read_at(COLUMN_OFFSET(segment, cwd, row - 1), &previous, sizeof(previous)) == 0 &&
+            previous <= META_HEAP - cwd_len &&
+            read_at(segment + (off_t)offsetof(MetaSegment, heap) + previous, previous_cwd, cwd_len) == 0 &&
+            memcmp(previous_cwd, cwd, cwd_len) == 0) {
+            cwd_offset = previous;
+        }
+    }
+
+    off_t heap = segment + (off_t)offsetof(MetaSegment, heap);
+    uint32_t command_offset = header.heap_used;
+    int ok = write_at(heap + command_offset, command, command_len) == 0;
+    header.heap_used += (uint32_t)command_len;
+    if (ok && cwd_offset == UINT32_MAX) {
+        cwd_offset = header.heap_used;
+        ok = write_at(heap + cwd_offset, cwd, cwd_len) == 0;
+        header.heap_used += (uint32_t)cwd_len;
+    }
+
+    int64_t start = started_at;
+    int32_t status_value = status;
+    ok = ok &&
+         write_at(COLUMN_OFFSET(segment, start, row), &start, sizeof(start)) == 0 &&
+         write_at(COLUMN_OFFSET(segment, duration, row), &duration_ms, sizeof(duration_ms)) == 0 &&
+         write_at(COLUMN_OFFSET(segment, status, row), &status_value, sizeof(status_value)) == 0 &&
+         write_at(COLUMN_OFFSET(segment, session, row), &session_id, sizeof(session_id)) == 0 &&
+         write_at(COLUMN_OFFSET(segment, command, row), &command_offset, sizeof(command_offset)) == 0 &&
+         write_at(COLUMN_OFFSET(segment, cwd, row), &cwd_offset, sizeof(cwd_offset)) == 0;
+
+    // Publishing the row: bump the count last
+    if (ok) {
+        header.row_count++;
+        if (start < header.min_start) header.min_start = start;
+        if (start > header.max_start) header.max_start = start;
+        write_at(segment, &header, sizeof(header));
+    }
+
+    flock(meta_fd, LOCK_UN);
+}
+
+/**
+ * Parse a duration such as "90", "1.5s", "250ms", "10m", "2h", "3d" or "1w"
+ * A bare number is in seconds
+ * Returns the duration in milliseconds, or -1 if malformed
+ */
+static int64_t parse_duration(const char *text) {
+    char *end;
+    double value = strtod(text, &end);
+    if (end == text || value < 0) {
+        return -1;
+    }
+
+    double unit;
+    if (*end == '\0' || strcmp(end, "s") == 0) {
+        unit = 1000;
+    } else if (strcmp(end, "ms") == 0) {
+        unit = 1;
+    } else if (strcmp(end, "m") == 0) {
+        unit = 60 * 1000.0;
+    } else if (strcmp(end, "h") == 0) {
+        unit = 3600 * 1000.0;
+    } else if (strcmp(end, "d") == 0) {
+        unit = 86400 * 1000.0;
+    } else if (strcmp(end, "w") == 0) {
+        unit = 7 * 86400 * 1000.0;
+    } else {
+        return -1;
+    }
+    return (int64_t)(value * unit);
+}
+
+/**
+ * Parse the options of a history query
+ * Returns 0 on success, -1 on a usage error (already reported)
+ */
+static int parse_query(char **args, MetaQuery *query, char *cwd_buffer) {
+    memset(query, 0, sizeof(*query));
+    query->status = -1;
+    time_t now = time(NULL);
+
+    for (int i = 1; args[i] != NULL; i++) {
+        const char *option = args[i];
+        const char *value = args[i + 1];
+        int takes_value = strcmp(option, "--since") == 0 || strcmp(option, "--until") == 0 ||
+                          strcmp(option, "--cwd") == 0 || strcmp(option, "--status") == 0 ||
+                          strcmp(option, "--slower") == 0 || strcmp(option, "--grep") == 0 ||
+                          strcmp(option, "--sort") == 0 || strcmp(option, "--limit") == 0;
+        if (takes_value && value == NULL) {
+            fprintf(stderr, "history: %s: option requires an argument\n\r", option);
+            return -1;
+        }
+
+        if (strcmp(option, "--since") == 0 || strcmp(option, "--until") == 0) {
+            int64_t age = parse_duration(value);
+            if (age < 0) {
+                fprintf(stderr, "history: %s: invalid duration\n\r", value);
+                return -1;
+            }
+            if (option[2] == 's') {
+                query->since = (int64_t)now - age / 1000;
+            } else {
+                query->until = (int64_t)now - age / 1000;
+            }
+        } else if (strcmp(option, "--cwd") == 0) {
+            // Stored directories are absolute; resolve relative arguments the same way
+            if (realpath(value, cwd_buffer) == NULL) {
+                snprintf(cwd_buffer, PATH_MAX, "%s", value);
+            }
+            query->cwd = cwd_buffer;
+            query->cwd_len = strlen(cwd_buffer);
+            while (query->cwd_len > 1 && cwd_buffer[query->cwd_len - 1] == '/') {
+                cwd_buffer[--query->cwd_len] = '\0';
+            }
+        } else if (strcmp(option, "--status") == 0) {
+            char *end;
+            long status = strtol(value, &end, 10);
+            if (*end != '\0' || status < 0 || status > 255) {
+                fprintf(stderr, "history: %s: invalid exit status\n\r", value);
+                return -1;
+            }
+            query->status = (int)status;
+        } else if (strcmp(option, "--slower") == 0) {
+            int64_t duration = parse_duration(value);
+            if (duration < 0) {
+                fprintf(stderr, "history: %s: invalid duration\n\r", value);
+                return -1;
+            }
+            query->min_duration = duration > UINT32_MAX ? UINT32_MAX : (uint32_t)duration;
+        } else if (strcmp(option, "--grep") == 0) {
+            query->grep = value;
+        } else if (strcmp(option, "--sort") == 0) {
+            if (strcmp(value, "duration") == 0) {
+                query->sort_duration = 1;
+            } else if (strcmp(value, "time") != 0) {
+                fprintf(stderr, "history: --sort: expected 'time' or 'duration'\n\r");
+                return -1;
+            }
+        } else if (strcmp(option, "--limit") == 0) {
+            char *end;
+            query->limit = strtol(value, &end, 10);
+            if (*end != '\0' || query->limit < 0) {
+                fprintf(stderr, "history: %s: invalid limit\n\r", value);
+                return -1;
+            }
+        } else if (strcmp(option, "--failed") == 0) {
+            query->failed = 1;
+        } else if (strcmp(option, "--session") == 0) {
+            query->this_session = 1;
+        } else if (strcmp(option, "--stats") == 0) {
+            query->stats = 1;
+        } else {
+            fprintf(stderr, "history: %s: invalid option\n\r", option);
+            return -1;
+        }
+
+        if (takes_value) {
+            i++;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Check the string columns of a row that already passed the numeric filters
+ */
+static int row_matches_text(const MetaSegment *segment, uint32_t row, const MetaQuery *query) {
+    // The strings must end inside the heap: the file may be truncated or corrupt
+    uint32_t heap_used = segment->header.heap_used < META_HEAP ? segment->header.heap_used : META_HEAP;
+    uint32_t command = segment->command[row];
+    uint32_t cwd_offset = segment->cwd[row];
+    if (command >= heap_used || cwd_offset >= heap_used ||
+        memchr(segment->heap + command, '\0', heap_used - command) == NULL ||
+        memchr(segment->heap + cwd_offset, '\0', heap_used - cwd_offset) == NULL) {
+        return 0;
+    }
+
+    if (query->cwd != NULL) {
+        const char *cwd = segment->heap + cwd_offset;
+        if (strncmp(cwd, query->cwd, query->cwd_len) != 0 ||
+            (cwd[query->cwd_len] != '\0' && cwd[query->cwd_len] != '/' &&
+             !(query->cwd_len == 1 && query->cwd[0] == '/'))) {
+            return 0;
+        }
+    }
+
+    return query->grep == NULL || strstr(segment->heap + command, query->grep) != NULL;
+}
+
+/**
+ * Scan every segment, column by column, collecting the matching rows
+ * Returns the number of matches (stored in *matches_out), or -1 on failure
+ */
+static long scan_segments(const MetaSegment *segments, size_t segment_count, const MetaQuery *query, MetaMatch **matches_out) {
+    MetaMatch *matches = NULL;
+    size_t count = 0, capacity = 0;
+
+    for (size_t s = 0; s < segment_count; s++) {
+        const MetaSegment *segment = &segments[s];
+        const MetaHeader *header = &segment->header;
+        if (memcmp(header->magic, META_MAGIC, sizeof(header->magic)) != 0 || header->row_count == 0) {
+            continue;
+        }
+        if ((query->since && header->max_start < query->since) ||
+            (query->until && header->min_start > query->until)) {
+            continue;
+        }
+
+        uint32_t rows = header->row_count < META_ROWS ? header->row_count : META_ROWS;
+        for (uint32_t row = 0; row < rows; row++) {
+            if ((query->since && segment->start[row] < query->since) ||
+                (query->until && segment->start[row] > query->until) ||
+                segment->duration[row] < query->min_duration ||
+                (query->failed && segment->status[row] == 0) ||
+                (query->status >= 0 && segment->status[row] != query->status) ||
+                (query->this_session && segment->session[row] != session_id) ||
+                !row_matches_text(segment, row, query)) {
+                continue;
+            }
+
+            if (count == capacity) {
+                size_t new_capacity = capacity ? capacity * 2 : 256;
+                MetaMatch *new_matches = realloc(matches, new_capacity * sizeof(MetaMatch));
+                if (new_matches == NULL) {
+                    perror("realloc");
+                    free(matches);
+                    return -1;
+                }
+                matches = new_matches;
+                capacity = new_capacity;
+            }
+            matches[count].segment = segment;
+            matches[count].row = row;
+            count++;
+        }
+    }
+
+    *matches_out = matches;
+    return (long)count;
+}
+
+/**
+ * Format a duration in milliseconds for display
+ */
+static void format_duration(uint64_t ms, char *buffer, size_t size) {
+    if (ms < 1000) {
+        snprintf(buffer, size, "%ums", (unsigned)ms);
+    } else if (ms < 60 * 1000) {
+        snprintf(buffer, size, "%.1fs", ms / 1000.0);
+    } else if (ms < 3600 * 1000) {
+        snprintf(buffer, size, "%um%02us", (unsigned)(ms / 60000), (unsigned)(ms / 1000 % 60));
+    } else {
+        snprintf(buffer, size, "%uh%02um", (unsigned)(ms / 3600000), (unsigned)(ms / 60000 % 60));
+    }
+}
+
+/**
+ * qsort comparator: slowest row first
+ */
+static int compare_match_duration(const void *a, const void *b) {
+    const MetaMatch *ma = a;
+    const MetaMatch *mb = b;
+    uint32_t da = ma->segment->duration[ma->row];
+    uint32_t db = mb->segment->duration[mb->row];
+    return (da < db) - (da > db);
+}
+
+/**
+ * qsort comparator: largest total time first
+ */
+static int compare_stats_total(const void *a, const void *b) {
+    const CommandStats *sa = *(const CommandStats * const *)a;
+    const CommandStats *sb = *(const CommandStats * const *)b;
+    return (sa->total_ms < sb->total_ms) - (sa->total_ms > sb->total_ms);
+}
+
+static void print_rows(MetaMatch *matches, long count, const MetaQuery *query) {
+    if (query->sort_duration) {
+        qsort(matches, (size_t)count, sizeof(MetaMatch), compare_match_duration);
+    }
+
+    // Chronological output keeps the newest rows, slowest-first the first ones
+    long first = 0, last = count;
+    if (query->limit > 0 && count > query->limit) {
+        if (query->sort_duration) {
+            last = query->limit;
+        } else {
+            first = count - query->limit;
+        }
+    }
+
+    for (long i = first; i < last; i++) {
+        const MetaSegment *segment = matches[i].segment;
+        uint32_t row = matches[i].row;
+
+        char when[32];
+        time_t start = (time_t)segment->start[row];
+        struct tm tm;
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M", localtime_r(&start, &tm));
+
+        char took[16];
+        format_duration(segment->duration[row], took, sizeof(took));
+
+        printf(" %s  %7s  %3d  %s  %s\n\r", when, took, segment->status[row],
+               segment->heap + segment->cwd[row], segment->heap + segment->command[row]);
+    }
+}
+
+static void print_stats(MetaMatch *matches, long count, const MetaQuery *query) {
+    HashTable table;
+    if (ht_init(&table, 256) != 0) {
+        return;
+    }
+
+    for (long i = 0; i < count; i++) {
+        const MetaSegment *segment = matches[i].segment;
+        uint32_t row = matches[i].row;
+        const char *command = segment->heap + segment->command[row];
+
+        HashEntry *entry = ht_insert(&table, command, strlen(command));
+        if (entry == NULL) {
+            break;
+        }
+        CommandStats *stats = entry->value;
+        if (stats == NULL) {
+            stats = calloc(1, sizeof(CommandStats));
+            if (stats == NULL) {
+                perror("calloc");
+                break;
+            }
+            stats->command = command;
+            entry->value = stats;
+        }
+
+        uint32_t duration = segment->duration[row];
+        stats->runs++;
+        stats->failures += segment->status[row] != 0;
+        stats->total_ms += duration;
+        if (duration > stats->max_ms) {
+            stats->max_ms = duration;
+        }
+    }
+
+    CommandStats **sorted = malloc((table.count + 1) * sizeof(CommandStats *));
+    if (sorted != NULL) {
+        size_t n = 0, pos = 0;
+        HashEntry *entry;
+        while ((entry = ht_next(&table, &pos)) != NULL) {
+            if (entry->value != NULL) {
+                sorted[n++] = entry->value;
+            }
+        }
+        qsort(sorted, n, sizeof(CommandStats *), compare_stats_total);
+        if (query->limit > 0 && n > (size_t)query->limit) {
+            n = (size_t)query->limit;
+        }
+
+        printf("   runs  fails      avg      max    total  command\n\r");
+        for (size_t i = 0; i < n; i++) {
+            char avg[16], max[16], total[16];
+            format_duration(sorted[i]->total_ms / sorted[i]->runs, avg, sizeof(avg));
+            format_duration(sorted[i]->max_ms, max, sizeof(max));
+            format_duration(sorted[i]->total_ms, total, sizeof(total));
+            printf(" %6u %6u  %7s  %7s  %7s  %s\n\r", sorted[i]->runs, sorted[i]->failures,
+                   avg, max, total, sorted[i]->command);
+        }
+        free(sorted);
+    }
+
+    ht_free(&table, free);
+}
+
+int query_history_meta(char **args) {
+    MetaQuery query;
+    char cwd_buffer[PATH_MAX];
+    if (parse_query(args, &query, cwd_buffer) != 0) {
+        return 1;
+    }
+
+    if (!meta_initialized) {
+        init_history_meta();
+    }
+
+    struct stat st;
+    if (meta_fd == -1 || fstat(meta_fd, &st) != 0 || st.st_size < SEGMENT_SIZE) {
+        printf("No history metadata recorded\n\r");
+        return 0;
+    }
+
+    // Only whole segments; a segment being created by another shell is skipped
+    size_t segment_count = (size_t)(st.st_size / SEGMENT_SIZE);
+    size_t map_size = segment_count * (size_t)SEGMENT_SIZE;
+    const MetaSegment *segments = mmap(NULL, map_size, PROT_READ, MAP_SHARED, meta_fd, 0);
+    if (segments == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    MetaMatch *matches = NULL;
+    long count = scan_segments(segments, segment_count, &query, &matches);
+    if (count > 0) {
+        if (query.stats) {
+            print_stats(matches, count, &query);
+        } else {
+            print_rows(matches, count, &query);
+        }
+    }
+
+    free(matches);
+    munmap((void *)segments, map_size);
+    return count < 0 ? 1 : 0;
+}
@@ -0,0 +1,387 @@
+#include "../include/common.h"
+#include "../include/history_search.h"
+#include "../include/history.h"
+#include "../include/scan.h"
+#include <stdint.h>
+
+/* Trigrams are hashed into this many posting lists; collisions only cost a verification */
+#define TRIGRAM_BUCKETS 65536
+
+/* The index is rebuilt once at least this many indexed entries were evicted
+ * and they make up half of it */
+#define SEARCH_REBUILD_MIN 4096
+
+/* Entries filtered per call of the mask kernel; should_stop is polled in between */
+#define FUZZY_BLOCK 16384
+
+/* Fuzzy scoring weights */
+#define FUZZY_MATCH 16
+#define FUZZY_WORD_START 12
+#define FUZZY_CONSECUTIVE 8
+#define FUZZY_GAP_MAX 8
+
+/**
+ * Ids of the entries containing a trigram, in increasing order
+ * Id = sequence number - index_base, so ids survive eviction of old entries
+ */
+typedef struct {
+    uint32_t *ids;
+    uint32_t count;
+    uint32_t capacity;
+} Posting;
+
+static Posting *postings = NULL;
+static uint64_t *char_masks = NULL;     // per id: character classes present in the entry
+static size_t mask_capacity = 0;
+static size_t indexed_count = 0;        // ids [0, indexed_count) are indexed
+static uint64_t index_base = 0;         // sequence number of id 0
+static unsigned int index_generation = 0;
+static int index_valid = 0;
+
+/**
+ * Bit of a character in an entry's class mask (case-insensitive)
+ * Letters and digits get a bit each; everything else shares the rest
+ */
+static inline uint64_t char_class_bit(unsigned char c) {
+    if (c >= 'A' && c <= 'Z') {
+        c = (unsigned char)(c + ('a' - 'A'));
+    }
+    if (c >= 'a' && c <= 'z') {
+        return 1ULL << (c - 'a');
+    }
+    if (c >= '0' && c <= '9') {
+        return 1ULL << (26 + (c - '0'));
+    }
+    return 1ULL << (36 + c % 28);
+}
+
+static inline uint32_t trigram_bucket(const char *s) {
+    uint32_t v = ((uint32_t)(unsigned char)s[0] << 16) |
+                 ((uint32_t)(unsigned char)s[1] << 8) |
+                 (uint32_t)(unsigned char)s[2];
+    return (v * 2654435761u) >> 16;
+}
+
+/**
+ * Add id to a posting list (once, however often the trigram occurs)
+ * Returns 0 on success, -1 on allocation failure
+ */
+static int posting_add(Posting *posting, uint32_t id) {
+    if (posting->count > 0 && posting->ids[posting->count - 1] == id) {
+        return 0;
+    }
+
+    if (posting->count == posting->capacity) {
+        uint32_t new_capacity = posting->capacity ? posting->capacity * 2 : 8;
+        uint32_t *new_ids = realloc(posting->ids, new_capacity * sizeof(uint32_t));
+        if (new_ids == NULL) {
+            perror("realloc");
+            return -1;
+        }
+        posting->ids = new_ids;
+        posting->capacity = new_capacity;
+    }
+
+    posting->ids[posting->count++] = id;
+    return 0;
+}
+
+/**
+ * Forget every indexed entry; posting storage is kept for reuse
+ */
+static void reset_index(uint64_t base) {
+    for (size_t i = 0; i < TRIGRAM_BUCKETS; i++) {
+        postings[i].count = 0;
+    }
+    indexed_count = 0;
+    index_base = base;
+    index_generation = get_history_generation();
+}
+
+/**
+ * Index the entries added since the last call
+ * Returns 0 on success, -1 on allocation failure
+ */
+static int sync_index(void) {
+    uint64_t base = get_history_base_seq();
+    size_t count = (size_t)get_history_count();
+
+    if (postings == NULL) {
+        postings = calloc(TRIGRAM_BUCKETS, sizeof(Posting));
+        if (postings == NULL) {
+            perror("calloc");
+            return -1;
+        }
+        reset_index(base);
+        index_valid = 1;
+    }
+
+    // Renumbered entries, or mostly evicted ones: start over
+    uint64_t evicted = base >= index_base ? base - index_base : 0;
+    if (!index_valid || index_generation != get_history_generation() || base < index_base ||
+        (evicted >= SEARCH_REBUILD_MIN && evicted * 2 >= indexed_count) ||
+        base + count - index_base > UINT32_MAX) {
+        reset_index(base);
+        index_valid = 1;
+    }
+
+    size_t target = (size_t)(base + count - index_base);
+    if (target > mask_capacity) {
+        size_t new_capacity = mask_capacity ? mask_capacity : 1024;
+        while (new_capacity < target) {
+            new_capacity *= 2;
+        }
+        uint64_t *new_masks = realloc(char_masks, new_capacity * sizeof(uint64_t));
+        if (new_masks == NULL) {
+            perror("realloc");
+            return -1;
+        }
+        char_masks = new_masks;
+        mask_capacity = new_capacity;
+    }
+
+    for (size_t id = indexed_count; id < target; id++) {
+        const char *command = get_history((int)(index_base + id - base));
+        uint64_t mask = 0;
+
+        if (command != NULL) {
+            size_t len = strlen(command);
+            for (size_t i = 0; i < len; i++) {
+                mask |= char_class_bit((unsigned char)command[i]);
+            }
+            for (size_t i = 0; i + 3 <= len; i++) {
+                if (posting_add(&postings[trigram_bucket(command + i)], (uint32_t)id) != 0) {
+                    index_valid = 0;
+                    return -1;
+                }
+            }
+        }
+
+        char_masks[id] = mask;
+        indexed_count = id + 1;
+    }
+
+    return 0;
+}
+
+/**
+ * History index of an id, or -1 if the entry was evicted
+ */
+static inline int id_to_index(uint32_t id, uint64_t base) {
+    uint64_t seq = index_base + id;
+    return seq < base ? -1 : (int)(seq - base);
+}
+
+/**
+ * Linear scan used for short queries (and if the index cannot be built)
+ */
+static int scan_substring(const char *query, int before) {
+    for (int i = before - 1; i >= 0; i--) {
+        const char *command = get_history(i);
+        if (command != NULL && strstr(command, query) != NULL) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int history_search_substring(const char *query, int before) {
+    size_t query_len = query ? strlen(query) : 0;
+    int count = get_history_count();
+    if (query_len == 0 || count == 0) {
+        return -1;
+    }
+    if (before > count) {
+        before = count;
+    }
+
+    if (query_len < 3 || sync_index() != 0) {
+        return scan_substring(query, before);
+    }
+
+    // Only entries in the rarest trigram's list can match
+    const Posting *rarest = NULL;
+    for (size_t i = 0; i + 3 <= query_len; i++) {
+        const Posting *posting = &postings[trigram_bucket(query + i)];
+        if (rarest == NULL || posting->count < rarest->count) {
+            rarest = posting;
+        }
+    }
+
+    uint64_t base = get_history_base_seq();
+    uint64_t limit = base + (uint64_t)before - index_base;
+
+    // First position in the list whose id is >= limit
+    size_t lo = 0, hi = rarest->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (rarest->ids[mid] < limit) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    while (lo-- > 0) {
+        int index = id_to_index(rarest->ids[lo], base);
+        if (index < 0) {
+            break;  // Everything older was evicted
+        }
+        const char *command = get_history(index);
+        if (command != NULL && strstr(command, query) != NULL) {
+            return index;
+        }
+    }
+    return -1;
+}
+
+static inline int is_word_start(const char *command, size_t i) {
+    if (i == 0) {
+        return 1;
+    }
+    char prev = command[i - 1];
+    return prev == ' ' || prev == '/' || prev == '-' || prev == '_' || prev == '.' ||
+           prev == '=' || prev == '|' || prev == ';' || prev == '\'' || prev == '"';
+}
+
+/**
+ * Score command against a lower-cased query, trying every start position
+ * of the first letter and matching the rest greedily
+ * Returns the best score, or -1 if query is not a subsequence of command
+ */
+static int fuzzy_score(const char *command, const char *query, size_t query_len) {
+    int best = -1;
+
+    for (size_t start = 0; command[start] != '\0'; start++) {
+        if (tolower((unsigned char)command[start]) != query[0]) {
+            continue;
+        }
+
+        int score = FUZZY_MATCH + (is_word_start(command, start) ? FUZZY_WORD_START : 0);
+        size_t last = start;
+        size_t q = 1;
+        for (size_t i = start + 1; command[i] != '\0' && q < query_len; i++) {
+            if (tolower((unsigned char)command[i]) != query[q]) {
+                continue;
+            }
+
+            score += FUZZY_MATCH;
+            if (i == last + 1) {
+                score += FUZZY_CONSECUTIVE;
+            } else {
+                size_t gap = i - last - 1;
+                score -= gap > FUZZY_GAP_MAX ? FUZZY_GAP_MAX : (int)gap;
+            }
+            if (is_word_start(command, i)) {
+                score += FUZZY_WORD_START;
+            }
+            last = i;
+            q++;
+        }
+
+        if (q < query_len) {
+            break;  // Later starts cannot match either
+        }
+        if (score > best) {
+            best = score;
+        }
+    }
+
+    return best;
+}
+
+int history_search_fuzzy(const char *query, int *results, int max_results, int (*should_stop)(void)) {
+    size_t query_len = query ? strlen(query) : 0;
+    if (query_len == 0 || max_results <= 0 || sync_index() != 0) {
+        return 0;
+    }
+
+    char folded[256];
+    if (query_len >= sizeof(folded)) {
+        query_len = sizeof(folded) - 1;
+    }
+    uint64_t need = 0;
+    for (size_t i = 0; i < query_len; i++) {
+        folded[i] = (char)tolower((unsigned char)query[i]);
+        need |= char_class_bit((unsigned char)query[i]);
+    }
+    folded[query_len] = '\0';
+
+    if (max_results > HISTORY_FUZZY_MAX_RESULTS) {
+        max_results = HISTORY_FUZZY_MAX_RESULTS;
+    }
+    int scores[HISTORY_FUZZY_MAX_RESULTS];
+    int found = 0;
+
+    static uint32_t candidates[FUZZY_BLOCK];
+    uint64_t base = get_history_base_seq();
+    size_t first_live = base > index_base ? (size_t)(base - index_base) : 0;
+    int count = get_history_count();
+
+    // Newest block first, so a command's newest copy is seen before older ones
+    size_t hi = indexed_count;
+    while (hi > first_live) {
+        if (should_stop != NULL && should_stop()) {
+            return -1;
+        }
+
+        size_t lo = hi - first_live > FUZZY_BLOCK ? hi - FUZZY_BLOCK : first_live;
+        size_t n = scan_mask_superset(char_masks + lo, hi - lo, need, candidates);
+
+        while (n-- > 0) {
+            int index = id_to_index((uint32_t)(lo + candidates[n]), base);
+            const char *command = get_history(index);
+            if (command == NULL) {
+                continue;
+            }
+
+            int score = fuzzy_score(command, folded, query_len);
+            if (score < 0) {
+                continue;
+            }
+
+            // Older entries lose a little per doubling of their age
+            unsigned int age = (unsigned int)(count - 1 - index);
+            int rank = score * 8 - (age ? 32 - __builtin_clz(age) : 0);
+            if (found == max_results && rank <= scores[found - 1]) {
+                continue;
+            }
+
+            int duplicate = 0;
+            for (int k = 0; k < found && !duplicate; k++) {
+                duplicate = strcmp(get_history(results[k]), command) == 0;
+            }
+            if (duplicate) {
+                continue;
+            }
+
+            int pos = found < max_results ? found++ : found - 1;
+            while (pos > 0 && scores[pos - 1] < rank) {
+                scores[pos] = scores[pos - 1];
+                results[pos] = results[pos - 1];
+                pos--;
+            }
+            scores[pos] = rank;
+            results[pos] = index;
+        }
+
+        hi = lo;
+    }
+
+    return found;
+}
+
+void cleanup_history_search(void) {
+    if (postings != NULL) {
+        for (size_t i = 0; i < TRIGRAM_BUCKETS; i++) {
+            free(postings[i].ids);
+        }
+        free(postings);
+        postings = NULL;
+    }
+    free(char_masks);
+    char_masks = NULL;
+    mask_capacity = 0;
+    indexed_count = 0;
+    index_valid = 0;
+}
@@ -1,25 +1,83 @@
 #include "../include/common.h"
 #include "../include/prompt.h"
-#include "../include/parser.h"
-#include "../include/executor.h"
+#include "../include/builtins.h"
+#include "../include/plugin.h"
 #include "../include/raw_input.h"
 #include "../include/variables.h"
 #include "../include/aliases.h"
 #include "../include/history.h"
+#include "../include/history_search.h"
+#include "../include/history_meta.h"
+#include "../include/suggest.h"
+#include "../include/script.h"
+#include "../include/command_index.h"
+#include "../include/completion_spec.h"
+#include "../include/highlight.h"
 
-int main()
+/**
+ * Release all shell state before exiting
+ */
+static void shutdown_shell(void)
 {
-    char command[1024];
+    // Cleanup history system (saves to file)
+    cleanup_history_search();
+    cleanup_suggest();
+    cleanup_history_meta();
+    cleanup_history();
+
+    // Cleanup command name catalogue and completion specs
+    cleanup_command_index();
+    cleanup_completion_specs();
+    cleanup_highlight();
+    cleanup_prompt();
+    
+    // Unload plugin builtins
+    cleanup_plugins();
     
+    // Cleanup alias system
+    cleanup_aliases();
+    
+    // Cleanup variable system
+    cleanup_variables();
+}
+
+int main(int argc, char *argv[])
+{
     // Initialize variable system
     init_variables();
     
     // Initialize alias system
     init_aliases();
     
-    // Initialize history system
+    // Non-interactive use: kord-sh -c 'command' or kord-sh script
+    if (argc > 1) {
+        int result;
+        if (strcmp(argv[1], "-c") == 0) {
+            if (argc < 3) {
+                fprintf(stderr, "kord-sh: -c: option requires an argument\n");
+                shutdown_shell();
+                return 2;
+            }
+            result = load_rc_file();
+            if (result != -1) {
+                result = run_command_line(argv[2]);
+            }
+        } else {
+            result = source_file(argv[1]);
+        }
+        shutdown_shell();
+        return result == -1 ? get_exit_status() : result;
+    }
+    
+    // History is only loaded for interactive use
     init_history();
     
+    // Define aliases and variables from ~/.kordrc
+    if (load_rc_file() == -1) {
+        shutdown_shell();
+        return get_exit_status();
+    }
+    
     // Print welcome banner
     print_welcome();
     
@@ -35,7 +93,8 @@ int main()
         print_prompt();
 
         // Read user input
-        int len = read_user_input(command);
+        char *command = NULL;
+        int len = read_user_input(&command);
         
         // Handle EOF (Ctrl+D)
         if (len == -1) {
@@ -45,33 +104,29 @@ int main()
         
         // Skip empty commands
         if (len == 0) {
+            free(command);
             continue;
         }
         
         // Add command to history
         add_history(command);
         
-        // Expand aliases if present
-        char *expanded_command = expand_alias(command);
-        const char *cmd_to_parse = (expanded_command != NULL) ? expanded_command : command;
-
-        // Parse command into array of commands (for pipes)
-        char ***commands = parse_command(cmd_to_parse);
-        
-        // Free expanded command if it was allocated
-        if (expanded_command != NULL) {
-            free(expanded_command);
-        }
+        // Expand aliases, parse and execute, timing the run for history metadata
+        char cwd[PATH_MAX];
+        const char *current = get_current_directory();
+        snprintf(cwd, sizeof(cwd), "%s", current ? current : "");
+        time_t started_at = time(NULL);
+        struct timespec started, finished;
+        clock_gettime(CLOCK_MONOTONIC, &started);
         
-        if (commands == NULL) {
-            continue;
-        }
-
-        // Execute commands
-        int result = execute_command(commands);
+        int result = run_command_line(command);
         
-        // Free commands
-        free_commands(commands);
+        clock_gettime(CLOCK_MONOTONIC, &finished);
+        int64_t elapsed_ms = (int64_t)(finished.tv_sec - started.tv_sec) * 1000 +
+                             (finished.tv_nsec - started.tv_nsec) / 1000000;
+        record_history_meta(command, started_at, elapsed_ms > UINT32_MAX ? UINT32_MAX : (uint32_t)elapsed_ms,
+                            result == -1 ? 0 : result, cwd);
+        free(command);
         
         // Check if shell should exit (exit command returns -1)
         if (result == -1) {
@@ -80,15 +135,8 @@ int main()
         }
     }
     
-    // Cleanup history system (saves to file)
-    cleanup_history();
-    
-    // Cleanup alias system
-    cleanup_aliases();
-    
-    // Cleanup variable system
-    cleanup_variables();
+    shutdown_shell();
     
     // Raw mode is automatically disabled on exit via atexit()
-    return EXIT_SUCCESS;
+    return get_exit_status();
 }
@@ -0,0 +1,78 @@
+#include "../include/common.h"
+#include "../include/output.h"
+#include <errno.h>
+#include <stdarg.h>
+
+void output_init(OutputBuffer *out, int fd) {
+    out->fd = fd;
+    out->len = 0;
+    out->failed = 0;
+}
+
+int output_flush(OutputBuffer *out) {
+    size_t done = 0;
+    while (done < out->len && !out->failed) {
+        ssize_t n = write(out->fd, out->data + done, out->len - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            out->failed = 1;
+            break;
+        }
+        done += (size_t)n;
+    }
+    out->len = 0;
+    return out->failed ? -1 : 0;
+}
+
+void output_append(OutputBuffer *out, const char *data, size_t len) {
+    while (len > 0) {
+        if (out->len == sizeof(out->data)) {
+            output_flush(out);
+        }
+        size_t chunk = sizeof(out->data) - out->len;
+        if (chunk > len) {
+            chunk = len;
+        }
+        memcpy(out->data + out->len, data, chunk);
+        out->len += chunk;
+        data += chunk;
+        len -= chunk;
+    }
+}
+
+int output_vformat(OutputBuffer *out, const char *format, va_list ap) {
+    char small[256];
+    va_list again;
+    va_copy(again, ap);
+    int len = vsnprintf(small, sizeof(small), format, ap);
+    if (len < 0 || (size_t)len < sizeof(small)) {
+        va_end(again);
+        if (len >= 0) {
+            output_append(out, small, (size_t)len);
+        }
+        return len < 0 ? -1 : len;
+    }
+
+    // Too long for the stack buffer: format it again into one that fits
+    char *text = malloc((size_t)len + 1);
+    if (text == NULL) {
+        perror("malloc");
+        va_end(again);
+        return -1;
+    }
+    vsnprintf(text, (size_t)len + 1, format, again);
+    va_end(again);
+    output_append(out, text, (size_t)len);
+    free(text);
+    return len;
+}
+
+int output_format(OutputBuffer *out, const char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    int len = output_vformat(out, format, ap);
+    va_end(ap);
+    return len;
+}
@@ -1,190 +1,1017 @@
 #include "../include/common.h"
 #include "../include/parser.h"
 #include "../include/variables.h"
+#include "../include/scan.h"
+
+/* Bytes that end an unquoted token */
+#define WHITESPACE_SET " \t\n\v\f\r"
 
 /**
  * Helper function to trim leading and trailing whitespace
  */
 static char *trim_whitespace(char *str) {
-    // Trim leading whitespace
-    while (isspace((unsigned char)*str)) str++;
+    size_t len = strlen(str);
     
-    if (*str == 0) return str;
+    // Trim leading whitespace
+    size_t start = scan_skip_space(str, len);
+    str += start;
+    len -= start;
     
     // Trim trailing whitespace
-    char *end = str + strlen(str) - 1;
-    while (end > str && isspace((unsigned char)*end)) end--;
-    
-    *(end + 1) = '\0';
+    str[scan_trim_end(str, len)] = '\0';
     return str;
 }
 
+/* Growable output buffer used while expanding a word */
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+    size_t *breaks;      // offsets where "${arr[@]}" starts a new word
+    size_t break_count;
+    size_t break_cap;
+    int split_fields;    // 1 if the caller accepts several words
+    int saw_array;       // 1 once a "${arr[@]}" has been expanded
+} ExpandBuffer;
+
 /**
- * Expand variables in a string (e.g., "$foo" -> "value")
- * Returns a newly allocated string that must be freed by caller
+ * Make room for at least extra more bytes (plus the terminator)
+ * Returns 0 on success, -1 on allocation failure
  */
-static char *expand_variables(const char *str) {
-    if (str == NULL) {
-        return NULL;
+static int buffer_reserve(ExpandBuffer *buf, size_t extra) {
+    if (buf->len + extra + 1 <= buf->cap) {
+        return 0;
     }
     
-    // Allocate buffer for expanded string (worst case: same size if no variables)
-    size_t max_len = strlen(str) * 4 + 1024;  // Allow room for expansion
-    char *result = malloc(max_len);
-    if (!result) {
-        perror("malloc");
-        return NULL;
+    size_t new_cap = buf->cap ? buf->cap : 64;
+    while (new_cap < buf->len + extra + 1) {
+        new_cap *= 2;
     }
     
-    const char *src = str;
-    char *dst = result;
-    size_t remaining = max_len - 1;
+    char *new_data = realloc(buf->data, new_cap);
+    if (!new_data) {
+        perror("realloc");
+        return -1;
+    }
     
-    while (*src && remaining > 0) {
-        if (*src == '$') {
-            src++;  // Skip the '$'
-            
-            // Extract variable name
-            const char *var_start = src;
-            while (*src && (isalnum((unsigned char)*src) || *src == '_')) {
-                src++;
-            }
+    buf->data = new_data;
+    buf->data[buf->len] = '\0';  // An expansion that appends nothing is still a valid string
+    buf->cap = new_cap;
+    return 0;
+}
+
+/**
+ * Start a new word at the current end of the buffer
+ * Returns 0 on success, -1 on allocation failure
+ */
+static int buffer_break(ExpandBuffer *buf) {
+    if (buf->break_count == buf->break_cap) {
+        size_t new_cap = buf->break_cap ? buf->break_cap * 2 : 8;
+        size_t *new_breaks = realloc(buf->breaks, new_cap * sizeof(size_t));
+        if (!new_breaks) {
+            perror("realloc");
+            return -1;
+        }
+        buf->breaks = new_breaks;
+        buf->break_cap = new_cap;
+    }
+    buf->breaks[buf->break_count++] = buf->len;
+    return 0;
+}
+
+static int buffer_append(ExpandBuffer *buf, const char *src, size_t n) {
+    if (buffer_reserve(buf, n) != 0) {
+        return -1;
+    }
+    memcpy(buf->data + buf->len, src, n);
+    buf->len += n;
+    buf->data[buf->len] = '\0';
+    return 0;
+}
+
+/**
+ * Check if a byte can appear in a variable name
+ */
+static int is_name_char(char c) {
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+/**
+ * Find the '}' closing a "${" whose body starts at s
+ * Nested "${...}" are skipped
+ * Returns the index of the closing brace, or len if unterminated
+ */
+static size_t find_brace_end(const char *s, size_t len) {
+    int depth = 1;
+    
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] == '\\' && i + 1 < len) {
+            i++;
+        } else if (s[i] == '$' && i + 1 < len && s[i + 1] == '{') {
+            depth++;
+            i++;
+        } else if (s[i] == '}' && --depth == 0) {
+            return i;
+        }
+    }
+    
+    return len;
+}
+
+/**
+ * Match a shell glob pattern (*, ?, [...], backslash escapes) against
+ * the whole of s[0..slen). Both sides are length-delimited so that
+ * prefixes and suffixes of a stored value can be tested in place.
+ * Returns 1 on match, 0 otherwise
+ */
+static int glob_match(const char *pat, size_t plen, const char *s, size_t slen) {
+    size_t p = 0, i = 0;
+    size_t star_p = (size_t)-1, star_i = 0;
+    
+    while (i < slen) {
+        if (p < plen && pat[p] == '*') {
+            // Remember the star and first try matching it against nothing
+            star_p = p++;
+            star_i = i;
+            continue;
+        }
+        
+        if (p < plen) {
+            int matched = 0;
+            size_t next_p = p + 1;
             
-            if (src > var_start) {
-                // We have a variable name
-                size_t var_len = src - var_start;
-                char var_name[256];
+            if (pat[p] == '?') {
+                matched = 1;
+            } else if (pat[p] == '[') {
+                size_t q = p + 1;
+                int negate = 0;
+                if (q < plen && (pat[q] == '!' || pat[q] == '^')) {
+                    negate = 1;
+                    q++;
+                }
                 
-                if (var_len < sizeof(var_name)) {
-                    strncpy(var_name, var_start, var_len);
-                    var_name[var_len] = '\0';
-                    
-                    // Get variable value
-                    const char *value = get_variable(var_name);
-                    if (value) {
-                        size_t value_len = strlen(value);
-                        if (value_len < remaining) {
-                            strcpy(dst, value);
-                            dst += value_len;
-                            remaining -= value_len;
-                        }
+                int in_class = 0;
+                size_t first = q;
+                while (q < plen && (pat[q] != ']' || q == first)) {
+                    unsigned char lo = (unsigned char)pat[q];
+                    unsigned char hi = lo;
+                    if (q + 2 < plen && pat[q + 1] == '-' && pat[q + 2] != ']') {
+                        hi = (unsigned char)pat[q + 2];
+                        q += 2;
+                    }
+                    if ((unsigned char)s[i] >= lo && (unsigned char)s[i] <= hi) {
+                        in_class = 1;
                     }
-                    // If variable not found, replace with empty string
+                    q++;
+                }
+                
+                if (q < plen) {
+                    matched = in_class != negate;
+                    next_p = q + 1;
+                } else {
+                    // Unterminated class: treat '[' literally
+                    matched = (s[i] == '[');
                 }
+            } else if (pat[p] == '\\' && p + 1 < plen) {
+                matched = (pat[p + 1] == s[i]);
+                next_p = p + 2;
             } else {
-                // Just a '$' without a variable name, keep it
-                if (remaining > 0) {
-                    *dst++ = '$';
-                    remaining--;
+                matched = (pat[p] == s[i]);
+            }
+            
+            if (matched) {
+                p = next_p;
+                i++;
+                continue;
+            }
+        }
+        
+        // Mismatch: let the last star swallow one more character
+        if (star_p == (size_t)-1) {
+            return 0;
+        }
+        p = star_p + 1;
+        i = ++star_i;
+    }
+    
+    // Only trailing stars may remain in the pattern
+    while (p < plen && pat[p] == '*') p++;
+    return p == plen;
+}
+
+static int expand_into(ExpandBuffer *out, const char *src, size_t len);
+
+/**
+ * Expand a word embedded in a parameter expansion (default value, pattern, ...)
+ * Returns a newly allocated string, or NULL on allocation failure
+ */
+static char *expand_word(const char *word, size_t len) {
+    ExpandBuffer buf = {0};
+    if (buffer_reserve(&buf, len) != 0 || expand_into(&buf, word, len) != 0) {
+        free(buf.data);
+        free(buf.breaks);
+        return NULL;
+    }
+    free(buf.breaks);
+    return buf.data;
+}
+
+/**
+ * Parse an integer operand of a substring expansion, e.g. " -3" or "(-3)"
+ */
+static long parse_offset(const char *word, size_t len) {
+    char *expanded = expand_word(word, len);
+    if (!expanded) {
+        return 0;
+    }
+    
+    const char *p = expanded;
+    while (isspace((unsigned char)*p) || *p == '(') p++;
+    long result = strtol(p, NULL, 10);
+    free(expanded);
+    return result;
+}
+
+/**
+ * Remove the shortest/longest prefix or suffix matching pat from value
+ * and append what is left. op is one of '#' or '%'.
+ */
+static int append_trimmed(ExpandBuffer *out, const char *value, size_t value_len,
+                          const char *pat, size_t plen, char op, int longest) {
+    size_t start = 0;
+    size_t end = value_len;
+    
+    if (op == '#') {
+        for (size_t k = 0; k <= value_len; k++) {
+            size_t cut = longest ? value_len - k : k;
+            if (glob_match(pat, plen, value, cut)) {
+                start = cut;
+                break;
+            }
+        }
+    } else {
+        for (size_t k = 0; k <= value_len; k++) {
+            size_t cut = longest ? k : value_len - k;
+            if (glob_match(pat, plen, value + cut, value_len - cut)) {
+                end = cut;
+                break;
+            }
+        }
+    }
+    
+    return buffer_append(out, value + start, end - start);
+}
+
+/**
+ * Lengths of the strings a glob pattern can match: every element but '*'
+ * matches one byte, so *min is their count and *max is the same unless
+ * there is a star (SIZE_MAX)
+ * Returns 1 if the pattern is plain text (no *, ?, [ or \\), 0 otherwise
+ */
+static int pattern_bounds(const char *pat, size_t plen, size_t *min, size_t *max) {
+    int star = 0, literal = 1;
+    size_t count = 0;
+    for (size_t p = 0; p < plen; count++) {
+        if (pat[p] == '*') {
+            star = 1;
+            literal = 0;
+            count--;
+            p++;
+        } else if (pat[p] == '[') {
+            // Find the closing bracket as glob_match() does; unterminated is literal
+            literal = 0;
+            size_t q = p + 1;
+            if (q < plen && (pat[q] == '!' || pat[q] == '^')) q++;
+            size_t first = q;
+            while (q < plen && (pat[q] != ']' || q == first)) q++;
+            p = q < plen ? q + 1 : p + 1;
+        } else if (pat[p] == '\\' && p + 1 < plen) {
+            literal = 0;
+            p += 2;
+        } else {
+            if (pat[p] == '?' || pat[p] == '\\') literal = 0;
+            p++;
+        }
+    }
+    *min = count;
+    *max = star ? SIZE_MAX : count;
+    return literal;
+}
+
+/**
+ * Find the first occurrence of pat[0..plen) in s[0..slen)
+ * Returns its offset, or slen if there is none
+ */
+static size_t find_literal(const char *s, size_t slen, const char *pat, size_t plen) {
+    size_t i = 0;
+    while (plen <= slen - i) {
+        const char *hit = memchr(s + i, pat[0], slen - i - plen + 1);
+        if (hit == NULL) {
+            break;
+        }
+        i = (size_t)(hit - s);
+        if (memcmp(hit, pat, plen) == 0) {
+            return i;
+        }
+        i++;
+    }
+    return slen;
+}
+
+/**
+ * Append value with every (mode 'a') or the first occurrence of the plain
+ * text pat replaced by rep, without trying each position with glob_match()
+ */
+static int append_replaced_literal(ExpandBuffer *out, const char *value, size_t value_len,
+                                   const char *pat, size_t plen, const char *rep, size_t rep_len,
+                                   char mode) {
+    if (mode == '#' || mode == '%') {
+        size_t at = mode == '#' ? 0 : value_len - plen;
+        if (plen > value_len || memcmp(value + at, pat, plen) != 0) {
+            return buffer_append(out, value, value_len);
+        }
+        if (buffer_append(out, value, at) != 0 || buffer_append(out, rep, rep_len) != 0) {
+            return -1;
+        }
+        return buffer_append(out, value + at + plen, value_len - at - plen);
+    }
+    
+    size_t i = 0;
+    while (i < value_len) {
+        size_t hit = find_literal(value + i, value_len - i, pat, plen);
+        if (hit == value_len - i) {
+            break;
+        }
+        if (buffer_append(out, value + i, hit) != 0 || buffer_append(out, rep, rep_len) != 0) {
+            return -1;
+        }
+        i += hit + plen;
+        if (mode != 'a') {
+            break;
+        }
+    }
+    return buffer_append(out, value + i, value_len - i);
+}
+
+/**
+ * Append value with occurrences of pat replaced by rep
+ * mode: '/' first match, 'a' all matches, '#' anchored at start, '%' anchored at end
+ */
+static int append_replaced(ExpandBuffer *out, const char *value, size_t value_len,
+                           const char *pat, size_t plen, const char *rep, char mode) {
+    if (plen == 0) {
+        return buffer_append(out, value, value_len);
+    }
+    
+    size_t rep_len = strlen(rep);
+    size_t min_len, max_len;
+    if (pattern_bounds(pat, plen, &min_len, &max_len)) {
+        return append_replaced_literal(out, value, value_len, pat, plen, rep, rep_len, mode);
+    }
+    
+    size_t i = 0;
+    int replaced = 0;
+    
+    while (i <= value_len) {
+        if (mode == '%') {
+            // Only a match that reaches the end of the value counts,
+            // and only one between min_len and max_len long
+            size_t k = value_len > max_len ? value_len - max_len : 0;
+            for (; k + min_len <= value_len; k++) {
+                if (glob_match(pat, plen, value + k, value_len - k)) {
+                    if (buffer_append(out, value, k) != 0) return -1;
+                    return buffer_append(out, rep, rep_len);
+                }
+            }
+            return buffer_append(out, value, value_len);
+        }
+        
+        // Longest match starting at i
+        size_t match_end = (size_t)-1;
+        if (!(replaced && mode != 'a') && !(mode == '#' && i > 0) && value_len - i >= min_len) {
+            size_t end = value_len - i > max_len ? i + max_len : value_len;
+            for (; end + 1 > i + min_len; end--) {
+                if (glob_match(pat, plen, value + i, end - i)) {
+                    match_end = end;
+                    break;
                 }
             }
+        }
+        
+        if (match_end != (size_t)-1 && match_end > i) {
+            if (buffer_append(out, rep, rep_len) != 0) return -1;
+            i = match_end;
+            replaced = 1;
+            continue;
+        }
+        
+        if (i == value_len) {
+            break;
+        }
+        
+        if ((replaced && mode != 'a') || mode == '#') {
+            // Nothing else can be replaced: copy the tail in one go
+            return buffer_append(out, value + i, value_len - i);
+        }
+        
+        if (buffer_append(out, value + i, 1) != 0) return -1;
+        i++;
+    }
+    
+    return 0;
+}
+
+/* State shared with the array visitor while expanding "${arr[@]}" */
+typedef struct {
+    ExpandBuffer *out;
+    int split;           // 1 for "@" in a context that accepts several words
+    int first;
+    long skip;           // elements still to drop for ${arr[@]:off}
+    long limit;          // elements still to emit, or -1 for all
+} ArrayWordsContext;
+
+static int append_array_word(void *ctx, const char *item) {
+    ArrayWordsContext *words = ctx;
+    
+    if (words->skip > 0) {
+        words->skip--;
+        return 0;
+    }
+    if (words->limit == 0) {
+        return 0;
+    }
+    if (words->limit > 0) {
+        words->limit--;
+    }
+    
+    if (!words->first) {
+        int result = words->split ? buffer_break(words->out) : buffer_append(words->out, " ", 1);
+        if (result != 0) {
+            return -1;
+        }
+    }
+    words->first = 0;
+    return buffer_append(words->out, item, strlen(item));
+}
+
+/**
+ * Expand ${arr[@]}, ${arr[*]}, ${#arr[@]} and ${!arr[@]}
+ * "@" yields one word per element when the caller splits fields,
+ * "*" always joins the elements with a blank
+ * slice is the ":off[:len]" part of ${arr[@]:off:len} (element positions), or empty
+ */
+static int expand_array_words(ExpandBuffer *out, const char *name, size_t name_len,
+                              char which, int want_length, int want_keys,
+                              const char *slice, size_t slice_len) {
+    if (want_length) {
+        long count = for_each_array_item(name, name_len, 0, NULL, NULL);
+        char num[32];
+        int n = snprintf(num, sizeof(num), "%ld", count < 0 ? 0 : count);
+        return buffer_append(out, num, n);
+    }
+    
+    ArrayWordsContext words = {out, which == '@' && out->split_fields, 1, 0, -1};
+    out->saw_array = 1;
+    
+    if (slice_len > 0) {
+        const char *second = memchr(slice + 1, ':', slice_len - 1);
+        size_t first_len = second ? (size_t)(second - slice - 1) : slice_len - 1;
+        
+        words.skip = parse_offset(slice + 1, first_len);
+        if (words.skip < 0) {
+            words.skip += for_each_array_item(name, name_len, 0, NULL, NULL);
+            if (words.skip < 0) {
+                return 0;
+            }
+        }
+        if (second) {
+            words.limit = parse_offset(second + 1, slice_len - first_len - 2);
+            if (words.limit < 0) {
+                fprintf(stderr, "kord-sh: %.*s: substring expression < 0\n", (int)name_len, name);
+                return 0;
+            }
+        }
+    }
+    
+    // Unset expands to nothing; a failed append (out of memory) is an error
+    return for_each_array_item(name, name_len, want_keys, append_array_word, &words) == -2 ? -1 : 0;
+}
+
+static int expand_operator(ExpandBuffer *out, const char *name, size_t name_len, const char *subscript,
+                           const char *value, const char *op, size_t op_len);
+
+/**
+ * Evaluate the body of a "${...}" expansion and append the result
+ * Supports ${VAR}, ${#VAR}, ${!VAR}, ${VAR:-w}, ${VAR-w}, ${VAR:=w}, ${VAR=w},
+ * ${VAR:+w}, ${VAR+w}, ${VAR:?w}, ${VAR#p}, ${VAR##p}, ${VAR%p}, ${VAR%%p},
+ * ${VAR/p/r}, ${VAR//p/r}, ${VAR/#p/r}, ${VAR/%p/r}, ${VAR:off} and ${VAR:off:len}
+ * VAR may carry a subscript (${arr[i]}, ${map[key]}), and whole arrays expand
+ * with ${arr[@]}, ${arr[*]}, ${#arr[@]}, ${!arr[@]} and ${arr[@]:off:len}
+ */
+static int expand_parameter(ExpandBuffer *out, const char *body, size_t len) {
+    int want_length = 0;
+    int indirect = 0;
+    if (len > 1 && body[0] == '#') {
+        want_length = 1;
+        body++;
+        len--;
+    } else if (len > 1 && body[0] == '!') {
+        indirect = 1;
+        body++;
+        len--;
+    }
+    
+    size_t name_len = 0;
+    while (name_len < len && is_name_char(body[name_len])) {
+        name_len++;
+    }
+    
+    // Optional [subscript]
+    const char *subscript = NULL;
+    size_t sub_len = 0;
+    size_t lhs_len = name_len;
+    if (name_len > 0 && name_len < len && body[name_len] == '[') {
+        const char *close = memchr(body + name_len, ']', len - name_len);
+        if (close != NULL) {
+            subscript = body + name_len + 1;
+            sub_len = close - subscript;
+            lhs_len = close - body + 1;
+        }
+    }
+    
+    if (name_len == 0 || ((want_length || indirect) && lhs_len != len)) {
+        fprintf(stderr, "kord-sh: ${%.*s}: bad substitution\n", (int)len, body);
+        return 0;
+    }
+    
+    // The name is looked up in place; only ${VAR:=w} needs a terminated copy
+    const char *name = body;
+    
+    if (subscript != NULL && sub_len == 1 && (subscript[0] == '@' || subscript[0] == '*')) {
+        // Only the ${arr[@]:off:len} slice may follow a whole-array subscript
+        int slice = lhs_len + 1 < len && body[lhs_len] == ':' && !want_length && !indirect &&
+                    strchr("-=+?", body[lhs_len + 1]) == NULL;
+        if (lhs_len != len && !slice) {
+            fprintf(stderr, "kord-sh: ${%.*s}: bad substitution\n", (int)len, body);
+            return 0;
+        }
+        return expand_array_words(out, name, name_len, subscript[0], want_length, indirect,
+                                  body + lhs_len, len - lhs_len);
+    }
+    
+    char *sub_expanded = NULL;
+    const char *value;
+    if (subscript != NULL) {
+        sub_expanded = expand_word(subscript, sub_len);
+        if (!sub_expanded) {
+            return -1;
+        }
+        value = get_array_element_n(name, name_len, sub_expanded, strlen(sub_expanded));
+    } else {
+        value = get_variable_n(name, name_len);
+    }
+    
+    // ${!VAR}: the value of the variable named by $VAR
+    if (indirect) {
+        value = value ? get_variable(value) : NULL;
+    }
+    
+    int result;
+    if (want_length) {
+        char num[32];
+        int n = snprintf(num, sizeof(num), "%zu", value ? strlen(value) : 0);
+        result = buffer_append(out, num, n);
+    } else {
+        result = expand_operator(out, name, name_len, sub_expanded, value, body + lhs_len, len - lhs_len);
+    }
+    
+    free(sub_expanded);
+    return result;
+}
+
+/**
+ * Apply the operator part of "${...}" (":-w", "#p", "/p/r", ...) to value
+ * subscript is the expanded subscript when the name carried one, else NULL
+ */
+static int expand_operator(ExpandBuffer *out, const char *name, size_t name_len, const char *subscript,
+                           const char *value, const char *op, size_t op_len) {
+    size_t value_len = value ? strlen(value) : 0;
+    
+    if (op_len == 0) {
+        return value ? buffer_append(out, value, value_len) : 0;
+    }
+    
+    // ${VAR:-w} ${VAR:=w} ${VAR:+w} ${VAR:?w} and their colon-less forms
+    int colon = (op[0] == ':');
+    char kind = op[colon];
+    if (op_len > (size_t)colon && (kind == '-' || kind == '=' || kind == '+' || kind == '?')) {
+        const char *word = op + colon + 1;
+        size_t word_len = op_len - colon - 1;
+        int is_set = value != NULL && (!colon || value_len > 0);
+        
+        if (kind == '+') {
+            return is_set ? expand_into(out, word, word_len) : 0;
+        }
+        if (is_set) {
+            return buffer_append(out, value, value_len);
+        }
+        
+        char *expanded = expand_word(word, word_len);
+        if (!expanded) {
+            return -1;
+        }
+        
+        int result = 0;
+        if (kind == '?') {
+            fprintf(stderr, "kord-sh: %.*s: %s\n", (int)name_len, name,
+                    expanded[0] ? expanded : "parameter null or not set");
         } else {
-            // Regular character
-            *dst++ = *src++;
-            remaining--;
+            if (kind == '=') {
+                char *name_copy = strndup(name, name_len);
+                if (name_copy) {
+                    if (subscript != NULL) {
+                        set_array_element(name_copy, subscript, expanded);
+                    } else {
+                        set_variable(name_copy, expanded);
+                    }
+                    free(name_copy);
+                }
+            }
+            result = buffer_append(out, expanded, strlen(expanded));
+        }
+        free(expanded);
+        return result;
+    }
+    
+    // ${VAR:offset} and ${VAR:offset:length}
+    if (colon) {
+        const char *spec = op + 1;
+        size_t spec_len = op_len - 1;
+        const char *second = memchr(spec, ':', spec_len);
+        size_t first_len = second ? (size_t)(second - spec) : spec_len;
+        
+        long offset = parse_offset(spec, first_len);
+        if (offset < 0) {
+            offset += (long)value_len;
+            if (offset < 0) {
+                return 0;  // bash yields nothing when the offset is before the start
+            }
+        }
+        if ((size_t)offset > value_len) {
+            offset = (long)value_len;
+        }
+        
+        long count = (long)value_len - offset;
+        if (second) {
+            count = parse_offset(second + 1, spec_len - first_len - 1);
+            if (count < 0) {
+                count = (long)value_len + count - offset;
+                if (count < 0) {
+                    fprintf(stderr, "kord-sh: %.*s: substring expression < 0\n", (int)name_len, name);
+                    return 0;
+                }
+            }
+            if ((size_t)(offset + count) > value_len) {
+                count = (long)value_len - offset;
+            }
+        }
+        
+        return buffer_append(out, value ? value + offset : "", (size_t)count);
+    }
+    
+    // ${VAR#p} ${VAR##p} ${VAR%p} ${VAR%%p}
+    if (op[0] == '#' || op[0] == '%') {
+        int longest = (op_len > 1 && op[1] == op[0]);
+        size_t skip = longest ? 2 : 1;
+        
+        char *pat = expand_word(op + skip, op_len - skip);
+        if (!pat) {
+            return -1;
+        }
+        int result = append_trimmed(out, value ? value : "", value_len,
+                                    pat, strlen(pat), op[0], longest);
+        free(pat);
+        return result;
+    }
+    
+    // ${VAR/p/r} ${VAR//p/r} ${VAR/#p/r} ${VAR/%p/r}
+    if (op[0] == '/') {
+        char mode = '/';
+        size_t skip = 1;
+        if (op_len > 1 && (op[1] == '/' || op[1] == '#' || op[1] == '%')) {
+            mode = (op[1] == '/') ? 'a' : op[1];
+            skip = 2;
+        }
+        
+        const char *pat_start = op + skip;
+        size_t rest_len = op_len - skip;
+        size_t pat_len = rest_len;
+        for (size_t k = 0; k < rest_len; k++) {
+            if (pat_start[k] == '\\' && k + 1 < rest_len) {
+                k++;
+            } else if (pat_start[k] == '/') {
+                pat_len = k;
+                break;
+            }
         }
+        
+        const char *rep_start = pat_start + pat_len + (pat_len < rest_len ? 1 : 0);
+        size_t rep_len = (op + op_len) - rep_start;
+        
+        char *pat = expand_word(pat_start, pat_len);
+        char *rep = expand_word(rep_start, rep_len);
+        int result = -1;
+        if (pat && rep) {
+            result = append_replaced(out, value ? value : "", value_len,
+                                     pat, strlen(pat), rep, mode);
+        }
+        free(pat);
+        free(rep);
+        return result;
     }
     
-    *dst = '\0';
+    fprintf(stderr, "kord-sh: ${%.*s%.*s}: bad substitution\n", (int)name_len, name, (int)op_len, op);
+    return 0;
+}
+
+/**
+ * Expand $VAR and ${...} references in src[0..len) and append to out
+ * Returns 0 on success, -1 on allocation failure
+ */
+static int expand_into(ExpandBuffer *out, const char *src, size_t len) {
+    const char *src_end = src + len;
+    
+    while (src < src_end) {
+        // Copy the literal run up to the next '$' in one go
+        size_t run = scan_find_any(src, src_end - src, "$");
+        if (buffer_append(out, src, run) != 0) {
+            return -1;
+        }
+        src += run;
+        
+        if (src >= src_end) {
+            break;
+        }
+        
+        src++;  // Skip the '$'
+        
+        if (src < src_end && *src == '{') {
+            size_t body_len = find_brace_end(src + 1, src_end - src - 1);
+            if (src + 1 + body_len >= src_end) {
+                // Unterminated: keep the text as typed
+                if (buffer_append(out, src - 1, src_end - src + 1) != 0) {
+                    return -1;
+                }
+                break;
+            }
+            
+            if (expand_parameter(out, src + 1, body_len) != 0) {
+                return -1;
+            }
+            src += body_len + 2;
+            continue;
+        }
+        
+        // Extract variable name
+        const char *var_start = src;
+        while (src < src_end && is_name_char(*src)) {
+            src++;
+        }
+        
+        if (src > var_start) {
+            // We have a variable name
+            // Get variable value (looked up in place, no copy of the name)
+            const char *value = get_variable_n(var_start, src - var_start);
+            if (value && buffer_append(out, value, strlen(value)) != 0) {
+                return -1;
+            }
+            // If variable not found, replace with empty string
+        } else {
+            // Just a '$' without a variable name, keep it
+            if (buffer_append(out, "$", 1) != 0) {
+                return -1;
+            }
+        }
+    }
+    
+    return 0;
+}
+
+/* Growable argument vector for one command */
+typedef struct {
+    char **items;
+    int count;
+    int cap;
+} ArgList;
+
+/**
+ * Append an argument, keeping room for the NULL terminator
+ * Takes ownership of arg; returns 0 on success, -1 on failure
+ */
+static int arg_list_push(ArgList *list, char *arg) {
+    if (arg == NULL) {
+        perror("strdup");
+        return -1;
+    }
+    
+    if (list->count + 1 >= list->cap) {
+        int new_cap = list->cap ? list->cap * 2 : MAX_ARGS;
+        char **new_items = realloc(list->items, new_cap * sizeof(char *));
+        if (!new_items) {
+            perror("realloc");
+            free(arg);
+            return -1;
+        }
+        list->items = new_items;
+        list->cap = new_cap;
+    }
+    
+    list->items[list->count++] = arg;
+    list->items[list->count] = NULL;
+    return 0;
+}
+
+/**
+ * Expand variables in a token and append the resulting word(s) to args
+ * "${arr[@]}" produces one word per element; everything else one word
+ * Returns 0 on success, -1 on allocation failure
+ */
+static int expand_token(const char *token, ArgList *args) {
+    size_t len = strlen(token);
+    ExpandBuffer buf = {0};
+    buf.split_fields = 1;
+    
+    if (buffer_reserve(&buf, len) != 0 || expand_into(&buf, token, len) != 0) {
+        free(buf.data);
+        free(buf.breaks);
+        return -1;
+    }
+    
+    int result = 0;
+    if (buf.saw_array && buf.len == 0 && buf.break_count == 0) {
+        // An empty "${arr[@]}" produces no word at all
+        free(buf.data);
+    } else if (buf.break_count == 0) {
+        result = arg_list_push(args, buf.data);
+    } else {
+        size_t start = 0;
+        for (size_t i = 0; i <= buf.break_count && result == 0; i++) {
+            size_t end = (i < buf.break_count) ? buf.breaks[i] : buf.len;
+            result = arg_list_push(args, strndup(buf.data + start, end - start));
+            start = end;
+        }
+        free(buf.data);
+    }
+    
+    free(buf.breaks);
     return result;
 }
 
+/**
+ * Length of the "NAME=" / "NAME[sub]=" / "NAME+=" prefix of an assignment word
+ * Returns 0 if s does not start like an assignment
+ */
+static size_t assignment_prefix_length(const char *s) {
+    if (!isalpha((unsigned char)s[0]) && s[0] != '_') {
+        return 0;
+    }
+    
+    size_t i = 1;
+    while (is_name_char(s[i])) i++;
+    
+    if (s[i] == '[') {
+        while (s[i] && s[i] != ']' && !isspace((unsigned char)s[i])) i++;
+        if (s[i] != ']') {
+            return 0;
+        }
+        i++;
+    }
+    if (s[i] == '+') i++;
+    
+    return (s[i] == '=') ? i + 1 : 0;
+}
+
 /**
  * Parse a single command string into arguments
+ * "NAME=(a b c)" is split into the words "NAME=(", "a", "b", "c", ")"
+ * so that quoted elements keep their blanks
  */
 static char **parse_single_command(const char *cmd_str) {
-    char **args = malloc(MAX_ARGS * sizeof(char *));
-    if (!args) {
-        perror("malloc");
-        return NULL;
-    }
+    ArgList args = {0};
     
     char *cmd_copy = strdup(cmd_str);
     if (!cmd_copy) {
-        free(args);
         perror("strdup");
         return NULL;
     }
     
-    int arg_count = 0;
     char *ptr = cmd_copy;
+    char *cmd_end = cmd_copy + strlen(cmd_copy);
+    int in_array_list = 0;     // inside NAME=( ... )
+    int assignments_only = 1;  // every word so far was NAME=value
+    int declaring = 0;         // words so far were "declare" and its options
     
-    while (*ptr && arg_count < MAX_ARGS - 1) {
+    while (ptr < cmd_end) {
         // Skip leading whitespace
-        while (*ptr && isspace((unsigned char)*ptr)) ptr++;
+        ptr += scan_skip_space(ptr, cmd_end - ptr);
         
-        if (!*ptr) break;
+        if (ptr >= cmd_end) break;
         
         char *start = ptr;
-        char quote = 0;
+        int result;
         
-        // Check if this token starts with a quote
-        if (*ptr == '"' || *ptr == '\'') {
-            quote = *ptr;
+        if (in_array_list && *ptr == ')') {
+            // End of a compound array assignment
+            in_array_list = 0;
+            ptr++;
+            result = arg_list_push(&args, strdup(")"));
+        } else if (*ptr == '"' || *ptr == '\'') {
+            // Check if this token starts with a quote
+            char quote = *ptr;
             ptr++;
             start = ptr;
             
             // Find matching closing quote
-            while (*ptr && *ptr != quote) ptr++;
+            char quote_set[2] = {quote, '\0'};
+            ptr += scan_find_any(ptr, cmd_end - ptr, quote_set);
             
-            if (*ptr == quote) {
-                *ptr = '\0';  // Null-terminate at closing quote
-                
-                // Expand variables in the argument
-                char *expanded = expand_variables(start);
-                if (expanded) {
-                    args[arg_count] = expanded;
-                } else {
-                    args[arg_count] = strdup(start);
-                }
-                
+            int closed = (*ptr == quote);
+            *ptr = '\0';  // Null-terminate at closing quote
+            
+            // Expand variables in the argument
+            result = expand_token(start, &args);
+            
+            if (closed) {
                 ptr++;  // Move past the closing quote
-            } else {
-                // No closing quote found, treat as regular token
-                char *expanded = expand_variables(start);
-                if (expanded) {
-                    args[arg_count] = expanded;
-                } else {
-                    args[arg_count] = strdup(start);
-                }
+            }
+            if (!in_array_list) {
+                assignments_only = 0;
             }
         } else {
-            // Regular token (no quotes)
-            while (*ptr && !isspace((unsigned char)*ptr)) ptr++;
-            
-            char temp = *ptr;
-            *ptr = '\0';
+            size_t prefix = (assignments_only && !in_array_list) ? assignment_prefix_length(ptr) : 0;
             
-            // Expand variables in the argument
-            char *expanded = expand_variables(start);
-            if (expanded) {
-                args[arg_count] = expanded;
+            if (prefix > 0 && ptr[prefix] == '(') {
+                // "NAME=(" becomes its own word; the elements follow
+                char saved = ptr[prefix + 1];
+                ptr[prefix + 1] = '\0';
+                result = arg_list_push(&args, strdup(start));
+                ptr[prefix + 1] = saved;
+                ptr += prefix + 1;
+                in_array_list = 1;
             } else {
-                args[arg_count] = strdup(start);
+                // Regular token (no quotes); a "${...}" inside it may contain blanks
+                const char *stop_set = in_array_list ? WHITESPACE_SET "$)" : WHITESPACE_SET "$";
+                while (ptr < cmd_end) {
+                    ptr += scan_find_any(ptr, cmd_end - ptr, stop_set);
+                    if (*ptr != '$') {
+                        break;
+                    }
+                    if (ptr[1] == '{') {
+                        ptr += 2 + find_brace_end(ptr + 2, cmd_end - ptr - 2);
+                    }
+                    if (ptr < cmd_end) ptr++;
+                }
+                
+                char temp = *ptr;
+                *ptr = '\0';
+                
+                if (prefix == 0 && !in_array_list) {
+                    // "declare [-aA] name=(...)" takes compound assignments too
+                    int is_declare = (args.count == 0 && strcmp(start, "declare") == 0) ||
+                                     (declaring && *start == '-');
+                    declaring = is_declare;
+                    assignments_only = is_declare;
+                }
+                
+                // Expand variables in the argument
+                result = expand_token(start, &args);
+                
+                *ptr = temp;
             }
-            
-            if (temp) *ptr = temp;
         }
         
-        if (!args[arg_count]) {
+        if (result != 0) {
             // Cleanup on error
-            for (int i = 0; i < arg_count; i++) {
-                free(args[i]);
+            for (int i = 0; i < args.count; i++) {
+                free(args.items[i]);
             }
-            free(args);
+            free(args.items);
             free(cmd_copy);
-            perror("strdup");
             return NULL;
         }
-        
-        arg_count++;
-        if (*ptr) ptr++;
     }
     
-    args[arg_count] = NULL;  // NULL terminate the array
     free(cmd_copy);
     
-    return args;
+    // A command with no words still needs a NULL-terminated array
+    if (args.items == NULL) {
+        args.items = calloc(1, sizeof(char *));
+        if (!args.items) {
+            perror("calloc");
+        }
+    }
+    
+    return args.items;
 }
 
 char ***parse_command(const char *command) {
@@ -204,12 +1031,30 @@ char ***parse_command(const char *command) {
     
     int cmd_count = 0;
     char *ptr = cmd_copy;
+    char *cmd_end = cmd_copy + strlen(cmd_copy);
     char *segment_start = ptr;
     int in_quotes = 0;
     char quote_char = 0;
     
     // Manually split by pipe while respecting quotes
     while (cmd_count < MAX_COMMANDS - 1) {
+        // Jump straight to the next byte that can change the split state
+        if (in_quotes) {
+            char quote_set[2] = {quote_char, '\0'};
+            ptr += scan_find_any(ptr, cmd_end - ptr, quote_set);
+        } else {
+            ptr += scan_find_any(ptr, cmd_end - ptr, "\"'|$");
+            
+            // A '|' inside "${VAR/a|b/c}" does not start a new command
+            if (ptr[0] == '$') {
+                if (ptr[1] == '{') {
+                    ptr += 2 + find_brace_end(ptr + 2, cmd_end - ptr - 2);
+                }
+                if (ptr < cmd_end) ptr++;
+                continue;
+            }
+        }
+        
         if (*ptr == '\0') {
             // End of string - process final segment
             char *segment = trim_whitespace(segment_start);
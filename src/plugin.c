@@ -0,0 +1,210 @@
+#include "../include/common.h"
+#include "../include/plugin.h"
+#include "../include/kord_plugin.h"
+#include "../include/output.h"
+#include "../include/variables.h"
+#include "../include/raw_input.h"
+#include <dlfcn.h>
+
+/* Suffix of the symbol a plugin exports for each builtin */
+#define PLUGIN_SYMBOL_SUFFIX "_kord_builtin"
+
+/**
+ * A builtin loaded from a shared object
+ * The descriptor comes first, so the registered Builtin * leads back here
+ */
+typedef struct {
+    Builtin builtin;
+    char *name;
+    char *path;
+    void *handle;                    // from dlopen(), one reference per builtin
+    const KordBuiltin *plugin;
+} LoadedBuiltin;
+
+static int api_write(KordOutput *out, const char *data, size_t len) {
+    output_append(out, data, len);
+    return out->failed ? -1 : 0;
+}
+
+static int api_printf(KordOutput *out, const char *format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    int len = output_vformat(out, format, ap);
+    va_end(ap);
+    return len;
+}
+
+static const KordShellApi shell_api = {
+    KORD_PLUGIN_ABI_VERSION,
+    sizeof(KordShellApi),
+    api_write,
+    api_printf,
+    get_variable,
+    set_variable,
+    export_variable,
+    unset_variable,
+};
+
+static void free_loaded(LoadedBuiltin *loaded) {
+    if (loaded->handle != NULL) {
+        dlclose(loaded->handle);
+    }
+    free(loaded->name);
+    free(loaded->path);
+    free(loaded);
+}
+
+int load_plugin_builtin(const char *path, const char *name) {
+    if (find_builtin(name) != NULL) {
+        fprintf(stderr, "enable: %s: already a builtin\n\r", name);
+        return -1;
+    }
+
+    void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (handle == NULL) {
+        fprintf(stderr, "enable: %s\n\r", dlerror());
+        return -1;
+    }
+
+    char symbol[256];
+    const KordBuiltin *plugin = NULL;
+    if (snprintf(symbol, sizeof(symbol), "%s" PLUGIN_SYMBOL_SUFFIX, name) < (int)sizeof(symbol)) {
+        plugin = dlsym(handle, symbol);
+    }
+    const char *problem = NULL;
+    if (plugin == NULL) {
+        problem = "no such builtin in this file";
+    } else if (plugin->abi_version != KORD_PLUGIN_ABI_VERSION) {
+        problem = "built for another plugin ABI version";
+    } else if (plugin->func == NULL || (plugin->name != NULL && strcmp(plugin->name, name) != 0)) {
+        problem = "invalid builtin definition";
+    }
+    if (problem != NULL) {
+        fprintf(stderr, "enable: %s: %s: %s\n\r", path, name, problem);
+        dlclose(handle);
+        return -1;
+    }
+
+    LoadedBuiltin *loaded = calloc(1, sizeof(LoadedBuiltin));
+    if (loaded == NULL) {
+        perror("calloc");
+        dlclose(handle);
+        return -1;
+    }
+    loaded->handle = handle;
+    loaded->plugin = plugin;
+    loaded->name = strdup(name);
+    loaded->path = strdup(path);
+    if (loaded->name == NULL || loaded->path == NULL) {
+        perror("strdup");
+        free_loaded(loaded);
+        return -1;
+    }
+
+    // Plugin builtins run in the shell; state-changing ones even in pipelines
+    loaded->builtin.name = loaded->name;
+    loaded->builtin.type = BUILTIN_TYPE_PLUGIN;
+    loaded->builtin.func = NULL;
+    loaded->builtin.flags = (plugin->flags & KORD_BUILTIN_SHELL_STATE) ? BUILTIN_RUN_IN_PARENT : BUILTIN_FORKLESS;
+    if (register_builtin(&loaded->builtin) != 0) {
+        fprintf(stderr, "enable: %s: cannot register builtin\n\r", name);
+        free_loaded(loaded);
+        return -1;
+    }
+    return 0;
+}
+
+int unload_plugin_builtin(const char *name) {
+    const Builtin *builtin = find_builtin(name);
+    if (builtin == NULL || builtin->type != BUILTIN_TYPE_PLUGIN) {
+        return -1;
+    }
+    unregister_builtin(name);
+    free_loaded((LoadedBuiltin *)builtin);
+    return 0;
+}
+
+int run_plugin_builtin(const Builtin *builtin, char **args) {
+    const LoadedBuiltin *loaded = (const LoadedBuiltin *)builtin;
+    int argc = 0;
+    while (args[argc] != NULL) {
+        argc++;
+    }
+
+    OutputBuffer *out = malloc(sizeof(OutputBuffer));
+    if (out == NULL) {
+        perror("malloc");
+        return 1;
+    }
+    output_init(out, STDOUT_FILENO);
+    fflush(stdout);
+
+    // The plugin sees the terminal as a command would
+    int was_raw_mode = is_raw_mode_enabled();
+    if (was_raw_mode) {
+        disable_raw_mode();
+    }
+    int status = loaded->plugin->func(argc, args, out, &shell_api);
+    output_flush(out);
+    if (was_raw_mode) {
+        enable_raw_mode();
+    }
+    free(out);
+
+    // A negative status would read as "exit the shell"
+    return status < 0 || status > 255 ? 1 : status;
+}
+
+const char *plugin_builtin_usage(const Builtin *builtin) {
+    return ((const LoadedBuiltin *)builtin)->plugin->usage;
+}
+
+const char *plugin_builtin_path(const Builtin *builtin) {
+    return ((const LoadedBuiltin *)builtin)->path;
+}
+
+int builtin_enable(char **args) {
+    if (args[1] == NULL || (strcmp(args[1], "-p") == 0 && args[2] == NULL)) {
+        for (int i = 0; get_builtin_name(i) != NULL; i++) {
+            printf("enable %s\n\r", get_builtin_name(i));
+        }
+        size_t pos = 0;
+        const Builtin *builtin;
+        while ((builtin = next_registered_builtin(&pos)) != NULL) {
+            printf("enable -f %s %s\n\r", plugin_builtin_path(builtin), builtin->name);
+        }
+        return 0;
+    }
+
+    int status = 0;
+    if (strcmp(args[1], "-f") == 0 && args[2] != NULL && args[3] != NULL) {
+        for (int i = 3; args[i] != NULL; i++) {
+            if (load_plugin_builtin(args[2], args[i]) != 0) {
+                status = 1;
+            }
+        }
+        return status;
+    }
+    if (strcmp(args[1], "-d") == 0 && args[2] != NULL) {
+        for (int i = 2; args[i] != NULL; i++) {
+            if (unload_plugin_builtin(args[i]) != 0) {
+                fprintf(stderr, "enable: %s: not a dynamically loaded builtin\n\r", args[i]);
+                status = 1;
+            }
+        }
+        return status;
+    }
+
+    fprintf(stderr, "enable: usage: enable [-p] | enable -f file name ... | enable -d name ...\n\r");
+    return 2;
+}
+
+void cleanup_plugins(void) {
+    size_t pos = 0;
+    const Builtin *builtin;
+    while ((builtin = next_registered_builtin(&pos)) != NULL) {
+        unregister_builtin(builtin->name);
+        free_loaded((LoadedBuiltin *)builtin);
+        pos = 0;
+    }
+}
@@ -1,101 +1,446 @@
 #include "../include/common.h"
 #include "../include/prompt.h"
 #include "../include/raw_input.h"
+#include "../include/variables.h"
+#include "../include/builtins.h"
+#include "../include/prompt_async.h"
+
+/* Prompt used when PS1 is unset: "user@host:cwd$ " in colors */
+#define DEFAULT_PS1 COLOR_BOLD_GREEN "\\u@" COLOR_BOLD_CYAN "\\h" COLOR_WHITE ":" COLOR_BOLD_BLUE "\\w" COLOR_RESET "$ "
+
+/* Kinds of pieces a PS1 template compiles to */
+typedef enum {
+    PIECE_TEXT,          // fixed text, with user and host already filled in
+    PIECE_CWD,           // \w: current directory, $HOME as ~
+    PIECE_CWD_BASE,      // \W: its last component
+    PIECE_SEGMENT        // \{name:format}: an asynchronous segment
+} PieceKind;
+
+/* One piece of the compiled prompt; text points into program_text */
+typedef struct {
+    PieceKind kind;
+    int segment;         // PIECE_SEGMENT: the AsyncSegment
+    size_t offset;       // text, or the segment's format ("%s" stands for the value)
+    size_t len;
+} Piece;
+
+/*
+ * PS1 is compiled once into pieces; the prompt is only rebuilt from them
+ * when PS1, the tracked current directory or a segment value changes
+ */
+static char *program_source = NULL;  // the PS1 compiled (NULL: the default)
+static int program_compiled = 0;
+static Piece *pieces = NULL;
+static size_t piece_count = 0;
+static size_t piece_capacity = 0;
+static char *program_text = NULL;
+static size_t program_len = 0;
+static size_t program_capacity = 0;
+static unsigned program_segments = 0;   // bits 1 << AsyncSegment used by the program
+
+static char *username = NULL;        // looked up once (getpwuid() may go through NSS/LDAP)
+static char *hostname = NULL;
+
+static char *prompt = NULL;          // the last prompt built
+static size_t prompt_len = 0;
+static size_t prompt_capacity = 0;
+static char *prompt_cwd = NULL;      // the directory it shows
+static unsigned prompt_generation = 0;
+static int prompt_valid = 0;
+
+/**
+ * Append text to the compiled program's text, extending the previous
+ * piece if it is fixed text too
+ * Returns 0 on success, -1 on allocation failure
+ */
+static int program_append(PieceKind kind, int segment, const char *text, size_t len) {
+    if (program_len + len > program_capacity) {
+        size_t new_capacity = program_capacity ? program_capacity : 256;
+        while (new_capacity < program_len + len) {
+            new_capacity *= 2;
+        }
+        char *new_text = realloc(program_text, new_capacity);
+        if (!new_text) {
+            perror("realloc");
+            return -1;
+        }
+        program_text = new_text;
+        program_capacity = new_capacity;
+    }
+    memcpy(program_text + program_len, text, len);
+
+    Piece *last = piece_count > 0 ? &pieces[piece_count - 1] : NULL;
+    if (kind == PIECE_TEXT && last && last->kind == PIECE_TEXT && last->offset + last->len == program_len) {
+        last->len += len;
+        program_len += len;
+        return 0;
+    }
+    if (piece_count == piece_capacity) {
+        size_t new_capacity = piece_capacity ? piece_capacity * 2 : 16;
+        Piece *new_pieces = realloc(pieces, new_capacity * sizeof(Piece));
+        if (!new_pieces) {
+            perror("realloc");
+            return -1;
+        }
+        pieces = new_pieces;
+        piece_capacity = new_capacity;
+    }
+    pieces[piece_count++] = (Piece){kind, segment, program_len, len};
+    program_len += len;
+    if (kind == PIECE_SEGMENT) {
+        program_segments |= 1u << segment;
+    }
+    return 0;
+}
+
+/**
+ * Look up the username and hostname, once per session
+ * Returns 0 on success, -1 on failure
+ */
+static int lookup_identity(void) {
+    if (username) {
+        return 0;
+    }
+
+    char host[HOST_NAME_MAX + 1];
+    if (gethostname(host, sizeof(host)) == -1)
+    {
+        perror("gethostname");
+        return -1;
+    }
+    host[HOST_NAME_MAX] = '\0';
+
+    const char *user = get_variable("USER");
+    if (!user) {
+        struct passwd *pw = getpwuid(getuid()); // Get the user info from the user ID
+        user = pw ? pw->pw_name : "unknown";
+    }
+
+    hostname = strdup(host);
+    username = strdup(user);
+    if (!hostname || !username) {
+        perror("strdup");
+        free(hostname);
+        free(username);
+        hostname = username = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Compile a PS1 template into pieces. Escapes:
+ *   \u user   \h host up to the first '.'   \H host   \w cwd   \W its basename
+ *   \$ '#' for root, else '$'   \n newline   \e escape   \a bell   \\ backslash
+ *   \nnn octal byte   \[ \] (accepted; escape sequences are never counted as columns)
+ *   \{name} or \{name:format} the git, k8s or battery segment, with %s in
+ *   format standing for its value; left out entirely while the value is empty
+ * Anything else is copied as is
+ * Returns 0 on success, -1 on failure
+ */
+static int compile_prompt(const char *source) {
+    piece_count = 0;
+    program_len = 0;
+    program_segments = 0;
+    if (lookup_identity() != 0) {
+        return -1;
+    }
+
+    int status = 0;
+    const char *p = source;
+    while (*p && status == 0) {
+        if (*p != '\\' || p[1] == '\0') {
+            size_t len = strcspn(p + 1, "\\") + 1;
+            status = program_append(PIECE_TEXT, 0, p, len);
+            p += len;
+            continue;
+        }
+
+        char c = p[1];
+        p += 2;
+        char byte;
+        switch (c) {
+            case 'u':
+                status = program_append(PIECE_TEXT, 0, username, strlen(username));
+                break;
+            case 'h':
+                status = program_append(PIECE_TEXT, 0, hostname, strcspn(hostname, "."));
+                break;
+            case 'H':
+                status = program_append(PIECE_TEXT, 0, hostname, strlen(hostname));
+                break;
+            case 'w':
+                status = program_append(PIECE_CWD, 0, "", 0);
+                break;
+            case 'W':
+                status = program_append(PIECE_CWD_BASE, 0, "", 0);
+                break;
+            case '$':
+                status = program_append(PIECE_TEXT, 0, geteuid() == 0 ? "#" : "$", 1);
+                break;
+            case 'n':
+                status = program_append(PIECE_TEXT, 0, "\r\n", 2);  // raw mode: no output processing
+                break;
+            case 'e':
+                status = program_append(PIECE_TEXT, 0, "\033", 1);
+                break;
+            case 'a':
+                status = program_append(PIECE_TEXT, 0, "\a", 1);
+                break;
+            case '\\':
+                status = program_append(PIECE_TEXT, 0, "\\", 1);
+                break;
+            case '[':
+            case ']':
+                break;
+            case '{': {
+                size_t len = strcspn(p, "}");
+                size_t name_len = strcspn(p, ":}");
+                int segment = p[len] == '}' ? prompt_async_lookup(p, name_len) : -1;
+                if (segment < 0) {
+                    status = program_append(PIECE_TEXT, 0, "\\{", 2);
+                    break;
+                }
+                if (name_len < len) {
+                    status = program_append(PIECE_SEGMENT, segment, p + name_len + 1, len - name_len - 1);
+                } else {
+                    status = program_append(PIECE_SEGMENT, segment, "%s", 2);
+                }
+                p += len + 1;
+                break;
+            }
+            default:
+                if (c >= '0' && c <= '7') {
+                    byte = c - '0';
+                    for (int i = 0; i < 2 && *p >= '0' && *p <= '7'; i++) {
+                        byte = (char)(byte * 8 + (*p++ - '0'));
+                    }
+                    status = program_append(PIECE_TEXT, 0, &byte, 1);
+                } else {
+                    status = program_append(PIECE_TEXT, 0, p - 2, 2);
+                }
+                break;
+        }
+    }
+    return status;
+}
+
+/**
+ * Compile $PS1 (or the default prompt) if it changed since the last time
+ * Returns 1 if it was compiled again, 0 if not, -1 on failure
+ */
+static int update_program(void) {
+    const char *source = get_variable("PS1");
+    if (program_compiled && (source == NULL ? program_source == NULL
+                                            : program_source != NULL && strcmp(program_source, source) == 0)) {
+        return 0;
+    }
+
+    char *copy = source ? strdup(source) : NULL;
+    if (source && !copy) {
+        perror("strdup");
+        return -1;
+    }
+    free(program_source);
+    program_source = copy;
+    prompt_valid = 0;
+    program_compiled = compile_prompt(source ? source : DEFAULT_PS1) == 0;
+    return program_compiled ? 1 : -1;
+}
 
 void print_prompt(void)
 {
-    char *prompt = build_prompt();
-    if (!prompt) {
+    // Slow segments start on a worker now and are patched in as they arrive
+    if (update_program() >= 0) {
+        prompt_async_start(program_segments);
+    }
+
+    const char *prompt_str = build_prompt();
+    if (!prompt_str) {
         fprintf(stderr, "kord-sh$ ");
         fflush(stderr);
         return;
     }
 
-    fprintf(stdout, "%s", prompt);
+    fprintf(stdout, "%s", prompt_str);
     fflush(stdout);
-    free(prompt);
 }
 
-char *build_prompt() {
-    char hostname[HOST_NAME_MAX + 1];
-    char cwd[PATH_MAX];
-    char *username;
-    char *prompt;
-    size_t PROMPT_SIZE;
+/**
+ * Append text to the prompt being built
+ * Returns 0 on success, -1 on allocation failure
+ */
+static int prompt_append(const char *text, size_t len) {
+    if (prompt_len + len + 1 > prompt_capacity) {
+        size_t new_capacity = prompt_capacity ? prompt_capacity : 256;
+        while (new_capacity < prompt_len + len + 1) {
+            new_capacity *= 2;
+        }
+        char *new_prompt = realloc(prompt, new_capacity);
+        if (!new_prompt) {
+            perror("realloc");
+            return -1;
+        }
+        prompt = new_prompt;
+        prompt_capacity = new_capacity;
+    }
+    memcpy(prompt + prompt_len, text, len);
+    prompt_len += len;
+    prompt[prompt_len] = '\0';
+    return 0;
+}
 
-    // Get current directory
-    if (getcwd(cwd, sizeof(cwd)) == NULL)
-    {
-        perror("getcwd");
+/**
+ * Append the current directory, with $HOME shown as ~ (\w), or just its
+ * last component (\W)
+ * Returns 0 on success, -1 on allocation failure
+ */
+static int append_cwd(const char *cwd, int base_only) {
+    const char *home = get_variable("HOME");
+    size_t home_len = home ? strlen(home) : 0;
+    int in_home = home_len > 1 && strncmp(cwd, home, home_len) == 0 &&
+                  (cwd[home_len] == '\0' || cwd[home_len] == '/');
+
+    if (base_only) {
+        const char *slash = strrchr(cwd, '/');
+        if (in_home && cwd[home_len] == '\0') {
+            return prompt_append("~", 1);
+        }
+        if (slash && slash[1] != '\0') {
+            return prompt_append(slash + 1, strlen(slash + 1));
+        }
+        return prompt_append(cwd, strlen(cwd));
+    }
+    if (in_home) {
+        return prompt_append("~", 1) == 0 ? prompt_append(cwd + home_len, strlen(cwd + home_len)) : -1;
+    }
+    return prompt_append(cwd, strlen(cwd));
+}
+
+/**
+ * Append a segment through its format, or nothing while its value is empty
+ * Returns 0 on success, -1 on allocation failure
+ */
+static int append_segment(const Piece *piece) {
+    const char *value = prompt_async_value(piece->segment);
+    if (value[0] == '\0') {
+        return 0;
+    }
+
+    const char *format = program_text + piece->offset;
+    size_t i = 0;
+    while (i < piece->len) {
+        if (format[i] == '%' && i + 1 < piece->len && format[i + 1] == 's') {
+            if (prompt_append(value, strlen(value)) != 0) {
+                return -1;
+            }
+            i += 2;
+            continue;
+        }
+        if (prompt_append(format + i, 1) != 0) {
+            return -1;
+        }
+        i++;
+    }
+    return 0;
+}
+
+const char *build_prompt(void) {
+    if (update_program() < 0) {
         return NULL;
     }
 
-    // Get the hostname
-    if (gethostname(hostname, sizeof(hostname)) == -1)
+    // Current directory as tracked by cd in $PWD
+    const char *cwd = get_current_directory();
+    if (cwd == NULL)
     {
-        perror("gethostname");
+        perror("getcwd");
         return NULL;
     }
-
-    // Get the username
-    username = getenv("USER");
-    if (!username) {
-        struct passwd *pw = getpwuid(getuid()); // Get the user info from the user ID
-        username = pw ? pw->pw_name : "unknown";
+    if (prompt_valid && prompt_generation == prompt_async_generation() &&
+        prompt_cwd && strcmp(prompt_cwd, cwd) == 0) {
+        return prompt;
     }
 
-    // Calculate required size: color codes + username + hostname + cwd + formatting + null terminator
-    // Color codes: ~100 bytes (to be safe), formatting chars: "@:$ " = 4 bytes
-    PROMPT_SIZE = strlen(username) + strlen(hostname) + strlen(cwd) + 150;
-    
-    // Allocate prompt with calculated size
-    prompt = malloc(PROMPT_SIZE);
-    if (!prompt) {
-        perror("malloc");
+    char *new_cwd = strdup(cwd);
+    if (!new_cwd) {
+        perror("strdup");
         return NULL;
     }
 
-    snprintf(
-        prompt,
-        PROMPT_SIZE,
-        "%s%s@%s%s%s:%s%s%s$ ",
-        COLOR_BOLD_GREEN, username,
-        COLOR_BOLD_CYAN, hostname,
-        COLOR_WHITE,
-        COLOR_BOLD_BLUE, cwd,
-        COLOR_RESET
-    );
+    prompt_valid = 0;
+    prompt_len = 0;
+    int status = prompt_append("", 0);
+    for (size_t i = 0; i < piece_count && status == 0; i++) {
+        const Piece *piece = &pieces[i];
+        switch (piece->kind) {
+            case PIECE_TEXT:
+                status = prompt_append(program_text + piece->offset, piece->len);
+                break;
+            case PIECE_CWD:
+            case PIECE_CWD_BASE:
+                status = append_cwd(cwd, piece->kind == PIECE_CWD_BASE);
+                break;
+            case PIECE_SEGMENT:
+                status = append_segment(piece);
+                break;
+        }
+    }
+    if (status != 0) {
+        free(new_cwd);
+        return NULL;
+    }
 
+    free(prompt_cwd);
+    prompt_cwd = new_cwd;
+    prompt_generation = prompt_async_generation();
+    prompt_valid = 1;
     return prompt;
 }
 
-int read_user_input(char *command) {
+void cleanup_prompt(void) {
+    cleanup_prompt_async();
+    free(program_source);
+    free(pieces);
+    free(program_text);
+    free(username);
+    free(hostname);
+    free(prompt);
+    free(prompt_cwd);
+    program_source = program_text = username = hostname = prompt = prompt_cwd = NULL;
+    pieces = NULL;
+    piece_count = piece_capacity = program_len = program_capacity = 0;
+    prompt_len = prompt_capacity = 0;
+    program_compiled = prompt_valid = 0;
+    program_segments = 0;
+}
+
+int read_user_input(char **command) {
     // Use raw mode if enabled, otherwise use cooked mode
     if (is_raw_mode_enabled()) {
-        return read_input_raw(command, 1024);
+        return read_input_raw(command);
     }
     
-    // Cooked mode (original implementation)
-    int ch;
-    int i = 0;
-    
-    while ((ch = getchar()) != '\n' && ch != EOF)
-    {
-        if (i < 1023) { // Prevent buffer overflow (assuming 1024 buffer size)
-            command[i++] = (char)ch;
-        }
-    }
-    command[i] = '\0';
+    // Cooked mode: getline grows the buffer to fit the line
+    size_t capacity = 0;
+    *command = NULL;
+    ssize_t len = getline(command, &capacity, stdin);
     
     // Return -1 on EOF (Ctrl+D)
-    return (ch == EOF) ? -1 : i;
+    if (len == -1) {
+        free(*command);
+        *command = NULL;
+        return -1;
+    }
+    if (len > 0 && (*command)[len - 1] == '\n') {
+        (*command)[--len] = '\0';
+    }
+    return (int)len;
 }
 
 void print_welcome(void) {
     struct utsname sys_info;
-    struct passwd *pw = getpwuid(getuid());
-    char *username = pw ? pw->pw_name : getenv("USER");
-    if (!username) username = "user";
+    const char *user = lookup_identity() == 0 ? username : "user";
     
     // Get system info
     if (uname(&sys_info) == -1) {
@@ -123,7 +468,7 @@ void print_welcome(void) {
     printf("\n");
     
     printf("  %s⚡ Version:%s %s%s%s\n", COLOR_BOLD_YELLOW, COLOR_RESET, COLOR_BOLD_WHITE, SHELL_VERSION, COLOR_RESET);
-    printf("  %s👤 User:%s    %s%s%s\n", COLOR_BOLD_YELLOW, COLOR_RESET, COLOR_BOLD_WHITE, username, COLOR_RESET);
+    printf("  %s👤 User:%s    %s%s%s\n", COLOR_BOLD_YELLOW, COLOR_RESET, COLOR_BOLD_WHITE, user, COLOR_RESET);
     
     if (uname(&sys_info) != -1) {
         printf("  %s💻 System:%s  %s%s %s%s\n", COLOR_BOLD_YELLOW, COLOR_RESET, COLOR_BOLD_WHITE, sys_info.sysname, sys_info.machine, COLOR_RESET);
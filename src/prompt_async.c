@@ -0,0 +1,501 @@
+#include "../include/common.h"
+#include "../include/prompt_async.h"
+#include "../include/variables.h"
+#include "../include/builtins.h"
+#include "../include/background.h"
+#include <errno.h>
+
+/* Values remembered per segment, for as many contexts (directories, kubeconfigs) */
+#define SEGMENT_MEMORY 8
+
+/* Worker time budget when $PROMPT_TIMEOUT is unset (ms) */
+#define DEFAULT_PROMPT_TIMEOUT_MS 2000
+
+/* Segment values are cut to this many bytes */
+#define SEGMENT_VALUE_MAX 128
+
+/* Where batteries show up on Linux */
+#define POWER_SUPPLY_DIR "/sys/class/power_supply"
+
+static const char *const segment_names[SEGMENT_COUNT] = {"git", "k8s", "battery"};
+
+/* A value computed in some context */
+typedef struct {
+    char *key;
+    char *value;
+    unsigned long used;
+} Remembered;
+
+/**
+ * Segments being computed for one prompt
+ * Shared by the shell and the worker; freed by whichever lets go last
+ */
+typedef struct {
+    BackgroundTask task;
+    unsigned mask;
+    long long deadline;                 // CLOCK_MONOTONIC ms
+    char *keys[SEGMENT_COUNT];          // context of each segment
+    char *cwd;
+    char *kubeconfig;
+    char *path;
+    char **envp;                        // environment copy, for the commands run
+    char *results[SEGMENT_COUNT];       // NULL if not computed (guarded by task.lock)
+} PromptJob;
+
+static Remembered memory[SEGMENT_COUNT][SEGMENT_MEMORY];
+static unsigned long use_clock = 0;
+static char *current_keys[SEGMENT_COUNT];
+static unsigned generation = 0;
+static PromptJob *running = NULL;
+
+int prompt_async_lookup(const char *name, size_t len) {
+    for (int i = 0; i < SEGMENT_COUNT; i++) {
+        if (strlen(segment_names[i]) == len && strncmp(segment_names[i], name, len) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static Remembered *find_remembered(int segment, const char *key) {
+    for (int i = 0; i < SEGMENT_MEMORY; i++) {
+        Remembered *entry = &memory[segment][i];
+        if (entry->key != NULL && strcmp(entry->key, key) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Remember value for key, replacing the entry for the same key or else
+ * the least recently used one; takes ownership of value
+ * Returns 1 if the remembered value changed, 0 otherwise
+ */
+static int remember(int segment, const char *key, char *value) {
+    Remembered *entry = find_remembered(segment, key);
+    if (entry != NULL && strcmp(entry->value, value) == 0) {
+        free(value);
+        entry->used = ++use_clock;
+        return 0;
+    }
+    if (entry == NULL) {
+        char *key_copy = strdup(key);
+        if (key_copy == NULL) {
+            free(value);
+            return 0;
+        }
+        entry = &memory[segment][0];
+        for (int i = 0; i < SEGMENT_MEMORY; i++) {
+            if (memory[segment][i].key == NULL || memory[segment][i].used < entry->used) {
+                entry = &memory[segment][i];
+            }
+        }
+        free(entry->key);
+        entry->key = key_copy;
+    }
+    free(entry->value);
+    entry->value = value;
+    entry->used = ++use_clock;
+    return 1;
+}
+
+const char *prompt_async_value(int segment) {
+    if (segment < 0 || segment >= SEGMENT_COUNT || current_keys[segment] == NULL) {
+        return "";
+    }
+    Remembered *entry = find_remembered(segment, current_keys[segment]);
+    return entry ? entry->value : "";
+}
+
+unsigned prompt_async_generation(void) {
+    return generation;
+}
+
+static void release_job(PromptJob *job) {
+    if (!background_task_release(&job->task)) {
+        return;
+    }
+
+    for (int i = 0; i < SEGMENT_COUNT; i++) {
+        free(job->keys[i]);
+        free(job->results[i]);
+    }
+    free(job->cwd);
+    free(job->kubeconfig);
+    free(job->path);
+    free(job->envp);
+    free(job);
+}
+
+/**
+ * Read up to size - 1 bytes of a small file, NUL-terminated
+ * Returns the number of bytes read, or -1 on failure
+ */
+static ssize_t read_small_file(const char *path, char *buffer, size_t size) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    ssize_t n;
+    do {
+        n = read(fd, buffer, size - 1);
+    } while (n == -1 && errno == EINTR);
+    close(fd);
+    if (n < 0) {
+        return -1;
+    }
+    buffer[n] = '\0';
+    return n;
+}
+
+/**
+ * Find the repository holding dir: its work tree and git directory
+ * (a ".git" directory, or the one a ".git" file points to)
+ * Returns 0 if found, -1 if dir is not in a repository
+ */
+static int find_repository(const char *dir, char *worktree, char *gitdir) {
+    snprintf(worktree, PATH_MAX, "%s", dir);
+    while (1) {
+        struct stat st;
+        size_t len = strlen(worktree);
+        if (snprintf(gitdir, PATH_MAX, "%s/.git", len > 1 ? worktree : "") >= PATH_MAX) {
+            return -1;
+        }
+        if (stat(gitdir, &st) == 0 && S_ISDIR(st.st_mode)) {
+            return 0;
+        }
+        if (stat(gitdir, &st) == 0 && S_ISREG(st.st_mode)) {
+            // Linked work tree or submodule: "gitdir: <path>"
+            char link[PATH_MAX];
+            if (read_small_file(gitdir, link, sizeof(link)) <= 8 || strncmp(link, "gitdir: ", 8) != 0) {
+                return -1;
+            }
+            link[strcspn(link, "\r\n")] = '\0';
+            const char *target = link + 8;
+            if (target[0] == '/') {
+                snprintf(gitdir, PATH_MAX, "%s", target);
+            } else if (snprintf(gitdir, PATH_MAX, "%s/%s", len > 1 ? worktree : "", target) >= PATH_MAX) {
+                return -1;
+            }
+            return 0;
+        }
+
+        // Up one directory, until the root has been tried
+        char *slash = strrchr(worktree, '/');
+        if (slash == NULL || len <= 1) {
+            return -1;
+        }
+        if (slash == worktree) {
+            slash[1] = '\0';
+        } else {
+            *slash = '\0';
+        }
+    }
+}
+
+/**
+ * Find name in the directories of path
+ * Returns 0 with the full path in buffer, -1 if not found
+ */
+static int find_executable(const char *path, const char *name, char *buffer, size_t size) {
+    for (const char *dir = path; dir != NULL && *dir; ) {
+        size_t dir_len = strcspn(dir, ":");
+        if (dir_len > 0 && (size_t)snprintf(buffer, size, "%.*s/%s", (int)dir_len, dir, name) < size &&
+            access(buffer, X_OK) == 0) {
+            return 0;
+        }
+        dir += dir_len;
+        if (*dir == ':') dir++;
+    }
+    return -1;
+}
+
+/**
+ * Ask git whether the work tree has changes to tracked files, giving up at
+ * the job's deadline or when it is abandoned
+ * Returns 1 if it has, 0 if not, -1 if unknown
+ */
+static int repository_dirty(PromptJob *job, const char *worktree) {
+    char git[PATH_MAX];
+    if (find_executable(job->path, "git", git, sizeof(git)) != 0) {
+        return -1;
+    }
+
+    // Any output line is a changed file, so one byte settles it; untracked
+    // files would need a full scan
+    char *argv[] = {git, "-C", (char *)worktree, "--no-optional-locks", "status", "--porcelain",
+                    "--untracked-files=no", NULL};
+    size_t len;
+    int complete;
+    char *output = background_spawn_read(argv, job->envp, 1, job->deadline, &job->task.cancelled, &len, &complete);
+    if (output == NULL) {
+        return -1;
+    }
+    free(output);
+    return len > 0 ? 1 : complete ? 0 : -1;
+}
+
+/**
+ * Git segment: the branch checked out (from HEAD, without running git),
+ * or the short commit when detached, then '*' if tracked files changed
+ * Returns the value ("" outside a repository), or NULL on failure
+ */
+static char *git_segment(PromptJob *job) {
+    char worktree[PATH_MAX];
+    char gitdir[PATH_MAX];
+    if (find_repository(job->cwd, worktree, gitdir) != 0) {
+        return strdup("");
+    }
+
+    char head_path[PATH_MAX];
+    char head[256];
+    if (snprintf(head_path, sizeof(head_path), "%s/HEAD", gitdir) >= (int)sizeof(head_path) ||
+        read_small_file(head_path, head, sizeof(head)) <= 0) {
+        return strdup("");
+    }
+    head[strcspn(head, "\r\n")] = '\0';
+
+    const char *branch = head;
+    int branch_len = (int)strlen(head);
+    if (strncmp(head, "ref: refs/heads/", 16) == 0) {
+        branch += 16;
+        branch_len -= 16;
+    } else if (strncmp(head, "ref: ", 5) == 0) {
+        branch += 5;
+        branch_len -= 5;
+    } else if (branch_len > 7) {
+        branch_len = 7;
+    }
+
+    int dirty = repository_dirty(job, worktree);
+    char value[SEGMENT_VALUE_MAX];
+    snprintf(value, sizeof(value), "%.*s%s", branch_len, branch, dirty > 0 ? "*" : "");
+    return strdup(value);
+}
+
+/**
+ * Kubernetes segment: the current-context line of the kubeconfig
+ * Returns the value ("" if there is none), or NULL on failure
+ */
+static char *k8s_segment(PromptJob *job) {
+    FILE *file = job->kubeconfig ? fopen(job->kubeconfig, "re") : NULL;
+    if (file == NULL) {
+        return strdup("");
+    }
+
+    char line[SEGMENT_VALUE_MAX + 32];
+    char value[SEGMENT_VALUE_MAX] = "";
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (strncmp(line, "current-context:", 16) != 0) {
+            continue;
+        }
+        char *start = line + 16;
+        while (*start == ' ' || *start == '\t') start++;
+        size_t len = strcspn(start, "\r\n");
+        while (len > 0 && (start[len - 1] == ' ' || start[len - 1] == '\t')) len--;
+        if (len >= 2 && (start[0] == '"' || start[0] == '\'') && start[len - 1] == start[0]) {
+            start++;
+            len -= 2;
+        }
+        snprintf(value, sizeof(value), "%.*s", (int)len, start);
+        break;
+    }
+    fclose(file);
+    return strdup(value);
+}
+
+/**
+ * Battery segment: capacity of the first battery, '+' while charging
+ * Returns the value ("" without a battery), or NULL on failure
+ */
+static char *battery_segment(void) {
+    DIR *dir = opendir(POWER_SUPPLY_DIR);
+    if (dir == NULL) {
+        return strdup("");
+    }
+
+    char value[SEGMENT_VALUE_MAX] = "";
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        char path[PATH_MAX];
+        char type[32], capacity[16], status[32];
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s/type", POWER_SUPPLY_DIR, entry->d_name);
+        if (read_small_file(path, type, sizeof(type)) <= 0 || strncmp(type, "Battery", 7) != 0) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s/capacity", POWER_SUPPLY_DIR, entry->d_name);
+        if (read_small_file(path, capacity, sizeof(capacity)) <= 0) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s/status", POWER_SUPPLY_DIR, entry->d_name);
+        int charging = read_small_file(path, status, sizeof(status)) > 0 && strncmp(status, "Charging", 8) == 0;
+        snprintf(value, sizeof(value), "%d%%%s", atoi(capacity), charging ? "+" : "");
+        break;
+    }
+    closedir(dir);
+    return strdup(value);
+}
+
+static void *prompt_worker(void *arg) {
+    PromptJob *job = arg;
+    char *results[SEGMENT_COUNT] = {NULL};
+
+    for (int i = 0; i < SEGMENT_COUNT && !atomic_load(&job->task.cancelled); i++) {
+        if (!(job->mask & (1u << i))) {
+            continue;
+        }
+        if (i == SEGMENT_GIT) {
+            results[i] = git_segment(job);
+        } else if (i == SEGMENT_K8S) {
+            results[i] = k8s_segment(job);
+        } else {
+            results[i] = battery_segment();
+        }
+    }
+
+    pthread_mutex_lock(&job->task.lock);
+    memcpy(job->results, results, sizeof(results));
+    pthread_mutex_unlock(&job->task.lock);
+    background_task_finish(&job->task);
+
+    release_job(job);
+    return NULL;
+}
+
+/**
+ * Set the context of a segment for the current prompt
+ * Returns 1 if it changed, 0 otherwise
+ */
+static int set_current_key(int segment, const char *key) {
+    if (current_keys[segment] != NULL && strcmp(current_keys[segment], key) == 0) {
+        return 0;
+    }
+    char *copy = strdup(key);
+    if (copy == NULL) {
+        return 0;
+    }
+    free(current_keys[segment]);
+    current_keys[segment] = copy;
+    return 1;
+}
+
+void prompt_async_start(unsigned mask) {
+    // Results that arrived unseen (no one polled for them) still count
+    if (running != NULL) {
+        if (background_task_done(&running->task)) {
+            prompt_async_update();
+        } else {
+            atomic_store(&running->task.cancelled, 1);
+            release_job(running);
+            running = NULL;
+        }
+    }
+
+    // Contexts, read from shell state here on the main thread
+    const char *cwd = get_current_directory();
+    char kubeconfig[PATH_MAX] = "";
+    const char *kube = get_variable("KUBECONFIG");
+    const char *home = get_variable("HOME");
+    if (kube != NULL && kube[0] != '\0') {
+        snprintf(kubeconfig, sizeof(kubeconfig), "%.*s", (int)strcspn(kube, ":"), kube);
+    } else if (home != NULL) {
+        snprintf(kubeconfig, sizeof(kubeconfig), "%s/.kube/config", home);
+    }
+    const char *keys[SEGMENT_COUNT] = {cwd ? cwd : "", kubeconfig, ""};
+
+    int changed = 0;
+    for (int i = 0; i < SEGMENT_COUNT; i++) {
+        changed |= set_current_key(i, keys[i]);
+    }
+    if (changed) {
+        generation++;
+    }
+    if (mask == 0 || cwd == NULL) {
+        return;
+    }
+
+    PromptJob *job = calloc(1, sizeof(PromptJob));
+    if (job == NULL) {
+        perror("calloc");
+        return;
+    }
+    if (background_task_init(&job->task) != 0) {
+        free(job);
+        return;
+    }
+    job->mask = mask;
+    job->deadline = monotonic_ms() + get_variable_int("PROMPT_TIMEOUT", DEFAULT_PROMPT_TIMEOUT_MS);
+
+    const char *path = get_variable("PATH");
+    int failed = 0;
+    for (int i = 0; i < SEGMENT_COUNT; i++) {
+        job->keys[i] = strdup(keys[i]);
+        failed |= job->keys[i] == NULL;
+    }
+    job->cwd = strdup(cwd);
+    job->kubeconfig = kubeconfig[0] ? strdup(kubeconfig) : NULL;
+    job->path = strdup(path ? path : "/usr/local/bin:/usr/bin:/bin");
+    job->envp = copy_environment(NULL);
+    if (failed || job->cwd == NULL || job->path == NULL || job->envp == NULL) {
+        perror("malloc");
+        release_job(job);
+        return;
+    }
+
+    if (background_task_start(&job->task, prompt_worker, job) != 0) {
+        // No thread to spare: the prompt goes without these segments
+        release_job(job);
+        job = NULL;
+    }
+    running = job;
+}
+
+int prompt_async_fd(void) {
+    return running ? running->task.notify[0] : -1;
+}
+
+int prompt_async_update(void) {
+    if (running == NULL || !background_task_done(&running->task)) {
+        return 0;
+    }
+
+    int changed = 0;
+    for (int i = 0; i < SEGMENT_COUNT; i++) {
+        if (running->results[i] == NULL) {
+            continue;
+        }
+        int shown = current_keys[i] != NULL && strcmp(current_keys[i], running->keys[i]) == 0;
+        if (remember(i, running->keys[i], running->results[i]) && shown) {
+            changed = 1;
+        }
+        running->results[i] = NULL;
+    }
+    release_job(running);
+    running = NULL;
+
+    if (changed) {
+        generation++;
+    }
+    return changed;
+}
+
+void cleanup_prompt_async(void) {
+    if (running != NULL) {
+        atomic_store(&running->task.cancelled, 1);
+        release_job(running);
+        running = NULL;
+    }
+    for (int i = 0; i < SEGMENT_COUNT; i++) {
+        for (int j = 0; j < SEGMENT_MEMORY; j++) {
+            free(memory[i][j].key);
+            free(memory[i][j].value);
+            memory[i][j].key = memory[i][j].value = NULL;
+        }
+        free(current_keys[i]);
+        current_keys[i] = NULL;
+    }
+}
@@ -2,15 +2,70 @@
 #include "../include/raw_input.h"
 #include "../include/history.h"
 #include "../include/prompt.h"
+#include "../include/builtins.h"
+#include "../include/history_search.h"
+#include "../include/suggest.h"
+#include "../include/render.h"
+#include "../include/gap_buffer.h"
+#include "../include/completion.h"
+#include "../include/variables.h"
+#include "../include/completion_spec.h"
+#include "../include/highlight.h"
+#include "../include/prompt_async.h"
+#include "../include/background.h"
+#include <errno.h>
+#include <poll.h>
 
 /* Word boundary characters for navigation */
 #define IS_WORD_BOUNDARY(c) ((c) == ' ' || (c) == '\t' || (c) == '/' || (c) == '.' || (c) == '-' || (c) == '_' || (c) == '=' || (c) == ':' || (c) == ';')
 
+/* Longest query accepted by Ctrl+R search */
+#define SEARCH_QUERY_MAX 255
+
+/* How long to wait for the rest of an escape sequence before treating ESC as a key (ms) */
+#define ESCAPE_TIMEOUT_MS 50
+
+/* History entries indexed for autosuggestions per idle step */
+#define SUGGEST_BACKFILL_STEP 512
+
+/* How long Tab waits before listing the completions found so far (ms) */
+#define DEFAULT_COMPLETION_TIMEOUT_MS 250
+
+/* Completion candidates listed without asking first */
+#define COMPLETION_QUERY_ITEMS 100
+
+/* Size of the terminal input ring (power of two) */
+#define INPUT_RING_SIZE 16384
+
+/* Bracketed paste mode (xterm): pasted text arrives between these markers */
+#define PASTE_MODE_ON "\033[?2004h"
+#define PASTE_MODE_OFF "\033[?2004l"
+#define PASTE_END "\033[201~"
+
 /* Terminal state */
 static struct termios original_termios;
 static int raw_mode_active = 0;
 
+/* Length of the autosuggestion drawn (dimmed) after the line, and the prompt width */
+static size_t shown_suggestion = 0;
+static int prompt_width = 0;
+static int prompt_rows = 0;   // rows taken by the lines of the prompt before its last
+
+/* Bytes read from the terminal but not yet decoded: ring[head..tail) */
+static unsigned char input_ring[INPUT_RING_SIZE];
+static size_t ring_head = 0;
+static size_t ring_tail = 0;
+
+/* Lines of a multi-line paste still to be offered at the next prompts */
+static char *paste_rest = NULL;
+static size_t paste_rest_len = 0;
+static int paste_mode = 0;
+
 void disable_raw_mode(void) {
+    if (paste_mode) {
+        write(STDOUT_FILENO, PASTE_MODE_OFF, strlen(PASTE_MODE_OFF));
+        paste_mode = 0;
+    }
     if (raw_mode_active) {
         tcsetattr(STDIN_FILENO, TCSAFLUSH, &original_termios);
         raw_mode_active = 0;
@@ -84,103 +139,230 @@ int is_raw_mode_enabled(void) {
 }
 
 /**
- * Read a single byte from stdin
+ * Read whatever the terminal has (up to the free space in the ring) with
+ * one read(), waiting at most timeout_ms (-1: block)
+ * Returns the number of bytes added, 0 on timeout, -1 on error or EINTR
+ */
+static ssize_t fill_input(int timeout_ms) {
+    if (timeout_ms >= 0) {
+        struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+        if (poll(&pfd, 1, timeout_ms) <= 0) {
+            return 0;
+        }
+    }
+
+    if (ring_head == ring_tail) {
+        ring_head = ring_tail = 0;
+    }
+    // Largest contiguous free stretch after the tail
+    size_t start = ring_tail & (INPUT_RING_SIZE - 1);
+    size_t room = INPUT_RING_SIZE - (ring_tail - ring_head);
+    if (room > INPUT_RING_SIZE - start) {
+        room = INPUT_RING_SIZE - start;
+    }
+    if (room == 0) {
+        return 0;
+    }
+
+    ssize_t n = read(STDIN_FILENO, input_ring + start, room);
+    if (n <= 0) {
+        return -1;
+    }
+    ring_tail += (size_t)n;
+    return n;
+}
+
+/**
+ * Read a single byte of input, blocking until there is one
+ * Returns -1 if interrupted (e.g. by SIGWINCH)
  */
 static int read_byte(void) {
-    char c;
-    int nread = read(STDIN_FILENO, &c, 1);
-    return (nread == 1) ? c : -1;
+    if (ring_head == ring_tail && fill_input(-1) <= 0) {
+        return -1;
+    }
+    return (char)input_ring[ring_head++ & (INPUT_RING_SIZE - 1)];
 }
 
 /**
- * Write data to stdout
+ * Read the next byte of an escape sequence; a lone ESC does not wait forever
+ * Returns -1 if nothing arrives within ESCAPE_TIMEOUT_MS
  */
-static void write_stdout(const char *data, size_t len) {
-    write(STDOUT_FILENO, data, len);
+static int read_sequence_byte(void) {
+    if (ring_head == ring_tail && fill_input(ESCAPE_TIMEOUT_MS) <= 0) {
+        return -1;
+    }
+    return (char)input_ring[ring_head++ & (INPUT_RING_SIZE - 1)];
 }
 
 /**
- * Move cursor left by n positions
+ * Check whether more input is already waiting, without blocking
+ * Returns 1 if a read would not block, 0 otherwise
  */
-static void move_cursor_left(int n) {
-    if (n <= 0) return;
-    char buf[16];
-    snprintf(buf, sizeof(buf), "\033[%dD", n);
-    write_stdout(buf, strlen(buf));
+static int input_pending(void) {
+    if (ring_head != ring_tail) {
+        return 1;
+    }
+    struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+    return poll(&pfd, 1, 0) > 0;
 }
 
 /**
- * Move cursor right by n positions
+ * Block until input arrives, taking the results of the prompt's
+ * background segments if they come first
+ * Returns 0 when input is waiting, 1 if the prompt changed, -1 otherwise
+ * (interrupted, or segment results that change nothing)
  */
-static void move_cursor_right(int n) {
-    if (n <= 0) return;
-    char buf[16];
-    snprintf(buf, sizeof(buf), "\033[%dC", n);
-    write_stdout(buf, strlen(buf));
+static int wait_for_input(void) {
+    int fd = prompt_async_fd();
+    if (fd == -1 || ring_head != ring_tail) {
+        return 0;
+    }
+
+    struct pollfd pfds[2] = {{STDIN_FILENO, POLLIN, 0}, {fd, POLLIN, 0}};
+    if (poll(pfds, 2, -1) <= 0) {
+        return -1;
+    }
+    if (pfds[1].revents) {
+        return prompt_async_update() ? 1 : -1;
+    }
+    return 0;
 }
 
 /**
- * Clear from cursor to end of line
+ * Take the run of printable ASCII bytes already buffered after a typed one,
+ * so a burst of keys is inserted (and drawn) at once
+ * Returns the number of bytes copied to out
  */
-static void clear_to_end(void) {
-    write_stdout("\033[K", 3);
+static size_t take_printable_run(char *out, size_t max) {
+    size_t n = 0;
+    while (n < max && ring_head != ring_tail) {
+        unsigned char c = input_ring[ring_head & (INPUT_RING_SIZE - 1)];
+        if (c < 32 || c >= 127) {
+            break;
+        }
+        out[n++] = (char)c;
+        ring_head++;
+    }
+    return n;
+}
+
+/**
+ * Turn bracketed paste mode on or off (queued with the next frame)
+ */
+static void set_paste_mode(int on) {
+    if (paste_mode != on) {
+        const char *seq = on ? PASTE_MODE_ON : PASTE_MODE_OFF;
+        render_append(seq, strlen(seq));
+        paste_mode = on;
+    }
+}
+
+/**
+ * Read the body of a bracketed paste, after ESC[200~, up to ESC[201~
+ * Line breaks become '\n', tabs become spaces and other control bytes
+ * (including any escape sequences inside the paste) are dropped
+ * Returns the text (caller frees) and its length in *len, or NULL
+ */
+static char *read_paste(size_t *len) {
+    size_t cap = 4096, n = 0;
+    char *text = malloc(cap);
+    if (text == NULL) {
+        return NULL;
+    }
+
+    size_t end_len = strlen(PASTE_END);
+    size_t matched = 0;    // bytes of PASTE_END seen so far
+    int in_escape = 0;     // skipping another escape sequence inside the paste
+    int after_cr = 0;      // \r\n is one line break
+    while (matched < end_len) {
+        if (ring_head == ring_tail) {
+            errno = 0;
+            if (fill_input(-1) < 0 && errno != EINTR) {
+                break;  // EOF or error: keep what arrived
+            }
+        }
+        while (ring_head != ring_tail && matched < end_len) {
+            unsigned char c = input_ring[ring_head++ & (INPUT_RING_SIZE - 1)];
+
+            if (c == (unsigned char)PASTE_END[matched]) {
+                matched++;
+                continue;
+            }
+            if (matched > 0) {
+                matched = 0;
+                in_escape = 1;
+            }
+            if (c == '\033') {
+                matched = 1;
+                continue;
+            }
+            if (in_escape) {
+                in_escape = !(c >= '@' && c <= '~');
+                continue;
+            }
+
+            int was_cr = after_cr;
+            after_cr = (c == '\r');
+            if (c == '\n' && was_cr) {
+                continue;
+            }
+            if (c == '\r') {
+                c = '\n';
+            } else if (c == '\t') {
+                c = ' ';
+            } else if ((c < 32 && c != '\n') || c == 127) {
+                continue;
+            }
+
+            if (n + 1 >= cap) {
+                char *grown = realloc(text, cap * 2);
+                if (grown == NULL) {
+                    continue;  // Out of memory: keep what fits
+                }
+                text = grown;
+                cap *= 2;
+            }
+            text[n++] = (char)c;
+        }
+    }
+
+    text[n] = '\0';
+    *len = n;
+    return text;
 }
 
 /**
  * Handle backspace: remove character before cursor
  */
-static void handle_backspace(char *buffer, int *cursor, int *length) {
-    if (*cursor <= 0) return;
-    
-    // Shift characters left
-    memmove(&buffer[*cursor - 1], &buffer[*cursor], *length - *cursor);
+static void handle_backspace(GapBuffer *line, size_t *cursor) {
+    if (*cursor == 0) return;
+
     (*cursor)--;
-    (*length)--;
-    buffer[*length] = '\0';
-    
-    // move back one position
-    write_stdout("\b", 1);
-    write_stdout(&buffer[*cursor], *length - *cursor);
-    write_stdout(" ", 1);  // Clear the last character
-    
-    // Move cursor back to correct position
-    move_cursor_left(*length - *cursor + 1);
+    gb_delete(line, *cursor, 1);
 }
 
 /**
  * Handle delete: remove character at cursor position
  */
-static void handle_delete(char *buffer, int *cursor, int *length) {
-    if (*cursor >= *length) return;
-    
-    // Shift characters left
-    memmove(&buffer[*cursor], &buffer[*cursor + 1], *length - *cursor - 1);
-    (*length)--;
-    buffer[*length] = '\0';
-    
-    // Visual feedback: clear to end, reprint remaining text
-    write_stdout(&buffer[*cursor], *length - *cursor);
-    write_stdout(" ", 1);  // Clear the last character
-    
-    // Move cursor back to correct position
-    move_cursor_left(*length - *cursor + 1);
+static void handle_delete(GapBuffer *line, size_t *cursor) {
+    gb_delete(line, *cursor, 1);
 }
 
 /**
  * Move cursor to next word (Ctrl+Right)
  */
-static void move_cursor_next_word(const char *buffer, int *cursor, int length) {
-    if (*cursor >= length) return;
-    
+static void move_cursor_next_word(GapBuffer *line, size_t *cursor) {
+    const char *text = gb_text(line);
+    size_t length = gb_length(line);
+    if (text == NULL || *cursor >= length) return;
+
     // Skip any word boundaries
-    while (*cursor < length && IS_WORD_BOUNDARY(buffer[*cursor])) {
-        write_stdout(&buffer[*cursor], 1);
+    while (*cursor < length && IS_WORD_BOUNDARY(text[*cursor])) {
         (*cursor)++;
     }
-    
+
     // Move to end of current word
-    while (*cursor < length && !IS_WORD_BOUNDARY(buffer[*cursor])) {
-        write_stdout(&buffer[*cursor], 1);
+    while (*cursor < length && !IS_WORD_BOUNDARY(text[*cursor])) {
         (*cursor)++;
     }
 }
@@ -188,613 +370,917 @@ static void move_cursor_next_word(const char *buffer, int *cursor, int length) {
 /**
  * Move cursor to previous word (Ctrl+Left)
  */
-static void move_cursor_prev_word(const char *buffer, int *cursor) {
-    if (*cursor <= 0) return;
-    
-    int original_cursor = *cursor;
-    
+static void move_cursor_prev_word(GapBuffer *line, size_t *cursor) {
+    const char *text = gb_text(line);
+    if (text == NULL || *cursor == 0) return;
+
     // Skip any word boundaries before cursor
-    while (*cursor > 0 && IS_WORD_BOUNDARY(buffer[*cursor - 1])) {
+    while (*cursor > 0 && IS_WORD_BOUNDARY(text[*cursor - 1])) {
         (*cursor)--;
     }
-    
+
     // Move to start of current word
-    while (*cursor > 0 && !IS_WORD_BOUNDARY(buffer[*cursor - 1])) {
+    while (*cursor > 0 && !IS_WORD_BOUNDARY(text[*cursor - 1])) {
         (*cursor)--;
     }
-    
-    // Visual feedback
-    move_cursor_left(original_cursor - *cursor);
 }
 
 /**
  * Delete word forward (Ctrl+Delete)
  */
-static void delete_word_forward(char *buffer, int *cursor, int *length) {
-    if (*cursor >= *length) return;
-    
-    int start = *cursor;
-    int end = *cursor;
-    
-    // Skip word boundaries
-    while (end < *length && IS_WORD_BOUNDARY(buffer[end])) {
-        end++;
+static void delete_word_forward(GapBuffer *line, size_t *cursor) {
+    size_t end = *cursor;
+    move_cursor_next_word(line, &end);
+    gb_delete(line, *cursor, end - *cursor);
+}
+
+/**
+ * Delete word backward (Ctrl+Backspace)
+ */
+static void delete_word_backward(GapBuffer *line, size_t *cursor) {
+    size_t start = *cursor;
+    move_cursor_prev_word(line, &start);
+    gb_delete(line, start, *cursor - start);
+    *cursor = start;
+}
+
+/**
+ * Insert text[0..len) at cursor position and move the cursor past it
+ */
+static void insert_text(GapBuffer *line, size_t *cursor, const char *text, size_t len) {
+    if (gb_insert(line, *cursor, text, len) == 0) {
+        *cursor += len;
     }
-    
-    // Delete word characters
-    while (end < *length && !IS_WORD_BOUNDARY(buffer[end])) {
-        end++;
+}
+
+/**
+ * Insert pasted text as one block
+ * Only its first line goes into the current line; the others are kept
+ * and offered, one per prompt, after this one is run (nothing pasted
+ * runs without Enter)
+ */
+static void insert_paste(GapBuffer *line, size_t *cursor, char *text, size_t len) {
+    char *newline = memchr(text, '\n', len);
+    size_t first = newline ? (size_t)(newline - text) : len;
+    insert_text(line, cursor, text, first);
+
+    size_t rest = len - first;
+    while (rest > 0 && text[first + rest - 1] == '\n') {
+        rest--;
     }
-    
-    if (end > start) {
-        // Shift remaining characters left
-        memmove(&buffer[start], &buffer[end], *length - end);
-        *length -= (end - start);
-        buffer[*length] = '\0';
-        
-        // Visual feedback
-        write_stdout(&buffer[*cursor], *length - *cursor);
-        // Clear extra characters
-        for (int i = 0; i < (end - start); i++) {
-            write_stdout(" ", 1);
+    if (rest > 1) {
+        free(paste_rest);
+        paste_rest = malloc(rest);
+        if (paste_rest != NULL) {
+            memcpy(paste_rest, text + first + 1, rest - 1);
+            paste_rest_len = rest - 1;
+        } else {
+            paste_rest_len = 0;
         }
-        move_cursor_left(*length - *cursor + (end - start));
     }
 }
 
 /**
- * Delete word backward (Ctrl+Backspace)
+ * Move the next kept line of a multi-line paste into the empty line
  */
-static void delete_word_backward(char *buffer, int *cursor, int *length) {
-    if (*cursor <= 0) return;
-    
-    int end = *cursor;
-    int start = *cursor;
-    
-    // Skip word boundaries before cursor
-    while (start > 0 && IS_WORD_BOUNDARY(buffer[start - 1])) {
-        start--;
+static void take_paste_line(GapBuffer *line, size_t *cursor) {
+    if (paste_rest == NULL) return;
+
+    char *newline = memchr(paste_rest, '\n', paste_rest_len);
+    size_t first = newline ? (size_t)(newline - paste_rest) : paste_rest_len;
+    insert_text(line, cursor, paste_rest, first);
+
+    if (newline == NULL) {
+        free(paste_rest);
+        paste_rest = NULL;
+        paste_rest_len = 0;
+    } else {
+        paste_rest_len -= first + 1;
+        memmove(paste_rest, newline + 1, paste_rest_len);
     }
-    
-    // Delete word characters
-    while (start > 0 && !IS_WORD_BOUNDARY(buffer[start - 1])) {
-        start--;
+}
+
+/**
+ * Measure a prompt just drawn: the width of its last line, where the
+ * edited line starts, and the rows its earlier lines take
+ */
+static void measure_prompt(const char *prompt_str) {
+    prompt_width = 0;
+    prompt_rows = 0;
+    if (prompt_str == NULL) {
+        return;
     }
-    
-    if (start < end) {
-        // Shift remaining characters left
-        memmove(&buffer[start], &buffer[end], *length - end);
-        *length -= (end - start);
-        buffer[*length] = '\0';
-        *cursor = start;
-        
-        // Visual feedback
-        move_cursor_left(end - start);
-        write_stdout(&buffer[*cursor], *length - *cursor);
-        // Clear extra characters
-        for (int i = 0; i < (end - start); i++) {
-            write_stdout(" ", 1);
-        }
-        move_cursor_left(*length - *cursor + (end - start));
+
+    int width = render_width();
+    const char *line = prompt_str;
+    const char *newline;
+    while ((newline = strchr(line, '\n')) != NULL) {
+        int columns = render_text_width(line, (size_t)(newline - line));
+        prompt_rows += columns > width ? (columns + width - 1) / width : 1;
+        line = newline + 1;
     }
+    prompt_width = render_text_width(line, strlen(line));
 }
 
 /**
- * Insert character at cursor position
+ * Print the prompt on a fresh row and start a new frame after it (queued)
  */
-static void insert_char(char *buffer, int *cursor, int *length, char c, size_t buffer_size) {
-    if (*length >= (int)buffer_size - 1) return;
-    
-    // Shift characters right to make room
-    memmove(&buffer[*cursor + 1], &buffer[*cursor], *length - *cursor);
-    buffer[*cursor] = c;
-    (*length)++;
-    buffer[*length] = '\0';
-    
-    // Visual feedback: write character and remaining text
-    write_stdout(&buffer[*cursor], *length - *cursor);
-    (*cursor)++;
-    
-    // Move cursor back to correct position
-    move_cursor_left(*length - *cursor);
+static void begin_prompt(void) {
+    const char *prompt_str = build_prompt();
+    if (prompt_str) {
+        render_append(prompt_str, strlen(prompt_str));
+    }
+    measure_prompt(prompt_str);
+    render_begin(prompt_width);
 }
 
 /**
- * Find all files/directories matching prefix
+ * Erase every line of the prompt and the drawn line, leaving the cursor
+ * where the prompt started (queued)
  */
-static char **find_completions(const char *prefix, int *count) {
-    *count = 0;
-    
-    char *last_slash = strrchr(prefix, '/');
-    const char *dir_path = ".";
-    const char *file_prefix = prefix;
-    char dir_buffer[1024];
-    
-    if (last_slash != NULL) {
-        // Extract directory path and file prefix
-        size_t dir_len = last_slash - prefix;
-        if (dir_len == 0) {
-            dir_path = "/";
-        } else {
-            strncpy(dir_buffer, prefix, dir_len);
-            dir_buffer[dir_len] = '\0';
-            dir_path = dir_buffer;
-        }
-        file_prefix = last_slash + 1;
+static void clear_prompt(void) {
+    render_clear();
+    if (prompt_rows > 0) {
+        char up[16];
+        int len = snprintf(up, sizeof(up), "\033[%dA\r\033[J", prompt_rows);
+        render_append(up, (size_t)len);
     }
-    
-    DIR *dir = opendir(dir_path);
-    if (dir == NULL) {
-        return NULL;
+}
+
+/**
+ * List completion candidates below the line in as many columns as the
+ * terminal fits, followed by a fresh prompt, all in one write
+ * Asks first when there are more than COMPLETION_QUERY_ITEMS of them.
+ * Partial results (from a search still running) are never asked about:
+ * the first COMPLETION_QUERY_ITEMS are listed, and the line is redrawn
+ */
+static void list_completions(GapBuffer *line, size_t cursor, const CompletionList *matches, int partial) {
+    const char *buffer = gb_text(line);
+    if (buffer != NULL) {
+        render_line(buffer, gb_length(line), highlight_line(buffer, gb_length(line)), cursor, NULL, 0);
     }
-    
-    // First pass: count matches
-    struct dirent *entry;
-    size_t prefix_len = strlen(file_prefix);
-    while ((entry = readdir(dir)) != NULL) {
-        // Skip . and ..
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-            continue;
+    render_end(NULL);
+
+    size_t shown = matches->count;
+    if (partial && shown > COMPLETION_QUERY_ITEMS) {
+        shown = COMPLETION_QUERY_ITEMS;
+    } else if (matches->count > COMPLETION_QUERY_ITEMS) {
+        char question[64];
+        int question_len = snprintf(question, sizeof(question), "Display all %zu possibilities? (y or n)",
+                                    matches->count);
+        render_append(question, question_len);
+        render_flush();
+
+        int answer;
+        do {
+            answer = read_byte();
+        } while (answer == -1);
+        render_append("\r\n", 2);
+
+        if (answer != 'y' && answer != 'Y' && answer != ' ') {
+            begin_prompt();
+            render_flush();
+            return;
         }
-        
-        // Check if name starts with prefix (case insensitive)
-        // If prefix is empty, match all files
-        if (prefix_len == 0 || strncasecmp(entry->d_name, file_prefix, prefix_len) == 0) {
-            (*count)++;
+    }
+
+    // Display matches in columns
+    int max_len = 0;
+    for (size_t i = 0; i < shown; i++) {
+        int len = render_text_width(matches->items[i], strlen(matches->items[i]));
+        if (len > max_len) max_len = len;
+    }
+
+    size_t cols = (size_t)(render_width() / (max_len + 2));
+    if (cols < 1) cols = 1;
+
+    static const char spaces[] = "                                ";
+    for (size_t i = 0; i < shown; i++) {
+        const char *match = matches->items[i];
+        size_t match_len = strlen(match);
+        render_append(match, match_len);
+
+        if ((i + 1) % cols == 0 || i == shown - 1) {
+            render_append("\r\n", 2);
+        } else {
+            int padding = max_len + 2 - render_text_width(match, match_len);
+            while (padding > 0) {
+                int chunk = padding < (int)sizeof(spaces) - 1 ? padding : (int)sizeof(spaces) - 1;
+                render_append(spaces, chunk);
+                padding -= chunk;
+            }
         }
     }
-    
-    if (*count == 0) {
-        closedir(dir);
-        return NULL;
+
+    if (partial) {
+        char note[96];
+        int note_len = snprintf(note, sizeof(note), "(still searching: %zu found so far)\r\n", matches->count);
+        render_append(note, note_len);
     }
-    
-    // Allocate array for matches
-    char **matches = malloc((*count + 1) * sizeof(char *));
-    if (matches == NULL) {
-        closedir(dir);
-        return NULL;
+
+    // Redraw prompt; the input line follows on the next refresh
+    begin_prompt();
+    if (partial && buffer != NULL) {
+        render_line(buffer, gb_length(line), highlight_line(buffer, gb_length(line)), cursor, NULL, 0);
     }
-    
-    // Second pass: collect matches
-    rewinddir(dir);
-    int idx = 0;
-    while ((entry = readdir(dir)) != NULL && idx < *count) {
-        // Skip . and ..
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-            continue;
+    render_flush();
+}
+
+/**
+ * Wait for a completion job while keeping the editor responsive
+ * Any keystroke stops the wait (and is then handled as usual). Once the
+ * time budget runs out, the candidates found so far are listed and the
+ * wait goes on
+ * Returns 1 with the final candidates in list, 0 if a keystroke
+ * interrupted the search, -1 on failure
+ */
+static int wait_for_completion(CompletionJob *job, GapBuffer *line, size_t cursor, CompletionList *list) {
+    memset(list, 0, sizeof(*list));
+    long long deadline = monotonic_ms() + get_variable_int("COMPLETION_TIMEOUT", DEFAULT_COMPLETION_TIMEOUT_MS);
+    int shown_partial = 0;
+
+    while (1) {
+        if (ring_head != ring_tail) {
+            return 0;
         }
-        
-        // Check if name starts with prefix (case insensitive)
-        // If prefix is empty, match all files
-        if (prefix_len == 0 || strncasecmp(entry->d_name, file_prefix, prefix_len) == 0) {
-            // Build full path for stat
-            char full_path[2048];
-            if (last_slash != NULL) {
-                snprintf(full_path, sizeof(full_path), "%s/%s", dir_path, entry->d_name);
-            } else {
-                snprintf(full_path, sizeof(full_path), "%s", entry->d_name);
-            }
-            
-            // Check if it's a directory
-            struct stat st;
-            int is_dir = 0;
-            if (stat(full_path, &st) == 0 && S_ISDIR(st.st_mode)) {
-                is_dir = 1;
-            }
-            
-            // Allocate and store match (add / for directories)
-            size_t name_len = strlen(entry->d_name);
-            matches[idx] = malloc(name_len + 2);  // +1 for /, +1 for null
-            if (matches[idx] == NULL) {
-                // Cleanup on error
-                for (int i = 0; i < idx; i++) {
-                    free(matches[i]);
-                }
-                free(matches);
-                closedir(dir);
-                return NULL;
-            }
-            
-            strcpy(matches[idx], entry->d_name);
-            if (is_dir) {
-                strcat(matches[idx], "/");
+
+        int timeout = -1;
+        if (!shown_partial) {
+            long long left = deadline - monotonic_ms();
+            timeout = left > 0 ? (int)left : 0;
+        }
+        struct pollfd fds[2] = {
+            {STDIN_FILENO, POLLIN, 0},
+            {completion_job_fd(job), POLLIN, 0},
+        };
+        int ready = poll(fds, 2, timeout);
+        if (ready == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (fds[0].revents) {
+            return 0;
+        }
+
+        int done;
+        if (fds[1].revents) {
+            return completion_job_collect(job, list, &done) == 0 ? 1 : -1;
+        }
+        if (ready == 0) {
+            shown_partial = 1;
+            if (completion_job_collect(job, list, &done) == 0 && list->count > 0) {
+                list_completions(line, cursor, list, 1);
             }
-            idx++;
+            completion_list_free(list);
         }
     }
-    
-    closedir(dir);
-    matches[idx] = NULL;
-    *count = idx;
-    
-    return matches;
 }
 
 /**
  * Handle tab completion
+ * Command names are completed in command position; the arguments of
+ * commands with a completion spec from the spec, file names elsewhere.
+ * A single match is completed in the buffer. Several matches are
+ * completed up to their longest common prefix if that adds anything,
+ * and listed otherwise
  */
-static void handle_tab_completion(char *buffer, int *cursor, int *length, size_t buffer_size) {
-    // Get word at cursor - extract the current word from buffer
-    char word[256] = {0};
-    int word_start = *cursor;
-    
+static void handle_tab_completion(GapBuffer *line, size_t *cursor) {
+    const char *buffer = gb_text(line);
+    size_t length = gb_length(line);
+    if (buffer == NULL) return;
+
     // Find start of current word (go back to whitespace or beginning)
+    size_t word_start = *cursor;
     while (word_start > 0 && !isspace((unsigned char)buffer[word_start - 1])) {
         word_start--;
     }
-    
-    // Extract word from word_start to cursor
-    int word_len = *cursor - word_start;
-    if (word_len > 0 && word_len < 256) {
-        strncpy(word, &buffer[word_start], word_len);
-        word[word_len] = '\0';
+
+    // End of the word, if characters extend beyond the cursor
+    size_t word_end = *cursor;
+    while (word_end < length && !isspace((unsigned char)buffer[word_end])) {
+        word_end++;
     }
-    
-    // tab completions requires at least one character
-    if (word_len == 0) {
+
+    // The command name and the word before this one, for completion specs
+    size_t segment = word_start;
+    while (segment > 0 && buffer[segment - 1] != '|') {
+        segment--;
+    }
+    size_t command_start = segment;
+    while (command_start < word_start && isspace((unsigned char)buffer[command_start])) {
+        command_start++;
+    }
+    size_t command_end = command_start;
+    while (command_end < word_start && !isspace((unsigned char)buffer[command_end])) {
+        command_end++;
+    }
+    size_t previous_end = word_start;
+    while (previous_end > segment && isspace((unsigned char)buffer[previous_end - 1])) {
+        previous_end--;
+    }
+    size_t previous_start = previous_end;
+    while (previous_start > segment && !isspace((unsigned char)buffer[previous_start - 1])) {
+        previous_start--;
+    }
+
+    int in_command_position = command_start == word_start;
+    char *command = in_command_position ? NULL : strndup(buffer + command_start, command_end - command_start);
+    if (!in_command_position && command == NULL) {
         return;
     }
-    
-    // Find completions
-    int match_count = 0;
-    char **matches = find_completions(word, &match_count);
-    
-    if (match_count == 0) {
+
+    // tab completions requires at least one character, except for specs
+    if (word_start == *cursor && (command == NULL || !has_completion_spec(command))) {
+        free(command);
+        return;
+    }
+
+    char *word = strndup(buffer + word_start, *cursor - word_start);
+    char *previous = strndup(buffer + previous_start, previous_end - previous_start);
+    if (word == NULL || previous == NULL) {
+        free(command);
+        free(word);
+        free(previous);
+        return;
+    }
+
+    CompletionRequest request = {
+        .word = word,
+        .command_word = in_command_position && strchr(word, '/') == NULL,
+        .command = command,
+        .previous = previous,
+        .line = buffer,
+        .point = *cursor,
+    };
+    int command_word = request.command_word;
+
+    CompletionList matches = {0};
+    CompletionJob *job = completion_job_start(&request);
+    int status = job ? wait_for_completion(job, line, *cursor, &matches) : -1;
+    int whole_words = job ? completion_job_whole_words(job) : 0;
+    if (job != NULL) {
+        completion_job_release(job);
+    }
+    free(command);
+    free(previous);
+    if (status != 1 || matches.count == 0) {
         // No matches - beep or do nothing
+        completion_list_free(&matches);
+        free(word);
         return;
     }
-    
-    if (match_count == 1) {
-        // Single match - complete it
-        const char *completion = matches[0];
-        
-        // Extract just the filename part from word for comparison
-        const char *word_filename = word;
-        char *last_slash_in_word = strrchr(word, '/');
-        size_t dir_prefix_len = 0;
-        if (last_slash_in_word != NULL) {
-            word_filename = last_slash_in_word + 1;
-            dir_prefix_len = (last_slash_in_word - word) + 1;  // Include the slash
-        }
-        
-        size_t word_filename_len = strlen(word_filename);
-        size_t completion_len = strlen(completion);
-        
-        // Calculate what to add: the part of completion that wasn't typed
-        const char *to_add = completion + word_filename_len;
-        size_t add_len = strlen(to_add);
-        
-        // Check if we have space
-        if (*length + add_len >= buffer_size - 1) {
-            free(matches[0]);
-            free(matches);
-            return;
-        }
-        
-        // Remove old word from cursor to end of word (if any characters extend beyond cursor)
-        int word_end = *cursor;
-        while (word_end < *length && !isspace((unsigned char)buffer[word_end])) {
-            word_end++;
-        }
-        
-        if (word_end > *cursor) {
-            memmove(&buffer[*cursor], &buffer[word_end], *length - word_end);
-            *length -= (word_end - *cursor);
-            buffer[*length] = '\0';
-            
-            // Clear and redraw
-            clear_to_end();
-            write_stdout(&buffer[*cursor], *length - *cursor);
-            move_cursor_left(*length - *cursor);
+
+    // Whole-word candidates replace the word; file names only the part after
+    // the last slash, keeping the directory prefix
+    char *last_slash = whole_words ? NULL : strrchr(word, '/');
+    size_t filename_start = word_start + (last_slash ? (size_t)(last_slash - word) + 1 : 0);
+    size_t typed_len = *cursor - filename_start;
+
+    size_t common = matches.count == 1 ? strlen(matches.items[0]) : completion_common_prefix(&matches);
+    if (matches.count == 1 || common > typed_len) {
+        // A single match replaces the rest of the word too
+        if (matches.count == 1) {
+            gb_delete(line, *cursor, word_end - *cursor);
         }
-        
-        // We need to replace only the filename part (after the last slash), keeping directory prefix
-        // Calculate position where filename starts in the buffer
-        int filename_start = word_start + dir_prefix_len;
-        
-        // Move cursor to the start of the filename (not the whole word)
-        if (*cursor > filename_start) {
-            int chars_back = *cursor - filename_start;
-            move_cursor_left(chars_back);
-            *cursor = filename_start;
+
+        // Replace the typed filename part with the completion with correct case
+        gb_delete(line, filename_start, typed_len);
+        *cursor = filename_start;
+        insert_text(line, cursor, matches.items[0], common);
+
+        // A completed command name is followed by its arguments
+        if (command_word && matches.count == 1) {
+            insert_text(line, cursor, " ", 1);
         }
-        
-        // Remove the typed filename part
-        int filename_chars = word_filename_len;
-        if (filename_chars > 0) {
-            memmove(&buffer[*cursor], &buffer[*cursor + filename_chars], *length - *cursor - filename_chars);
-            *length -= filename_chars;
-            buffer[*length] = '\0';
-            
-            // Redraw from cursor position
-            clear_to_end();
-            write_stdout(&buffer[*cursor], *length - *cursor);
-            move_cursor_left(*length - *cursor);
+    } else {
+        list_completions(line, *cursor, &matches, 0);
+    }
+
+    completion_list_free(&matches);
+    free(word);
+}
+
+/**
+ * Redraw the current line as the search prompt and its current match
+ * The match is cut at the terminal width so the line never wraps
+ */
+static void render_search(int fuzzy, int failed, const char *query, const char *match) {
+    char header[SEARCH_QUERY_MAX + 64];
+    int header_len = snprintf(header, sizeof(header), "\r\033[K(%s%s)`%s': ",
+                              failed ? "failed " : "",
+                              fuzzy ? "fuzzy-search" : "reverse-i-search", query);
+    if (header_len >= (int)sizeof(header)) {
+        header_len = sizeof(header) - 1;
+    }
+    render_append(header, header_len);
+
+    if (match != NULL) {
+        // "\r\033[K" takes no columns
+        int room = render_width() - (header_len - 4) - 1;
+        size_t match_len = strcspn(match, "\n");
+        if (room > 0) {
+            render_append(match, match_len < (size_t)room ? match_len : (size_t)room);
         }
-        
-        // Insert the complete filename with correct case
-        for (size_t i = 0; i < completion_len && *length < (int)buffer_size - 1; i++) {
-            insert_char(buffer, cursor, length, completion[i], buffer_size);
+    }
+    render_flush();
+}
+
+/**
+ * Find the oldest entry newer than index `after` containing query (Ctrl+S)
+ */
+static int search_newer(const char *query, int after) {
+    int count = get_history_count();
+    for (int i = after + 1; i < count; i++) {
+        const char *command = get_history(i);
+        if (command != NULL && strstr(command, query) != NULL) {
+            return i;
         }
-        
-        free(matches[0]);
-        free(matches);
-    } else {
-        // Multiple matches - display them
-        write_stdout("\n\r", 2);
-        
-        // Sort matches for better display
-        for (int i = 0; i < match_count - 1; i++) {
-            for (int j = i + 1; j < match_count; j++) {
-                if (strcmp(matches[i], matches[j]) > 0) {
-                    char *temp = matches[i];
-                    matches[i] = matches[j];
-                    matches[j] = temp;
+    }
+    return -1;
+}
+
+/**
+ * Incremental history search (Ctrl+R)
+ * Ctrl+R / Ctrl+S step to older / newer matches, Ctrl+T toggles fuzzy
+ * ranking, Ctrl+G cancels. Redraws are skipped while keys are still queued,
+ * and a fuzzy ranking pass gives up as soon as another key arrives.
+ * On return line holds the selected command (or the original line if
+ * cancelled) and *match_index its history index (or -1)
+ * Returns the key that ended the search, for the caller to process
+ * (0 if it was consumed)
+ */
+static int history_search(GapBuffer *line, int *match_index) {
+    char query[SEARCH_QUERY_MAX + 1] = "";
+    size_t query_len = 0;
+    const char *text = gb_text(line);
+    char *original = strdup(text ? text : "");
+
+    int fuzzy = 0;
+    int failed = 0;
+    int match = -1;                              // reverse-i-search: current match
+    int results[HISTORY_FUZZY_MAX_RESULTS];      // fuzzy: ranked matches
+    int result_count = 0;
+    int selected = 0;
+    int fuzzy_stale = 0;                         // results do not reflect the query yet
+    int redraw = 1;
+    int key;
+
+    while (1) {
+        if (!input_pending()) {
+            if (fuzzy && fuzzy_stale) {
+                int n = history_search_fuzzy(query, results, HISTORY_FUZZY_MAX_RESULTS, input_pending);
+                if (n >= 0) {
+                    result_count = n;
+                    selected = 0;
+                    fuzzy_stale = 0;
+                    failed = query_len > 0 && n == 0;
+                    redraw = 1;
                 }
             }
+            if (render_resized()) {
+                redraw = 1;
+            }
+            if (redraw && !input_pending()) {
+                int shown = fuzzy ? (result_count > 0 ? results[selected] : -1) : match;
+                render_search(fuzzy, failed, query, shown >= 0 ? get_history(shown) : NULL);
+                redraw = 0;
+            }
         }
-        
-        // Display matches in columns
-        int max_len = 0;
-        for (int i = 0; i < match_count; i++) {
-            int len = strlen(matches[i]);
-            if (len > max_len) max_len = len;
+
+        key = read_byte();
+        if (key == -1) {
+            continue;
         }
-        
-        int cols = 80 / (max_len + 2);
-        if (cols < 1) cols = 1;
-        
-        for (int i = 0; i < match_count; i++) {
-            write_stdout(matches[i], strlen(matches[i]));
-            
-            if ((i + 1) % cols == 0 || i == match_count - 1) {
-                write_stdout("\n\r", 2);
+
+        if (key == 18 || key == 19) {  // Ctrl+R / Ctrl+S - older / newer match
+            if (fuzzy) {
+                if (key == 18 && selected + 1 < result_count) {
+                    selected++;
+                } else if (key == 19 && selected > 0) {
+                    selected--;
+                }
+            } else if (match != -1) {
+                int next = key == 18 ? history_search_substring(query, match) : search_newer(query, match);
+                if (next != -1) {
+                    match = next;
+                }
+                failed = (next == -1);
+            }
+            redraw = 1;
+        } else if (key == 20) {  // Ctrl+T - toggle fuzzy ranking
+            fuzzy = !fuzzy;
+            if (fuzzy) {
+                fuzzy_stale = 1;
             } else {
-                int padding = max_len + 2 - strlen(matches[i]);
-                for (int p = 0; p < padding; p++) {
-                    write_stdout(" ", 1);
+                match = history_search_substring(query, get_history_count());
+                failed = query_len > 0 && match == -1;
+            }
+            redraw = 1;
+        } else if (key == 127 || key == 8) {  // Backspace - shorten the query
+            if (query_len > 0) {
+                query[--query_len] = '\0';
+                if (fuzzy) {
+                    fuzzy_stale = 1;
+                } else {
+                    match = history_search_substring(query, get_history_count());
+                    failed = query_len > 0 && match == -1;
                 }
+                redraw = 1;
+            }
+        } else if (key >= 32 && key < 127) {  // Extend the query
+            if (query_len < SEARCH_QUERY_MAX) {
+                query[query_len++] = (char)key;
+                query[query_len] = '\0';
+                if (fuzzy) {
+                    fuzzy_stale = 1;
+                } else {
+                    // The current match stays if it still contains the query
+                    int next = history_search_substring(query, match == -1 ? get_history_count() : match + 1);
+                    if (next != -1) {
+                        match = next;
+                    }
+                    failed = (next == -1);
+                }
+                redraw = 1;
+            }
+        } else if (key == 7 || key == 3) {  // Ctrl+G / Ctrl+C - give up
+            match = -1;
+            result_count = 0;
+            fuzzy = 0;
+            break;
+        } else if (key == 27) {  // ESC - keep the match; an escape sequence is handled by the caller
+            if (ring_head == ring_tail && fill_input(ESCAPE_TIMEOUT_MS) <= 0) {
+                key = 0;
             }
+            break;
+        } else {
+            break;  // Enter or another control key: accept the match
         }
-        
-        // Redraw prompt and current input
-        char *prompt_str = build_prompt();
-        if (prompt_str) {
-            write_stdout(prompt_str, strlen(prompt_str));
-            free(prompt_str);
+    }
+
+    // A stale fuzzy result list still points at the previous query's matches
+    int chosen = fuzzy ? (result_count > 0 && !fuzzy_stale ? results[selected] : -1) : match;
+    const char *command = chosen >= 0 ? get_history(chosen) : NULL;
+    if (command == NULL) {
+        command = original ? original : "";
+        chosen = -1;
+    }
+    gb_set(line, command, strlen(command));
+    free(original);
+
+    *match_index = chosen;
+    return (key == 7) ? 0 : key;
+}
+
+/**
+ * Bring the screen up to date with the line, with the history suggestion
+ * for it drawn dimmed after the cursor (fish-style)
+ * The suggestion is only offered while the cursor is at the end of the
+ * line, and is cut so that it never wraps onto another row
+ */
+static void refresh_line(GapBuffer *line, size_t cursor) {
+    const char *buffer = gb_text(line);
+    size_t length = gb_length(line);
+    if (buffer == NULL) return;
+
+    const char *suggestion = NULL;
+    if (cursor == length && length > 0) {
+        suggestion = suggest_lookup(buffer, length, get_current_directory());
+    }
+
+    int suffix_len = suggestion ? (int)strcspn(suggestion + length, "\n") : 0;
+    if (suffix_len > 0) {
+        int width = render_width();
+        int room = width - (prompt_width + render_text_width(buffer, length)) % width - 1;
+        if (suffix_len > room) {
+            suffix_len = room > 0 ? room : 0;
         }
-        write_stdout(buffer, *length);
-        move_cursor_left(*length - *cursor);
-        
-        // Cleanup
-        for (int i = 0; i < match_count; i++) {
-            free(matches[i]);
+        // Never end the cut in the middle of a UTF-8 character
+        while (suffix_len > 0 && ((unsigned char)suggestion[length + suffix_len] & 0xC0) == 0x80) {
+            suffix_len--;
         }
-        free(matches);
     }
+
+    render_line(buffer, length, highlight_line(buffer, length), cursor,
+                suffix_len > 0 ? suggestion + length : NULL, suffix_len);
+    shown_suggestion = suffix_len;
+}
+
+/**
+ * Finish the line: drop the suggestion, append tail (if any) after the
+ * text and move to the next row
+ */
+static void finish_line(GapBuffer *line, const char *tail) {
+    set_paste_mode(0);
+    const char *buffer = gb_text(line);
+    if (buffer != NULL) {
+        render_line(buffer, gb_length(line), highlight_line(buffer, gb_length(line)), gb_length(line), NULL, 0);
+    }
+    render_end(tail);
+    render_flush();
+    shown_suggestion = 0;
 }
 
+/**
+ * Accept the suggestion: append the rest of the suggested line
+ * Returns 1 if something was appended, 0 otherwise
+ */
+static int accept_suggestion(GapBuffer *line, size_t *cursor) {
+    const char *buffer = gb_text(line);
+    size_t length = gb_length(line);
+    if (shown_suggestion == 0 || *cursor != length || buffer == NULL) {
+        return 0;
+    }
+
+    const char *suggestion = suggest_lookup(buffer, length, get_current_directory());
+    if (suggestion == NULL) {
+        return 0;
+    }
+
+    insert_text(line, cursor, suggestion + length, strlen(suggestion) - length);
+    return 1;
+}
+
+/**
+ * Replace the line with a history entry, cursor at its end
+ */
+static void load_history_line(GapBuffer *line, size_t *cursor, const char *command) {
+    if (gb_set(line, command, strlen(command)) == 0) {
+        *cursor = gb_length(line);
+    }
+}
 
-int read_input_raw(char *buffer, size_t buffer_size) {
+int read_input_raw(char **result) {
+    *result = NULL;
     if (!raw_mode_active) {
         fprintf(stderr, "Error: Raw mode not enabled\n");
         return -1;
     }
-    
-    int cursor = 0;    // Current cursor position in buffer
-    int length = 0;    // Current length of input
-    memset(buffer, 0, buffer_size);
-    
+
+    GapBuffer line;
+    if (gb_init(&line, 256) != 0) {
+        return -1;
+    }
+    size_t cursor = 0;    // Current cursor position in the line
+
     // History navigation state
     static int history_index = -1;  // -1 means not navigating history
     static int from_history = 0;    // 1 if current buffer is from history
 
+    int pending_key = 0;            // key handed back by Ctrl+R search
+
+    // The caller has already printed the prompt
+    init_render();
+    measure_prompt(build_prompt());
+    render_begin(prompt_width);
+    render_resized();
+    highlight_reset();
+    shown_suggestion = 0;
+    set_paste_mode(1);
+    take_paste_line(&line, &cursor);
+
     while (1) {
-        int c = read_byte();
-        
+        // Draw once the keys typed so far are handled, then index older
+        // history for suggestions until the next key arrives
+        if (pending_key == 0 && !input_pending()) {
+            if (render_resized()) {
+                // Rows have reflowed; start over on the cursor's row
+                render_append("\r\033[J", 4);
+                begin_prompt();
+            }
+            refresh_line(&line, cursor);
+            while (suggest_backfill(SUGGEST_BACKFILL_STEP) && !input_pending()) {
+            }
+        }
+
+        // A background prompt segment changed: draw the prompt again in place
+        if (pending_key == 0) {
+            int woke = wait_for_input();
+            if (woke == 1) {
+                clear_prompt();
+                begin_prompt();
+            }
+            if (woke != 0) {
+                continue;
+            }
+        }
+
+        int c = pending_key ? pending_key : read_byte();
+        pending_key = 0;
+
         if (c == -1) {
-            continue;  // Timeout, no input
+            continue;  // Interrupted (e.g. by SIGWINCH), no input
         }
-        
+
         // Handle escape sequences (arrow keys, etc.)
         if (c == 27) {  // ESC
-            int c2 = read_byte();
+            int c2 = read_sequence_byte();
             if (c2 == '[') {
-                int c3 = read_byte();
-                
+                int c3 = read_sequence_byte();
+
                 if (c3 == 'A') {
                     // UP arrow - navigate history backwards (newer to older)
                     int hist_count = get_history_count();
                     if (hist_count > 0) {
-                        // Initialize history navigation
-                        if (history_index == -1) {
-                            history_index = hist_count - 1;
-                        } else if (history_index > 0) {
-                            history_index--;
-                        } else {
+                        // Initialize history navigation, skipping erased duplicates
+                        int prev = find_history_entry(history_index == -1 ? hist_count - 1 : history_index - 1, -1);
+                        if (prev == -1) {
                             // Already at oldest entry
                             continue;
                         }
-                        
+                        history_index = prev;
+
                         const char *hist_cmd = get_history(history_index);
                         if (hist_cmd != NULL) {
-                            // Clear current line
-                            move_cursor_left(cursor);
-                            clear_to_end();
-                            
-                            // Copy history command to buffer
-                            strncpy(buffer, hist_cmd, buffer_size - 1);
-                            buffer[buffer_size - 1] = '\0';
-                            length = strlen(buffer);
-                            cursor = length;
+                            load_history_line(&line, &cursor, hist_cmd);
                             from_history = 1;
-                            
-                            // Display the command
-                            write_stdout(buffer, length);
                         }
                     }
                     continue;
                 } else if (c3 == 'B') {
                     // DOWN arrow - navigate history forwards (older to newer)
                     int hist_count = get_history_count();
+                    int next = history_index == -1 ? -1 : find_history_entry(history_index + 1, 1);
                     if (hist_count > 0 && history_index != -1) {
-                        if (history_index < hist_count - 1) {
-                            history_index++;
-                            
+                        if (next != -1) {
+                            history_index = next;
+
                             const char *hist_cmd = get_history(history_index);
                             if (hist_cmd != NULL) {
-                                // Clear current line
-                                move_cursor_left(cursor);
-                                clear_to_end();
-                                
-                                // Copy history command to buffer
-                                strncpy(buffer, hist_cmd, buffer_size - 1);
-                                buffer[buffer_size - 1] = '\0';
-                                length = strlen(buffer);
-                                cursor = length;
+                                load_history_line(&line, &cursor, hist_cmd);
                                 from_history = 1;
-                                
-                                // Display the command
-                                write_stdout(buffer, length);
                             }
                         } else {
                             // Go past newest entry - clear line
                             history_index = -1;
                             from_history = 0;
-                            
-                            // Clear current line
-                            move_cursor_left(cursor);
-                            clear_to_end();
-                            
-                            buffer[0] = '\0';
-                            length = 0;
+
+                            gb_set(&line, "", 0);
                             cursor = 0;
                         }
                     }
                     continue;
                 } else if (c3 == 'C') {
-                    // RIGHT arrow - move cursor right
-                    if (cursor < length) {
-                        write_stdout(&buffer[cursor], 1);
+                    // RIGHT arrow - move cursor right, or accept the suggestion at the end
+                    if (accept_suggestion(&line, &cursor)) {
+                        from_history = 0;
+                    } else if (cursor < gb_length(&line)) {
                         cursor++;
                     }
                     continue;
                 } else if (c3 == 'D') {
                     // LEFT arrow - move cursor left
                     if (cursor > 0) {
-                        write_stdout("\b", 1);
                         cursor--;
                     }
                     continue;
                 } else if (c3 == 'H') {
                     // HOME - move to beginning
-                    move_cursor_left(cursor);
                     cursor = 0;
                     continue;
                 } else if (c3 == 'F') {
-                    // END - move to end
-                    move_cursor_right(length - cursor);
-                    cursor = length;
+                    // END - move to end, or accept the suggestion if already there
+                    if (accept_suggestion(&line, &cursor)) {
+                        from_history = 0;
+                        continue;
+                    }
+                    cursor = gb_length(&line);
                     continue;
                 } else if (c3 == '3') {
                     // DELETE key sequence is ESC [ 3 ~
                     // Or Ctrl+Delete: ESC [ 3 ; 5 ~
-                    int c4 = read_byte();
+                    int c4 = read_sequence_byte();
                     if (c4 == '~') {
-                        handle_delete(buffer, &cursor, &length);
+                        handle_delete(&line, &cursor);
                     } else if (c4 == ';') {
-                        int c5 = read_byte();
-                        int c6 = read_byte();
+                        int c5 = read_sequence_byte();
+                        int c6 = read_sequence_byte();
                         if (c5 == '5' && c6 == '~') {
                             // Ctrl+Delete - delete word forward
-                            delete_word_forward(buffer, &cursor, &length);
+                            delete_word_forward(&line, &cursor);
                         }
                     }
                     continue;
                 } else if (c3 == '1') {
                     // Ctrl+Arrow keys: ESC [ 1 ; 5 C/D
-                    int c4 = read_byte();
+                    int c4 = read_sequence_byte();
                     if (c4 == ';') {
-                        int c5 = read_byte();
-                        int c6 = read_byte();
+                        int c5 = read_sequence_byte();
+                        int c6 = read_sequence_byte();
                         if (c5 == '5') {
                             if (c6 == 'C') {
                                 // Ctrl+Right - move to next word
-                                move_cursor_next_word(buffer, &cursor, length);
+                                move_cursor_next_word(&line, &cursor);
                             } else if (c6 == 'D') {
                                 // Ctrl+Left - move to previous word
-                                move_cursor_prev_word(buffer, &cursor);
+                                move_cursor_prev_word(&line, &cursor);
                             }
                         }
                     }
                     continue;
+                } else if (c3 == '2') {
+                    // Bracketed paste: ESC [ 2 0 0 ~ <text> ESC [ 2 0 1 ~
+                    int c4 = read_sequence_byte();
+                    int c5 = read_sequence_byte();
+                    int c6 = read_sequence_byte();
+                    if (c4 == '0' && c5 == '0' && c6 == '~') {
+                        size_t paste_len = 0;
+                        char *paste = read_paste(&paste_len);
+                        if (paste != NULL) {
+                            insert_paste(&line, &cursor, paste, paste_len);
+                            free(paste);
+                            from_history = 0;
+                            history_index = -1;
+                        }
+                    }
+                    continue;
                 } else if (c3 == ';') {
                     // Alternative Ctrl+Arrow format: ESC [ ; 5 C/D
-                    int c4 = read_byte();
-                    int c5 = read_byte();
+                    int c4 = read_sequence_byte();
+                    int c5 = read_sequence_byte();
                     if (c4 == '5') {
                         if (c5 == 'C') {
                             // Ctrl+Right
-                            move_cursor_next_word(buffer, &cursor, length);
+                            move_cursor_next_word(&line, &cursor);
                         } else if (c5 == 'D') {
                             // Ctrl+Left
-                            move_cursor_prev_word(buffer, &cursor);
+                            move_cursor_prev_word(&line, &cursor);
                         }
                     }
                     continue;
                 }
             } else if (c2 == 127 || c2 == 8) {
                 // Some terminals send ESC+Backspace for Ctrl+Backspace
-                delete_word_backward(buffer, &cursor, &length);
+                delete_word_backward(&line, &cursor);
                 continue;
             }
             continue;
         }
-        
+
         // Handle special characters
         if (c == 1) {  // Ctrl+A - move to beginning
-            move_cursor_left(cursor);
             cursor = 0;
             continue;
         } else if (c == 4) {  // Ctrl+D (EOF)
-            if (length == 0) {
+            if (gb_length(&line) == 0) {
+                set_paste_mode(0);
+                render_flush();
+                gb_free(&line);
                 return -1;  // EOF on empty line
             }
             continue;
-        } else if (c == 3) {  // Ctrl+C
-            write_stdout("^C\n\r", 4);
-            buffer[0] = '\0';
+        } else if (c == 3) {  // Ctrl+C - also drops the rest of a multi-line paste
+            free(paste_rest);
+            paste_rest = NULL;
+            paste_rest_len = 0;
+            finish_line(&line, "^C");
+            gb_set(&line, "", 0);
+            *result = gb_detach(&line);
             return 0;
+        } else if (c == 18) {  // Ctrl+R - incremental history search
+            // The search prompt replaces the prompt and the line
+            clear_prompt();
+            int match = -1;
+            pending_key = history_search(&line, &match);
+            cursor = gb_length(&line);
+            history_index = match;
+            from_history = (match != -1);
+            render_append("\r\033[K", 4);
+            begin_prompt();
+            continue;
         } else if (c == 23) {  // Ctrl+W - delete word backward
-            delete_word_backward(buffer, &cursor, &length);
+            delete_word_backward(&line, &cursor);
             continue;
         } else if (c == '\r' || c == '\n') {  // Enter
-            write_stdout("\n\r", 2);
-            buffer[length] = '\0';
-            
+            finish_line(&line, NULL);
+            int length = (int)gb_length(&line);
+            *result = gb_detach(&line);
+            if (*result == NULL) {
+                return -1;
+            }
+
             // If command is from history and not modified, move it to latest position
             if (from_history && history_index != -1) {
                 const char *hist_cmd = get_history(history_index);
-                if (hist_cmd != NULL && strcmp(buffer, hist_cmd) == 0) {
+                if (hist_cmd != NULL && strcmp(*result, hist_cmd) == 0) {
                     move_history_to_latest(history_index);
                 }
             }
-            
+
             // Reset history navigation state
             history_index = -1;
             from_history = 0;
-            
+
             return length;
         } else if (c == 127 || c == 8) {  // Backspace or DEL
             // If user modifies history command, it's no longer from history
             if (from_history) {
                 from_history = 0;
             }
-            handle_backspace(buffer, &cursor, &length);
+            handle_backspace(&line, &cursor);
         } else if (c == '\t') {  // Tab
             // Tab completion for files and directories
-            handle_tab_completion(buffer, &cursor, &length, buffer_size);
+            handle_tab_completion(&line, &cursor);
             continue;
         } else if (c >= 32 && c < 127) {  // Printable character
             // If user types anything, reset history navigation
@@ -804,10 +1290,15 @@ int read_input_raw(char *buffer, size_t buffer_size) {
             if (history_index != -1) {
                 history_index = -1;
             }
-            insert_char(buffer, &cursor, &length, c, buffer_size);
+            // Insert it with the rest of the burst already buffered
+            char run[256];
+            run[0] = (char)c;
+            size_t run_len = 1 + take_printable_run(run + 1, sizeof(run) - 1);
+            insert_text(&line, &cursor, run, run_len);
         }
         // Ignore other control characters
     }
-    
-    return length;
+
+    gb_free(&line);
+    return -1;
 }
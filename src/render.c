@@ -0,0 +1,297 @@
+#include "../include/common.h"
+#include "../include/render.h"
+#include <errno.h>
+#include <sys/ioctl.h>
+
+/* Output queued for the next write() */
+static char *out = NULL;
+static size_t out_len = 0;
+static size_t out_cap = 0;
+
+/* The frame on screen: line text followed by the dimmed suggestion */
+static char *drawn = NULL;
+static unsigned char *drawn_styles = NULL;  // STYLE_* of each byte of drawn
+static size_t drawn_len = 0;
+static size_t drawn_cap = 0;
+static size_t drawn_ghost = 0;       // drawn[drawn_ghost..drawn_len) is the suggestion
+static int origin = 0;               // column of drawn[0], counted from the start of the prompt's row
+static int cursor_col = 0;           // cursor position, counted the same way
+
+/* Terminal width, re-read whenever SIGWINCH bumped resize_count */
+static int width = 80;
+static volatile sig_atomic_t resize_count = 0;
+static sig_atomic_t width_count = -1;
+static sig_atomic_t reported_count = 0;
+static int render_initialized = 0;
+
+/* Escape sequence starting each style (NULL: plain) */
+static const char *const style_colors[STYLE_COUNT] = {
+    [STYLE_PLAIN] = NULL,
+    [STYLE_BUILTIN] = COLOR_BOLD_CYAN,
+    [STYLE_ALIAS] = COLOR_CYAN,
+    [STYLE_COMMAND] = COLOR_GREEN,
+    [STYLE_UNKNOWN_COMMAND] = COLOR_RED,
+    [STYLE_STRING] = COLOR_YELLOW,
+    [STYLE_REDIRECT] = COLOR_MAGENTA,
+};
+
+static void handle_sigwinch(int sig) {
+    (void)sig;
+    resize_count++;
+}
+
+void init_render(void) {
+    if (render_initialized) {
+        return;
+    }
+
+    // No SA_RESTART: a read() blocked on the keyboard returns, so the line is redrawn
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_sigwinch;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGWINCH, &sa, NULL);
+
+    render_initialized = 1;
+}
+
+int render_width(void) {
+    sig_atomic_t count = resize_count;
+    if (width_count != count) {
+        width_count = count;
+        struct winsize ws;
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0) {
+            width = ws.ws_col;
+        }
+    }
+    return width;
+}
+
+int render_resized(void) {
+    sig_atomic_t count = resize_count;
+    if (reported_count == count) {
+        return 0;
+    }
+    reported_count = count;
+    return 1;
+}
+
+int render_text_width(const char *s, size_t len) {
+    int columns = 0;
+    size_t i = 0;
+    while (i < len) {
+        if (s[i] == '\033' && i + 1 < len && s[i + 1] == '[') {
+            i += 2;
+            while (i < len && !(s[i] >= '@' && s[i] <= '~')) {
+                i++;
+            }
+            i++;
+            continue;
+        }
+        if (((unsigned char)s[i] & 0xC0) != 0x80) {
+            columns++;
+        }
+        i++;
+    }
+    return columns;
+}
+
+void render_append(const char *data, size_t len) {
+    if (out_len + len > out_cap) {
+        size_t new_cap = out_cap ? out_cap : 1024;
+        while (new_cap < out_len + len) {
+            new_cap *= 2;
+        }
+        char *new_out = realloc(out, new_cap);
+        if (new_out == NULL) {
+            // Drop the frame rather than the shell; the next one starts from scratch
+            render_flush();
+            return;
+        }
+        out = new_out;
+        out_cap = new_cap;
+    }
+    memcpy(out + out_len, data, len);
+    out_len += len;
+}
+
+void render_flush(void) {
+    size_t done = 0;
+    while (done < out_len) {
+        ssize_t n = write(STDOUT_FILENO, out + done, out_len - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        done += (size_t)n;
+    }
+    out_len = 0;
+}
+
+/**
+ * Queue the escape sequences moving the cursor between two columns
+ * (both counted from the start of the prompt's row; lines wrap at width)
+ */
+static void move_cursor(int from, int to) {
+    char seq[32];
+    int from_row = from / width, to_row = to / width;
+
+    if (to_row < from_row) {
+        render_append(seq, (size_t)snprintf(seq, sizeof(seq), "\033[%dA", from_row - to_row));
+    } else if (to_row > from_row) {
+        render_append(seq, (size_t)snprintf(seq, sizeof(seq), "\033[%dB", to_row - from_row));
+    }
+    if (from % width != to % width) {
+        render_append(seq, (size_t)snprintf(seq, sizeof(seq), "\033[%dG", to % width + 1));
+    }
+}
+
+void render_begin(int prompt_width) {
+    drawn_len = 0;
+    drawn_ghost = 0;
+    origin = prompt_width;
+    cursor_col = prompt_width;
+}
+
+/**
+ * Queue text[from..to) with the color changes its styles call for,
+ * starting from plain and ending plain
+ */
+static void append_styled(const char *text, const unsigned char *styles, size_t from, size_t to) {
+    unsigned char current = STYLE_PLAIN;
+    size_t run = from;
+    for (size_t i = from; i <= to; i++) {
+        unsigned char style = (i < to && styles != NULL && styles[i] < STYLE_COUNT) ? styles[i] : STYLE_PLAIN;
+        if (i < to && style == current) {
+            continue;
+        }
+        render_append(text + run, i - run);
+        run = i;
+        if (current != STYLE_PLAIN) {
+            render_append(COLOR_RESET, strlen(COLOR_RESET));
+        }
+        if (style != STYLE_PLAIN) {
+            render_append(style_colors[style], strlen(style_colors[style]));
+        }
+        current = style;
+    }
+}
+
+void render_line(const char *text, size_t len, const unsigned char *styles, size_t cursor,
+                 const char *ghost, size_t ghost_len) {
+    render_width();
+    size_t new_len = len + ghost_len;
+
+    // First cell that differs in content, color or dimming
+    size_t common = drawn_len < new_len ? drawn_len : new_len;
+    size_t i = 0;
+    while (i < common) {
+        char c = i < len ? text[i] : ghost[i - len];
+        unsigned char style = (i < len && styles != NULL) ? styles[i] : STYLE_PLAIN;
+        if (c != drawn[i] || (i >= len) != (i >= drawn_ghost) || style != drawn_styles[i]) {
+            break;
+        }
+        i++;
+    }
+    // Never start in the middle of a UTF-8 character
+    while (i > 0 && i < new_len && ((unsigned char)(i < len ? text[i] : ghost[i - len]) & 0xC0) == 0x80) {
+        i--;
+    }
+
+    if (i < new_len || drawn_len > new_len) {
+        int start_col = origin + render_text_width(text, i < len ? i : len) +
+                        (i > len ? render_text_width(ghost, i - len) : 0);
+        move_cursor(cursor_col, start_col);
+
+        if (i < len) {
+            append_styled(text, styles, i, len);
+        }
+        if (ghost_len > 0 && i < new_len) {
+            size_t skip = i > len ? i - len : 0;
+            render_append(COLOR_DIM, strlen(COLOR_DIM));
+            render_append(ghost + skip, ghost_len - skip);
+            render_append(COLOR_RESET, strlen(COLOR_RESET));
+        }
+
+        int end_col = origin + render_text_width(text, len) + render_text_width(ghost, ghost_len);
+        // A full last row leaves the cursor pending at the margin; make the wrap real
+        if (i < new_len && end_col % width == 0) {
+            render_append("\r\n", 2);
+        }
+        if (drawn_len > new_len) {
+            render_append("\033[J", 3);
+        }
+        cursor_col = end_col;
+
+        // Remember what is on screen now
+        if (new_len > drawn_cap) {
+            size_t new_cap = drawn_cap ? drawn_cap : 256;
+            while (new_cap < new_len) {
+                new_cap *= 2;
+            }
+            char *new_drawn = realloc(drawn, new_cap);
+            unsigned char *new_styles = new_drawn ? realloc(drawn_styles, new_cap) : NULL;
+            if (new_drawn != NULL) {
+                drawn = new_drawn;
+            }
+            if (new_styles == NULL) {
+                drawn_len = 0;  // Forces a full redraw next time
+                render_flush();
+                return;
+            }
+            drawn_styles = new_styles;
+            drawn_cap = new_cap;
+        }
+        memcpy(drawn + i, i < len ? text + i : ghost + (i - len), i < len ? len - i : new_len - i);
+        if (i < len && ghost_len > 0) {
+            memcpy(drawn + len, ghost, ghost_len);
+        }
+        if (i < len) {
+            if (styles != NULL) {
+                memcpy(drawn_styles + i, styles + i, len - i);
+            } else {
+                memset(drawn_styles + i, STYLE_PLAIN, len - i);
+            }
+        }
+        memset(drawn_styles + (i > len ? i : len), STYLE_PLAIN, new_len - (i > len ? i : len));
+        drawn_len = new_len;
+        drawn_ghost = len;
+    }
+
+    int target = origin + render_text_width(text, cursor);
+    move_cursor(cursor_col, target);
+    cursor_col = target;
+    render_flush();
+}
+
+void render_clear(void) {
+    render_width();
+    move_cursor(cursor_col, 0);
+    render_append("\r\033[J", 4);
+    drawn_len = 0;
+    drawn_ghost = 0;
+    origin = 0;
+    cursor_col = 0;
+}
+
+void render_end(const char *tail) {
+    render_width();
+    int end_col = origin + render_text_width(drawn, drawn_len);
+    move_cursor(cursor_col, end_col);
+    if (tail != NULL && *tail) {
+        // Anything written after the line leaves the cursor on its last row
+        render_append(tail, strlen(tail));
+        render_append("\r\n", 2);
+    } else if (drawn_len > 0 && end_col % width == 0) {
+        // A line filling its last row already left the cursor on the row below
+        render_append("\r", 1);
+    } else {
+        render_append("\r\n", 2);
+    }
+    drawn_len = 0;
+    drawn_ghost = 0;
+    cursor_col = 0;
+    origin = 0;
+}
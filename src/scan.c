@@ -0,0 +1,400 @@
+#include "../include/common.h"
+#include "../include/scan.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && defined(__GNUC__)
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+/* Inputs shorter than this are handled by the scalar code directly */
+#define SCAN_SIMD_MIN 16
+
+typedef size_t (*find_any_fn)(const char *s, size_t len, const char *set, size_t set_len);
+typedef size_t (*skip_space_fn)(const char *s, size_t len);
+typedef int (*prefix_nocase_fn)(const char *a, const char *b, size_t n);
+typedef size_t (*mask_superset_fn)(const uint64_t *masks, size_t count, uint64_t need, uint32_t *out);
+
+static find_any_fn find_any_impl;
+static skip_space_fn skip_space_impl;
+static skip_space_fn trim_end_impl;
+static prefix_nocase_fn prefix_nocase_impl;
+static mask_superset_fn mask_superset_impl;
+static int scan_initialized = 0;
+
+/* ------------------------------------------------------------------------ */
+/* Scalar kernels (portable fallback and tail handling)                     */
+/* ------------------------------------------------------------------------ */
+
+static inline int is_space_byte(unsigned char c) {
+    return c == ' ' || (unsigned char)(c - '\t') <= ('\r' - '\t');
+}
+
+static inline unsigned char fold_byte(unsigned char c) {
+    return (c >= 'A' && c <= 'Z') ? (unsigned char)(c + ('a' - 'A')) : c;
+}
+
+static size_t find_any_scalar(const char *s, size_t len, const char *set, size_t set_len) {
+    for (size_t i = 0; i < len; i++) {
+        if (memchr(set, s[i], set_len) != NULL) {
+            return i;
+        }
+    }
+    return len;
+}
+
+static size_t skip_space_scalar(const char *s, size_t len) {
+    size_t i = 0;
+    while (i < len && is_space_byte((unsigned char)s[i])) i++;
+    return i;
+}
+
+static size_t trim_end_scalar(const char *s, size_t len) {
+    while (len > 0 && is_space_byte((unsigned char)s[len - 1])) len--;
+    return len;
+}
+
+static int prefix_nocase_scalar(const char *a, const char *b, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (fold_byte((unsigned char)a[i]) != fold_byte((unsigned char)b[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static size_t mask_superset_scalar(const uint64_t *masks, size_t count, uint64_t need, uint32_t *out) {
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        out[n] = (uint32_t)i;
+        n += (masks[i] & need) == need;  // Branch-free: the slot is overwritten on a miss
+    }
+    return n;
+}
+
+#ifdef SCAN_X86
+
+/* ------------------------------------------------------------------------ */
+/* SSE2 kernels (baseline on x86-64)                                        */
+/* ------------------------------------------------------------------------ */
+
+static size_t find_any_sse2(const char *s, size_t len, const char *set, size_t set_len) {
+    __m128i needles[SCAN_MAX_SET];
+    for (size_t k = 0; k < set_len; k++) {
+        needles[k] = _mm_set1_epi8(set[k]);
+    }
+
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i hits = _mm_cmpeq_epi8(block, needles[0]);
+        for (size_t k = 1; k < set_len; k++) {
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, needles[k]));
+        }
+        unsigned mask = (unsigned)_mm_movemask_epi8(hits);
+        if (mask != 0) {
+            return i + (size_t)__builtin_ctz(mask);
+        }
+    }
+    return i + find_any_scalar(s + i, len - i, set, set_len);
+}
+
+/**
+ * Bitmask of whitespace bytes in a 16-byte block
+ * Whitespace is ' ' or the range '\t'..'\r', tested with an unsigned min
+ */
+static inline unsigned space_mask_sse2(__m128i block) {
+    __m128i shifted = _mm_sub_epi8(block, _mm_set1_epi8('\t'));
+    __m128i in_range = _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8('\r' - '\t')), shifted);
+    __m128i blank = _mm_cmpeq_epi8(block, _mm_set1_epi8(' '));
+    return (unsigned)_mm_movemask_epi8(_mm_or_si128(in_range, blank));
+}
+
+static size_t skip_space_sse2(const char *s, size_t len) {
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        unsigned mask = space_mask_sse2(_mm_loadu_si128((const __m128i *)(s + i))) ^ 0xFFFFu;
+        if (mask != 0) {
+            return i + (size_t)__builtin_ctz(mask);
+        }
+    }
+    return i + skip_space_scalar(s + i, len - i);
+}
+
+static size_t trim_end_sse2(const char *s, size_t len) {
+    while (len >= 16) {
+        unsigned mask = space_mask_sse2(_mm_loadu_si128((const __m128i *)(s + len - 16))) ^ 0xFFFFu;
+        if (mask != 0) {
+            // Highest non-blank byte in the block
+            return len - 16 + (size_t)(31 - __builtin_clz(mask)) + 1;
+        }
+        len -= 16;
+    }
+    return trim_end_scalar(s, len);
+}
+
+/**
+ * Fold ASCII upper-case letters to lower-case in a 16-byte block
+ * Bytes are biased so that 'A'..'Z' become the 26 smallest signed values
+ */
+static inline __m128i fold_sse2(__m128i block) {
+    __m128i biased = _mm_add_epi8(block, _mm_set1_epi8((char)(0x80 - 'A')));
+    __m128i upper = _mm_cmplt_epi8(biased, _mm_set1_epi8((char)(-128 + 26)));
+    return _mm_add_epi8(block, _mm_and_si128(upper, _mm_set1_epi8('a' - 'A')));
+}
+
+static int prefix_nocase_sse2(const char *a, const char *b, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i va = fold_sse2(_mm_loadu_si128((const __m128i *)(a + i)));
+        __m128i vb = fold_sse2(_mm_loadu_si128((const __m128i *)(b + i)));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) != 0xFFFF) {
+            return 0;
+        }
+    }
+    return prefix_nocase_scalar(a + i, b + i, n - i);
+}
+
+/*
+ * Compaction by table lookup, for the AVX2 mask kernel: for each 4-bit
+ * match mask, the positions of its set bits (padded) to store as one
+ * 16-byte block, and their count
+ */
+static const uint32_t compact_positions[16][4] __attribute__((aligned(16))) = {
+    {0, 0, 0, 0}, {0, 0, 0, 0}, {1, 0, 0, 0}, {0, 1, 0, 0},
+    {2, 0, 0, 0}, {0, 2, 0, 0}, {1, 2, 0, 0}, {0, 1, 2, 0},
+    {3, 0, 0, 0}, {0, 3, 0, 0}, {1, 3, 0, 0}, {0, 1, 3, 0},
+    {2, 3, 0, 0}, {0, 2, 3, 0}, {1, 2, 3, 0}, {0, 1, 2, 3},
+};
+static const unsigned char compact_count[16] = {0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4};
+
+/**
+ * Store i + the positions of the set bits of match (4 bits) at out[n],
+ * writing a whole 16-byte block (out needs room for 4 entries at n)
+ * Returns the new n
+ */
+static inline size_t compact_store(uint32_t *out, size_t n, size_t i, unsigned match) {
+    __m128i positions = _mm_load_si128((const __m128i *)compact_positions[match]);
+    _mm_storeu_si128((__m128i *)(out + n), _mm_add_epi32(positions, _mm_set1_epi32((int)i)));
+    return n + compact_count[match];
+}
+
+/* ------------------------------------------------------------------------ */
+/* AVX2 kernels (selected at runtime)                                       */
+/* ------------------------------------------------------------------------ */
+
+/*
+ * The tails are handed to the SSE2 kernels, which use legacy SSE
+ * encodings: the upper halves of the ymm registers are cleared first, as
+ * GCC does not when the call becomes a tail jump, or every call pays an
+ * AVX-SSE transition penalty
+ */
+
+__attribute__((target("avx2")))
+static size_t find_any_avx2(const char *s, size_t len, const char *set, size_t set_len) {
+    __m256i needles[SCAN_MAX_SET];
+    for (size_t k = 0; k < set_len; k++) {
+        needles[k] = _mm256_set1_epi8(set[k]);
+    }
+
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i *)(s + i));
+        __m256i hits = _mm256_cmpeq_epi8(block, needles[0]);
+        for (size_t k = 1; k < set_len; k++) {
+            hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(block, needles[k]));
+        }
+        unsigned mask = (unsigned)_mm256_movemask_epi8(hits);
+        if (mask != 0) {
+            return i + (size_t)__builtin_ctz(mask);
+        }
+    }
+    _mm256_zeroupper();
+    return i + find_any_sse2(s + i, len - i, set, set_len);
+}
+
+__attribute__((target("avx2")))
+static inline unsigned space_mask_avx2(__m256i block) {
+    __m256i shifted = _mm256_sub_epi8(block, _mm256_set1_epi8('\t'));
+    __m256i in_range = _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, _mm256_set1_epi8('\r' - '\t')), shifted);
+    __m256i blank = _mm256_cmpeq_epi8(block, _mm256_set1_epi8(' '));
+    return (unsigned)_mm256_movemask_epi8(_mm256_or_si256(in_range, blank));
+}
+
+__attribute__((target("avx2")))
+static size_t skip_space_avx2(const char *s, size_t len) {
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        unsigned mask = ~space_mask_avx2(_mm256_loadu_si256((const __m256i *)(s + i)));
+        if (mask != 0) {
+            return i + (size_t)__builtin_ctz(mask);
+        }
+    }
+    _mm256_zeroupper();
+    return i + skip_space_sse2(s + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t trim_end_avx2(const char *s, size_t len) {
+    while (len >= 32) {
+        unsigned mask = ~space_mask_avx2(_mm256_loadu_si256((const __m256i *)(s + len - 32)));
+        if (mask != 0) {
+            return len - 32 + (size_t)(31 - __builtin_clz(mask)) + 1;
+        }
+        len -= 32;
+    }
+    _mm256_zeroupper();
+    return trim_end_sse2(s, len);
+}
+
+__attribute__((target("avx2")))
+static size_t mask_superset_avx2(const uint64_t *masks, size_t count, uint64_t need, uint32_t *out) {
+    __m256i vneed = _mm256_set1_epi64x((long long)need);
+    size_t n = 0;
+    size_t i = 0;
+    // The blocks stored at out[n] stay in bounds: n <= i and i + 8 <= count
+    for (; i + 8 <= count; i += 8) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(masks + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(masks + i + 4));
+        unsigned bits = (unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(
+                            _mm256_cmpeq_epi64(_mm256_and_si256(a, vneed), vneed))) |
+                        ((unsigned)_mm256_movemask_pd(_mm256_castsi256_pd(
+                            _mm256_cmpeq_epi64(_mm256_and_si256(b, vneed), vneed))) << 4);
+        n = compact_store(out, n, i, bits & 15);
+        n = compact_store(out, n, i + 4, bits >> 4);
+    }
+    for (; i < count; i++) {
+        out[n] = (uint32_t)i;
+        n += (masks[i] & need) == need;
+    }
+    return n;
+}
+
+#endif // SCAN_X86
+
+/**
+ * Whether the running CPU can use the kernels of level
+ */
+static int level_supported(int level) {
+    if (level == SCAN_LEVEL_SCALAR) {
+        return 1;
+    }
+#ifdef SCAN_X86
+    if (level == SCAN_LEVEL_SSE2) {
+        return 1;
+    }
+    if (level == SCAN_LEVEL_AVX2) {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+    }
+#endif
+    return 0;
+}
+
+int scan_set_level(int level) {
+    if (!level_supported(level)) {
+        return -1;
+    }
+
+    find_any_impl = find_any_scalar;
+    skip_space_impl = skip_space_scalar;
+    trim_end_impl = trim_end_scalar;
+    prefix_nocase_impl = prefix_nocase_scalar;
+    mask_superset_impl = mask_superset_scalar;
+
+#ifdef SCAN_X86
+    if (level == SCAN_LEVEL_SSE2) {
+        find_any_impl = find_any_sse2;
+        skip_space_impl = skip_space_sse2;
+        trim_end_impl = trim_end_sse2;
+        prefix_nocase_impl = prefix_nocase_sse2;
+        // The 2 masks per SSE2 register do not beat the scalar loop
+    } else if (level == SCAN_LEVEL_AVX2) {
+        find_any_impl = find_any_avx2;
+        skip_space_impl = skip_space_avx2;
+        trim_end_impl = trim_end_avx2;
+        prefix_nocase_impl = prefix_nocase_sse2;   // prefixes are too short for 32-byte blocks to pay off
+        mask_superset_impl = mask_superset_avx2;
+    }
+#endif
+
+    scan_initialized = 1;
+    return 0;
+}
+
+void init_scan(void) {
+    if (scan_initialized) {
+        return;
+    }
+
+    int level = SCAN_LEVEL_AVX2;
+    while (scan_set_level(level) != 0) {
+        level--;
+    }
+}
+
+size_t scan_find_any(const char *s, size_t len, const char *set) {
+    size_t set_len = strlen(set);
+    if (set_len == 0 || set_len > SCAN_MAX_SET) {
+        return len;
+    }
+
+    // Single needle: libc memchr is already vectorized
+    if (set_len == 1) {
+        const char *hit = memchr(s, set[0], len);
+        return hit ? (size_t)(hit - s) : len;
+    }
+
+    if (len < SCAN_SIMD_MIN) {
+        return find_any_scalar(s, len, set, set_len);
+    }
+
+    if (!scan_initialized) {
+        init_scan();
+    }
+    return find_any_impl(s, len, set, set_len);
+}
+
+size_t scan_skip_space(const char *s, size_t len) {
+    // Most tokens are separated by a single blank; avoid the dispatch for those
+    if (len < SCAN_SIMD_MIN || !is_space_byte((unsigned char)s[1])) {
+        return skip_space_scalar(s, len);
+    }
+
+    if (!scan_initialized) {
+        init_scan();
+    }
+    return skip_space_impl(s, len);
+}
+
+size_t scan_trim_end(const char *s, size_t len) {
+    if (len < SCAN_SIMD_MIN || !is_space_byte((unsigned char)s[len - 2])) {
+        return trim_end_scalar(s, len);
+    }
+
+    if (!scan_initialized) {
+        init_scan();
+    }
+    return trim_end_impl(s, len);
+}
+
+int scan_has_prefix_nocase(const char *s, size_t s_len, const char *prefix, size_t prefix_len) {
+    if (s_len < prefix_len) {
+        return 0;
+    }
+
+    if (prefix_len < SCAN_SIMD_MIN) {
+        return prefix_nocase_scalar(s, prefix, prefix_len);
+    }
+
+    if (!scan_initialized) {
+        init_scan();
+    }
+    return prefix_nocase_impl(s, prefix, prefix_len);
+}
+
+size_t scan_mask_superset(const uint64_t *masks, size_t count, uint64_t need, uint32_t *out) {
+    if (!scan_initialized) {
+        init_scan();
+    }
+    return mask_superset_impl(masks, count, need, out);
+}
@@ -0,0 +1,578 @@
+#include "../include/common.h"
+#include "../include/script.h"
+#include "../include/parser.h"
+#include "../include/executor.h"
+#include "../include/aliases.h"
+#include "../include/variables.h"
+#include "../include/hashtable.h"
+#include "../include/scan.h"
+#include <stdint.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+/* Bump whenever the cache layout or the tokenizer's output changes */
+#define SCRIPT_CACHE_VERSION 1
+#define SCRIPT_CACHE_MAGIC "KORDSHC"
+
+/* Deepest chain of nested source commands */
+#define MAX_SOURCE_DEPTH 64
+
+#define ALIGN4(n) (((n) + 3) & ~(size_t)3)
+#define ALIGN8(n) (((n) + 7) & ~(size_t)7)
+
+/**
+ * Header of a compiled script cache file
+ * Followed by the source path (NUL-terminated, padded to 8 bytes)
+ * and record_count records
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_count;
+    uint64_t source_size;
+    int64_t source_mtime_sec;
+    int64_t source_mtime_nsec;
+    uint64_t source_inode;
+    uint64_t source_dev;
+    uint32_t path_len;
+    uint32_t reserved;
+} ScriptCacheHeader;
+
+/**
+ * One command line of a compiled script
+ * Followed by segment_count word counts, the line text (NUL-terminated)
+ * and words_size bytes of NUL-terminated words, each part padded to 4 bytes
+ * segment_count is 0 for lines that must be parsed when run ($ expansion)
+ */
+typedef struct {
+    uint32_t text_len;
+    uint32_t segment_count;
+    uint32_t words_size;
+} ScriptRecord;
+
+/* Growable byte buffer used to build a cache image */
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} ByteBuffer;
+
+static int source_depth = 0;
+
+int run_command_line(const char *line) {
+    // Expand aliases if present
+    char *expanded = expand_alias(line);
+
+    // Parse command into array of commands (for pipes)
+    char ***commands = parse_command(expanded != NULL ? expanded : line);
+    free(expanded);
+
+    if (commands == NULL) {
+        return 1;
+    }
+
+    int result = execute_command(commands);
+    free_commands(commands);
+    return result;
+}
+
+/**
+ * Append n bytes (src may be NULL for zero fill), then pad to align bytes
+ * Returns 0 on success, -1 on allocation failure
+ */
+static int bytes_append(ByteBuffer *buf, const void *src, size_t n, size_t align) {
+    size_t padded = (n + align - 1) & ~(align - 1);
+    if (buf->len + padded > buf->cap) {
+        size_t new_cap = buf->cap ? buf->cap : 4096;
+        while (new_cap < buf->len + padded) {
+            new_cap *= 2;
+        }
+        char *new_data = realloc(buf->data, new_cap);
+        if (new_data == NULL) {
+            perror("realloc");
+            return -1;
+        }
+        buf->data = new_data;
+        buf->cap = new_cap;
+    }
+
+    if (src != NULL) {
+        memcpy(buf->data + buf->len, src, n);
+    } else {
+        memset(buf->data + buf->len, 0, n);
+    }
+    memset(buf->data + buf->len + n, 0, padded - n);
+    buf->len += padded;
+    return 0;
+}
+
+/**
+ * Append the record for one command line
+ * Lines without '$' are tokenized now: their words cannot change between runs
+ */
+static int compile_line(ByteBuffer *out, const char *line, size_t line_len) {
+    ScriptRecord rec = {(uint32_t)line_len, 0, 0};
+    char ***commands = NULL;
+
+    if (memchr(line, '$', line_len) == NULL) {
+        commands = parse_command(line);
+    }
+
+    if (commands != NULL) {
+        while (commands[rec.segment_count] != NULL) {
+            if (commands[rec.segment_count][0] == NULL) {
+                // Nothing to run in this segment: leave the line to the parser
+                rec.segment_count = 0;
+                rec.words_size = 0;
+                break;
+            }
+            for (int j = 0; commands[rec.segment_count][j] != NULL; j++) {
+                rec.words_size += strlen(commands[rec.segment_count][j]) + 1;
+            }
+            rec.segment_count++;
+        }
+    }
+
+    int result = bytes_append(out, &rec, sizeof(rec), 4);
+    for (uint32_t i = 0; result == 0 && i < rec.segment_count; i++) {
+        uint32_t word_count = 0;
+        while (commands[i][word_count] != NULL) {
+            word_count++;
+        }
+        result = bytes_append(out, &word_count, sizeof(word_count), 4);
+    }
+
+    if (result == 0) {
+        result = bytes_append(out, line, line_len + 1, 4);
+    }
+
+    // Words back to back; only the end of the block is padded
+    for (uint32_t i = 0; result == 0 && i < rec.segment_count; i++) {
+        for (int j = 0; result == 0 && commands[i][j] != NULL; j++) {
+            result = bytes_append(out, commands[i][j], strlen(commands[i][j]) + 1, 1);
+        }
+    }
+    if (result == 0) {
+        result = bytes_append(out, NULL, ALIGN4((size_t)rec.words_size) - rec.words_size, 1);
+    }
+
+    if (commands != NULL) {
+        free_commands(commands);
+    }
+    return result;
+}
+
+/**
+ * Lex a script into a cache image: header, path, then one record per command
+ * Blank lines and comments are dropped
+ * Returns 0 on success, -1 on allocation failure
+ */
+static int compile_script(ByteBuffer *out, const char *path, const struct stat *st,
+                          const char *text, size_t len) {
+    ScriptCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SCRIPT_CACHE_MAGIC, sizeof(header.magic));
+    header.version = SCRIPT_CACHE_VERSION;
+    header.source_size = (uint64_t)st->st_size;
+    header.source_mtime_sec = (int64_t)st->st_mtim.tv_sec;
+    header.source_mtime_nsec = (int64_t)st->st_mtim.tv_nsec;
+    header.source_inode = (uint64_t)st->st_ino;
+    header.source_dev = (uint64_t)st->st_dev;
+    header.path_len = (uint32_t)strlen(path);
+
+    if (bytes_append(out, &header, sizeof(header), 8) != 0 ||
+        bytes_append(out, path, header.path_len + 1, 8) != 0) {
+        return -1;
+    }
+
+    uint32_t record_count = 0;
+    size_t pos = 0;
+    while (pos < len) {
+        const char *newline = memchr(text + pos, '\n', len - pos);
+        size_t end = newline ? (size_t)(newline - text) : len;
+
+        size_t start = pos + scan_skip_space(text + pos, end - pos);
+        size_t line_len = scan_trim_end(text + start, end - start);
+        pos = end + 1;
+
+        // Skip empty lines and comments
+        if (line_len == 0 || text[start] == '#') {
+            continue;
+        }
+
+        char *line = strndup(text + start, line_len);
+        if (line == NULL) {
+            perror("strndup");
+            return -1;
+        }
+        int result = compile_line(out, line, line_len);
+        free(line);
+        if (result != 0) {
+            return -1;
+        }
+        record_count++;
+    }
+
+    ((ScriptCacheHeader *)out->data)->record_count = record_count;
+    return 0;
+}
+
+/**
+ * Check that record_count records starting at offset fit inside size bytes
+ * Returns 1 if the image is well-formed, 0 otherwise
+ */
+static int validate_records(const char *base, size_t size, size_t offset, uint32_t record_count) {
+    for (uint32_t r = 0; r < record_count; r++) {
+        if (offset + sizeof(ScriptRecord) > size) {
+            return 0;
+        }
+        const ScriptRecord *rec = (const ScriptRecord *)(base + offset);
+        size_t text_off = offset + sizeof(ScriptRecord) + (size_t)rec->segment_count * sizeof(uint32_t);
+        size_t words_off = text_off + ALIGN4((size_t)rec->text_len + 1);
+        size_t next = words_off + ALIGN4((size_t)rec->words_size);
+
+        if (next > size || base[text_off + rec->text_len] != '\0' ||
+            (rec->words_size > 0 && base[words_off + rec->words_size - 1] != '\0')) {
+            return 0;
+        }
+
+        // Every segment needs a command word, and the counts must match the words
+        const uint32_t *word_counts = (const uint32_t *)(base + offset + sizeof(ScriptRecord));
+        size_t total = 0;
+        for (uint32_t i = 0; i < rec->segment_count; i++) {
+            if (word_counts[i] == 0) {
+                return 0;
+            }
+            total += word_counts[i];
+        }
+        size_t found = 0;
+        for (size_t i = 0; i < rec->words_size; i++) {
+            found += (base[words_off + i] == '\0');
+        }
+        if (found != total) {
+            return 0;
+        }
+
+        offset = next;
+    }
+    return 1;
+}
+
+/**
+ * Whether a cache file or directory belongs to us alone: owned by the
+ * effective user and not writable by group or others
+ */
+static int owned_privately(const struct stat *st) {
+    return st->st_uid == geteuid() && (st->st_mode & (S_IWGRP | S_IWOTH)) == 0;
+}
+
+/**
+ * Location of the cache file for a script: $XDG_CACHE_HOME/kord-sh (or
+ * ~/.cache/kord-sh) plus a hash of the script's absolute path
+ * Creates the directory when create is set
+ * Returns 0 on success, -1 if no cache location is available or the
+ * directory is not a private one of ours (someone else could plant files)
+ */
+static int get_cache_path(const char *path, char *buffer, size_t size, int create) {
+    char dir[PATH_MAX];
+    const char *xdg = get_variable("XDG_CACHE_HOME");
+    const char *home = get_variable("HOME");
+
+    if (xdg != NULL && xdg[0] == '/') {
+        snprintf(dir, sizeof(dir), "%s", xdg);
+    } else if (home != NULL && home[0] == '/') {
+        snprintf(dir, sizeof(dir), "%s/.cache", home);
+    } else {
+        return -1;
+    }
+
+    if (create) {
+        mkdir(dir, 0700);
+    }
+    size_t dir_len = strlen(dir);
+    snprintf(dir + dir_len, sizeof(dir) - dir_len, "/kord-sh");
+    if (create && mkdir(dir, 0700) != 0 && errno != EEXIST) {
+        return -1;
+    }
+    struct stat dir_st;
+    if (lstat(dir, &dir_st) != 0 || !S_ISDIR(dir_st.st_mode) || !owned_privately(&dir_st)) {
+        return -1;
+    }
+
+    int n = snprintf(buffer, size, "%s/%08x.kc", dir, hash_string(path, strlen(path)));
+    return (n > 0 && (size_t)n < size) ? 0 : -1;
+}
+
+/**
+ * Map a cache file if it is still current for the script described by st
+ * The mapping is private and writable so that commands can be run in place
+ * Returns the mapping, or NULL on a miss (including a file that is a
+ * symlink or that someone else owns or can write)
+ */
+static char *map_cache(const char *cache_path, const char *path, const struct stat *st, size_t *size_out) {
+    int fd = open(cache_path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    struct stat cache_st;
+    if (fstat(fd, &cache_st) != 0 || !S_ISREG(cache_st.st_mode) || !owned_privately(&cache_st) ||
+        (size_t)cache_st.st_size < sizeof(ScriptCacheHeader)) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = (size_t)cache_st.st_size;
+    char *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+
+    const ScriptCacheHeader *header = (const ScriptCacheHeader *)base;
+    size_t path_len = strlen(path);
+    size_t records_off = sizeof(ScriptCacheHeader) + ALIGN8(path_len + 1);
+
+    int current = memcmp(header->magic, SCRIPT_CACHE_MAGIC, sizeof(header->magic)) == 0 &&
+                  header->version == SCRIPT_CACHE_VERSION &&
+                  header->source_size == (uint64_t)st->st_size &&
+                  header->source_mtime_sec == (int64_t)st->st_mtim.tv_sec &&
+                  header->source_mtime_nsec == (int64_t)st->st_mtim.tv_nsec &&
+                  header->source_inode == (uint64_t)st->st_ino &&
+                  header->source_dev == (uint64_t)st->st_dev &&
+                  header->path_len == path_len &&
+                  records_off <= size &&
+                  memcmp(base + sizeof(ScriptCacheHeader), path, path_len + 1) == 0 &&
+                  validate_records(base, size, records_off, header->record_count);
+
+    if (!current) {
+        munmap(base, size);
+        return NULL;
+    }
+
+    *size_out = size;
+    return base;
+}
+
+/**
+ * Write a cache image atomically (temporary file + rename)
+ * Failures are silent: the cache is only an optimization
+ */
+static void write_cache(const char *cache_path, const ByteBuffer *image) {
+    char tmp_path[PATH_MAX];
+    int n = snprintf(tmp_path, sizeof(tmp_path), "%s.%ld.tmp", cache_path, (long)getpid());
+    if (n < 0 || (size_t)n >= sizeof(tmp_path)) {
+        return;
+    }
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW, 0600);
+    if (fd == -1) {
+        return;
+    }
+
+    size_t written = 0;
+    while (written < image->len) {
+        ssize_t w = write(fd, image->data + written, image->len - written);
+        if (w <= 0) {
+            if (w < 0 && errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        written += (size_t)w;
+    }
+
+    if (close(fd) != 0 || written != image->len || rename(tmp_path, cache_path) != 0) {
+        unlink(tmp_path);
+    }
+}
+
+/**
+ * Check whether any pipeline segment of a compiled line starts with an alias
+ */
+static int segments_have_alias(const uint32_t *word_counts, uint32_t segment_count, const char *words) {
+    for (uint32_t i = 0; i < segment_count; i++) {
+        if (get_alias(words) != NULL) {
+            return 1;
+        }
+        for (uint32_t j = 0; j < word_counts[i]; j++) {
+            words += strlen(words) + 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Execute a precompiled line, pointing argv straight into the image
+ */
+static int run_compiled(const uint32_t *word_counts, uint32_t segment_count, char *words) {
+    char ***commands = calloc(segment_count + 1, sizeof(char **));
+    if (commands == NULL) {
+        perror("calloc");
+        return 1;
+    }
+
+    int result = 0;
+    for (uint32_t i = 0; i < segment_count; i++) {
+        commands[i] = malloc((word_counts[i] + 1) * sizeof(char *));
+        if (commands[i] == NULL) {
+            perror("malloc");
+            result = 1;
+            break;
+        }
+        for (uint32_t j = 0; j < word_counts[i]; j++) {
+            commands[i][j] = words;
+            words += strlen(words) + 1;
+        }
+        commands[i][word_counts[i]] = NULL;
+    }
+
+    if (result == 0) {
+        result = execute_command(commands);
+    }
+
+    // Only the arrays are ours; the words belong to the image
+    for (uint32_t i = 0; commands[i] != NULL; i++) {
+        free(commands[i]);
+    }
+    free(commands);
+    return result;
+}
+
+/**
+ * Run the records of a cache image
+ * Lines that need expansion, or whose commands are now aliases, go
+ * through the regular text path
+ */
+static int run_records(char *base, size_t offset, uint32_t record_count) {
+    int status = 0;
+
+    for (uint32_t r = 0; r < record_count; r++) {
+        ScriptRecord *rec = (ScriptRecord *)(base + offset);
+        uint32_t *word_counts = (uint32_t *)(rec + 1);
+        char *text = (char *)(word_counts + rec->segment_count);
+        char *words = text + ALIGN4((size_t)rec->text_len + 1);
+        offset = (size_t)(words - base) + ALIGN4((size_t)rec->words_size);
+
+        if (rec->segment_count == 0 || segments_have_alias(word_counts, rec->segment_count, words)) {
+            status = run_command_line(text);
+        } else {
+            status = run_compiled(word_counts, rec->segment_count, words);
+        }
+
+        if (status == -1) {
+            return -1;
+        }
+    }
+
+    return status;
+}
+
+/**
+ * Read a whole file into memory
+ * Returns the contents (not NUL-terminated), or NULL on failure
+ */
+static char *read_file(int fd, size_t size) {
+    char *text = malloc(size ? size : 1);
+    if (text == NULL) {
+        perror("malloc");
+        return NULL;
+    }
+
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = read(fd, text + done, size - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        done += (size_t)n;
+    }
+
+    if (done != size) {
+        free(text);
+        return NULL;
+    }
+    return text;
+}
+
+int source_file(const char *path) {
+    if (source_depth >= MAX_SOURCE_DEPTH) {
+        fprintf(stderr, "kord-sh: %s: maximum source depth exceeded\n\r", path);
+        return 1;
+    }
+
+    char abs_path[PATH_MAX];
+    if (realpath(path, abs_path) == NULL) {
+        fprintf(stderr, "kord-sh: %s: %s\n\r", path, strerror(errno));
+        return 1;
+    }
+
+    int fd = open(abs_path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        fprintf(stderr, "kord-sh: %s: %s\n\r", path, fd == -1 ? strerror(errno) : "not a regular file");
+        if (fd != -1) {
+            close(fd);
+        }
+        return 1;
+    }
+
+    char cache_path[PATH_MAX];
+    int have_cache_path = (get_cache_path(abs_path, cache_path, sizeof(cache_path), 0) == 0);
+    int result;
+
+    source_depth++;
+
+    size_t image_size;
+    char *image = have_cache_path ? map_cache(cache_path, abs_path, &st, &image_size) : NULL;
+    if (image != NULL) {
+        // Cache hit: no lexing at all
+        close(fd);
+        const ScriptCacheHeader *header = (const ScriptCacheHeader *)image;
+        size_t records_off = sizeof(ScriptCacheHeader) + ALIGN8((size_t)header->path_len + 1);
+        result = run_records(image, records_off, header->record_count);
+        munmap(image, image_size);
+    } else {
+        char *text = read_file(fd, (size_t)st.st_size);
+        close(fd);
+
+        ByteBuffer compiled = {0};
+        if (text == NULL || compile_script(&compiled, abs_path, &st, text, (size_t)st.st_size) != 0) {
+            fprintf(stderr, "kord-sh: %s: cannot read script\n\r", path);
+            result = 1;
+        } else {
+            if (get_cache_path(abs_path, cache_path, sizeof(cache_path), 1) == 0) {
+                write_cache(cache_path, &compiled);
+            }
+            const ScriptCacheHeader *header = (const ScriptCacheHeader *)compiled.data;
+            size_t records_off = sizeof(ScriptCacheHeader) + ALIGN8((size_t)header->path_len + 1);
+            result = run_records(compiled.data, records_off, header->record_count);
+        }
+
+        free(text);
+        free(compiled.data);
+    }
+
+    source_depth--;
+    return result;
+}
+
+int load_rc_file(void) {
+    const char *home = get_variable("HOME");
+    if (home == NULL) {
+        home = ".";  // Fallback to current directory
+    }
+
+    char rc_path[PATH_MAX];
+    snprintf(rc_path, sizeof(rc_path), "%s/.kordrc", home);
+
+    // A missing rc file is not an error
+    if (access(rc_path, F_OK) != 0) {
+        return 0;
+    }
+
+    return source_file(rc_path) == -1 ? -1 : 0;
+}
@@ -0,0 +1,460 @@
+#include "../include/common.h"
+#include "../include/suggest.h"
+#include "../include/history.h"
+#include "../include/hashtable.h"
+#include <stdint.h>
+#include <math.h>
+
+/* Best lines cached per trie node */
+#define SUGGEST_TOP 6
+
+/* A use counts half as much after this many newer commands */
+#define SUGGEST_HALF_LIFE 200.0
+
+/* Bonus (in half-lives) for lines previously run in the current directory */
+#define SUGGEST_CWD_BONUS 4.0
+
+/* Directories remembered per line */
+#define SUGGEST_DIRS 4
+
+/* Longer lines are not worth suggesting */
+#define SUGGEST_MAX_LEN 4096
+
+/**
+ * A distinct history line
+ * score is log2 of its use count with every use weighted 2^(t / half-life),
+ * t being the command counter: newer uses weigh more, so the score of a
+ * line never has to be revised when other lines are used
+ */
+typedef struct {
+    char *text;
+    uint32_t len;
+    double score;
+    unsigned int dirs[SUGGEST_DIRS];  // hashes of the latest directories it ran in
+    uint32_t dir_count;
+} Suggestion;
+
+/**
+ * Radix trie node; its edge label is the label_len bytes of line label_id
+ * starting at label_off. top holds the best lines of the node's subtree,
+ * best first, so a lookup never descends below the node it ends on.
+ */
+typedef struct {
+    uint32_t label_id;
+    uint32_t label_off;
+    uint32_t label_len;
+    uint32_t top[SUGGEST_TOP];
+    double top_score[SUGGEST_TOP];   // scores of the top lines, kept here to avoid chasing them
+    uint32_t top_count;
+} TrieNode;
+
+/**
+ * Child link: (parent node, first byte of the child's label) -> child
+ * Kept in one open-addressing table so a step down costs a single probe
+ */
+typedef struct {
+    uint64_t key;                    // parent << 8 | byte
+    uint32_t child;                  // 0 = empty slot (the root is never a child)
+} TrieEdge;
+
+static Suggestion *lines = NULL;
+static size_t line_count = 0;
+static size_t line_capacity = 0;
+static HashTable line_index;         // text -> line id + 1
+
+static TrieNode *nodes = NULL;
+static size_t node_count = 0;
+static size_t node_capacity = 0;
+
+static TrieEdge *edges = NULL;
+static size_t edge_capacity = 0;     // power of two
+static size_t edge_count = 0;
+
+static uint64_t use_clock = 0;      // history sequence number of the next use
+static int trie_built = 0;
+
+/* Older history is indexed newest first, a step at a time, while the user is idle */
+static uint64_t backfill_seq = 0;    // entries below this sequence number are not indexed yet
+static unsigned int backfill_generation = 0;
+
+/**
+ * log2(2^a + 2^b) without overflowing
+ */
+static double log2_add(double a, double b) {
+    double hi = a > b ? a : b;
+    double lo = a > b ? b : a;
+    return hi + log2(1.0 + exp2(lo - hi));
+}
+
+/**
+ * Allocate a node
+ * Returns its index, or 0 on allocation failure
+ */
+static uint32_t new_node(uint32_t label_id, uint32_t label_off, uint32_t label_len) {
+    if (node_count == node_capacity) {
+        size_t new_capacity = node_capacity ? node_capacity * 2 : 1024;
+        TrieNode *new_nodes = realloc(nodes, new_capacity * sizeof(TrieNode));
+        if (new_nodes == NULL) {
+            perror("realloc");
+            return 0;
+        }
+        nodes = new_nodes;
+        node_capacity = new_capacity;
+    }
+
+    TrieNode *node = &nodes[node_count];
+    memset(node, 0, sizeof(*node));
+    node->label_id = label_id;
+    node->label_off = label_off;
+    node->label_len = label_len;
+    return (uint32_t)node_count++;
+}
+
+static inline const char *node_label(const TrieNode *node) {
+    return lines[node->label_id].text + node->label_off;
+}
+
+static inline size_t edge_slot(uint64_t key) {
+    return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & (edge_capacity - 1);
+}
+
+static uint32_t find_child(uint32_t parent, char c) {
+    if (edge_count == 0) {
+        return 0;
+    }
+
+    uint64_t key = (uint64_t)parent << 8 | (unsigned char)c;
+    for (size_t i = edge_slot(key); edges[i].child != 0; i = (i + 1) & (edge_capacity - 1)) {
+        if (edges[i].key == key) {
+            return edges[i].child;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Point (parent, c) at child, adding the link if needed
+ * Returns 0 on success, -1 on allocation failure
+ */
+static int set_child(uint32_t parent, char c, uint32_t child) {
+    if ((edge_count + 1) * 2 > edge_capacity) {
+        size_t old_capacity = edge_capacity;
+        TrieEdge *old_edges = edges;
+        size_t new_capacity = old_capacity ? old_capacity * 2 : 1024;
+        TrieEdge *new_edges = calloc(new_capacity, sizeof(TrieEdge));
+        if (new_edges == NULL) {
+            perror("calloc");
+            return -1;
+        }
+
+        edges = new_edges;
+        edge_capacity = new_capacity;
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (old_edges[i].child != 0) {
+                size_t j = edge_slot(old_edges[i].key);
+                while (edges[j].child != 0) {
+                    j = (j + 1) & (edge_capacity - 1);
+                }
+                edges[j] = old_edges[i];
+            }
+        }
+        free(old_edges);
+    }
+
+    uint64_t key = (uint64_t)parent << 8 | (unsigned char)c;
+    size_t i = edge_slot(key);
+    while (edges[i].child != 0 && edges[i].key != key) {
+        i = (i + 1) & (edge_capacity - 1);
+    }
+    if (edges[i].child == 0) {
+        edges[i].key = key;
+        edge_count++;
+    }
+    edges[i].child = child;
+    return 0;
+}
+
+/**
+ * Offer line id (whose score just rose) to a node's top list
+ * Every node listing a line lies on its path, so stored scores never go stale
+ */
+static void top_update(TrieNode *node, uint32_t id) {
+    double score = lines[id].score;
+    uint32_t pos = 0;
+    while (pos < node->top_count && node->top[pos] != id) {
+        pos++;
+    }
+
+    if (pos == node->top_count) {
+        if (node->top_count < SUGGEST_TOP) {
+            node->top_count++;
+        } else if (score <= node->top_score[pos - 1]) {
+            return;
+        } else {
+            pos--;  // Replace the weakest
+        }
+    }
+
+    while (pos > 0 && node->top_score[pos - 1] < score) {
+        node->top[pos] = node->top[pos - 1];
+        node->top_score[pos] = node->top_score[pos - 1];
+        pos--;
+    }
+    node->top[pos] = id;
+    node->top_score[pos] = score;
+}
+
+/**
+ * Insert line id into the trie (or re-rank it if present), updating the
+ * top lists along its path
+ * Returns 0 on success, -1 on allocation failure
+ */
+static int trie_insert(uint32_t id) {
+    const char *text = lines[id].text;
+    uint32_t len = lines[id].len;
+    uint32_t node = 0;
+    uint32_t pos = 0;
+
+    top_update(&nodes[0], id);
+    while (pos < len) {
+        uint32_t child = find_child(node, text[pos]);
+        if (child == 0) {
+            uint32_t leaf = new_node(id, pos, len - pos);
+            if (leaf == 0 || set_child(node, text[pos], leaf) != 0) {
+                return -1;
+            }
+            top_update(&nodes[leaf], id);
+            return 0;
+        }
+
+        const char *label = node_label(&nodes[child]);
+        uint32_t label_len = nodes[child].label_len;
+        uint32_t m = 1;
+        while (m < label_len && pos + m < len && label[m] == text[pos + m]) {
+            m++;
+        }
+
+        if (m < label_len) {
+            // Split the edge: the new node takes the shared part and the old subtree's ranking
+            uint32_t mid = new_node(nodes[child].label_id, nodes[child].label_off, m);
+            if (mid == 0) {
+                return -1;
+            }
+            memcpy(nodes[mid].top, nodes[child].top, sizeof(nodes[mid].top));
+            memcpy(nodes[mid].top_score, nodes[child].top_score, sizeof(nodes[mid].top_score));
+            nodes[mid].top_count = nodes[child].top_count;
+
+            // mid takes child's place under the parent, child hangs below mid
+            nodes[child].label_off += m;
+            nodes[child].label_len -= m;
+            if (set_child(node, text[pos], mid) != 0 ||
+                set_child(mid, node_label(&nodes[child])[0], child) != 0) {
+                return -1;
+            }
+            child = mid;
+        }
+
+        top_update(&nodes[child], id);
+        node = child;
+        pos += m;
+    }
+    return 0;
+}
+
+/**
+ * Record one use of a line; seq orders uses (history sequence number)
+ */
+static void add_line(const char *command, const char *cwd, uint64_t seq) {
+    size_t len = strlen(command);
+    if (len == 0 || len > SUGGEST_MAX_LEN) {
+        return;
+    }
+
+    HashEntry *entry = ht_insert(&line_index, command, len);
+    if (entry == NULL) {
+        return;
+    }
+
+    double now = (double)seq / SUGGEST_HALF_LIFE;
+    uint32_t id;
+    if (entry->value != NULL) {
+        id = (uint32_t)((uintptr_t)entry->value - 1);
+        lines[id].score = log2_add(lines[id].score, now);
+    } else {
+        if (line_count == line_capacity) {
+            size_t new_capacity = line_capacity ? line_capacity * 2 : 1024;
+            Suggestion *new_lines = realloc(lines, new_capacity * sizeof(Suggestion));
+            if (new_lines == NULL) {
+                perror("realloc");
+                ht_remove(&line_index, command, len);
+                return;
+            }
+            lines = new_lines;
+            line_capacity = new_capacity;
+        }
+
+        Suggestion *line = &lines[line_count];
+        line->text = strdup(command);
+        if (line->text == NULL) {
+            perror("strdup");
+            ht_remove(&line_index, command, len);
+            return;
+        }
+        line->len = (uint32_t)len;
+        line->score = now;
+        line->dir_count = 0;
+        id = (uint32_t)line_count++;
+        entry->value = (void *)(uintptr_t)(id + 1);
+    }
+
+    if (cwd != NULL) {
+        Suggestion *line = &lines[id];
+        unsigned int hash = hash_string(cwd, strlen(cwd));
+        uint32_t i = 0;
+        while (i < line->dir_count && line->dirs[i] != hash) {
+            i++;
+        }
+        if (i == line->dir_count && line->dir_count < SUGGEST_DIRS) {
+            line->dir_count++;
+        }
+        if (i == SUGGEST_DIRS) {
+            i--;  // Forget the least recent directory
+        }
+        memmove(&line->dirs[1], &line->dirs[0], i * sizeof(unsigned int));
+        line->dirs[0] = hash;
+    }
+
+    trie_insert(id);
+}
+
+/**
+ * Set up an empty trie; history already recorded is indexed by suggest_backfill()
+ * Returns 0 on success, -1 on failure
+ */
+static int init_trie(void) {
+    if (ht_init(&line_index, 1024) != 0) {
+        return -1;
+    }
+
+    // The root is node 0, so success and failure look alike here
+    new_node(0, 0, 0);
+    if (node_count != 1) {
+        ht_free(&line_index, NULL);
+        return -1;
+    }
+
+    backfill_seq = get_history_base_seq() + (uint64_t)get_history_count();
+    backfill_generation = get_history_generation();
+    use_clock = backfill_seq;
+    trie_built = 1;
+    return 0;
+}
+
+void suggest_add(const char *command, const char *cwd) {
+    if (trie_built && command != NULL) {
+        add_line(command, cwd, use_clock++);
+    }
+}
+
+int suggest_backfill(int budget) {
+    if (!trie_built && init_trie() != 0) {
+        return 0;
+    }
+
+    // Renumbered history: what is left cannot be located any more
+    uint64_t base = get_history_base_seq();
+    if (backfill_generation != get_history_generation() || backfill_seq < base) {
+        backfill_seq = base;
+    }
+
+    while (budget-- > 0 && backfill_seq > base) {
+        backfill_seq--;
+        const char *command = get_history((int)(backfill_seq - base));
+        if (command != NULL) {
+            add_line(command, NULL, backfill_seq);
+        }
+    }
+    return backfill_seq > base;
+}
+
+const char *suggest_lookup(const char *prefix, size_t len, const char *cwd) {
+    if (prefix == NULL || len == 0) {
+        return NULL;
+    }
+    if (!trie_built && init_trie() != 0) {
+        return NULL;
+    }
+
+    uint32_t node = 0;
+    size_t pos = 0;
+    while (pos < len) {
+        uint32_t child = find_child(node, prefix[pos]);
+        if (child == 0) {
+            return NULL;
+        }
+
+        const char *label = node_label(&nodes[child]);
+        uint32_t label_len = nodes[child].label_len;
+        uint32_t m = 1;
+        while (m < label_len && pos + m < len && label[m] == prefix[pos + m]) {
+            m++;
+        }
+        if (m < label_len && pos + m < len) {
+            return NULL;  // Diverges inside the edge
+        }
+
+        node = child;
+        pos += m;
+    }
+
+    unsigned int cwd_hash = cwd ? hash_string(cwd, strlen(cwd)) : 0;
+    const Suggestion *best = NULL;
+    double best_score = 0;
+    for (uint32_t k = 0; k < nodes[node].top_count; k++) {
+        const Suggestion *line = &lines[nodes[node].top[k]];
+        if (line->len <= len) {
+            continue;
+        }
+
+        double score = line->score;
+        for (uint32_t d = 0; cwd != NULL && d < line->dir_count; d++) {
+            if (line->dirs[d] == cwd_hash) {
+                score += SUGGEST_CWD_BONUS;
+                break;
+            }
+        }
+        if (best == NULL || score > best_score) {
+            best = line;
+            best_score = score;
+        }
+    }
+
+    return best ? best->text : NULL;
+}
+
+void cleanup_suggest(void) {
+    if (!trie_built) {
+        return;
+    }
+
+    for (size_t i = 0; i < line_count; i++) {
+        free(lines[i].text);
+    }
+    free(lines);
+    lines = NULL;
+    line_count = 0;
+    line_capacity = 0;
+
+    free(nodes);
+    nodes = NULL;
+    node_count = 0;
+    node_capacity = 0;
+
+    free(edges);
+    edges = NULL;
+    edge_count = 0;
+    edge_capacity = 0;
+
+    ht_free(&line_index, NULL);
+    trie_built = 0;
+}
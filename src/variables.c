@@ -1,101 +1,443 @@
 #include "../include/common.h"
 #include "../include/variables.h"
+#include "../include/hashtable.h"
 
+extern char **environ;
+
+/* Initial number of slots in the variable table */
+#define VARIABLE_TABLE_INITIAL 64
+
+/* Initial capacity of the exported environment vector */
+#define ENV_VECTOR_INITIAL 64
+
+typedef enum {
+    VAR_SCALAR = 0,
+    VAR_INDEXED,         // arr=(a b c): dense vector, NULL marks an unset element
+    VAR_ASSOC            // declare -A map: hash table of heap strings
+} VariableType;
+
+/**
+ * A shell variable
+ * The value is stored as a complete "NAME=value" string so that exported
+ * variables can be referenced from the envp vector without building copies
+ */
 typedef struct {
-    char name[MAX_VAR_NAME];
-    char value[MAX_VAR_VALUE];
-    int is_set;  // 1 if this slot is in use, 0 otherwise
+    char *entry;         // "NAME=value", heap buffer sized to fit
+    size_t name_len;
+    size_t len;          // length of the value part
+    size_t cap;
+    int exported;
+    size_t env_index;    // position in env_vector when exported
+    VariableType type;
+    char **items;        // VAR_INDEXED elements
+    size_t item_count;   // highest set index + 1
+    size_t item_cap;
+    HashTable *map;      // VAR_ASSOC elements
 } Variable;
 
-static Variable shell_variables[MAX_VARIABLES];
+static HashTable shell_variables;
 static int variables_initialized = 0;
 
-void init_variables(void) {
-    if (variables_initialized) {
+/* NULL-terminated envp handed directly to execve() */
+static char **env_vector = NULL;
+static size_t env_count = 0;
+static size_t env_capacity = 0;
+
+#define VARIABLE_VALUE(var) ((var)->entry + (var)->name_len + 1)
+
+/**
+ * Release a variable's storage (used as the hash table value destructor)
+ */
+static void free_variable(void *ptr) {
+    Variable *var = ptr;
+    if (var == NULL) {
         return;
     }
     
-    for (int i = 0; i < MAX_VARIABLES; i++) {
-        shell_variables[i].is_set = 0;
-        shell_variables[i].name[0] = '\0';
-        shell_variables[i].value[0] = '\0';
+    for (size_t i = 0; i < var->item_count; i++) {
+        free(var->items[i]);
+    }
+    free(var->items);
+    
+    if (var->map != NULL) {
+        ht_free(var->map, free);
+        free(var->map);
     }
     
+    free(var->entry);
+    free(var);
+}
+
+/**
+ * Look up a shell variable by name[0..len)
+ */
+static Variable *find_variable(const char *name, size_t len) {
+    HashEntry *entry = ht_lookup(&shell_variables, name, len);
+    return entry ? entry->value : NULL;
+}
+
+/**
+ * Append an exported variable to the environment vector
+ * Returns 0 on success, -1 on allocation failure
+ */
+static int env_append(Variable *var) {
+    if (env_count + 1 >= env_capacity) {
+        size_t new_capacity = env_capacity ? env_capacity * 2 : ENV_VECTOR_INITIAL;
+        char **new_vector = realloc(env_vector, new_capacity * sizeof(char *));
+        if (new_vector == NULL) {
+            perror("realloc");
+            return -1;
+        }
+        env_vector = new_vector;
+        env_capacity = new_capacity;
+    }
+
+    var->env_index = env_count;
+    env_vector[env_count++] = var->entry;
+    env_vector[env_count] = NULL;
+
+    // Keep libc (getenv() in library code) looking at the same vector
+    environ = env_vector;
+    return 0;
+}
+
+/**
+ * Remove an exported variable from the environment vector in O(1)
+ * by moving the last entry into its slot
+ */
+static void env_remove(Variable *var) {
+    size_t idx = var->env_index;
+    size_t last = env_count - 1;
+
+    if (idx != last) {
+        char *moved = env_vector[last];
+        env_vector[idx] = moved;
+
+        Variable *moved_var = find_variable(moved, strcspn(moved, "="));
+        if (moved_var != NULL) {
+            moved_var->env_index = idx;
+        }
+    }
+
+    env_vector[last] = NULL;
+    env_count--;
+}
+
+/**
+ * Store value into var, reusing its buffer when it is large enough
+ * Returns 0 on success, -1 on allocation failure
+ */
+static int assign_value(Variable *var, const char *value) {
+    size_t len = strlen(value);
+    size_t needed = var->name_len + 1 + len + 1;
+
+    if (needed > var->cap) {
+        size_t cap = var->cap ? var->cap : 32;
+        while (cap < needed) {
+            cap *= 2;
+        }
+        char *buf = realloc(var->entry, cap);
+        if (buf == NULL) {
+            perror("realloc");
+            return -1;
+        }
+        var->entry = buf;
+        var->cap = cap;
+
+        // The environment references the buffer directly
+        if (var->exported) {
+            env_vector[var->env_index] = buf;
+        }
+    }
+
+    memcpy(VARIABLE_VALUE(var), value, len + 1);
+    var->len = len;
+    return 0;
+}
+
+/**
+ * Find or create the variable name[0..name_len)
+ * Returns NULL on allocation failure
+ */
+static Variable *get_or_create_variable(const char *name, size_t name_len) {
+    HashEntry *entry = ht_insert(&shell_variables, name, name_len);
+    if (entry == NULL) {
+        return NULL;
+    }
+
+    if (entry->value != NULL) {
+        return entry->value;
+    }
+
+    Variable *var = calloc(1, sizeof(Variable));
+    if (var == NULL) {
+        perror("calloc");
+        ht_remove(&shell_variables, name, name_len);
+        return NULL;
+    }
+
+    var->name_len = name_len;
+    var->cap = name_len + 2 + 16;
+    var->entry = malloc(var->cap);
+    if (var->entry == NULL) {
+        perror("malloc");
+        free(var);
+        ht_remove(&shell_variables, name, name_len);
+        return NULL;
+    }
+    memcpy(var->entry, name, name_len);
+    var->entry[name_len] = '=';
+    var->entry[name_len + 1] = '\0';
+
+    entry->value = var;
+    return var;
+}
+
+void init_variables(void) {
+    if (variables_initialized) {
+        return;
+    }
+
+    if (ht_init(&shell_variables, VARIABLE_TABLE_INITIAL) != 0) {
+        return;
+    }
     variables_initialized = 1;
+
+    // Import the inherited environment; from here on the shell owns it
+    char **inherited = environ;
+    for (size_t i = 0; inherited != NULL && inherited[i] != NULL; i++) {
+        const char *equals = strchr(inherited[i], '=');
+        if (equals == NULL || equals == inherited[i]) {
+            continue;
+        }
+
+        Variable *var = get_or_create_variable(inherited[i], equals - inherited[i]);
+        if (var == NULL || assign_value(var, equals + 1) != 0) {
+            continue;
+        }
+        if (!var->exported && env_append(var) == 0) {
+            var->exported = 1;
+        }
+    }
+
+    // An empty environment still needs a valid NULL-terminated vector
+    if (env_vector == NULL) {
+        env_vector = calloc(ENV_VECTOR_INITIAL, sizeof(char *));
+        if (env_vector != NULL) {
+            env_capacity = ENV_VECTOR_INITIAL;
+            environ = env_vector;
+        }
+    }
 }
 
 void cleanup_variables(void) {
-    // Nothing to clean up for static arrays
+    if (!variables_initialized) {
+        return;
+    }
+
+    environ = NULL;
+    free(env_vector);
+    env_vector = NULL;
+    env_count = 0;
+    env_capacity = 0;
+
+    ht_free(&shell_variables, free_variable);
     variables_initialized = 0;
 }
 
-int set_variable(const char *name, const char *value) {
-    if (name == NULL || value == NULL) {
+/**
+ * Parse an indexed-array subscript; negative values count from the end
+ * Returns the index, or -1 if the subscript is not a valid index
+ */
+static long parse_index(const char *subscript, size_t len, size_t count) {
+    char buf[32];
+    if (len == 0 || len >= sizeof(buf)) {
         return -1;
     }
+    memcpy(buf, subscript, len);
+    buf[len] = '\0';
     
-    if (!variables_initialized) {
-        init_variables();
+    char *end;
+    long index = strtol(buf, &end, 10);
+    while (isspace((unsigned char)*end)) end++;
+    if (*end != '\0') {
+        return -1;
     }
     
-    // Check if variable exists in environment (was previously exported)
-    // If so, update it there instead of creating a shell variable
-    if (getenv(name) != NULL) {
-        if (setenv(name, value, 1) != 0) {
-            perror("setenv");
+    if (index < 0) {
+        index += (long)count;
+    }
+    return (index >= 0 && index < MAX_ARRAY_INDEX) ? index : -1;
+}
+
+/**
+ * Store value at index of an indexed array, growing the vector as needed
+ * Returns 0 on success, -1 on failure
+ */
+static int indexed_set(Variable *var, size_t index, const char *value) {
+    if (index >= var->item_cap) {
+        size_t new_cap = var->item_cap ? var->item_cap : 8;
+        while (new_cap <= index) {
+            new_cap *= 2;
+        }
+        char **new_items = realloc(var->items, new_cap * sizeof(char *));
+        if (new_items == NULL) {
+            perror("realloc");
             return -1;
         }
+        memset(new_items + var->item_cap, 0, (new_cap - var->item_cap) * sizeof(char *));
+        var->items = new_items;
+        var->item_cap = new_cap;
+    }
+    
+    char *copy = strdup(value);
+    if (copy == NULL) {
+        perror("strdup");
+        return -1;
+    }
+    
+    free(var->items[index]);
+    var->items[index] = copy;
+    if (index >= var->item_count) {
+        var->item_count = index + 1;
+    }
+    return 0;
+}
+
+/**
+ * Store value under key[0..key_len) of an associative array
+ * Returns 0 on success, -1 on failure
+ */
+static int assoc_set(Variable *var, const char *key, size_t key_len, const char *value) {
+    char *copy = strdup(value);
+    if (copy == NULL) {
+        perror("strdup");
+        return -1;
+    }
+    
+    HashEntry *entry = ht_insert(var->map, key, key_len);
+    if (entry == NULL) {
+        free(copy);
+        return -1;
+    }
+    
+    free(entry->value);
+    entry->value = copy;
+    return 0;
+}
+
+/**
+ * Turn var into an empty array of the given type
+ * A scalar value is kept as element 0 (bash semantics) when keep_scalar is set
+ * Returns 0 on success, -1 on failure
+ */
+static int convert_to_array(Variable *var, VariableType type, int keep_scalar) {
+    if (var->type == type) {
         return 0;
     }
     
-    // Check if variable already exists in shell variables, update it
-    for (int i = 0; i < MAX_VARIABLES; i++) {
-        if (shell_variables[i].is_set && strcmp(shell_variables[i].name, name) == 0) {
-            strncpy(shell_variables[i].value, value, MAX_VAR_VALUE - 1);
-            shell_variables[i].value[MAX_VAR_VALUE - 1] = '\0';
-            return 0;
+    if (var->type != VAR_SCALAR) {
+        fprintf(stderr, "kord-sh: %.*s: cannot convert %s array to %s array\n\r",
+                (int)var->name_len, var->entry,
+                var->type == VAR_ASSOC ? "associative" : "indexed",
+                type == VAR_ASSOC ? "associative" : "indexed");
+        return -1;
+    }
+    
+    // Arrays are never exported
+    if (var->exported) {
+        env_remove(var);
+        var->exported = 0;
+    }
+    
+    int had_value = keep_scalar && var->len > 0;
+    
+    if (type == VAR_ASSOC) {
+        var->map = malloc(sizeof(HashTable));
+        if (var->map == NULL || ht_init(var->map, 0) != 0) {
+            free(var->map);
+            var->map = NULL;
+            return -1;
         }
     }
+    var->type = type;
     
-    // Find empty slot to add new variable
-    for (int i = 0; i < MAX_VARIABLES; i++) {
-        if (!shell_variables[i].is_set) {
-            strncpy(shell_variables[i].name, name, MAX_VAR_NAME - 1);
-            shell_variables[i].name[MAX_VAR_NAME - 1] = '\0';
-            
-            strncpy(shell_variables[i].value, value, MAX_VAR_VALUE - 1);
-            shell_variables[i].value[MAX_VAR_VALUE - 1] = '\0';
-            
-            shell_variables[i].is_set = 1;
-            return 0;
+    if (had_value) {
+        int result = (type == VAR_ASSOC) ? assoc_set(var, "0", 1, VARIABLE_VALUE(var))
+                                         : indexed_set(var, 0, VARIABLE_VALUE(var));
+        if (result != 0) {
+            return -1;
         }
     }
     
-    fprintf(stderr, "Error: Maximum number of variables reached\n\r");
-    return -1;
+    VARIABLE_VALUE(var)[0] = '\0';
+    var->len = 0;
+    return 0;
 }
 
-const char *get_variable(const char *name) {
+/**
+ * Remove all elements of an array variable
+ */
+static void clear_array(Variable *var) {
+    for (size_t i = 0; i < var->item_count; i++) {
+        free(var->items[i]);
+        var->items[i] = NULL;
+    }
+    var->item_count = 0;
+    
+    if (var->map != NULL) {
+        ht_free(var->map, free);
+        ht_init(var->map, 0);
+    }
+}
+
+/**
+ * Assign one element given its textual subscript
+ * Returns 0 on success, -1 on failure
+ */
+static int set_element(Variable *var, const char *subscript, size_t sub_len, const char *value) {
+    if (var->type == VAR_ASSOC) {
+        return assoc_set(var, subscript, sub_len, value);
+    }
+    
+    long index = parse_index(subscript, sub_len, var->item_count);
+    if (index < 0) {
+        fprintf(stderr, "kord-sh: %.*s[%.*s]: bad array subscript\n\r",
+                (int)var->name_len, var->entry, (int)sub_len, subscript);
+        return -1;
+    }
+    return indexed_set(var, (size_t)index, value);
+}
+
+/**
+ * Value of an array variable used as a scalar ($arr is ${arr[0]})
+ */
+static const char *array_scalar_value(const Variable *var) {
+    if (var->type == VAR_INDEXED) {
+        return var->item_count > 0 ? var->items[0] : NULL;
+    }
+    HashEntry *entry = ht_lookup(var->map, "0", 1);
+    return entry ? entry->value : NULL;
+}
+
+int declare_array(const char *name, int assoc) {
     if (name == NULL) {
-        return NULL;
+        return -1;
     }
     
     if (!variables_initialized) {
         init_variables();
     }
     
-    // First check shell variables
-    for (int i = 0; i < MAX_VARIABLES; i++) {
-        if (shell_variables[i].is_set && strcmp(shell_variables[i].name, name) == 0) {
-            return shell_variables[i].value;
-        }
+    Variable *var = get_or_create_variable(name, strlen(name));
+    if (var == NULL) {
+        return -1;
     }
     
-    // Then check environment variables
-    return getenv(name);
+    return convert_to_array(var, assoc ? VAR_ASSOC : VAR_INDEXED, 1);
 }
 
-int export_variable(const char *name, const char *value) {
+int set_array(const char *name, char **values, int count, int append) {
     if (name == NULL) {
         return -1;
     }
@@ -104,135 +446,605 @@ int export_variable(const char *name, const char *value) {
         init_variables();
     }
     
-    // If value is provided, use it
-    // Otherwise, look up the value from shell variables
-    const char *export_value = value;
+    Variable *var = get_or_create_variable(name, strlen(name));
+    if (var == NULL) {
+        return -1;
+    }
+    
+    if (var->type == VAR_SCALAR && convert_to_array(var, VAR_INDEXED, append) != 0) {
+        return -1;
+    }
+    
+    if (!append) {
+        clear_array(var);
+    }
     
-    if (export_value == NULL) {
-        // Try to find it in shell variables
-        for (int i = 0; i < MAX_VARIABLES; i++) {
-            if (shell_variables[i].is_set && strcmp(shell_variables[i].name, name) == 0) {
-                export_value = shell_variables[i].value;
-                break;
+    size_t next = var->item_count;
+    for (int i = 0; i < count; i++) {
+        const char *word = values[i];
+        
+        // [subscript]=value sets an explicit element
+        const char *close = (word[0] == '[') ? strstr(word, "]=") : NULL;
+        if (close != NULL) {
+            if (set_element(var, word + 1, close - word - 1, close + 2) != 0) {
+                return -1;
             }
+            next = var->item_count;
+            continue;
         }
         
-        // If still not found, can't export
-        if (export_value == NULL) {
-            fprintf(stderr, "Error: Variable '%s' not set\n\r", name);
+        if (var->type == VAR_ASSOC) {
+            fprintf(stderr, "kord-sh: %s: %s: must use subscript when assigning associative array\n\r", name, word);
+            return -1;
+        }
+        
+        if (indexed_set(var, next++, word) != 0) {
             return -1;
         }
     }
     
-    // Set in environment
-    if (setenv(name, export_value, 1) != 0) {
-        perror("setenv");
+    return 0;
+}
+
+int set_array_element(const char *name, const char *subscript, const char *value) {
+    if (name == NULL || subscript == NULL || value == NULL) {
         return -1;
     }
     
-    // Remove from shell variables if it exists there (now it's an env var)
-    for (int i = 0; i < MAX_VARIABLES; i++) {
-        if (shell_variables[i].is_set && strcmp(shell_variables[i].name, name) == 0) {
-            shell_variables[i].is_set = 0;
-            break;
-        }
+    if (!variables_initialized) {
+        init_variables();
     }
     
-    return 0;
+    Variable *var = get_or_create_variable(name, strlen(name));
+    if (var == NULL) {
+        return -1;
+    }
+    
+    if (var->type == VAR_SCALAR && convert_to_array(var, VAR_INDEXED, 1) != 0) {
+        return -1;
+    }
+    
+    return set_element(var, subscript, strlen(subscript), value);
 }
 
-int unset_variable(const char *name) {
-    if (name == NULL) {
-        return -1;
+const char *get_array_element_n(const char *name, size_t name_len, const char *subscript, size_t sub_len) {
+    if (!variables_initialized) {
+        init_variables();
+    }
+    
+    Variable *var = find_variable(name, name_len);
+    if (var == NULL) {
+        return NULL;
+    }
+    
+    if (var->type == VAR_ASSOC) {
+        HashEntry *entry = ht_lookup(var->map, subscript, sub_len);
+        return entry ? entry->value : NULL;
+    }
+    
+    if (var->type == VAR_SCALAR) {
+        // A scalar behaves like a one-element array
+        long index = parse_index(subscript, sub_len, 1);
+        return index == 0 ? VARIABLE_VALUE(var) : NULL;
     }
     
+    long index = parse_index(subscript, sub_len, var->item_count);
+    if (index < 0 || (size_t)index >= var->item_count) {
+        return NULL;
+    }
+    return var->items[index];
+}
+
+int unset_array_element(const char *name, const char *subscript) {
     if (!variables_initialized) {
         init_variables();
     }
     
-    int found = 0;
+    Variable *var = find_variable(name, strlen(name));
+    if (var == NULL || var->type == VAR_SCALAR) {
+        return -1;
+    }
     
-    // Remove from shell variables
-    for (int i = 0; i < MAX_VARIABLES; i++) {
-        if (shell_variables[i].is_set && strcmp(shell_variables[i].name, name) == 0) {
-            shell_variables[i].is_set = 0;
-            found = 1;
-            break;
+    if (var->type == VAR_ASSOC) {
+        char *value = ht_remove(var->map, subscript, strlen(subscript));
+        if (value == NULL) {
+            return -1;
         }
+        free(value);
+        return 0;
     }
     
-    // Remove from environment
-    if (unsetenv(name) == 0) {
-        found = 1;
+    long index = parse_index(subscript, strlen(subscript), var->item_count);
+    if (index < 0 || (size_t)index >= var->item_count || var->items[index] == NULL) {
+        return -1;
     }
     
-    return found ? 0 : -1;
+    free(var->items[index]);
+    var->items[index] = NULL;
+    
+    // Keep item_count at highest set index + 1
+    while (var->item_count > 0 && var->items[var->item_count - 1] == NULL) {
+        var->item_count--;
+    }
+    return 0;
 }
 
-void print_variables(void) {
+long for_each_array_item(const char *name, size_t name_len, int want_keys,
+                         int (*visit)(void *ctx, const char *item), void *ctx) {
     if (!variables_initialized) {
         init_variables();
     }
     
-    printf("Shell variables:\n\r");
-    int count = 0;
-    for (int i = 0; i < MAX_VARIABLES; i++) {
-        if (shell_variables[i].is_set) {
-            printf("  %s=%s\n\r", shell_variables[i].name, shell_variables[i].value);
-            count++;
+    Variable *var = find_variable(name, name_len);
+    if (var == NULL) {
+        return -1;
+    }
+    
+    long visited = 0;
+    
+    if (var->type == VAR_SCALAR) {
+        visited = 1;
+        if (visit != NULL && visit(ctx, want_keys ? "0" : VARIABLE_VALUE(var)) != 0) {
+            return -2;
+        }
+    } else if (var->type == VAR_INDEXED) {
+        char key[32];
+        for (size_t i = 0; i < var->item_count; i++) {
+            if (var->items[i] == NULL) {
+                continue;
+            }
+            visited++;
+            if (visit == NULL) {
+                continue;
+            }
+            if (want_keys) {
+                snprintf(key, sizeof(key), "%zu", i);
+            }
+            if (visit(ctx, want_keys ? key : var->items[i]) != 0) {
+                return -2;
+            }
+        }
+    } else {
+        size_t pos = 0;
+        HashEntry *entry;
+        while ((entry = ht_next(var->map, &pos)) != NULL) {
+            visited++;
+            if (visit != NULL && visit(ctx, want_keys ? entry->key : (const char *)entry->value) != 0) {
+                return -2;
+            }
         }
     }
     
-    if (count == 0) {
+    return visited;
+}
+
+int set_variable(const char *name, const char *value) {
+    if (name == NULL || value == NULL) {
+        return -1;
+    }
+
+    if (!variables_initialized) {
+        init_variables();
+    }
+
+    // Exported variables stay exported; their envp slot is updated in place
+    Variable *var = get_or_create_variable(name, strlen(name));
+    if (var == NULL) {
+        return -1;
+    }
+
+    // Assigning to an array name sets element 0, as in bash
+    if (var->type != VAR_SCALAR) {
+        return set_element(var, "0", 1, value);
+    }
+
+    return assign_value(var, value);
+}
+
+const char *get_variable_n(const char *name, size_t len) {
+    if (name == NULL) {
+        return NULL;
+    }
+
+    if (!variables_initialized) {
+        init_variables();
+    }
+
+    Variable *var = find_variable(name, len);
+    if (var == NULL) {
+        return NULL;
+    }
+    return var->type == VAR_SCALAR ? VARIABLE_VALUE(var) : array_scalar_value(var);
+}
+
+const char *get_variable(const char *name) {
+    if (name == NULL) {
+        return NULL;
+    }
+
+    return get_variable_n(name, strlen(name));
+}
+
+int get_variable_int(const char *name, int default_value) {
+    const char *value = get_variable(name);
+    if (value == NULL || value[0] == '\0') {
+        return default_value;
+    }
+
+    char *end;
+    long number = strtol(value, &end, 10);
+    if (*end != '\0' || number < 0 || number > INT_MAX) {
+        return default_value;
+    }
+    return (int)number;
+}
+
+int export_variable(const char *name, const char *value) {
+    if (name == NULL) {
+        return -1;
+    }
+
+    if (!variables_initialized) {
+        init_variables();
+    }
+
+    size_t name_len = strlen(name);
+    Variable *var;
+
+    if (value != NULL) {
+        // export VAR=value: create or update, then export
+        var = get_or_create_variable(name, name_len);
+        if (var == NULL || assign_value(var, value) != 0) {
+            return -1;
+        }
+    } else {
+        // export VAR: promote an existing shell variable
+        var = find_variable(name, name_len);
+        if (var == NULL) {
+            fprintf(stderr, "Error: Variable '%s' not set\n\r", name);
+            return -1;
+        }
+    }
+
+    if (var->type != VAR_SCALAR) {
+        fprintf(stderr, "Error: Cannot export array '%s'\n\r", name);
+        return -1;
+    }
+
+    if (!var->exported) {
+        if (env_append(var) != 0) {
+            return -1;
+        }
+        var->exported = 1;
+    }
+
+    return 0;
+}
+
+int unset_variable(const char *name) {
+    if (name == NULL) {
+        return -1;
+    }
+
+    if (!variables_initialized) {
+        init_variables();
+    }
+
+    Variable *var = ht_remove(&shell_variables, name, strlen(name));
+    if (var == NULL) {
+        return -1;
+    }
+
+    if (var->exported) {
+        env_remove(var);
+    }
+    free_variable(var);
+
+    return 0;
+}
+
+char **get_environment(void) {
+    if (!variables_initialized) {
+        init_variables();
+    }
+
+    return env_vector;
+}
+
+/**
+ * Whether two "NAME=value" strings set the same name
+ */
+static int same_name(const char *a, const char *b) {
+    size_t len = strcspn(a, "=");
+    return strncmp(a, b, len) == 0 && b[len] == '=';
+}
+
+char **copy_environment(char *const *extra) {
+    char **environment = get_environment();
+    size_t count = 0;
+    size_t size = 0;
+    for (size_t i = 0; environment != NULL && environment[i] != NULL; i++) {
+        count++;
+        size += strlen(environment[i]) + 1;
+    }
+    for (size_t i = 0; extra != NULL && extra[i] != NULL; i++) {
+        count++;
+        size += strlen(extra[i]) + 1;
+    }
+
+    // The vector and the strings it points to share one allocation
+    char **envp = malloc((count + 1) * sizeof(char *) + size);
+    if (envp == NULL) {
+        perror("malloc");
+        return NULL;
+    }
+    char *data = (char *)(envp + count + 1);
+    size_t n = 0;
+    for (size_t i = 0; environment != NULL && environment[i] != NULL; i++) {
+        int replaced = 0;
+        for (size_t j = 0; extra != NULL && extra[j] != NULL && !replaced; j++) {
+            replaced = same_name(extra[j], environment[i]);
+        }
+        if (!replaced) {
+            envp[n++] = data;
+            data = stpcpy(data, environment[i]) + 1;
+        }
+    }
+    for (size_t i = 0; extra != NULL && extra[i] != NULL; i++) {
+        envp[n++] = data;
+        data = stpcpy(data, extra[i]) + 1;
+    }
+    envp[n] = NULL;
+    return envp;
+}
+
+/**
+ * qsort comparator for hash entries, by name
+ */
+static int compare_entries(const void *a, const void *b) {
+    const HashEntry *ea = *(const HashEntry * const *)a;
+    const HashEntry *eb = *(const HashEntry * const *)b;
+    return strcmp(ea->key, eb->key);
+}
+
+void print_variables(void) {
+    if (!variables_initialized) {
+        init_variables();
+    }
+
+    printf("Shell variables:\n\r");
+
+    // Collect and sort so the listing is stable regardless of hash order
+    HashEntry **sorted = malloc((shell_variables.count + 1) * sizeof(HashEntry *));
+    if (sorted == NULL) {
+        perror("malloc");
+        return;
+    }
+
+    size_t pos = 0, n = 0;
+    HashEntry *entry;
+    while ((entry = ht_next(&shell_variables, &pos)) != NULL) {
+        const Variable *var = entry->value;
+        if (!var->exported) {
+            sorted[n++] = entry;
+        }
+    }
+    qsort(sorted, n, sizeof(HashEntry *), compare_entries);
+
+    for (size_t i = 0; i < n; i++) {
+        const Variable *var = sorted[i]->value;
+        if (var->type == VAR_SCALAR) {
+            printf("  %s\n\r", var->entry);
+            continue;
+        }
+        
+        printf("  %s=(", sorted[i]->key);
+        const char *sep = "";
+        if (var->type == VAR_INDEXED) {
+            for (size_t k = 0; k < var->item_count; k++) {
+                if (var->items[k] != NULL) {
+                    printf("%s[%zu]=\"%s\"", sep, k, var->items[k]);
+                    sep = " ";
+                }
+            }
+        } else {
+            size_t map_pos = 0;
+            HashEntry *item;
+            while ((item = ht_next(var->map, &map_pos)) != NULL) {
+                printf("%s[%s]=\"%s\"", sep, item->key, (const char *)item->value);
+                sep = " ";
+            }
+        }
+        printf(")\n\r");
+    }
+
+    if (n == 0) {
         printf("  (none)\n\r");
     }
+    free(sorted);
 }
 
-int is_variable_assignment(char **command) {
-    if (command == NULL || command[0] == NULL) {
+/**
+ * Check if word is NAME=value with a valid variable name
+ * Returns the length of the name, or 0 if word is not an assignment
+ */
+static size_t assignment_name_length(const char *word) {
+    if (!isalpha((unsigned char)word[0]) && word[0] != '_') {
+        return 0;
+    }
+
+    size_t i = 1;
+    while (isalnum((unsigned char)word[i]) || word[i] == '_') {
+        i++;
+    }
+
+    // NAME[subscript]=value assigns one array element
+    if (word[i] == '[') {
+        const char *close = strchr(word + i, ']');
+        if (close == NULL) {
+            return 0;
+        }
+        i = close - word + 1;
+    }
+
+    // NAME+=value appends
+    if (word[i] == '+' && word[i + 1] == '=') {
+        i++;
+    }
+
+    return (word[i] == '=') ? i : 0;
+}
+
+/**
+ * Number of words making up the assignment that starts at command[0]
+ * "NAME=(" / "NAME+=(" compound assignments extend up to the ")" word
+ * Returns 0 if command[0] is not an assignment
+ */
+static int assignment_word_span(char **command) {
+    size_t lhs_len = assignment_name_length(command[0]);
+    if (lhs_len == 0) {
         return 0;
     }
     
-    // Only treat as assignment if it's a single argument and contains '='
-    if (command[1] == NULL && strchr(command[0], '=') != NULL) {
+    if (strcmp(command[0] + lhs_len + 1, "(") != 0) {
         return 1;
     }
     
-    return 0;
+    int span = 1;
+    while (command[span] != NULL && strcmp(command[span], ")") != 0) {
+        span++;
+    }
+    return command[span] != NULL ? span + 1 : 0;
 }
 
-int execute_variable_assignment(char **command) {
+int count_assignment_words(char **command) {
+    int count = 0;
+    while (command != NULL && command[count] != NULL) {
+        int span = assignment_word_span(command + count);
+        if (span == 0) {
+            break;
+        }
+        count += span;
+    }
+    return count;
+}
+
+int is_variable_assignment(char **command) {
     if (command == NULL || command[0] == NULL) {
-        return 1;
+        return 0;
     }
-    
-    char *equals = strchr(command[0], '=');
-    if (equals == NULL) {
-        return 1;  // Not a valid assignment
+
+    // Only treat as assignment if every word is NAME=value
+    int count = count_assignment_words(command);
+    return count > 0 && command[count] == NULL;
+}
+
+/**
+ * Concatenate two strings into a newly allocated one (for NAME+=value)
+ */
+static char *concat_strings(const char *a, const char *b) {
+    size_t a_len = strlen(a);
+    size_t b_len = strlen(b);
+    char *joined = malloc(a_len + b_len + 1);
+    if (joined == NULL) {
+        perror("malloc");
+        return NULL;
     }
+    memcpy(joined, a, a_len);
+    memcpy(joined + a_len, b, b_len + 1);
+    return joined;
+}
+
+/**
+ * Perform the assignment starting at words[0] (span words long)
+ * Handles NAME=value, NAME+=value, NAME[sub]=value and NAME=(a b c)
+ * Returns 0 on success, -1 on failure
+ */
+static int perform_assignment(char **words, int span) {
+    char *word = words[0];
+    size_t lhs_len = assignment_name_length(word);
+    char *value = word + lhs_len + 1;
     
-    // Split at '='
-    *equals = '\0';
-    const char *name = command[0];
-    const char *value = equals + 1;
+    int append = (word[lhs_len - 1] == '+');
+    size_t name_end = append ? lhs_len - 1 : lhs_len;
     
-    // Validate variable name (must start with letter or underscore, contain only alnum or underscore)
-    if (!name[0] || (!isalpha((unsigned char)name[0]) && name[0] != '_')) {
-        *equals = '=';  // Restore
-        return 1;
+    // Split off an optional [subscript]
+    char *bracket = memchr(word, '[', name_end);
+    size_t name_len = bracket ? (size_t)(bracket - word) : name_end;
+    
+    char saved = word[name_len];
+    word[name_len] = '\0';
+    int result;
+    
+    if (span > 1) {
+        // NAME=( ... ): words[1..span-2] are the elements
+        result = set_array(word, words + 1, span - 2, append);
+    } else if (bracket != NULL) {
+        word[name_end - 1] = '\0';  // closing ']'
+        const char *subscript = bracket + 1;
+        char *joined = NULL;
+        if (append) {
+            const char *old = get_array_element_n(word, name_len, subscript, strlen(subscript));
+            if (old != NULL) {
+                joined = concat_strings(old, value);
+            }
+        }
+        result = set_array_element(word, subscript, joined ? joined : value);
+        free(joined);
+        word[name_end - 1] = ']';
+    } else if (append) {
+        const char *old = get_variable(word);
+        char *joined = NULL;
+        if (old != NULL) {
+            joined = concat_strings(old, value);
+        }
+        result = set_variable(word, joined ? joined : value);
+        free(joined);
+    } else {
+        result = set_variable(word, value);
     }
     
-    // Check all characters in name
-    for (const char *p = name; *p; p++) {
-        if (!isalnum((unsigned char)*p) && *p != '_') {
-            *equals = '=';  // Restore
+    word[name_len] = saved;
+    return result;
+}
+
+int execute_variable_assignment(char **command) {
+    if (command == NULL || command[0] == NULL) {
+        return 1;
+    }
+
+    int i = 0;
+    while (command[i] != NULL) {
+        int span = assignment_word_span(command + i);
+        if (span == 0) {
+            return 1;  // Not a valid assignment
+        }
+
+        if (perform_assignment(command + i, span) != 0) {
             return 1;
         }
+        i += span;
     }
-    
-    // Valid variable name, set it
-    int result = set_variable(name, value);
-    *equals = '=';  // Restore the original string
-    
-    return (result == 0) ? 0 : 1;
+
+    return 0;
+}
+
+int apply_command_assignments(char **assignments, int count) {
+    for (int i = 0; i < count; i++) {
+        size_t name_len = assignment_name_length(assignments[i]);
+        if (name_len == 0 || assignments[i][name_len - 1] == ']' || assignments[i][name_len - 1] == '+') {
+            continue;  // Only plain NAME=value can go into the environment
+        }
+
+        char *equals = assignments[i] + name_len;
+        *equals = '\0';
+        int result = export_variable(assignments[i], equals + 1);
+        *equals = '=';
+
+        if (result != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
 }